@@ -113,6 +113,7 @@ CartLoop() {
   const Dust::Frame &frame = Dust::GetCurrentFrame();
   Dust::Info("pose pos(%f, %f, %f)", pose.pos.x, pose.pos.y, pose.pos.z);
 
+  RadianceCascadesFollow(state->radianceCascades, frame.eye);
   RadianceCascadesTick(state->radianceCascades, state->scratchArena);
 
   // Render Fractal
@@ -139,7 +140,7 @@ CartLoop() {
       glActiveTexture(GL_TEXTURE0);
       if (state->radianceCascades.debug.mergeTexelSampleOriginal) {
         glBindTexture(GL_TEXTURE_2D_ARRAY,
-                      state->radianceCascades.octahedralProbeAtlasOriginal.handle);
+                      RadianceCascadesUnmergedAtlas(state->radianceCascades).handle);
       } else {
         glBindTexture(GL_TEXTURE_2D_ARRAY,
                       state->radianceCascades.octahedralProbeAtlas.handle);
@@ -149,17 +150,27 @@ CartLoop() {
 
       glUniform1f(7, state->radianceCascades.debug.mergeTexelGatherOffset);
       glUniform1f(8, state->radianceCascades.debug.mergeTexelGatherRatio);
+      // the irradiance is integrated from the merged atlas
+      glUniform1i(9,
+                  state->radianceCascades.debug.gatherIrradiance &&
+                    !state->radianceCascades.debug.mergeTexelSampleOriginal &&
+                    RadianceCascadesIrradianceResident(state->radianceCascades));
+      glUniform1i(10, RadianceCascadesGatherLevel(state->radianceCascades));
 
       // TODO: memory barrier for image reading
-      glBindImageTexture(1,
-                         state->radianceCascades.octahedralProbeAtlas.handle,
-                         0,
-                         0,
-                         0,
-                         GL_READ_ONLY,
-                         GL_RGBA32F);
+      glBindImageTexture(
+        RadianceCascadesAtlasImageUnit(state->radianceCascades.config),
+        state->radianceCascades.octahedralProbeAtlas.handle,
+        0,
+        0,
+        0,
+        GL_READ_ONLY,
+        RadianceCascadesAtlasInternalFormat(state->radianceCascades.config));
 
       Bind(state->radianceCascades.configUBO, 0, GL_UNIFORM_BUFFER);
+      Bind(state->radianceCascades.irradiance, 3, GL_SHADER_STORAGE_BUFFER);
+      Bind(state->radianceCascades.probeValidity, 6, GL_SHADER_STORAGE_BUFFER);
+      Bind(state->radianceCascades.sparseBricks, 7, GL_SHADER_STORAGE_BUFFER);
 
       glDrawArrays(GL_TRIANGLES, 0, 3);
     }
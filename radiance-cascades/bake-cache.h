@@ -0,0 +1,574 @@
+#pragma once
+
+#include <hotcart/types.h>
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cpu.h"
+#include "layout.h"
+#include "shared.h"
+
+// On-disk cache of a finished bake, so a restart with the same config and scene maps the
+// atlas in instead of re-tracing it. A cache file is a RadianceCascadesBakeCacheHeader
+// followed by its sections, texels are stored like the CPU atlas
+// (RadianceCascadesKernels::PackedTexel, the GL_RGBA32F layout). Files are keyed by a
+// hash of the config and a caller provided scene hash, and are memory mapped on load so
+// the texels can be uploaded or copied straight out of the page cache. Nothing in here
+// touches GL, the upload and readback live in radiance-cascades.h.
+
+#define RADIANCE_CASCADES_BAKE_CACHE_MAGIC 0x43424352u
+// Bump when the file layout, the texel encoding or what a bake produces changes, older
+// files are then ignored and re-baked
+#define RADIANCE_CASCADES_BAKE_CACHE_VERSION 3
+
+enum RadianceCascadesBakeCacheSectionKind : u32 {
+  // the whole merged atlas, layer major then rows
+  RadianceCascadesBakeCacheSection_Atlas = 0,
+  // one level's rect of the merged atlas, RadianceCascadesLevelExtent rows packed
+  // tightly. Written instead of _Atlas with RADIANCE_CASCADES_BAKE_CACHE_PER_LEVEL, top
+  // level first so a reader streaming the file gets the coarse levels first.
+  RadianceCascadesBakeCacheSection_AtlasLevel,
+  // the whole unmerged atlas, incremental updates re-merge from it
+  RadianceCascadesBakeCacheSection_AtlasOriginal,
+  // RadianceCascadesIrradianceProbe per level 0 probe slot
+  RadianceCascadesBakeCacheSection_Irradiance,
+  // the probe validity bits, see RadianceCascadesProbeValidityWordOffset
+  RadianceCascadesBakeCacheSection_ProbeValidity,
+  // RADIANCE_CASCADES_STORAGE_SPARSE only, the brick table the atlas was built with
+  RadianceCascadesBakeCacheSection_SparseBricks,
+};
+
+#define RADIANCE_CASCADES_BAKE_CACHE_MAX_SECTIONS (RADIANCE_CASCADES_MAX_LEVELS + 5)
+// sections start on this boundary
+#define RADIANCE_CASCADES_BAKE_CACHE_ALIGNMENT 64
+
+// Store each level in its own section
+#define RADIANCE_CASCADES_BAKE_CACHE_PER_LEVEL (1 << 0)
+
+struct RadianceCascadesBakeCacheSection {
+  RadianceCascadesBakeCacheSectionKind kind;
+  // _AtlasLevel only, -1 otherwise
+  i32 level;
+  // from the start of the file
+  u64 offset;
+  u64 byteSize;
+};
+
+struct RadianceCascadesBakeCacheHeader {
+  u32 magic;
+  u32 version;
+  u64 configHash;
+  u64 sceneHash;
+  u32 texelByteSize;
+  u32 sectionCount;
+  // with the layout applied, see RadianceCascadesBakeCacheKeyConfig
+  RadianceCascadesConfig config;
+  RadianceCascadesBakeCacheSection sections[RADIANCE_CASCADES_BAKE_CACHE_MAX_SECTIONS];
+};
+
+// What gets written, atlasOriginal is optional
+struct RadianceCascadesBakeCacheContents {
+  const RadianceCascadesKernels::PackedTexel *atlas;
+  const RadianceCascadesKernels::PackedTexel *atlasOriginal;
+  const RadianceCascadesIrradianceProbe *irradiance;
+  u32 irradianceProbeCount;
+  // RadianceCascadesProbeValidityWordCount words
+  const u32 *probeValidity;
+  // layout.sparseBrickTableSize words, sparse storage only
+  const u32 *sparseBricks;
+};
+
+// A mapped cache file, see RadianceCascadesBakeCacheOpen
+struct RadianceCascadesBakeCacheFile {
+  const u8 *data;
+  u64 byteSize;
+  const RadianceCascadesBakeCacheHeader *header;
+};
+
+// 64 bit FNV-1a, pass the previous result as hash to chain
+inline u64
+RadianceCascadesHashBytes(const void *data,
+                          u64 byteSize,
+                          u64 hash = 0xcbf29ce484222325ull) {
+  const u8 *bytes = (const u8 *)data;
+  for (u64 i = 0; i < byteSize; i++) {
+    hash = (hash ^ bytes[i]) * 0x100000001b3ull;
+  }
+  return hash;
+}
+
+// Hash of a file's contents, e.g. the shader source map() lives in. Returns hash
+// unchanged when the file can't be read.
+static u64
+RadianceCascadesHashFile(const char *path, u64 hash = 0xcbf29ce484222325ull) {
+  FILE *file = fopen(path, "rb");
+  if (!file) {
+    return hash;
+  }
+  u8 buffer[4096];
+  u64 read;
+  while ((read = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+    hash = RadianceCascadesHashBytes(buffer, read, hash);
+  }
+  fclose(file);
+  return hash;
+}
+
+// The part of a config that decides what a bake produces: debug flags don't change any
+// texel, so they are left out of the key
+inline RadianceCascadesConfig
+RadianceCascadesBakeCacheKeyConfig(const RadianceCascadesConfig &config) {
+  RadianceCascadesConfig key = config;
+  RadianceCascadesApplyLayout(key, RadianceCascadesComputeLayout(config));
+  key.debugFlags = 0;
+  return key;
+}
+
+inline u64
+RadianceCascadesBakeCacheConfigHash(const RadianceCascadesConfig &config) {
+  const RadianceCascadesConfig key = RadianceCascadesBakeCacheKeyConfig(config);
+  return RadianceCascadesHashBytes(&key, sizeof(key));
+}
+
+// <directory>/radiance-cascades-<config hash>-<scene hash>.bake, directory may be empty
+inline void
+RadianceCascadesBakeCachePath(char *path,
+                              u32 pathSize,
+                              const char *directory,
+                              const RadianceCascadesConfig &config,
+                              u64 sceneHash) {
+  snprintf(path,
+           pathSize,
+           "%s%sradiance-cascades-%016llx-%016llx.bake",
+           directory,
+           directory[0] ? "/" : "",
+           (unsigned long long)RadianceCascadesBakeCacheConfigHash(config),
+           (unsigned long long)sceneHash);
+}
+
+inline u64
+RadianceCascadesBakeCacheAlign(u64 offset) {
+  return (offset + RADIANCE_CASCADES_BAKE_CACHE_ALIGNMENT - 1) &
+         ~u64(RADIANCE_CASCADES_BAKE_CACHE_ALIGNMENT - 1);
+}
+
+// Sections are written in the order a streaming load wants them, see
+// RadianceCascadesBakeCacheStream: the few bytes of probe validity the gather of any
+// level needs, the merged levels coarse first, then the irradiance and finally the
+// unmerged atlas, which only incremental updates read.
+//
+// Writes into path + ".tmp" and renames it over path once complete, a process killed
+// mid write never leaves a truncated cache behind. Returns false on IO failure.
+static bool
+RadianceCascadesBakeCacheWrite(const char *path,
+                               const RadianceCascadesConfig &config,
+                               u64 sceneHash,
+                               const RadianceCascadesBakeCacheContents &contents,
+                               u32 flags = 0) {
+  using namespace RadianceCascadesKernels;
+  const RadianceCascadesConfig key = RadianceCascadesBakeCacheKeyConfig(config);
+  const RadianceCascadesLayout layout = RadianceCascadesComputeLayout(config);
+  const u64 atlasByteSize = RadianceCascadesAtlasTexelCount(layout) * sizeof(PackedTexel);
+
+  RadianceCascadesBakeCacheHeader header = {};
+  header.magic = RADIANCE_CASCADES_BAKE_CACHE_MAGIC;
+  header.version = RADIANCE_CASCADES_BAKE_CACHE_VERSION;
+  header.configHash = RadianceCascadesHashBytes(&key, sizeof(key));
+  header.sceneHash = sceneHash;
+  header.texelByteSize = sizeof(PackedTexel);
+  header.config = key;
+
+  u64 offset = RadianceCascadesBakeCacheAlign(sizeof(header));
+  auto addSection = [&](RadianceCascadesBakeCacheSectionKind kind,
+                        i32 level,
+                        u64 byteSize) {
+    header.sections[header.sectionCount++] = {.kind = kind,
+                                              .level = level,
+                                              .offset = offset,
+                                              .byteSize = byteSize};
+    offset = RadianceCascadesBakeCacheAlign(offset + byteSize);
+  };
+  // ahead of the atlas, nothing in it can be found without the table
+  if (layout.sparseBrickTableSize) {
+    addSection(RadianceCascadesBakeCacheSection_SparseBricks,
+               -1,
+               u64(layout.sparseBrickTableSize) * sizeof(u32));
+  }
+  addSection(RadianceCascadesBakeCacheSection_ProbeValidity,
+             -1,
+             u64(RadianceCascadesProbeValidityWordCount(layout)) * sizeof(u32));
+  if (flags & RADIANCE_CASCADES_BAKE_CACHE_PER_LEVEL) {
+    for (i32 level = i32(layout.totalLevels) - 1; level >= 0; level--) {
+      const v2u32 extent = RadianceCascadesLevelExtent(key, layout, level);
+      addSection(RadianceCascadesBakeCacheSection_AtlasLevel,
+                 level,
+                 u64(extent.x) * extent.y * sizeof(PackedTexel));
+    }
+  } else {
+    addSection(RadianceCascadesBakeCacheSection_Atlas, -1, atlasByteSize);
+  }
+  addSection(RadianceCascadesBakeCacheSection_Irradiance,
+             -1,
+             u64(contents.irradianceProbeCount) *
+               sizeof(RadianceCascadesIrradianceProbe));
+  if (contents.atlasOriginal) {
+    addSection(RadianceCascadesBakeCacheSection_AtlasOriginal, -1, atlasByteSize);
+  }
+
+  char tmpPath[1024];
+  snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", path);
+  FILE *file = fopen(tmpPath, "wb");
+  if (!file) {
+    printf("RadianceCascadesBakeCacheWrite: unable to open %s\n", tmpPath);
+    return false;
+  }
+
+  bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+  for (u32 i = 0; ok && i < header.sectionCount; i++) {
+    const RadianceCascadesBakeCacheSection &section = header.sections[i];
+    ok = fseek(file, long(section.offset), SEEK_SET) == 0;
+    switch (section.kind) {
+      case RadianceCascadesBakeCacheSection_Atlas:
+        ok = ok && fwrite(contents.atlas, section.byteSize, 1, file) == 1;
+        break;
+      case RadianceCascadesBakeCacheSection_AtlasLevel: {
+        const RadianceCascadesLevelRect &rect = key.levels[section.level];
+        const v2u32 extent = RadianceCascadesLevelExtent(key, layout, section.level);
+        for (u32 y = 0; ok && y < extent.y; y++) {
+          const PackedTexel *row = contents.atlas +
+                                   (u64(rect.layer) * key.atlasHeight + rect.y + y) *
+                                     key.atlasWidth +
+                                   rect.x;
+          ok = fwrite(row, sizeof(PackedTexel), extent.x, file) == extent.x;
+        }
+      } break;
+      case RadianceCascadesBakeCacheSection_AtlasOriginal:
+        ok = ok && fwrite(contents.atlasOriginal, section.byteSize, 1, file) == 1;
+        break;
+      case RadianceCascadesBakeCacheSection_Irradiance:
+        ok = ok && (!section.byteSize ||
+                    fwrite(contents.irradiance, section.byteSize, 1, file) == 1);
+        break;
+      case RadianceCascadesBakeCacheSection_ProbeValidity:
+        ok = ok && fwrite(contents.probeValidity, section.byteSize, 1, file) == 1;
+        break;
+      case RadianceCascadesBakeCacheSection_SparseBricks:
+        ok = ok && contents.sparseBricks &&
+             fwrite(contents.sparseBricks, section.byteSize, 1, file) == 1;
+        break;
+    }
+  }
+  ok = fclose(file) == 0 && ok;
+
+  if (!ok || rename(tmpPath, path) != 0) {
+    printf("RadianceCascadesBakeCacheWrite: failed to write %s\n", path);
+    remove(tmpPath);
+    return false;
+  }
+  return true;
+}
+
+static void
+RadianceCascadesBakeCacheClose(RadianceCascadesBakeCacheFile &file) {
+  if (file.data) {
+    munmap((void *)file.data, file.byteSize);
+  }
+  file = {};
+}
+
+// Maps path and checks it holds a bake of config and scene. Returns false, with
+// nothing mapped, for a missing, stale or damaged file.
+static bool
+RadianceCascadesBakeCacheOpen(RadianceCascadesBakeCacheFile &file,
+                              const char *path,
+                              const RadianceCascadesConfig &config,
+                              u64 sceneHash) {
+  file = {};
+  const int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat info = {};
+  if (fstat(fd, &info) != 0 ||
+      u64(info.st_size) < sizeof(RadianceCascadesBakeCacheHeader)) {
+    close(fd);
+    return false;
+  }
+  void *data = mmap(nullptr, u64(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+  // the mapping keeps the file alive
+  close(fd);
+  if (data == MAP_FAILED) {
+    return false;
+  }
+  file.data = (const u8 *)data;
+  file.byteSize = u64(info.st_size);
+  file.header = (const RadianceCascadesBakeCacheHeader *)data;
+
+  const RadianceCascadesBakeCacheHeader &header = *file.header;
+  const RadianceCascadesConfig key = RadianceCascadesBakeCacheKeyConfig(config);
+  bool valid = header.magic == RADIANCE_CASCADES_BAKE_CACHE_MAGIC &&
+               header.version == RADIANCE_CASCADES_BAKE_CACHE_VERSION &&
+               header.sceneHash == sceneHash &&
+               header.texelByteSize == sizeof(RadianceCascadesKernels::PackedTexel) &&
+               header.sectionCount <= RADIANCE_CASCADES_BAKE_CACHE_MAX_SECTIONS &&
+               memcmp(&header.config, &key, sizeof(key)) == 0;
+  for (u32 i = 0; valid && i < header.sectionCount; i++) {
+    const RadianceCascadesBakeCacheSection &section = header.sections[i];
+    valid = section.offset <= file.byteSize &&
+            section.byteSize <= file.byteSize - section.offset &&
+            (section.kind != RadianceCascadesBakeCacheSection_AtlasLevel ||
+             (section.level >= 0 && section.level < RADIANCE_CASCADES_MAX_LEVELS));
+  }
+  if (!valid) {
+    RadianceCascadesBakeCacheClose(file);
+    return false;
+  }
+  return true;
+}
+
+// Section of the given kind (and level for _AtlasLevel), nullptr if the file has none
+inline const RadianceCascadesBakeCacheSection *
+RadianceCascadesBakeCacheFind(const RadianceCascadesBakeCacheFile &file,
+                              RadianceCascadesBakeCacheSectionKind kind,
+                              i32 level = -1) {
+  for (u32 i = 0; i < file.header->sectionCount; i++) {
+    const RadianceCascadesBakeCacheSection &section = file.header->sections[i];
+    if (section.kind == kind && section.level == level) {
+      return &section;
+    }
+  }
+  return nullptr;
+}
+
+inline const void *
+RadianceCascadesBakeCacheSectionData(const RadianceCascadesBakeCacheFile &file,
+                                     const RadianceCascadesBakeCacheSection &section) {
+  return file.data + section.offset;
+}
+
+// Whether an opened file holds every section a load of config needs, at the sizes config
+// implies. original asks for the unmerged atlas as well.
+static bool
+RadianceCascadesBakeCacheComplete(const RadianceCascadesBakeCacheFile &file,
+                                  const RadianceCascadesConfig &config,
+                                  bool original) {
+  using namespace RadianceCascadesKernels;
+  const RadianceCascadesLayout layout = RadianceCascadesComputeLayout(config);
+  const u64 atlasByteSize = RadianceCascadesAtlasTexelCount(layout) * sizeof(PackedTexel);
+
+  const RadianceCascadesBakeCacheSection *irradiance = RadianceCascadesBakeCacheFind(
+    file, RadianceCascadesBakeCacheSection_Irradiance);
+  if (!irradiance ||
+      irradiance->byteSize != u64(RadianceCascadesIrradianceProbeCount(config, layout)) *
+                                sizeof(RadianceCascadesIrradianceProbe)) {
+    return false;
+  }
+  if (layout.sparseBrickTableSize) {
+    const RadianceCascadesBakeCacheSection *bricks = RadianceCascadesBakeCacheFind(
+      file, RadianceCascadesBakeCacheSection_SparseBricks);
+    if (!bricks || bricks->byteSize != u64(layout.sparseBrickTableSize) * sizeof(u32)) {
+      return false;
+    }
+  }
+  const RadianceCascadesBakeCacheSection *validity = RadianceCascadesBakeCacheFind(
+    file, RadianceCascadesBakeCacheSection_ProbeValidity);
+  const u64 validityByteSize =
+    u64(RadianceCascadesProbeValidityWordCount(layout)) * sizeof(u32);
+  if (!validity || validity->byteSize != validityByteSize) {
+    return false;
+  }
+  if (original) {
+    const RadianceCascadesBakeCacheSection *section = RadianceCascadesBakeCacheFind(
+      file, RadianceCascadesBakeCacheSection_AtlasOriginal);
+    if (!section || section->byteSize != atlasByteSize) {
+      return false;
+    }
+  }
+  if (const RadianceCascadesBakeCacheSection *atlas = RadianceCascadesBakeCacheFind(
+        file, RadianceCascadesBakeCacheSection_Atlas)) {
+    return atlas->byteSize == atlasByteSize;
+  }
+  for (u32 level = 0; level < layout.totalLevels; level++) {
+    const RadianceCascadesBakeCacheSection *section = RadianceCascadesBakeCacheFind(
+      file, RadianceCascadesBakeCacheSection_AtlasLevel, level);
+    const v2u32 extent = RadianceCascadesLevelExtent(config, layout, level);
+    if (!section || section->byteSize != u64(extent.x) * extent.y * sizeof(PackedTexel)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+inline RadianceCascadesBakeCacheContents
+RadianceCascadesCPUBakeCacheContents(const RadianceCascadesCPU &cpu) {
+  return {.atlas = cpu.atlas,
+          .atlasOriginal = cpu.atlasOriginal,
+          .irradiance = cpu.irradiance,
+          .irradianceProbeCount = cpu.irradianceProbeCount,
+          .probeValidity = cpu.probeValidity,
+          .sparseBricks = cpu.sparseBricks};
+}
+
+// Copies an opened cache into a CPU backend initialized with the same config. Returns
+// false when the file lacks something the backend keeps, e.g. the unmerged atlas.
+static bool
+RadianceCascadesCPULoadBakeCache(RadianceCascadesCPU &cpu,
+                                 const RadianceCascadesBakeCacheFile &file) {
+  using namespace RadianceCascadesKernels;
+  const bool hasOriginal = cpu.atlasOriginal != nullptr;
+  if (!cpu.atlas || !RadianceCascadesBakeCacheComplete(file, cpu.config, hasOriginal)) {
+    return false;
+  }
+
+  if (const RadianceCascadesBakeCacheSection *atlas = RadianceCascadesBakeCacheFind(
+        file, RadianceCascadesBakeCacheSection_Atlas)) {
+    memcpy(cpu.atlas,
+           RadianceCascadesBakeCacheSectionData(file, *atlas),
+           cpu.atlasByteSize);
+  } else {
+    for (u32 level = 0; level < cpu.layout.totalLevels; level++) {
+      const RadianceCascadesBakeCacheSection *section = RadianceCascadesBakeCacheFind(
+        file, RadianceCascadesBakeCacheSection_AtlasLevel, level);
+      const RadianceCascadesLevelRect &rect = cpu.config.levels[level];
+      const v2u32 extent = RadianceCascadesLevelExtent(cpu.config, cpu.layout, level);
+      const PackedTexel *src = (const PackedTexel *)RadianceCascadesBakeCacheSectionData(
+        file, *section);
+      for (u32 y = 0; y < extent.y; y++) {
+        memcpy(&RadianceCascadesCPUTexel(cpu, cpu.atlas, rect.x, rect.y + y, rect.layer),
+               src + u64(y) * extent.x,
+               u64(extent.x) * sizeof(PackedTexel));
+      }
+    }
+  }
+
+  if (cpu.atlasOriginal) {
+    const RadianceCascadesBakeCacheSection *original = RadianceCascadesBakeCacheFind(
+      file, RadianceCascadesBakeCacheSection_AtlasOriginal);
+    memcpy(cpu.atlasOriginal,
+           RadianceCascadesBakeCacheSectionData(file, *original),
+           cpu.atlasByteSize);
+  }
+  const RadianceCascadesBakeCacheSection *irradiance = RadianceCascadesBakeCacheFind(
+    file, RadianceCascadesBakeCacheSection_Irradiance);
+  memcpy(cpu.irradiance,
+         RadianceCascadesBakeCacheSectionData(file, *irradiance),
+         irradiance->byteSize);
+  const RadianceCascadesBakeCacheSection *validity = RadianceCascadesBakeCacheFind(
+    file, RadianceCascadesBakeCacheSection_ProbeValidity);
+  memcpy(cpu.probeValidity,
+         RadianceCascadesBakeCacheSectionData(file, *validity),
+         validity->byteSize);
+  if (cpu.sparseBricks) {
+    const RadianceCascadesBakeCacheSection *bricks = RadianceCascadesBakeCacheFind(
+      file, RadianceCascadesBakeCacheSection_SparseBricks);
+    memcpy(cpu.sparseBricks,
+           RadianceCascadesBakeCacheSectionData(file, *bricks),
+           bricks->byteSize);
+  }
+  return true;
+}
+
+// Loads a cache file's sections in file order a few rows at a time, so the coarse levels
+// of a per level file are usable long before the whole atlas has been read. Where the
+// rows go is up to the caller, see RadianceCascadesBakeCacheStreamStep.
+struct RadianceCascadesBakeCacheStream {
+  RadianceCascadesBakeCacheFile file;
+  // next section to load and the next row within it
+  u32 section;
+  u32 row;
+  // every level >= residentLevel is loaded, RADIANCE_CASCADES_MAX_LEVELS before any
+  i32 residentLevel;
+  bool irradianceResident;
+};
+
+// Texels of an atlas section are handed out in rows: a level section's rows are
+// RadianceCascadesLevelExtent wide, a whole atlas row is atlasWidth wide with the
+// layers following each other. The irradiance, the probe validity and the sparse brick
+// table are a single row.
+inline u64
+RadianceCascadesBakeCacheRowByteSize(const RadianceCascadesConfig &config,
+                                     const RadianceCascadesLayout &layout,
+                                     const RadianceCascadesBakeCacheSection &section) {
+  switch (section.kind) {
+    case RadianceCascadesBakeCacheSection_AtlasLevel:
+      return u64(RadianceCascadesLevelExtent(config, layout, section.level).x) *
+             sizeof(RadianceCascadesKernels::PackedTexel);
+    case RadianceCascadesBakeCacheSection_Atlas:
+    case RadianceCascadesBakeCacheSection_AtlasOriginal:
+      return u64(config.atlasWidth) * sizeof(RadianceCascadesKernels::PackedTexel);
+    default: return Max(section.byteSize, u64(1));
+  }
+}
+
+// Takes ownership of an opened file
+inline void
+RadianceCascadesBakeCacheStreamBegin(RadianceCascadesBakeCacheStream &stream,
+                                     const RadianceCascadesBakeCacheFile &file) {
+  stream = {};
+  stream.file = file;
+  stream.residentLevel = RADIANCE_CASCADES_MAX_LEVELS;
+  // the sections are read front to back
+  madvise((void *)file.data, file.byteSize, MADV_SEQUENTIAL);
+}
+
+inline void
+RadianceCascadesBakeCacheStreamEnd(RadianceCascadesBakeCacheStream &stream) {
+  RadianceCascadesBakeCacheClose(stream.file);
+  stream = {};
+}
+
+inline bool
+RadianceCascadesBakeCacheStreaming(const RadianceCascadesBakeCacheStream &stream) {
+  return stream.file.data != nullptr;
+}
+
+// Hands out up to byteBudget bytes of rows (0 is unbounded, at least one row is always
+// handed out) to loadRows(section, firstRow, rowCount, data). Returns true once every
+// section has been handed out; the file stays mapped until
+// RadianceCascadesBakeCacheStreamEnd.
+template <typename LoadRows>
+static bool
+RadianceCascadesBakeCacheStreamStep(RadianceCascadesBakeCacheStream &stream,
+                                    const RadianceCascadesConfig &config,
+                                    u64 byteBudget,
+                                    const LoadRows &loadRows) {
+  const RadianceCascadesBakeCacheHeader &header = *stream.file.header;
+  const RadianceCascadesLayout layout = RadianceCascadesComputeLayout(config);
+  u64 bytesLeft = byteBudget ? byteBudget : ~u64(0);
+  while (stream.section < header.sectionCount && bytesLeft) {
+    const RadianceCascadesBakeCacheSection &section = header.sections[stream.section];
+    const u64 rowByteSize = RadianceCascadesBakeCacheRowByteSize(config, layout, section);
+    const u32 rows = u32(section.byteSize / rowByteSize);
+    const u32 rowCount =
+      u32(Min(u64(rows - stream.row), Max(bytesLeft / rowByteSize, u64(1))));
+    if (rowCount) {
+      loadRows(section,
+               stream.row,
+               rowCount,
+               (const u8 *)RadianceCascadesBakeCacheSectionData(stream.file, section) +
+                 u64(stream.row) * rowByteSize);
+    }
+    stream.row += rowCount;
+    bytesLeft -= Min(bytesLeft, u64(rowCount) * rowByteSize);
+    if (stream.row < rows) {
+      break;
+    }
+
+    if (section.kind == RadianceCascadesBakeCacheSection_AtlasLevel) {
+      stream.residentLevel = Min(stream.residentLevel, section.level);
+    } else if (section.kind == RadianceCascadesBakeCacheSection_Atlas) {
+      stream.residentLevel = 0;
+    } else if (section.kind == RadianceCascadesBakeCacheSection_Irradiance) {
+      stream.irradianceResident = true;
+    }
+    stream.section++;
+    stream.row = 0;
+  }
+  return stream.section == header.sectionCount;
+}
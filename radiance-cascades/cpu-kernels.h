@@ -0,0 +1,362 @@
+#pragma once
+
+#include <engine/linalg.h>
+#include <hotcart/types.h>
+
+#include <math.h>
+#include <string.h>
+
+// C++ ports of the pieces of shaders/shared.glsl and shaders/octahedral.glsl that
+// the cascade build/merge kernels use. Keep these in sync with the shaders, the CPU
+// backend is expected to produce the same atlas contents as the GL path.
+namespace RadianceCascadesKernels {
+
+struct MapResult {
+  v3 color;
+  v3 emission;
+  v3 throughput;
+  f32 d;
+  i32 level;
+};
+
+// The raw bits of an RGBA32F atlas texel
+struct PackedTexel {
+  u32 x;
+  u32 y;
+  u32 z;
+  u32 w;
+};
+
+// GLSL packHalf2x16 / unpackHalf2x16 equivalents (round to nearest even)
+inline u16
+FloatToHalf(f32 value) {
+  u32 bits;
+  memcpy(&bits, &value, sizeof(bits));
+
+  u32 sign = (bits >> 16) & 0x8000;
+  i32 exponent = i32((bits >> 23) & 0xFF) - 127 + 15;
+  u32 mantissa = bits & 0x7FFFFF;
+
+  if (((bits >> 23) & 0xFF) == 0xFF) {
+    return u16(sign | 0x7C00 | (mantissa ? 0x200 : 0));
+  }
+
+  if (exponent >= 31) {
+    return u16(sign | 0x7C00);
+  }
+
+  if (exponent <= 0) {
+    if (exponent < -10) {
+      return u16(sign);
+    }
+    mantissa |= 0x800000;
+    u32 shift = u32(14 - exponent);
+    u32 half = mantissa >> shift;
+    u32 rem = mantissa & ((1u << shift) - 1);
+    u32 halfway = 1u << (shift - 1);
+    if (rem > halfway || (rem == halfway && (half & 1))) {
+      half++;
+    }
+    return u16(sign | half);
+  }
+
+  u32 half = sign | (u32(exponent) << 10) | (mantissa >> 13);
+  u32 rem = mantissa & 0x1FFF;
+  if (rem > 0x1000 || (rem == 0x1000 && (half & 1))) {
+    half++;
+  }
+  return u16(half);
+}
+
+inline f32
+HalfToFloat(u16 half) {
+  u32 sign = u32(half & 0x8000) << 16;
+  u32 exponent = (half >> 10) & 0x1F;
+  u32 mantissa = half & 0x3FF;
+
+  u32 bits;
+  if (exponent == 0) {
+    if (mantissa == 0) {
+      bits = sign;
+    } else {
+      exponent = 127 - 15 + 1;
+      while ((mantissa & 0x400) == 0) {
+        mantissa <<= 1;
+        exponent--;
+      }
+      mantissa &= 0x3FF;
+      bits = sign | (exponent << 23) | (mantissa << 13);
+    }
+  } else if (exponent == 31) {
+    bits = sign | 0x7F800000 | (mantissa << 13);
+  } else {
+    bits = sign | ((exponent - 15 + 127) << 23) | (mantissa << 13);
+  }
+
+  f32 value;
+  memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+inline u32
+PackHalf2x16(f32 a, f32 b) {
+  return u32(FloatToHalf(a)) | (u32(FloatToHalf(b)) << 16);
+}
+
+inline v2
+UnpackHalf2x16(u32 bits) {
+  return v2(HalfToFloat(u16(bits & 0xFFFF)), HalfToFloat(u16(bits >> 16)));
+}
+
+inline u32
+PackUnorm4x8(v3 value) {
+  u32 r = u32(roundf(Clamp(value.x, 0.0f, 1.0f) * 255.0f));
+  u32 g = u32(roundf(Clamp(value.y, 0.0f, 1.0f) * 255.0f));
+  u32 b = u32(roundf(Clamp(value.z, 0.0f, 1.0f) * 255.0f));
+  return r | (g << 8) | (b << 16);
+}
+
+inline v3
+UnpackUnorm4x8(u32 bits) {
+  return v3(f32(bits & 0xFF), f32((bits >> 8) & 0xFF), f32((bits >> 16) & 0xFF)) /
+         255.0f;
+}
+
+inline PackedTexel
+PackMapResult(const MapResult &mapResult) {
+  PackedTexel packed;
+  packed.x = PackUnorm4x8(mapResult.color);
+  packed.y = PackHalf2x16(mapResult.emission.x, mapResult.emission.y);
+  packed.z = PackHalf2x16(mapResult.emission.z, mapResult.throughput.x);
+  packed.w = PackHalf2x16(mapResult.throughput.y, mapResult.throughput.z);
+  return packed;
+}
+
+inline MapResult
+UnpackMapResult(const PackedTexel &packed) {
+  MapResult mapResult = {};
+  mapResult.color = UnpackUnorm4x8(packed.x);
+  v2 tmp = UnpackHalf2x16(packed.y);
+  mapResult.emission.x = tmp.x;
+  mapResult.emission.y = tmp.y;
+  tmp = UnpackHalf2x16(packed.z);
+  mapResult.emission.z = tmp.x;
+  mapResult.throughput.x = tmp.y;
+  tmp = UnpackHalf2x16(packed.w);
+  mapResult.throughput.y = tmp.x;
+  mapResult.throughput.z = tmp.y;
+  return mapResult;
+}
+
+// The raw bits of a GL_RG32F atlas texel, see PackMapResultCompact in shared.glsl
+struct CompactTexel {
+  u32 x;
+  u32 y;
+};
+
+inline u32
+PackRGB9E5(v3 rgb) {
+  const f32 maxValue = 65408.0f;
+  v3 c = Clamp(rgb, v3(0.0f), v3(maxValue));
+  f32 maxChannel = Max(c.x, Max(c.y, c.z));
+  i32 exponent = Max(-16, i32(floorf(log2f(Max(maxChannel, 1e-30f))))) + 16;
+  f32 scale = exp2f(f32(exponent - 24));
+  if (floorf(maxChannel / scale + 0.5f) >= 512.0f) {
+    exponent++;
+    scale *= 2.0f;
+  }
+  u32 r = u32(Min(floorf(c.x / scale + 0.5f), 511.0f));
+  u32 g = u32(Min(floorf(c.y / scale + 0.5f), 511.0f));
+  u32 b = u32(Min(floorf(c.z / scale + 0.5f), 511.0f));
+  return r | (g << 9) | (b << 18) | (u32(exponent) << 27);
+}
+
+inline v3
+UnpackRGB9E5(u32 bits) {
+  f32 scale = exp2f(f32(i32(bits >> 27) - 24));
+  return v3(f32(bits & 0x1FF), f32((bits >> 9) & 0x1FF), f32((bits >> 18) & 0x1FF)) *
+         scale;
+}
+
+inline CompactTexel
+PackMapResultCompact(const MapResult &mapResult) {
+  f32 throughput = (mapResult.throughput.x + mapResult.throughput.y +
+                    mapResult.throughput.z) *
+                   (1.0f / 3.0f);
+  CompactTexel packed;
+  packed.x = PackUnorm4x8(mapResult.color) |
+             (u32(roundf(Clamp(throughput, 0.0f, 1.0f) * 255.0f)) << 24);
+  packed.y = PackRGB9E5(mapResult.emission);
+  return packed;
+}
+
+inline MapResult
+UnpackMapResultCompact(const CompactTexel &packed) {
+  MapResult mapResult = {};
+  mapResult.color = UnpackUnorm4x8(packed.x);
+  mapResult.throughput = v3(f32(packed.x >> 24) / 255.0f);
+  mapResult.emission = UnpackRGB9E5(packed.y);
+  return mapResult;
+}
+
+inline v3
+Lerp3D(v3 c000, v3 c100, v3 c010, v3 c110, v3 c001, v3 c101, v3 c011, v3 c111, v3 t) {
+  // front face
+  v3 c00 = c000 * (1.0f - t.x) + c100 * t.x;
+  v3 c01 = c010 * (1.0f - t.x) + c110 * t.x;
+
+  // back face
+  v3 c10 = c001 * (1.0f - t.x) + c101 * t.x;
+  v3 c11 = c011 * (1.0f - t.x) + c111 * t.x;
+
+  v3 c0 = c00 * (1.0f - t.z) + c10 * t.z;
+  v3 c1 = c01 * (1.0f - t.z) + c11 * t.z;
+
+  return c0 * (1.0f - t.y) + c1 * t.y;
+}
+
+inline MapResult
+Lerp3D(const MapResult c[8], v3 t) {
+  MapResult r = {};
+  r.color = Lerp3D(c[0].color,
+                   c[1].color,
+                   c[2].color,
+                   c[3].color,
+                   c[4].color,
+                   c[5].color,
+                   c[6].color,
+                   c[7].color,
+                   t);
+  r.emission = Lerp3D(c[0].emission,
+                      c[1].emission,
+                      c[2].emission,
+                      c[3].emission,
+                      c[4].emission,
+                      c[5].emission,
+                      c[6].emission,
+                      c[7].emission,
+                      t);
+  r.throughput = Lerp3D(c[0].throughput,
+                        c[1].throughput,
+                        c[2].throughput,
+                        c[3].throughput,
+                        c[4].throughput,
+                        c[5].throughput,
+                        c[6].throughput,
+                        c[7].throughput,
+                        t);
+  return r;
+}
+
+// Trilinear weights of the 8 corners in Lerp3D order, bit i of validMask set when
+// corner i is valid. Port of ValidTrilinearWeights in shaders/probe-validity.glsl.
+inline void
+ValidTrilinearWeights(v3 t, u32 validMask, f32 w[8]) {
+  f32 sum = 0.0f;
+  for (u32 i = 0; i < 8; i++) {
+    const f32 wx = (i & 1) ? t.x : 1.0f - t.x;
+    const f32 wy = (i & 2) ? t.y : 1.0f - t.y;
+    const f32 wz = (i & 4) ? t.z : 1.0f - t.z;
+    w[i] = ((validMask >> i) & 1) ? Max(wx * wy * wz, 0.0001f) : 0.0f;
+    sum += w[i];
+  }
+  for (u32 i = 0; i < 8; i++) {
+    w[i] /= sum;
+  }
+}
+
+// Lerp3D over the valid corners only, the plain Lerp3D when all or none of them are
+inline MapResult
+Lerp3DValid(const MapResult c[8], v3 t, u32 validMask) {
+  if (validMask == 0xFF || !validMask) {
+    return Lerp3D(c, t);
+  }
+  f32 w[8];
+  ValidTrilinearWeights(t, validMask, w);
+  MapResult r = {};
+  for (u32 i = 0; i < 8; i++) {
+    r.color = r.color + c[i].color * w[i];
+    r.emission = r.emission + c[i].emission * w[i];
+    r.throughput = r.throughput + c[i].throughput * w[i];
+  }
+  return r;
+}
+
+inline MapResult
+Box(v3 p, v3 b, v3 color) {
+  MapResult result = {};
+  result.color = color;
+  v3 q = Abs(p) - b;
+  result.d = Length(Max(q, v3(0.0f))) + Min(Max(q.x, Max(q.y, q.z)), 0.0f);
+  result.emission = v3(0.0f);
+  result.throughput = v3(1.0f);
+  return result;
+}
+
+inline MapResult
+EmissiveSphere(v3 p, f32 s, v3 color, v3 emission) {
+  MapResult result = {};
+  result.color = color;
+  result.d = Length(p) - s;
+  result.emission = emission;
+  result.throughput = v3(1.0f);
+  return result;
+}
+
+inline MapResult
+ProcessMaterial(const MapResult &a, const MapResult &b, f32 d) {
+  MapResult result = fabsf(a.d) < fabsf(b.d) ? a : b;
+  result.d = d;
+  return result;
+}
+
+inline MapResult
+Union(const MapResult &a, const MapResult &b) {
+  return ProcessMaterial(a, b, Min(a.d, b.d));
+}
+
+inline MapResult
+Cut(const MapResult &a, const MapResult &b) {
+  return ProcessMaterial(a, b, Max(a.d, -b.d));
+}
+
+// Port of map() from shaders/shared.glsl
+inline MapResult
+Map(v3 p) {
+  f32 wallThickness = 0.2f;
+  f32 emitterRadius = 1.4f;
+  v3 roomSize = v3(12.0f, 12.0f, 12.0f);
+  MapResult result = Box(p, roomSize, v3(1.0f, 0.0f, 0.0f));
+  result = Cut(result, Box(p, roomSize - wallThickness, v3(0.0f, 1.0f, 0.0f)));
+  result = Cut(result,
+               Box(p - v3(0.0f, 0.0f, roomSize.z),
+                   v3(roomSize.x * 1.5f, roomSize.y * 1.5f, wallThickness * 1.5f),
+                   v3(0.0f, 0.0f, 1.0f)));
+  result = Union(result, EmissiveSphere(p, emitterRadius, v3(1.0f), v3(100.0f)));
+  return result;
+}
+
+inline v3
+OctahedralDecode(v2 uv) {
+  uv = uv * 2.0f - 1.0f;
+  v2 auv = Abs(uv);
+  v2 suv = v2(uv.x >= 0.0f ? 1.0f : -1.0f, uv.y >= 0.0f ? 1.0f : -1.0f);
+  f32 l = auv.x + auv.y;
+
+  if (l > 1.0f) {
+    uv = (v2(1.0f) - v2(auv.y, auv.x)) * suv;
+  }
+
+  return Normalize(v3(uv.x, 1.0f - l, uv.y));
+}
+
+// Solid angle of an octahedral texel relative to the others of its probe, matches
+// OctahedralTexelWeight in shaders/octahedral.glsl. Texels are evenly spaced on the
+// |p|_1 = 1 octahedron, which projects onto the sphere with 1 / |p|_2^3 = |dir|_1^3.
+inline f32
+OctahedralTexelWeight(v3 dir) {
+  const f32 l = fabsf(dir.x) + fabsf(dir.y) + fabsf(dir.z);
+  return l * l * l;
+}
+
+} // namespace RadianceCascadesKernels
@@ -0,0 +1,529 @@
+#pragma once
+
+#include <hotcart/types.h>
+
+#if defined(__AVX512F__) || defined(__AVX2__)
+  #include <immintrin.h>
+#endif
+
+#include "cpu-kernels.h"
+#include "distance-bricks.h"
+#include "layout.h"
+
+// Ray packet sphere tracing for the CPU build kernel. The lanes of a packet are
+// consecutive octahedral texels of one probe, so every lane shares an origin and
+// only the direction differs. The width is picked at compile time from the target
+// ISA: 16 lanes with -mavx512f, 8 lanes with -mavx2 and 8 lanes of plain scalar code
+// (which the compiler is free to auto-vectorize) otherwise.
+namespace RadianceCascadesKernels {
+
+#if defined(__AVX512F__)
+  #define RADIANCE_CASCADES_PACKET_WIDTH 16
+
+struct f32xN {
+  __m512 v;
+};
+
+struct maskxN {
+  __mmask16 m;
+};
+
+inline f32xN
+Splat(f32 a) {
+  return {_mm512_set1_ps(a)};
+}
+inline f32xN
+Load(const f32 *p) {
+  return {_mm512_loadu_ps(p)};
+}
+inline void
+Store(f32 *p, f32xN a) {
+  _mm512_storeu_ps(p, a.v);
+}
+inline f32xN
+operator+(f32xN a, f32xN b) {
+  return {_mm512_add_ps(a.v, b.v)};
+}
+inline f32xN
+operator-(f32xN a, f32xN b) {
+  return {_mm512_sub_ps(a.v, b.v)};
+}
+inline f32xN
+operator*(f32xN a, f32xN b) {
+  return {_mm512_mul_ps(a.v, b.v)};
+}
+inline f32xN
+Min(f32xN a, f32xN b) {
+  return {_mm512_min_ps(a.v, b.v)};
+}
+inline f32xN
+Max(f32xN a, f32xN b) {
+  return {_mm512_max_ps(a.v, b.v)};
+}
+inline f32xN
+Abs(f32xN a) {
+  return {_mm512_abs_ps(a.v)};
+}
+inline f32xN
+Sqrt(f32xN a) {
+  return {_mm512_sqrt_ps(a.v)};
+}
+inline maskxN
+LessEqual(f32xN a, f32xN b) {
+  return {_mm512_cmp_ps_mask(a.v, b.v, _CMP_LE_OQ)};
+}
+inline maskxN
+Less(f32xN a, f32xN b) {
+  return {_mm512_cmp_ps_mask(a.v, b.v, _CMP_LT_OQ)};
+}
+inline maskxN
+operator&(maskxN a, maskxN b) {
+  return {__mmask16(a.m & b.m)};
+}
+inline maskxN
+AndNot(maskxN a, maskxN b) {
+  return {__mmask16(a.m & ~b.m)};
+}
+inline maskxN
+operator|(maskxN a, maskxN b) {
+  return {__mmask16(a.m | b.m)};
+}
+// per lane a ? b : c
+inline f32xN
+Select(maskxN a, f32xN b, f32xN c) {
+  return {_mm512_mask_blend_ps(a.m, c.v, b.v)};
+}
+inline bool
+Any(maskxN a) {
+  return a.m != 0;
+}
+inline maskxN
+LaneMask(u32 laneCount) {
+  return {__mmask16(laneCount >= 16 ? 0xFFFF : (1u << laneCount) - 1)};
+}
+inline u32
+MaskBits(maskxN a) {
+  return a.m;
+}
+
+#elif defined(__AVX2__)
+  #define RADIANCE_CASCADES_PACKET_WIDTH 8
+
+struct f32xN {
+  __m256 v;
+};
+
+struct maskxN {
+  __m256 m;
+};
+
+inline f32xN
+Splat(f32 a) {
+  return {_mm256_set1_ps(a)};
+}
+inline f32xN
+Load(const f32 *p) {
+  return {_mm256_loadu_ps(p)};
+}
+inline void
+Store(f32 *p, f32xN a) {
+  _mm256_storeu_ps(p, a.v);
+}
+inline f32xN
+operator+(f32xN a, f32xN b) {
+  return {_mm256_add_ps(a.v, b.v)};
+}
+inline f32xN
+operator-(f32xN a, f32xN b) {
+  return {_mm256_sub_ps(a.v, b.v)};
+}
+inline f32xN
+operator*(f32xN a, f32xN b) {
+  return {_mm256_mul_ps(a.v, b.v)};
+}
+inline f32xN
+Min(f32xN a, f32xN b) {
+  return {_mm256_min_ps(a.v, b.v)};
+}
+inline f32xN
+Max(f32xN a, f32xN b) {
+  return {_mm256_max_ps(a.v, b.v)};
+}
+inline f32xN
+Abs(f32xN a) {
+  return {_mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.v)};
+}
+inline f32xN
+Sqrt(f32xN a) {
+  return {_mm256_sqrt_ps(a.v)};
+}
+inline maskxN
+LessEqual(f32xN a, f32xN b) {
+  return {_mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ)};
+}
+inline maskxN
+Less(f32xN a, f32xN b) {
+  return {_mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ)};
+}
+inline maskxN
+operator&(maskxN a, maskxN b) {
+  return {_mm256_and_ps(a.m, b.m)};
+}
+inline maskxN
+AndNot(maskxN a, maskxN b) {
+  return {_mm256_andnot_ps(b.m, a.m)};
+}
+inline maskxN
+operator|(maskxN a, maskxN b) {
+  return {_mm256_or_ps(a.m, b.m)};
+}
+// per lane a ? b : c
+inline f32xN
+Select(maskxN a, f32xN b, f32xN c) {
+  return {_mm256_blendv_ps(c.v, b.v, a.m)};
+}
+inline bool
+Any(maskxN a) {
+  return _mm256_movemask_ps(a.m) != 0;
+}
+inline maskxN
+LaneMask(u32 laneCount) {
+  __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+  return {_mm256_castsi256_ps(
+    _mm256_cmpgt_epi32(_mm256_set1_epi32(i32(laneCount)), lanes))};
+}
+inline u32
+MaskBits(maskxN a) {
+  return u32(_mm256_movemask_ps(a.m));
+}
+
+#else
+  #define RADIANCE_CASCADES_PACKET_WIDTH 8
+
+struct f32xN {
+  f32 v[RADIANCE_CASCADES_PACKET_WIDTH];
+};
+
+struct maskxN {
+  bool m[RADIANCE_CASCADES_PACKET_WIDTH];
+};
+
+  #define PACKET_LANES(expr)                                                             \
+    for (u32 lane = 0; lane < RADIANCE_CASCADES_PACKET_WIDTH; lane++) {                  \
+      expr;                                                                              \
+    }
+
+inline f32xN
+Splat(f32 a) {
+  f32xN r;
+  PACKET_LANES(r.v[lane] = a);
+  return r;
+}
+inline f32xN
+Load(const f32 *p) {
+  f32xN r;
+  PACKET_LANES(r.v[lane] = p[lane]);
+  return r;
+}
+inline void
+Store(f32 *p, f32xN a) {
+  PACKET_LANES(p[lane] = a.v[lane]);
+}
+inline f32xN
+operator+(f32xN a, f32xN b) {
+  f32xN r;
+  PACKET_LANES(r.v[lane] = a.v[lane] + b.v[lane]);
+  return r;
+}
+inline f32xN
+operator-(f32xN a, f32xN b) {
+  f32xN r;
+  PACKET_LANES(r.v[lane] = a.v[lane] - b.v[lane]);
+  return r;
+}
+inline f32xN
+operator*(f32xN a, f32xN b) {
+  f32xN r;
+  PACKET_LANES(r.v[lane] = a.v[lane] * b.v[lane]);
+  return r;
+}
+inline f32xN
+Min(f32xN a, f32xN b) {
+  f32xN r;
+  PACKET_LANES(r.v[lane] = a.v[lane] < b.v[lane] ? a.v[lane] : b.v[lane]);
+  return r;
+}
+inline f32xN
+Max(f32xN a, f32xN b) {
+  f32xN r;
+  PACKET_LANES(r.v[lane] = a.v[lane] > b.v[lane] ? a.v[lane] : b.v[lane]);
+  return r;
+}
+inline f32xN
+Abs(f32xN a) {
+  f32xN r;
+  PACKET_LANES(r.v[lane] = fabsf(a.v[lane]));
+  return r;
+}
+inline f32xN
+Sqrt(f32xN a) {
+  f32xN r;
+  PACKET_LANES(r.v[lane] = sqrtf(a.v[lane]));
+  return r;
+}
+inline maskxN
+LessEqual(f32xN a, f32xN b) {
+  maskxN r;
+  PACKET_LANES(r.m[lane] = a.v[lane] <= b.v[lane]);
+  return r;
+}
+inline maskxN
+Less(f32xN a, f32xN b) {
+  maskxN r;
+  PACKET_LANES(r.m[lane] = a.v[lane] < b.v[lane]);
+  return r;
+}
+inline maskxN
+operator&(maskxN a, maskxN b) {
+  maskxN r;
+  PACKET_LANES(r.m[lane] = a.m[lane] && b.m[lane]);
+  return r;
+}
+inline maskxN
+AndNot(maskxN a, maskxN b) {
+  maskxN r;
+  PACKET_LANES(r.m[lane] = a.m[lane] && !b.m[lane]);
+  return r;
+}
+inline maskxN
+operator|(maskxN a, maskxN b) {
+  maskxN r;
+  PACKET_LANES(r.m[lane] = a.m[lane] || b.m[lane]);
+  return r;
+}
+// per lane a ? b : c
+inline f32xN
+Select(maskxN a, f32xN b, f32xN c) {
+  f32xN r;
+  PACKET_LANES(r.v[lane] = a.m[lane] ? b.v[lane] : c.v[lane]);
+  return r;
+}
+inline bool
+Any(maskxN a) {
+  bool r = false;
+  PACKET_LANES(r |= a.m[lane]);
+  return r;
+}
+inline maskxN
+LaneMask(u32 laneCount) {
+  maskxN r;
+  PACKET_LANES(r.m[lane] = lane < laneCount);
+  return r;
+}
+inline u32
+MaskBits(maskxN a) {
+  u32 r = 0;
+  PACKET_LANES(r |= u32(a.m[lane]) << lane);
+  return r;
+}
+
+  #undef PACKET_LANES
+#endif
+
+struct v3xN {
+  f32xN x;
+  f32xN y;
+  f32xN z;
+};
+
+// Distance plus the index of the primitive whose material wins, see PacketMaterial
+struct PacketMapResult {
+  f32xN d;
+  f32xN material;
+};
+
+inline f32xN
+PacketLength(f32xN x, f32xN y, f32xN z) {
+  return Sqrt(x * x + y * y + z * z);
+}
+
+inline PacketMapResult
+PacketBox(const v3xN &p, v3 b, f32 material) {
+  f32xN zero = Splat(0.0f);
+  f32xN qx = Abs(p.x) - Splat(b.x);
+  f32xN qy = Abs(p.y) - Splat(b.y);
+  f32xN qz = Abs(p.z) - Splat(b.z);
+  PacketMapResult result;
+  result.d = PacketLength(Max(qx, zero), Max(qy, zero), Max(qz, zero)) +
+             Min(Max(qx, Max(qy, qz)), zero);
+  result.material = Splat(material);
+  return result;
+}
+
+inline PacketMapResult
+PacketSphere(const v3xN &p, f32 s, f32 material) {
+  PacketMapResult result;
+  result.d = PacketLength(p.x, p.y, p.z) - Splat(s);
+  result.material = Splat(material);
+  return result;
+}
+
+inline PacketMapResult
+PacketProcessMaterial(const PacketMapResult &a, const PacketMapResult &b, f32xN d) {
+  PacketMapResult result;
+  result.material = Select(Less(Abs(a.d), Abs(b.d)), a.material, b.material);
+  result.d = d;
+  return result;
+}
+
+inline PacketMapResult
+PacketUnion(const PacketMapResult &a, const PacketMapResult &b) {
+  return PacketProcessMaterial(a, b, Min(a.d, b.d));
+}
+
+inline PacketMapResult
+PacketCut(const PacketMapResult &a, const PacketMapResult &b) {
+  return PacketProcessMaterial(a, b, Max(a.d, Splat(0.0f) - b.d));
+}
+
+// Packet version of Map(), materials are resolved after the march with
+// PacketMaterial
+inline PacketMapResult
+PacketMap(const v3xN &p) {
+  f32 wallThickness = 0.2f;
+  f32 emitterRadius = 1.4f;
+  v3 roomSize = v3(12.0f, 12.0f, 12.0f);
+
+  PacketMapResult result = PacketBox(p, roomSize, 0.0f);
+  result = PacketCut(result, PacketBox(p, roomSize - wallThickness, 1.0f));
+
+  v3xN slabPos = {p.x, p.y, p.z - Splat(roomSize.z)};
+  result = PacketCut(result,
+                     PacketBox(slabPos,
+                               v3(roomSize.x * 1.5f,
+                                  roomSize.y * 1.5f,
+                                  wallThickness * 1.5f),
+                               2.0f));
+  result = PacketUnion(result, PacketSphere(p, emitterRadius, 3.0f));
+  return result;
+}
+
+inline MapResult
+PacketMaterial(u32 material) {
+  MapResult result = {};
+  result.throughput = v3(1.0f);
+  switch (material) {
+    case 0: result.color = v3(1.0f, 0.0f, 0.0f); break;
+    case 1: result.color = v3(0.0f, 1.0f, 0.0f); break;
+    case 2: result.color = v3(0.0f, 0.0f, 1.0f); break;
+    case 3: {
+      result.color = v3(1.0f);
+      result.emission = v3(100.0f);
+    } break;
+  }
+  return result;
+}
+
+// Per lane RadianceCascadesDistanceBricksBound, the brick lookups are scalar gathers
+inline f32xN
+PacketDistanceBricksBound(const RadianceCascadesDistanceBricks &bricks, const v3xN &p) {
+  f32 x[RADIANCE_CASCADES_PACKET_WIDTH];
+  f32 y[RADIANCE_CASCADES_PACKET_WIDTH];
+  f32 z[RADIANCE_CASCADES_PACKET_WIDTH];
+  f32 bound[RADIANCE_CASCADES_PACKET_WIDTH];
+  Store(x, p.x);
+  Store(y, p.y);
+  Store(z, p.z);
+  for (u32 lane = 0; lane < RADIANCE_CASCADES_PACKET_WIDTH; lane++) {
+    bound[lane] =
+      RadianceCascadesDistanceBricksBound(bricks, v3(x[lane], y[lane], z[lane]));
+  }
+  return Load(bound);
+}
+
+// Sphere trace laneCount rays from origin along dirs, writing one packed texel per
+// lane. Matches the single ray loop in radiance-cascades-build.comp lane for lane.
+// With a distance brick cache, PacketMap only runs when some lane is near a surface.
+// Writes the march steps each lane took to steps.
+inline void
+PacketTrace(v3 origin,
+            const f32 *dirX,
+            const f32 *dirY,
+            const f32 *dirZ,
+            u32 laneCount,
+            v2 rayRange,
+            const RadianceCascadesLevelMarch &march,
+            const RadianceCascadesDistanceBricks *bricks,
+            PackedTexel *out,
+            u32 *steps) {
+  const f32 eps = 0.001f;
+  const v3xN dir = {Load(dirX), Load(dirY), Load(dirZ)};
+  const f32xN maxT = Splat(rayRange.y);
+  const f32xN epsilonSlope = Splat(march.epsilonSlope);
+  const f32xN minStepSlope = Splat(march.minStepSlope);
+
+  f32xN t = Splat(rayRange.x);
+  f32xN hitMaterial = Splat(0.0f);
+  maskxN hit = LaneMask(0);
+  maskxN active = LaneMask(laneCount) & Less(t, maxT);
+  // every active lane takes one step per iteration, the ones still active when the
+  // budget runs out are misses
+  f32xN laneSteps = Splat(0.0f);
+
+  const u32 maxSteps = march.maxSteps ? march.maxSteps : 0xFFFFFFFF;
+  for (u32 iteration = 0; Any(active) && iteration < maxSteps; iteration++) {
+    laneSteps = Select(active, laneSteps + Splat(1.0f), laneSteps);
+    v3xN pos = {Splat(origin.x) + dir.x * t,
+                Splat(origin.y) + dir.y * t,
+                Splat(origin.z) + dir.z * t};
+
+    // lanes with a cached bound step by it, the rest evaluate the scene
+    maskxN exact = active;
+    f32xN step = Splat(0.0f);
+    if (bricks) {
+      step = PacketDistanceBricksBound(*bricks, pos);
+      exact = AndNot(active, Less(Splat(0.0f), step));
+    }
+
+    if (Any(exact)) {
+      PacketMapResult result = PacketMap(pos);
+
+      maskxN hitNow = exact & LessEqual(result.d, Max(Splat(eps), t * epsilonSlope));
+      hitMaterial = Select(hitNow, result.material, hitMaterial);
+      hit = hit | hitNow;
+      active = AndNot(active, hitNow);
+      step = Select(exact,
+                    Max(Max(Splat(0.000001f), t * minStepSlope), result.d),
+                    step);
+    }
+
+    t = Select(active, t + step, t);
+    active = active & Less(t, maxT);
+  }
+
+  f32 materials[RADIANCE_CASCADES_PACKET_WIDTH];
+  Store(materials, hitMaterial);
+  u32 hitBits = MaskBits(hit);
+
+  MapResult miss = {};
+  miss.throughput = v3(1.0f);
+  const PackedTexel missPacked = PackMapResult(miss);
+
+  for (u32 lane = 0; lane < laneCount; lane++) {
+    if (hitBits & (1u << lane)) {
+      MapResult write = PacketMaterial(u32(materials[lane]));
+      write.throughput = v3(0.0f);
+      out[lane] = PackMapResult(write);
+    } else {
+      out[lane] = missPacked;
+    }
+  }
+
+  f32 stepCounts[RADIANCE_CASCADES_PACKET_WIDTH];
+  Store(stepCounts, laneSteps);
+  for (u32 lane = 0; lane < laneCount; lane++) {
+    steps[lane] = u32(stepCounts[lane]);
+  }
+}
+
+} // namespace RadianceCascadesKernels
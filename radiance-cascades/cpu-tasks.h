@@ -0,0 +1,245 @@
+#pragma once
+
+#include <hotcart/types.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <string.h>
+#include <thread>
+
+#include "layout.h"
+#include "shared.h"
+
+// Dependency driven scheduling of the CPU backend's stages. Building a level doesn't need
+// any other level, merging a level needs that level's build and the reduced merge of the
+// level above it, and the irradiance needs the level 0 merge. RadianceCascadesCPUUpdate
+// describes that as a task graph and a pool of threads starts every task as soon as the
+// ones it depends on are done, so the lower levels build while the upper ones merge.
+// Tasks split their work with RadianceCascadesCPUTasksParallelFor, a thread with nothing
+// of its own to do takes chunks of whichever loop still has some left rather than waiting
+// for a stage to end.
+
+// a build, merge and reduce per level and the irradiance
+#define RADIANCE_CASCADES_CPU_MAX_TASKS (RADIANCE_CASCADES_MAX_LEVELS * 3 + 1)
+// a task is needed by the next stage of its level or the level below and, with
+// serialStages, the next task in line
+#define RADIANCE_CASCADES_CPU_MAX_TASK_DEPENDENTS 2
+
+struct RadianceCascadesCPUTask {
+  RadianceCascadesStage stage;
+  i32 level;
+  // tasks that still have to finish before this one can start
+  u32 waitingOn;
+  u32 dependents[RADIANCE_CASCADES_CPU_MAX_TASK_DEPENDENTS];
+  u32 dependentCount;
+};
+
+struct RadianceCascadesCPUTaskGraph {
+  RadianceCascadesCPUTask tasks[RADIANCE_CASCADES_CPU_MAX_TASKS];
+  u32 taskCount;
+};
+
+inline u32
+RadianceCascadesCPUTaskGraphAdd(RadianceCascadesCPUTaskGraph &graph,
+                                RadianceCascadesStage stage,
+                                i32 level) {
+  graph.tasks[graph.taskCount] = {.stage = stage,
+                                  .level = level,
+                                  .waitingOn = 0,
+                                  .dependents = {},
+                                  .dependentCount = 0};
+  return graph.taskCount++;
+}
+
+// task can't start before dependency is done
+inline void
+RadianceCascadesCPUTaskGraphDepend(RadianceCascadesCPUTaskGraph &graph,
+                                   u32 task,
+                                   u32 dependency) {
+  RadianceCascadesCPUTask &from = graph.tasks[dependency];
+  from.dependents[from.dependentCount++] = task;
+  graph.tasks[task].waitingOn++;
+}
+
+// A loop over [0, count) handed out grain iterations at a time
+struct RadianceCascadesCPUTaskLoop {
+  void (*run)(const void *fn, u32 start, u32 end);
+  const void *fn;
+  u32 count;
+  u32 grain;
+  // guarded by the pool's mutex
+  u32 next;
+  u32 finished;
+};
+
+struct RadianceCascadesCPUTaskPool {
+  std::mutex mutex;
+  std::condition_variable wake;
+
+  RadianceCascadesCPUTaskGraph *graph;
+  u32 unfinishedTasks;
+  // tasks whose dependencies are done
+  u32 ready[RADIANCE_CASCADES_CPU_MAX_TASKS];
+  u32 readyCount;
+
+  // loops with iterations left to hand out, oldest first. A task runs one loop at a
+  // time so there are never more than there are tasks.
+  RadianceCascadesCPUTaskLoop *loops[RADIANCE_CASCADES_CPU_MAX_TASKS];
+  u32 loopCount;
+};
+
+// Run the next chunk of loop, lock is held on entry and exit
+static void
+RadianceCascadesCPUTaskPoolRunChunk(RadianceCascadesCPUTaskPool &pool,
+                                    std::unique_lock<std::mutex> &lock,
+                                    RadianceCascadesCPUTaskLoop &loop) {
+  const u32 start = loop.next;
+  const u32 end = Min(start + loop.grain, loop.count);
+  loop.next = end;
+  if (end == loop.count) {
+    for (u32 i = 0; i < pool.loopCount; i++) {
+      if (pool.loops[i] == &loop) {
+        memmove(pool.loops + i,
+                pool.loops + i + 1,
+                (pool.loopCount - i - 1) * sizeof(pool.loops[0]));
+        pool.loopCount--;
+        break;
+      }
+    }
+  }
+
+  lock.unlock();
+  loop.run(loop.fn, start, end);
+  lock.lock();
+
+  loop.finished += end - start;
+  if (loop.finished == loop.count) {
+    pool.wake.notify_all();
+  }
+}
+
+// Runs fn(index) for index in [0, count) on the pool's threads and returns once every
+// index is done. While its own chunks are taken the calling thread helps with other
+// loops instead of starting another task.
+template <typename Fn>
+static void
+RadianceCascadesCPUTasksParallelFor(RadianceCascadesCPUTaskPool &pool,
+                                    u32 count,
+                                    u32 grain,
+                                    const Fn &fn) {
+  if (!count) {
+    return;
+  }
+  RadianceCascadesCPUTaskLoop loop = {};
+  loop.run = [](const void *fn, u32 start, u32 end) {
+    for (u32 index = start; index < end; index++) {
+      (*(const Fn *)fn)(index);
+    }
+  };
+  loop.fn = &fn;
+  loop.count = count;
+  loop.grain = Max(grain, 1u);
+
+  std::unique_lock<std::mutex> lock(pool.mutex);
+  pool.loops[pool.loopCount++] = &loop;
+  pool.wake.notify_all();
+  while (loop.finished < loop.count) {
+    RadianceCascadesCPUTaskLoop *next = loop.next < loop.count ? &loop
+                                        : pool.loopCount        ? pool.loops[0]
+                                                                : nullptr;
+    if (!next) {
+      pool.wake.wait(lock);
+      continue;
+    }
+    RadianceCascadesCPUTaskPoolRunChunk(pool, lock, *next);
+  }
+}
+
+// Ready task to start next: merges and reduces first, they are on the critical path,
+// then the highest level so its merge can start as early as possible
+inline u32
+RadianceCascadesCPUTaskPoolTakeReady(RadianceCascadesCPUTaskPool &pool) {
+  u32 best = 0;
+  i32 bestPriority = -1;
+  for (u32 i = 0; i < pool.readyCount; i++) {
+    const RadianceCascadesCPUTask &task = pool.graph->tasks[pool.ready[i]];
+    const i32 stagePriority = task.stage == RadianceCascadesStage_Build
+                                ? 0
+                                : RADIANCE_CASCADES_MAX_LEVELS;
+    const i32 priority = stagePriority + task.level;
+    if (priority > bestPriority) {
+      best = i;
+      bestPriority = priority;
+    }
+  }
+  const u32 task = pool.ready[best];
+  pool.ready[best] = pool.ready[--pool.readyCount];
+  return task;
+}
+
+template <typename RunTask>
+static void
+RadianceCascadesCPUTaskPoolWork(RadianceCascadesCPUTaskPool &pool,
+                                const RunTask &runTask) {
+  std::unique_lock<std::mutex> lock(pool.mutex);
+  while (pool.unfinishedTasks) {
+    // finishing what is running frees up its dependents sooner
+    if (pool.loopCount) {
+      RadianceCascadesCPUTaskPoolRunChunk(pool, lock, *pool.loops[0]);
+      continue;
+    }
+    if (!pool.readyCount) {
+      pool.wake.wait(lock);
+      continue;
+    }
+
+    const u32 taskIndex = RadianceCascadesCPUTaskPoolTakeReady(pool);
+    RadianceCascadesCPUTask &task = pool.graph->tasks[taskIndex];
+    lock.unlock();
+    runTask(task);
+    lock.lock();
+
+    for (u32 i = 0; i < task.dependentCount; i++) {
+      RadianceCascadesCPUTask &dependent = pool.graph->tasks[task.dependents[i]];
+      if (--dependent.waitingOn == 0) {
+        pool.ready[pool.readyCount++] = task.dependents[i];
+      }
+    }
+    pool.unfinishedTasks--;
+    pool.wake.notify_all();
+  }
+}
+
+// Runs runTask(task) for every task of the graph on threadCount threads, the calling
+// thread included, and returns once all of them are done
+template <typename RunTask>
+static void
+RadianceCascadesCPUTaskGraphRun(RadianceCascadesCPUTaskGraph &graph,
+                                RadianceCascadesCPUTaskPool &pool,
+                                u32 threadCount,
+                                const RunTask &runTask) {
+  pool.graph = &graph;
+  pool.unfinishedTasks = graph.taskCount;
+  pool.readyCount = 0;
+  pool.loopCount = 0;
+  for (u32 task = 0; task < graph.taskCount; task++) {
+    if (!graph.tasks[task].waitingOn) {
+      pool.ready[pool.readyCount++] = task;
+    }
+  }
+
+  auto worker = [&]() { RadianceCascadesCPUTaskPoolWork(pool, runTask); };
+  if (threadCount <= 1) {
+    worker();
+    return;
+  }
+  std::thread *threads = new std::thread[threadCount - 1];
+  for (u32 i = 0; i < threadCount - 1; i++) {
+    threads[i] = std::thread(worker);
+  }
+  worker();
+  for (u32 i = 0; i < threadCount - 1; i++) {
+    threads[i].join();
+  }
+  delete[] threads;
+}
@@ -0,0 +1,1374 @@
+#pragma once
+
+#include <engine/gpu/morton.h>
+#include <engine/linalg.h>
+#include <hotcart/types.h>
+
+#include <atomic>
+#include <chrono>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+
+#include "cpu-kernels.h"
+#include "cpu-packet.h"
+#include "cpu-tasks.h"
+#include "distance-bricks.h"
+#include "layout.h"
+#include "shared.h"
+#include "stats.h"
+#include "update.h"
+
+// Headless CPU implementation of the build -> merge -> irradiance sequence in
+// RadianceCascadesTick. The atlas memory matches the GL_RGBA32F 2D array texture
+// texel for texel (layer major, then rows), so it can be uploaded as-is with
+// glTextureSubImage3D or diffed against a readback of the GL atlas.
+// Called after every stage of RadianceCascadesCPUUpdate
+typedef void RadianceCascadesCPUStageCallback(void *user,
+                                              RadianceCascadesStage stage,
+                                              i32 level,
+                                              f64 milliseconds);
+
+struct RadianceCascadesCPU {
+  RadianceCascadesConfig config;
+  RadianceCascadesLayout layout;
+
+  // 0 means use every hardware thread
+  u32 threadCount;
+  bool keepOriginalAtlasCopy;
+  // Trace one ray at a time like the shader instead of in packets
+  bool singleRayTracer;
+  // Run the stages one after another instead of as soon as what they read is ready,
+  // each stage's wall time is then its own
+  bool serialStages;
+
+  RadianceCascadesCPUStageCallback *onStage;
+  void *onStageUser;
+  // Optional, owned by the caller. Every stage pushes a sample into it.
+  RadianceCascadesStats *stats;
+  RadianceCascadesStepHistogram stepHistogram;
+  // set while RadianceCascadesCPUUpdate runs, the stages' loops go through it
+  RadianceCascadesCPUTaskPool *tasks;
+
+  // Optional, owned by the caller. The build steps through empty space with it when
+  // its info.enabled is set.
+  const RadianceCascadesDistanceBricks *distanceBricks;
+
+  // merged results
+  RadianceCascadesKernels::PackedTexel *atlas;
+  // unmerged build results, merge reads the lower level from here so a region can be
+  // re-merged without re-tracing everything that feeds into it
+  RadianceCascadesKernels::PackedTexel *atlasOriginal;
+  u64 atlasByteSize;
+  // the level above the one being merged filtered down to its directions, see
+  // RadianceCascadesCPUReduceLevel
+  RadianceCascadesReducedTexel *reduced;
+  // a bit per probe of every level, clear when the probe is inside solid geometry, see
+  // RadianceCascadesProbeValidityWordOffset
+  u32 *probeValidity;
+  // sparse storage only: atlas slot of every brick of every level, see
+  // RadianceCascadesCPUAllocateSparseBricks
+  u32 *sparseBricks;
+
+  // one per level 0 probe, integrated from the merged atlas after every update
+  RadianceCascadesIrradianceProbe *irradiance;
+  u32 irradianceProbeCount;
+};
+
+static void
+RadianceCascadesCPUFree(RadianceCascadesCPU &cpu) {
+  free(cpu.atlas);
+  free(cpu.atlasOriginal);
+  free(cpu.irradiance);
+  free(cpu.reduced);
+  free(cpu.probeValidity);
+  free(cpu.sparseBricks);
+  cpu.atlas = nullptr;
+  cpu.atlasOriginal = nullptr;
+  cpu.atlasByteSize = 0;
+  cpu.irradiance = nullptr;
+  cpu.irradianceProbeCount = 0;
+  cpu.reduced = nullptr;
+  cpu.probeValidity = nullptr;
+  cpu.sparseBricks = nullptr;
+}
+
+// Bytes RadianceCascadesCPUInit allocates for config
+inline u64
+RadianceCascadesCPUByteSize(const RadianceCascadesConfig &requested,
+                            bool keepOriginalAtlasCopy) {
+  const RadianceCascadesLayout layout = RadianceCascadesComputeLayout(requested);
+  // sized with the branching factor the layout settled on
+  RadianceCascadesConfig config = requested;
+  RadianceCascadesApplyLayout(config, layout);
+  return RadianceCascadesAtlasTexelCount(layout) *
+           sizeof(RadianceCascadesKernels::PackedTexel) *
+           (keepOriginalAtlasCopy ? 2 : 1) +
+         u64(RadianceCascadesIrradianceProbeCount(config, layout)) *
+           sizeof(RadianceCascadesIrradianceProbe) +
+         RadianceCascadesReducedTexelCount(config, layout) *
+           sizeof(RadianceCascadesReducedTexel) +
+         (u64(RadianceCascadesProbeValidityWordCount(layout)) +
+          layout.sparseBrickTableSize) *
+           sizeof(u32);
+}
+
+// (Re)allocates the atlases when the layout changes, returns false on allocation
+// failure.
+static bool
+RadianceCascadesCPUInit(RadianceCascadesCPU &cpu, const RadianceCascadesConfig &config) {
+  RadianceCascadesLayout layout = RadianceCascadesComputeLayout(config);
+  // sparse slots can change without moving any level's rect
+  const bool capacityChanged = memcmp(config.sparseBrickCapacity,
+                                      cpu.config.sparseBrickCapacity,
+                                      sizeof(config.sparseBrickCapacity)) != 0;
+  cpu.config = config;
+  RadianceCascadesApplyLayout(cpu.config, layout);
+
+  bool layoutChanged = memcmp(&layout, &cpu.layout, sizeof(layout)) != 0 ||
+                       (layout.sparseBrickTableSize && capacityChanged);
+  bool originalChanged = cpu.keepOriginalAtlasCopy != (cpu.atlasOriginal != nullptr);
+  if (!layoutChanged && !originalChanged && cpu.atlas) {
+    return true;
+  }
+
+  // the merged atlas stays valid when only the unmerged copy comes or goes, a new copy
+  // is filled in by the next full rebuild
+  if (!layoutChanged && cpu.atlas) {
+    if (!cpu.keepOriginalAtlasCopy) {
+      free(cpu.atlasOriginal);
+      cpu.atlasOriginal = nullptr;
+      return true;
+    }
+    cpu.atlasOriginal = (RadianceCascadesKernels::PackedTexel *)malloc(cpu.atlasByteSize);
+    if (cpu.atlasOriginal) {
+      return true;
+    }
+  }
+
+  RadianceCascadesCPUFree(cpu);
+  cpu.layout = layout;
+  // always full RGBA32F texels, compact atlases are converted on upload
+  cpu.atlasByteSize = RadianceCascadesAtlasTexelCount(layout) *
+                      sizeof(RadianceCascadesKernels::PackedTexel);
+  cpu.atlas = (RadianceCascadesKernels::PackedTexel *)malloc(cpu.atlasByteSize);
+  if (cpu.keepOriginalAtlasCopy) {
+    cpu.atlasOriginal = (RadianceCascadesKernels::PackedTexel *)malloc(
+      cpu.atlasByteSize);
+  }
+  cpu.irradianceProbeCount = RadianceCascadesIrradianceProbeCount(cpu.config, layout);
+  cpu.irradiance = (RadianceCascadesIrradianceProbe *)calloc(
+    cpu.irradianceProbeCount, sizeof(RadianceCascadesIrradianceProbe));
+  cpu.reduced = (RadianceCascadesReducedTexel *)malloc(
+    Max(RadianceCascadesReducedTexelCount(cpu.config, layout), u64(1)) *
+    sizeof(RadianceCascadesReducedTexel));
+  // every probe is valid until a build finds it inside something
+  const u32 validityWordCount = RadianceCascadesProbeValidityWordCount(layout);
+  cpu.probeValidity = (u32 *)malloc(u64(validityWordCount) * sizeof(u32));
+  if (cpu.probeValidity) {
+    memset(cpu.probeValidity, 0xFF, u64(validityWordCount) * sizeof(u32));
+  }
+  // no brick has a slot until RadianceCascadesCPUAllocateSparseBricks places them
+  if (layout.sparseBrickTableSize) {
+    cpu.sparseBricks = (u32 *)malloc(u64(layout.sparseBrickTableSize) * sizeof(u32));
+    if (cpu.sparseBricks) {
+      memset(cpu.sparseBricks, 0xFF, u64(layout.sparseBrickTableSize) * sizeof(u32));
+    }
+  }
+
+  if (!cpu.atlas || (cpu.keepOriginalAtlasCopy && !cpu.atlasOriginal) ||
+      !cpu.irradiance || !cpu.reduced || !cpu.probeValidity ||
+      (layout.sparseBrickTableSize && !cpu.sparseBricks)) {
+    printf("RadianceCascadesCPUInit: failed to allocate %.2fMB atlas\n",
+           f64(cpu.atlasByteSize) / (1024.0 * 1024.0));
+    RadianceCascadesCPUFree(cpu);
+    return false;
+  }
+  return true;
+}
+
+inline u32
+RadianceCascadesCPUThreadCount(const RadianceCascadesCPU &cpu) {
+  if (cpu.threadCount) {
+    return cpu.threadCount;
+  }
+  return Max(1u, u32(std::thread::hardware_concurrency()));
+}
+
+// Runs fn(index) for index in [0, count) on threadCount threads, handing out work in
+// grain sized chunks.
+template <typename Fn>
+static void
+RadianceCascadesCPUParallelFor(u32 threadCount, u32 count, u32 grain, const Fn &fn) {
+  std::atomic<u32> next(0);
+  auto worker = [&]() {
+    while (true) {
+      u32 start = next.fetch_add(grain);
+      if (start >= count) {
+        return;
+      }
+      u32 end = Min(start + grain, count);
+      for (u32 index = start; index < end; index++) {
+        fn(index);
+      }
+    }
+  };
+
+  threadCount = Min(threadCount, (count + grain - 1) / grain);
+  if (threadCount <= 1) {
+    worker();
+    return;
+  }
+
+  std::thread *threads = new std::thread[threadCount - 1];
+  for (u32 i = 0; i < threadCount - 1; i++) {
+    threads[i] = std::thread(worker);
+  }
+  worker();
+  for (u32 i = 0; i < threadCount - 1; i++) {
+    threads[i].join();
+  }
+  delete[] threads;
+}
+
+// RadianceCascadesCPUParallelFor on the update's task pool while there is one
+template <typename Fn>
+static void
+RadianceCascadesCPUParallelFor(const RadianceCascadesCPU &cpu,
+                               u32 count,
+                               u32 grain,
+                               const Fn &fn) {
+  if (cpu.tasks) {
+    RadianceCascadesCPUTasksParallelFor(*cpu.tasks, count, grain, fn);
+    return;
+  }
+  RadianceCascadesCPUParallelFor(RadianceCascadesCPUThreadCount(cpu), count, grain, fn);
+}
+
+// Re-evaluate the bricks flagged in candidates (every brick when it is null) with the
+// packet version of map(). The GL build reads the same cache, so this relies on
+// PacketMap matching map() in shaders/shared.glsl like the CPU backend does.
+static void
+RadianceCascadesCPUUpdateDistanceBricks(RadianceCascadesDistanceBricks &bricks,
+                                        u32 threadCount,
+                                        const u8 *candidates) {
+  using namespace RadianceCascadesKernels;
+  const RadianceCascadesDistanceBricksInfo &info = bricks.info;
+  const u32 brickCount = RadianceCascadesDistanceBrickCount(info);
+  // a brick can only contain a surface if its center is within half a diagonal of one,
+  // the extra voxel keeps the filtered distance accurate right up to the brick
+  const f32 nearDistance = RadianceCascadesDistanceBrickDiameter(info) * 0.5f *
+                             sqrtf(3.0f) +
+                           info.voxelSize;
+
+  u32 *bakeList = (u32 *)malloc(u64(brickCount) * sizeof(u32));
+  if (!bakeList) {
+    return;
+  }
+
+  RadianceCascadesCPUParallelFor(threadCount, brickCount, 64, [&](u32 brickIndex) {
+    if (candidates && !candidates[brickIndex]) {
+      return;
+    }
+    const v3 center = RadianceCascadesDistanceBrickCenter(
+      info, RadianceCascadesDistanceBrickPos(info, brickIndex));
+    f32 d[RADIANCE_CASCADES_PACKET_WIDTH];
+    Store(d, PacketMap({Splat(center.x), Splat(center.y), Splat(center.z)}).d);
+    bricks.bricks[brickIndex].centerDistance = d[0];
+  });
+
+  // hand out sample storage, this is the only part that touches the slot lists
+  u32 bakeCount = 0;
+  for (u32 brickIndex = 0; brickIndex < brickCount; brickIndex++) {
+    if (candidates && !candidates[brickIndex]) {
+      continue;
+    }
+    RadianceCascadesDistanceBrick &brick = bricks.bricks[brickIndex];
+    const bool near = fabsf(brick.centerDistance) <= nearDistance;
+    if (near && !brick.slot) {
+      // out of memory leaves the brick empty, its center bound is still safe
+      brick.slot = RadianceCascadesDistanceBricksAllocSlot(bricks);
+    } else if (!near && brick.slot) {
+      RadianceCascadesDistanceBricksFreeSlot(bricks, brick.slot);
+      brick.slot = 0;
+    }
+    if (brick.slot) {
+      bricks.dirtySlots[brick.slot - 1] = 1;
+      bakeList[bakeCount++] = brickIndex;
+    }
+  }
+  bricks.dirty = true;
+
+  const u32 W = RADIANCE_CASCADES_PACKET_WIDTH;
+  const u32 S = RADIANCE_CASCADES_DISTANCE_BRICK_SAMPLES;
+  RadianceCascadesCPUParallelFor(threadCount, bakeCount, 4, [&](u32 bakeIndex) {
+    const u32 brickIndex = bakeList[bakeIndex];
+    const v3u32 brick = RadianceCascadesDistanceBrickPos(info, brickIndex);
+    f32 *samples = RadianceCascadesDistanceBrickSamples(bricks,
+                                                        bricks.bricks[brickIndex].slot);
+
+    f32 x[W];
+    f32 y[W];
+    f32 z[W];
+    const u32 sampleCount = RADIANCE_CASCADES_DISTANCE_BRICK_SAMPLE_COUNT;
+    for (u32 first = 0; first < sampleCount; first += W) {
+      const u32 laneCount = Min(W, sampleCount - first);
+      for (u32 lane = 0; lane < W; lane++) {
+        const u32 sampleIndex = first + Min(lane, laneCount - 1);
+        const v3u32 sample(sampleIndex % S, (sampleIndex / S) % S, sampleIndex / (S * S));
+        const v3 p = RadianceCascadesDistanceBrickSamplePos(info, brick, sample);
+        x[lane] = p.x;
+        y[lane] = p.y;
+        z[lane] = p.z;
+      }
+
+      f32 d[W];
+      Store(d, PacketMap({Load(x), Load(y), Load(z)}).d);
+      memcpy(samples + first, d, laneCount * sizeof(f32));
+    }
+  });
+
+  free(bakeList);
+}
+
+// Bake the whole cache
+static void
+RadianceCascadesCPUBakeDistanceBricks(RadianceCascadesDistanceBricks &bricks,
+                                      u32 threadCount) {
+  RadianceCascadesCPUUpdateDistanceBricks(bricks, threadCount, nullptr);
+}
+
+// Re-bake after the scene changed inside [aabbMin, aabbMax]. A cached distance can only
+// change if the box is closer than the surface it measured, so only bricks whose
+// distances reach the box are re-evaluated.
+static void
+RadianceCascadesCPUInvalidateDistanceBricks(RadianceCascadesDistanceBricks &bricks,
+                                            u32 threadCount,
+                                            v3 aabbMin,
+                                            v3 aabbMax) {
+  const RadianceCascadesDistanceBricksInfo &info = bricks.info;
+  const u32 brickCount = RadianceCascadesDistanceBrickCount(info);
+  const f32 brickRadius = RadianceCascadesDistanceBrickDiameter(info) * 0.5f;
+  const f32 halfDiagonal = brickRadius * sqrtf(3.0f);
+
+  u8 *candidates = (u8 *)malloc(brickCount);
+  if (!candidates) {
+    RadianceCascadesCPUBakeDistanceBricks(bricks, threadCount);
+    return;
+  }
+
+  for (u32 brickIndex = 0; brickIndex < brickCount; brickIndex++) {
+    const v3 center = RadianceCascadesDistanceBrickCenter(
+      info, RadianceCascadesDistanceBrickPos(info, brickIndex));
+    const v3 gap = Max(Max(aabbMin - (center + brickRadius),
+                           (center - brickRadius) - aabbMax),
+                       v3(0.0f));
+    const f32 reach = fabsf(bricks.bricks[brickIndex].centerDistance) + halfDiagonal;
+    candidates[brickIndex] = Length(gap) <= reach;
+  }
+
+  RadianceCascadesCPUUpdateDistanceBricks(bricks, threadCount, candidates);
+  free(candidates);
+}
+
+// Decide which bricks of every level get storage and hand out their slots in brick
+// order. A level 0 brick is kept when the scene's surface comes within a cell of its
+// probes, either side of it, so every probe the final gather can read next to a surface
+// has a tile. Each level above keeps the bricks the merge of the kept bricks below it
+// interpolates between. A level too small to split into whole bricks keeps all of it.
+// neededBricks gets how many bricks each level wanted, past its capacity the rest are
+// left without storage. The config's windows must not be scrolled.
+static void
+RadianceCascadesPlaceSparseBricks(const RadianceCascadesConfig &config,
+                                  const RadianceCascadesLayout &layout,
+                                  u32 threadCount,
+                                  u32 *bricks,
+                                  u32 neededBricks[RADIANCE_CASCADES_MAX_LEVELS]) {
+  const u32 D = RADIANCE_CASCADES_SPARSE_BRICK_DIAMETER;
+  const u32 brickProbes = RADIANCE_CASCADES_SPARSE_BRICK_PROBES;
+  // reuse bricks as the keep flags, 0 or 1 until the slots are handed out
+  memset(bricks, 0, u64(layout.sparseBrickTableSize) * sizeof(u32));
+
+  for (i32 level = 0; level < i32(layout.totalLevels); level++) {
+    u32 *levelBricks = bricks + RadianceCascadesSparseBrickOffset(layout, level);
+    const u32 brickCount = RadianceCascadesSparseBrickCount(layout, level);
+    if (RadianceCascadesLevelBrickDiameter(config, level) < D) {
+      for (u32 brick = 0; brick < brickCount; brick++) {
+        levelBricks[brick] = 1;
+      }
+      continue;
+    }
+
+    if (level == 0) {
+      // probes are a cell apart, the brick's cells reach half a diagonal from its center
+      const f32 cellDiameter = config.scale;
+      const f32 halfDiagonal = f32(D) * 0.5f * sqrtf(3.0f) * cellDiameter;
+      RadianceCascadesCPUParallelFor(threadCount, brickCount, 64, [&](u32 brick) {
+        const v3u32 first = RadianceCascadesProbeGridPos(config, brick * brickProbes, 0);
+        const v3 center = (RadianceCascadesProbeCenter(config, first, 0) +
+                           RadianceCascadesProbeCenter(config, first + (D - 1), 0)) *
+                          0.5f;
+        const f32 d = RadianceCascadesKernels::Map(center).d;
+        levelBricks[brick] = d >= -halfDiagonal && d <= halfDiagonal + cellDiameter;
+      });
+      continue;
+    }
+
+    const i32 lowerLevel = level - 1;
+    const u32 *lowerBricks =
+      bricks + RadianceCascadesSparseBrickOffset(layout, lowerLevel);
+    const u32 lowerBrickCount = RadianceCascadesSparseBrickCount(layout, lowerLevel);
+    for (u32 lowerBrick = 0; lowerBrick < lowerBrickCount; lowerBrick++) {
+      if (!lowerBricks[lowerBrick]) {
+        continue;
+      }
+      const v3u32 first = RadianceCascadesProbeGridPos(
+        config, lowerBrick * brickProbes, lowerLevel);
+      const RadianceCascadesProbeBox upper = RadianceCascadesProbeBoxMergeUpperProbes(
+        config, lowerLevel, {first, first + D});
+      const u32 upperProbeCount = RadianceCascadesProbeBoxCount(upper);
+      for (u32 boxIndex = 0; boxIndex < upperProbeCount; boxIndex++) {
+        const u32 probeIndex = RadianceCascadesProbeIndex(
+          config, RadianceCascadesProbeBoxGridPos(upper, boxIndex), level);
+        levelBricks[probeIndex / brickProbes] = 1;
+      }
+    }
+  }
+
+  for (i32 level = 0; level < i32(layout.totalLevels); level++) {
+    u32 *levelBricks = bricks + RadianceCascadesSparseBrickOffset(layout, level);
+    const u32 brickCount = RadianceCascadesSparseBrickCount(layout, level);
+    const u32 capacity = RadianceCascadesSparseBrickCapacity(config, layout, level);
+    u32 needed = 0;
+    for (u32 brick = 0; brick < brickCount; brick++) {
+      const bool keep = levelBricks[brick];
+      levelBricks[brick] =
+        keep && needed < capacity ? needed : RADIANCE_CASCADES_SPARSE_BRICK_EMPTY;
+      needed += keep;
+    }
+    neededBricks[level] = needed;
+  }
+}
+
+// Size config's sparse brick capacities for the scene, see
+// RadianceCascadesFitSparseBrickCapacity. Returns true when config changed.
+static bool
+RadianceCascadesCPUFitSparseStorage(RadianceCascadesConfig &config, u32 threadCount) {
+  if (!RadianceCascadesStorageSparse(config)) {
+    return false;
+  }
+  const RadianceCascadesLayout layout = RadianceCascadesComputeLayout(config);
+  RadianceCascadesConfig placed = config;
+  RadianceCascadesApplyLayout(placed, layout);
+  u32 *bricks = (u32 *)malloc(u64(layout.sparseBrickTableSize) * sizeof(u32));
+  if (!bricks) {
+    return false;
+  }
+  u32 neededBricks[RADIANCE_CASCADES_MAX_LEVELS] = {};
+  RadianceCascadesPlaceSparseBricks(placed, layout, threadCount, bricks, neededBricks);
+  free(bricks);
+  return RadianceCascadesFitSparseBrickCapacity(config, layout, neededBricks);
+}
+
+// Whether the scene changed in a way that needs bricks placed differently than in bricks,
+// after an edit. Nothing is traced into a brick without storage, so the edit needs a
+// full rebuild then.
+static bool
+RadianceCascadesSparseBricksStale(const RadianceCascadesConfig &config,
+                                  const RadianceCascadesLayout &layout,
+                                  u32 threadCount,
+                                  const u32 *bricks) {
+  u32 *placed = (u32 *)malloc(u64(layout.sparseBrickTableSize) * sizeof(u32));
+  if (!placed) {
+    return true;
+  }
+  u32 neededBricks[RADIANCE_CASCADES_MAX_LEVELS] = {};
+  RadianceCascadesPlaceSparseBricks(config, layout, threadCount, placed, neededBricks);
+  const bool stale =
+    memcmp(placed, bricks, u64(layout.sparseBrickTableSize) * sizeof(u32)) != 0;
+  free(placed);
+  return stale;
+}
+
+// Place cpu's sparse bricks for the scene and mark the probes left without storage
+// invalid. Levels that wanted more bricks than config.sparseBrickCapacity allows keep the
+// first ones in brick order, see RadianceCascadesCPUFitSparseStorage.
+static void
+RadianceCascadesCPUAllocateSparseBricks(RadianceCascadesCPU &cpu, u32 threadCount) {
+  u32 neededBricks[RADIANCE_CASCADES_MAX_LEVELS] = {};
+  RadianceCascadesPlaceSparseBricks(
+    cpu.config, cpu.layout, threadCount, cpu.sparseBricks, neededBricks);
+  for (i32 level = 0; level < i32(cpu.layout.totalLevels); level++) {
+    const u32 capacity =
+      RadianceCascadesSparseBrickCapacity(cpu.config, cpu.layout, level);
+    if (neededBricks[level] > capacity) {
+      printf("RadianceCascadesCPUAllocateSparseBricks: level %i needs %u bricks, "
+             "dropped %u\n",
+             level,
+             neededBricks[level],
+             neededBricks[level] - capacity);
+    }
+  }
+  RadianceCascadesResetSparseProbeValidity(
+    cpu.layout, cpu.sparseBricks, cpu.probeValidity);
+}
+
+// Storage slot of a probe, RADIANCE_CASCADES_SPARSE_BRICK_EMPTY when it has none
+inline u32
+RadianceCascadesCPUProbeSlot(const RadianceCascadesCPU &cpu, u32 probeIndex, i32 level) {
+  const u32 *levelBricks = nullptr;
+  if (cpu.sparseBricks) {
+    levelBricks = cpu.sparseBricks + RadianceCascadesSparseBrickOffset(cpu.layout, level);
+  }
+  return RadianceCascadesProbeSlot(
+    levelBricks, RadianceCascadesSparseBrickProbes(cpu.layout, level), probeIndex);
+}
+
+inline RadianceCascadesKernels::PackedTexel &
+RadianceCascadesCPUTexel(const RadianceCascadesCPU &cpu,
+                         RadianceCascadesKernels::PackedTexel *atlas,
+                         u32 x,
+                         u32 y,
+                         u32 layer) {
+  const u64 w = cpu.layout.atlasWidth;
+  const u64 h = cpu.layout.atlasHeight;
+  return atlas[(u64(layer) * h + y) * w + x];
+}
+
+// texelFetch semantics: out of range reads return zero
+inline RadianceCascadesKernels::PackedTexel
+RadianceCascadesCPUFetch(const RadianceCascadesCPU &cpu,
+                         const RadianceCascadesKernels::PackedTexel *atlas,
+                         i32 x,
+                         i32 y,
+                         i32 layer) {
+  const i32 w = i32(cpu.layout.atlasWidth);
+  const i32 h = i32(cpu.layout.atlasHeight);
+  if (x < 0 || y < 0 || x >= w || y >= h || layer < 0 ||
+      layer >= i32(cpu.layout.atlasLayers)) {
+    return {};
+  }
+  return atlas[(u64(layer) * u64(h) + u64(y)) * u64(w) + u64(x)];
+}
+
+// Atlas the build kernel writes into and the merge reads the lower level from
+inline RadianceCascadesKernels::PackedTexel *
+RadianceCascadesCPUUnmergedAtlas(const RadianceCascadesCPU &cpu) {
+  return cpu.atlasOriginal ? cpu.atlasOriginal : cpu.atlas;
+}
+
+// Port of AtlasImageStoreProbeTexel in shaders/atlas-image.glsl: stores an interior
+// probe texel and its copies in the probe's octahedral border
+inline void
+RadianceCascadesCPUStoreProbeTexel(const RadianceCascadesCPU &cpu,
+                                   RadianceCascadesKernels::PackedTexel *atlas,
+                                   v3u32 probeOrigin,
+                                   v2u32 stride,
+                                   u32 texelX,
+                                   u32 texelY,
+                                   u32 d,
+                                   RadianceCascadesKernels::PackedTexel value) {
+  const u32 P = OCTAPROBE_PADDING;
+  const u32 pd = d + P;
+  const u32 x = texelX + P;
+  const u32 y = texelY + P;
+  auto store = [&](u32 dstX, u32 dstY) {
+    const v3u32 dst =
+      RadianceCascadesProbeTexelAtlasCoord(probeOrigin, stride, dstX, dstY);
+    RadianceCascadesCPUTexel(cpu, atlas, dst.x, dst.y, dst.z) = value;
+  };
+
+  store(x, y);
+
+  // edges are mirrored along the fold
+  if (y == P) {
+    store(pd - x, 0);
+  }
+  if (y == d) {
+    store(pd - x, pd);
+  }
+  if (x == P) {
+    store(0, pd - y);
+  }
+  if (x == d) {
+    store(pd, pd - y);
+  }
+
+  // corners take the diagonally opposite texel
+  if (x == d && y == d) {
+    store(0, 0);
+  }
+  if (x == P && y == d) {
+    store(pd, 0);
+  }
+  if (x == P && y == P) {
+    store(pd, pd);
+  }
+  if (x == d && y == P) {
+    store(0, pd);
+  }
+}
+
+// A probe whose center is inside solid geometry only sees the inside of the surface.
+// Records which it is in cpu.probeValidity, the bits of a word belong to probes other
+// tasks may be building.
+inline bool
+RadianceCascadesCPUClassifyProbe(const RadianceCascadesCPU &cpu,
+                                 v3 probeCenter,
+                                 u32 probeIndex,
+                                 i32 level) {
+  const bool valid = RadianceCascadesKernels::Map(probeCenter).d >= 0.0f;
+  std::atomic_ref<u32> word(
+    cpu.probeValidity[RadianceCascadesProbeValidityWordOffset(cpu.layout, level) +
+                      probeIndex / 32]);
+  const u32 bit = 1u << (probeIndex % 32);
+  if (valid) {
+    word.fetch_or(bit, std::memory_order_relaxed);
+  } else {
+    word.fetch_and(~bit, std::memory_order_relaxed);
+  }
+  return valid;
+}
+
+// Leaves an invalid probe's tile dark, the merge and gather interpolate around it
+inline void
+RadianceCascadesCPUStoreInvalidProbe(const RadianceCascadesCPU &cpu,
+                                     RadianceCascadesKernels::PackedTexel *atlas,
+                                     v3u32 probeOrigin,
+                                     v2u32 stride,
+                                     u32 d) {
+  for (u32 y = 0; y < d; y++) {
+    for (u32 x = 0; x < d; x++) {
+      RadianceCascadesCPUStoreProbeTexel(
+        cpu, atlas, probeOrigin, stride, x, y, d, RadianceCascadesKernels::PackedTexel{});
+    }
+  }
+}
+
+// Port of shaders/radiance-cascades-build.comp
+static void
+RadianceCascadesCPUBuildLevel(RadianceCascadesCPU &cpu,
+                              const RadianceCascadesUpdatePlan &plan,
+                              i32 level,
+                              RadianceCascadesStageCounters &counters) {
+  using namespace RadianceCascadesKernels;
+
+  const RadianceCascadesProbeBox &box = plan.build[level];
+  const u32 boxProbeCount = RadianceCascadesProbeBoxCount(box);
+  if (!boxProbeCount) {
+    return;
+  }
+
+  PackedTexel *atlas = RadianceCascadesCPUUnmergedAtlas(cpu);
+  const u32 atlasProbeDiameter = RadianceCascadesLevelProbeDiameter(cpu.config, level);
+  const v2u32 stride = RadianceCascadesProbeTexelStride(cpu.config, level);
+  const u32 probeRayCount = atlasProbeDiameter * atlasProbeDiameter;
+  const v2 rayRange = RadianceCascadesLevelRayRange(cpu.config, level);
+
+  const u32 grain = Max(1u, 1024u / probeRayCount);
+
+  const RadianceCascadesLevelMarch march =
+    RadianceCascadesGetLevelMarch(cpu.config, level);
+
+  // probes that were not culled, their march steps and rays per step count bucket
+  const u32 B = RADIANCE_CASCADES_STEP_HISTOGRAM_BUCKETS;
+  std::atomic<u64> tracedProbes(0);
+  std::atomic<u64> marchSteps(0);
+  std::atomic<u64> stepHistogram[B] = {};
+  auto addProbe = [&](u64 steps, const u32 *histogram) {
+    tracedProbes++;
+    marchSteps += steps;
+    for (u32 bucket = 0; bucket < B; bucket++) {
+      if (histogram[bucket]) {
+        stepHistogram[bucket] += histogram[bucket];
+      }
+    }
+  };
+  auto setCounters = [&]() {
+    counters = RadianceCascadesProbeTileCounters(
+      tracedProbes, atlasProbeDiameter, sizeof(PackedTexel));
+    counters.marchSteps = marchSteps;
+    for (u32 bucket = 0; bucket < B; bucket++) {
+      cpu.stepHistogram.rays[level][bucket] = stepHistogram[bucket];
+    }
+  };
+
+  if (!cpu.singleRayTracer) {
+    // Every probe in a level shares the same directions, decode them once into SoA
+    // rows padded out to a whole number of packets.
+    const u32 W = RADIANCE_CASCADES_PACKET_WIDTH;
+    const u32 paddedRayCount = ((probeRayCount + W - 1) / W) * W;
+    f32 *dirs = (f32 *)calloc(paddedRayCount * 3, sizeof(f32));
+    f32 *dirX = dirs;
+    f32 *dirY = dirs + paddedRayCount;
+    f32 *dirZ = dirs + paddedRayCount * 2;
+    for (u32 probeRayIndex = 0; probeRayIndex < probeRayCount; probeRayIndex++) {
+      const v2 probeTexel = v2(f32(probeRayIndex % atlasProbeDiameter),
+                               f32(probeRayIndex / atlasProbeDiameter));
+      const v3 rayDir = OctahedralDecode((probeTexel + 0.5f) / f32(atlasProbeDiameter));
+      dirX[probeRayIndex] = rayDir.x;
+      dirY[probeRayIndex] = rayDir.y;
+      dirZ[probeRayIndex] = rayDir.z;
+    }
+
+    RadianceCascadesCPUParallelFor(cpu, boxProbeCount, grain, [&](u32 boxIndex) {
+        const v3u32 gridPos = RadianceCascadesProbeBoxGridPos(box, boxIndex);
+        const v3 probeCenter = RadianceCascadesProbeCenter(cpu.config, gridPos, level);
+        if (plan.cullToRegion &&
+            !RadianceCascadesRayIntervalReachesRegion(probeCenter,
+                                                      rayRange,
+                                                      plan.regionMin,
+                                                      plan.regionMax)) {
+          return;
+        }
+
+        const u32 probeIndex = RadianceCascadesProbeIndex(cpu.config, gridPos, level);
+        const u32 slot = RadianceCascadesCPUProbeSlot(cpu, probeIndex, level);
+        if (slot == RADIANCE_CASCADES_SPARSE_BRICK_EMPTY) {
+          return;
+        }
+        const v3u32 probeOrigin =
+          RadianceCascadesProbeAtlasOrigin(cpu.config, slot, level);
+        if (!RadianceCascadesCPUClassifyProbe(cpu, probeCenter, probeIndex, level)) {
+          RadianceCascadesCPUStoreInvalidProbe(
+            cpu, atlas, probeOrigin, stride, atlasProbeDiameter);
+          return;
+        }
+
+        PackedTexel packet[RADIANCE_CASCADES_PACKET_WIDTH];
+        u32 laneSteps[RADIANCE_CASCADES_PACKET_WIDTH];
+        u64 steps = 0;
+        u32 histogram[B] = {};
+        for (u32 first = 0; first < probeRayCount; first += W) {
+          const u32 laneCount = Min(W, probeRayCount - first);
+          PacketTrace(probeCenter,
+                      dirX + first,
+                      dirY + first,
+                      dirZ + first,
+                      laneCount,
+                      rayRange,
+                      march,
+                      cpu.distanceBricks,
+                      packet,
+                      laneSteps);
+
+          for (u32 lane = 0; lane < laneCount; lane++) {
+            const u32 probeRayIndex = first + lane;
+            steps += laneSteps[lane];
+            histogram[RadianceCascadesStepHistogramBucket(laneSteps[lane])]++;
+            RadianceCascadesCPUStoreProbeTexel(cpu,
+                                               atlas,
+                                               probeOrigin,
+                                               stride,
+                                               probeRayIndex % atlasProbeDiameter,
+                                               probeRayIndex / atlasProbeDiameter,
+                                               atlasProbeDiameter,
+                                               packet[lane]);
+          }
+        }
+        addProbe(steps, histogram);
+      });
+
+    free(dirs);
+    setCounters();
+    return;
+  }
+
+  RadianceCascadesCPUParallelFor(cpu, boxProbeCount, grain, [&](u32 boxIndex) {
+      const v3u32 gridPos = RadianceCascadesProbeBoxGridPos(box, boxIndex);
+      const v3 probeCenter = RadianceCascadesProbeCenter(cpu.config, gridPos, level);
+      if (plan.cullToRegion &&
+          !RadianceCascadesRayIntervalReachesRegion(probeCenter,
+                                                    rayRange,
+                                                    plan.regionMin,
+                                                    plan.regionMax)) {
+        return;
+      }
+
+      const u32 probeIndex = RadianceCascadesProbeIndex(cpu.config, gridPos, level);
+      const u32 slot = RadianceCascadesCPUProbeSlot(cpu, probeIndex, level);
+      if (slot == RADIANCE_CASCADES_SPARSE_BRICK_EMPTY) {
+        return;
+      }
+      const v3u32 probeOrigin = RadianceCascadesProbeAtlasOrigin(cpu.config, slot, level);
+      if (!RadianceCascadesCPUClassifyProbe(cpu, probeCenter, probeIndex, level)) {
+        RadianceCascadesCPUStoreInvalidProbe(
+          cpu, atlas, probeOrigin, stride, atlasProbeDiameter);
+        return;
+      }
+
+      u64 steps = 0;
+      u32 histogram[B] = {};
+      for (u32 probeRayIndex = 0; probeRayIndex < probeRayCount; probeRayIndex++) {
+        const v2 probeTexel = v2(f32(probeRayIndex % atlasProbeDiameter),
+                                 f32(probeRayIndex / atlasProbeDiameter));
+        const v2 probeUV = (probeTexel + 0.5f) / f32(atlasProbeDiameter);
+        const v3 rayDir = OctahedralDecode(probeUV);
+
+        f32 t = rayRange.x;
+        const f32 MaxT = rayRange.y;
+        const f32 eps = 0.001f;
+
+        MapResult write = {};
+        write.throughput = v3(1.0f);
+
+        u32 raySteps = 0;
+        while (t < MaxT) {
+          // out of budget, counts as a miss
+          if (raySteps == march.maxSteps && march.maxSteps) {
+            break;
+          }
+          raySteps++;
+          v3 pos = probeCenter + rayDir * t;
+          const f32 bound = cpu.distanceBricks ? RadianceCascadesDistanceBricksBound(
+                                                   *cpu.distanceBricks, pos)
+                                               : 0.0f;
+          if (bound > 0.0f) {
+            t += bound;
+            continue;
+          }
+
+          MapResult result = Map(pos);
+
+          if (result.d <= Max(eps, t * march.epsilonSlope)) {
+            result.throughput = v3(0.0f);
+            write = result;
+            break;
+          }
+
+          t += Max(Max(0.000001f, t * march.minStepSlope), result.d);
+        }
+        steps += raySteps;
+        histogram[RadianceCascadesStepHistogramBucket(raySteps)]++;
+
+        RadianceCascadesCPUStoreProbeTexel(cpu,
+                                           atlas,
+                                           probeOrigin,
+                                           stride,
+                                           u32(probeTexel.x),
+                                           u32(probeTexel.y),
+                                           atlasProbeDiameter,
+                                           PackMapResult(write));
+      }
+      addProbe(steps, histogram);
+    });
+  setCounters();
+}
+
+// Port of shaders/radiance-cascades-reduce.glsl: box filters each block of
+// 2^BranchingFactor x 2^BranchingFactor texels of the merged upper probes lowerLevel's
+// merge of box reads down to lowerLevel's directions, once per upper probe instead of
+// once per lower probe that reads it. Instantiated per factor like the shader variants
+// so the footprint loops unroll.
+template <u32 BranchingFactor>
+static void
+RadianceCascadesCPUReduceLevelBranching(RadianceCascadesCPU &cpu,
+                                        i32 lowerLevel,
+                                        const RadianceCascadesProbeBox &box,
+                                        RadianceCascadesStageCounters &counters) {
+  using namespace RadianceCascadesKernels;
+  constexpr u32 footprint = 1u << BranchingFactor;
+  constexpr f32 footprintScale = 1.0f / f32(footprint * footprint);
+
+  const RadianceCascadesProbeBox upperBox = RadianceCascadesProbeBoxMergeUpperProbes(
+    cpu.config, lowerLevel, box);
+  const u32 upperBoxProbeCount = RadianceCascadesProbeBoxCount(upperBox);
+  if (!upperBoxProbeCount) {
+    return;
+  }
+  const i32 upperLevel = lowerLevel + 1;
+  const u32 lowerAtlasProbeDiameter = RadianceCascadesLevelProbeDiameter(cpu.config,
+                                                                         lowerLevel);
+  const u32 probeRayCount = lowerAtlasProbeDiameter * lowerAtlasProbeDiameter;
+  const v2u32 upperStride = RadianceCascadesProbeTexelStride(cpu.config, upperLevel);
+  counters = RadianceCascadesReduceCounters(upperBoxProbeCount, lowerAtlasProbeDiameter);
+
+  const u32 grain = Max(1u, 1024u / probeRayCount);
+  RadianceCascadesCPUParallelFor(cpu, upperBoxProbeCount, grain, [&](u32 boxProbeIndex) {
+    const v3u32 gridPos = RadianceCascadesProbeBoxGridPos(upperBox, boxProbeIndex);
+    const u32 probeIndex = RadianceCascadesProbeIndex(cpu.config, gridPos, upperLevel);
+    const u32 slot = RadianceCascadesCPUProbeSlot(cpu, probeIndex, upperLevel);
+    if (slot == RADIANCE_CASCADES_SPARSE_BRICK_EMPTY) {
+      return;
+    }
+    const v3u32 probeOrigin =
+      RadianceCascadesProbeAtlasOrigin(cpu.config, slot, upperLevel);
+    RadianceCascadesReducedTexel *reduced = cpu.reduced + u64(slot) * probeRayCount;
+
+    for (u32 probeRayIndex = 0; probeRayIndex < probeRayCount; probeRayIndex++) {
+      const u32 x =
+        (probeRayIndex % lowerAtlasProbeDiameter) * footprint + OCTAPROBE_PADDING;
+      const u32 y =
+        (probeRayIndex / lowerAtlasProbeDiameter) * footprint + OCTAPROBE_PADDING;
+
+      v3 color(0.0f);
+      v3 emission(0.0f);
+      v3 throughput(0.0f);
+      for (u32 dy = 0; dy < footprint; dy++) {
+        for (u32 dx = 0; dx < footprint; dx++) {
+          const v3u32 src = RadianceCascadesProbeTexelAtlasCoord(
+            probeOrigin, upperStride, x + dx, y + dy);
+          const MapResult c = UnpackMapResult(
+            RadianceCascadesCPUFetch(cpu, cpu.atlas, src.x, src.y, src.z));
+          color += c.color;
+          emission += c.emission;
+          throughput += c.throughput;
+        }
+      }
+      color *= footprintScale;
+      emission *= footprintScale;
+      throughput *= footprintScale;
+      reduced[probeRayIndex] = {{color.x, color.y, color.z},
+                                {emission.x, emission.y, emission.z},
+                                {throughput.x, throughput.y, throughput.z}};
+    }
+  });
+}
+
+static void
+RadianceCascadesCPUReduceLevel(RadianceCascadesCPU &cpu,
+                               i32 lowerLevel,
+                               const RadianceCascadesProbeBox &box,
+                               RadianceCascadesStageCounters &counters) {
+  switch (RadianceCascadesBranchingFactor(cpu.config)) {
+    case 0:
+      RadianceCascadesCPUReduceLevelBranching<0>(cpu, lowerLevel, box, counters);
+      break;
+    case 1:
+      RadianceCascadesCPUReduceLevelBranching<1>(cpu, lowerLevel, box, counters);
+      break;
+    default:
+      RadianceCascadesCPUReduceLevelBranching<2>(cpu, lowerLevel, box, counters);
+      break;
+  }
+}
+
+inline RadianceCascadesKernels::MapResult
+RadianceCascadesCPUReducedMapResult(const RadianceCascadesReducedTexel &texel) {
+  RadianceCascadesKernels::MapResult r = {};
+  r.color = v3(texel.color[0], texel.color[1], texel.color[2]);
+  r.emission = v3(texel.emission[0], texel.emission[1], texel.emission[2]);
+  r.throughput = v3(texel.throughput[0], texel.throughput[1], texel.throughput[2]);
+  return r;
+}
+
+// Port of shaders/radiance-cascades-merge.comp, in the same block order: each task
+// merges a 2x2x2 block of lower probes, interpolating between the reduced upper probes
+// RadianceCascadesCPUReduceLevel left in cpu.reduced. The shader stages the block's
+// 3x3x3 upper probes in shared memory, here the 8 corners are read directly.
+static void
+RadianceCascadesCPUMergeLevel(RadianceCascadesCPU &cpu,
+                              i32 lowerLevel,
+                              const RadianceCascadesProbeBox &box,
+                              RadianceCascadesStageCounters &counters) {
+  using namespace RadianceCascadesKernels;
+
+  const v3u32 blockDims = RadianceCascadesProbeBoxBlockDims(box);
+  const u32 blockCount = blockDims.x * blockDims.y * blockDims.z;
+  if (!blockCount) {
+    return;
+  }
+  counters = RadianceCascadesProbeTileCounters(
+    RadianceCascadesProbeBoxCount(box),
+    RadianceCascadesLevelProbeDiameter(cpu.config, lowerLevel),
+    sizeof(PackedTexel));
+
+  const PackedTexel *lowerAtlas = RadianceCascadesCPUUnmergedAtlas(cpu);
+  const i32 upperLevel = lowerLevel + 1;
+  const u32 lowerAtlasProbeDiameter = RadianceCascadesLevelProbeDiameter(cpu.config,
+                                                                         lowerLevel);
+  const u32 probeRayCount = lowerAtlasProbeDiameter * lowerAtlasProbeDiameter;
+  const v2u32 lowerStride = RadianceCascadesProbeTexelStride(cpu.config, lowerLevel);
+  // last valid upper probe, clamping to the diameter itself would read the next
+  // tile over which now belongs to another level
+  const v3u32 upperGridDims = RadianceCascadesLevelGridDims(cpu.config, upperLevel);
+  const v3 upperGridMax = v3(upperGridDims) - 1.0f;
+  // the top level has nothing above it to merge in
+  const bool hasUpper = upperGridDims.x && upperGridDims.y && upperGridDims.z;
+  const u32 *lowerValidity =
+    cpu.probeValidity + RadianceCascadesProbeValidityWordOffset(cpu.layout, lowerLevel);
+  const u32 *upperValidity =
+    cpu.probeValidity + RadianceCascadesProbeValidityWordOffset(cpu.layout, upperLevel);
+  // upper probe positions are relative to the upper window
+  const v3 lowerScroll = v3(RadianceCascadesGetLevelScroll(cpu.config, lowerLevel));
+  const v3 upperScroll = v3(RadianceCascadesGetLevelScroll(cpu.config, upperLevel));
+  // upper probes are twice as far apart whatever the branching factor
+  auto upperIndex = [&](v3u32 gridPos) {
+    return (v3(gridPos) + lowerScroll + 0.5f) * 0.5f - 0.5f - upperScroll;
+  };
+
+  const u32 grain =
+    Max(1u, 1024u / (probeRayCount * RADIANCE_CASCADES_MERGE_BLOCK_PROBES));
+  RadianceCascadesCPUParallelFor(cpu, blockCount, grain, [&](u32 blockIndex) {
+      const v3u32 blockMin = RadianceCascadesProbeBoxBlockMin(box, blockIndex);
+
+      // lower probes of the block in morton order, the ones hanging over the box are
+      // skipped
+      for (u32 p = 0; p < RADIANCE_CASCADES_MERGE_BLOCK_PROBES; p++) {
+        const v3u32 gridPos = blockMin + MortonDecode(p);
+        if (gridPos.x >= box.max.x || gridPos.y >= box.max.y || gridPos.z >= box.max.z) {
+          continue;
+        }
+        const u32 probeIndex =
+          RadianceCascadesProbeIndex(cpu.config, gridPos, lowerLevel);
+        const u32 slot = RadianceCascadesCPUProbeSlot(cpu, probeIndex, lowerLevel);
+        if (slot == RADIANCE_CASCADES_SPARSE_BRICK_EMPTY) {
+          continue;
+        }
+        const v3u32 probeOrigin =
+          RadianceCascadesProbeAtlasOrigin(cpu.config, slot, lowerLevel);
+
+        // the upper probes' reduced directions, in the same order as the probe's rays,
+        // null for the ones without storage. An invalid lower probe has no throughput
+        // left to take any of them in with.
+        const RadianceCascadesReducedTexel *corners[8] = {};
+        v3 weight = v3(0.0f);
+        u32 validMask = 0;
+        const bool mergeUpper =
+          hasUpper && RadianceCascadesProbeValid(lowerValidity, probeIndex);
+        if (mergeUpper) {
+          const v3 index = upperIndex(gridPos);
+          const v3 upperProbeGridPos = Clamp(Floor(index), v3(0.0f), upperGridMax);
+          weight = Fract(index);
+          for (u32 corner = 0; corner < 8; corner++) {
+            const v3u32 upperPos = v3u32(
+              Min(upperProbeGridPos + v3(MortonDecode(corner)), upperGridMax));
+            const u32 upperProbeIndex = RadianceCascadesProbeIndex(
+              cpu.config, upperPos, upperLevel);
+            const u32 upperSlot =
+              RadianceCascadesCPUProbeSlot(cpu, upperProbeIndex, upperLevel);
+            if (upperSlot != RADIANCE_CASCADES_SPARSE_BRICK_EMPTY) {
+              corners[corner] = cpu.reduced + u64(upperSlot) * probeRayCount;
+            }
+            if (RadianceCascadesProbeValid(upperValidity, upperProbeIndex)) {
+              validMask |= 1u << corner;
+            }
+          }
+        }
+
+        for (u32 probeRayIndex = 0; probeRayIndex < probeRayCount; probeRayIndex++) {
+          const v2u32 probeTexel = v2u32(probeRayIndex % lowerAtlasProbeDiameter,
+                                         probeRayIndex / lowerAtlasProbeDiameter);
+
+          MapResult upperSample = {};
+          if (mergeUpper) {
+            MapResult c[8] = {};
+            for (u32 corner = 0; corner < 8; corner++) {
+              if (corners[corner]) {
+                c[corner] =
+                  RadianceCascadesCPUReducedMapResult(corners[corner][probeRayIndex]);
+              }
+            }
+            // upper probes inside solid geometry hold nothing, interpolate between the
+            // others
+            upperSample = Lerp3DValid(c, weight, validMask);
+          }
+
+          const v3u32 src = RadianceCascadesProbeTexelAtlasCoord(
+            probeOrigin,
+            lowerStride,
+            probeTexel.x + OCTAPROBE_PADDING,
+            probeTexel.y + OCTAPROBE_PADDING);
+          const PackedTexel &lowerTexel =
+            RadianceCascadesCPUTexel(cpu, (PackedTexel *)lowerAtlas, src.x, src.y, src.z);
+          MapResult lowerSample = UnpackMapResult(lowerTexel);
+
+          MapResult result = {};
+          result.color = lowerSample.color + upperSample.color * lowerSample.throughput;
+          result.emission = lowerSample.emission +
+                            upperSample.emission * lowerSample.throughput;
+          result.throughput = lowerSample.throughput * upperSample.throughput;
+          RadianceCascadesCPUStoreProbeTexel(cpu,
+                                             cpu.atlas,
+                                             probeOrigin,
+                                             lowerStride,
+                                             probeTexel.x,
+                                             probeTexel.y,
+                                             lowerAtlasProbeDiameter,
+                                             PackMapResult(result));
+        }
+      }
+    });
+}
+
+// Projects the merged radiance of the level 0 probes in box onto L1 spherical harmonics,
+// port of shaders/radiance-cascades-irradiance.comp. With the texel weights normalized
+// to sum to one the clamped cosine convolution folds down to
+//   ambient = sum(w * L), xyz = 2 * sum(w * L * dir)
+static void
+RadianceCascadesCPUIntegrateIrradiance(RadianceCascadesCPU &cpu,
+                                       const RadianceCascadesProbeBox &box,
+                                       RadianceCascadesStageCounters &counters) {
+  using namespace RadianceCascadesKernels;
+
+  const u32 boxProbeCount = RadianceCascadesProbeBoxCount(box);
+  if (!boxProbeCount) {
+    return;
+  }
+
+  const u32 atlasProbeDiameter = RadianceCascadesLevelProbeDiameter(cpu.config, 0);
+  const v2u32 stride = RadianceCascadesProbeTexelStride(cpu.config, 0);
+  const u32 probeRayCount = atlasProbeDiameter * atlasProbeDiameter;
+  counters = RadianceCascadesIrradianceCounters(boxProbeCount, atlasProbeDiameter);
+
+  // (w, 2 w dir) per texel, the same for every probe
+  f32 *basis = (f32 *)malloc(u64(probeRayCount) * 4 * sizeof(f32));
+  f32 weightSum = 0.0f;
+  for (u32 probeRayIndex = 0; probeRayIndex < probeRayCount; probeRayIndex++) {
+    const v2 probeTexel = v2(f32(probeRayIndex % atlasProbeDiameter),
+                             f32(probeRayIndex / atlasProbeDiameter));
+    const v3 dir = OctahedralDecode((probeTexel + 0.5f) / f32(atlasProbeDiameter));
+    const f32 w = OctahedralTexelWeight(dir);
+    basis[probeRayIndex * 4 + 0] = w;
+    basis[probeRayIndex * 4 + 1] = 2.0f * w * dir.x;
+    basis[probeRayIndex * 4 + 2] = 2.0f * w * dir.y;
+    basis[probeRayIndex * 4 + 3] = 2.0f * w * dir.z;
+    weightSum += w;
+  }
+  for (u32 i = 0; i < probeRayCount * 4; i++) {
+    basis[i] /= weightSum;
+  }
+
+  const u32 grain = Max(1u, 1024u / probeRayCount);
+  RadianceCascadesCPUParallelFor(cpu, boxProbeCount, grain, [&](u32 boxIndex) {
+      const v3u32 gridPos = RadianceCascadesProbeBoxGridPos(box, boxIndex);
+      const u32 probeIndex = RadianceCascadesProbeIndex(cpu.config, gridPos, 0);
+      const u32 slot = RadianceCascadesCPUProbeSlot(cpu, probeIndex, 0);
+      if (slot == RADIANCE_CASCADES_SPARSE_BRICK_EMPTY) {
+        return;
+      }
+      const v3u32 probeOrigin = RadianceCascadesProbeAtlasOrigin(cpu.config, slot, 0);
+
+      RadianceCascadesIrradianceProbe probe = {};
+      for (u32 probeRayIndex = 0; probeRayIndex < probeRayCount; probeRayIndex++) {
+        const v3u32 src = RadianceCascadesProbeTexelAtlasCoord(
+          probeOrigin,
+          stride,
+          probeRayIndex % atlasProbeDiameter + OCTAPROBE_PADDING,
+          probeRayIndex / atlasProbeDiameter + OCTAPROBE_PADDING);
+        const v3 L = UnpackMapResult(
+                       RadianceCascadesCPUTexel(cpu, cpu.atlas, src.x, src.y, src.z))
+                       .emission;
+        const f32 *b = basis + probeRayIndex * 4;
+        for (u32 i = 0; i < 4; i++) {
+          probe.r[i] += L.x * b[i];
+          probe.g[i] += L.y * b[i];
+          probe.b[i] += L.z * b[i];
+        }
+      }
+      cpu.irradiance[slot] = probe;
+    });
+
+  free(basis);
+}
+
+// Runs fn(counters) and reports its wall time through cpu.onStage, and its wall time and
+// counters through cpu.stats. Stages can run at the same time, the reports are made
+// under the task pool's lock.
+template <typename Fn>
+static void
+RadianceCascadesCPUStage(RadianceCascadesCPU &cpu,
+                         RadianceCascadesStage stage,
+                         i32 level,
+                         const Fn &fn) {
+  RadianceCascadesStageCounters counters = {};
+  if (!cpu.onStage && !cpu.stats) {
+    fn(counters);
+    return;
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  fn(counters);
+  auto end = std::chrono::steady_clock::now();
+  const f64 milliseconds = std::chrono::duration<f64, std::milli>(end - start).count();
+
+  std::unique_lock<std::mutex> lock;
+  if (cpu.tasks) {
+    lock = std::unique_lock<std::mutex>(cpu.tasks->mutex);
+  }
+  if (cpu.onStage) {
+    cpu.onStage(cpu.onStageUser, stage, level, milliseconds);
+  }
+  // stages with nothing to do in this plan are left out
+  if (cpu.stats && counters.probes) {
+    RadianceCascadesStatsPush(*cpu.stats,
+                              {.frame = cpu.stats->frame,
+                               .stage = stage,
+                               .level = level,
+                               .clock = RadianceCascadesStatsClock_CPU,
+                               .milliseconds = milliseconds,
+                               .counters = counters});
+  }
+}
+
+// Zero a level's block of the atlas
+static void
+RadianceCascadesCPUClearLevel(RadianceCascadesCPU &cpu,
+                              RadianceCascadesKernels::PackedTexel *atlas,
+                              i32 level) {
+  const RadianceCascadesLevelRect &rect = cpu.config.levels[level];
+  const v2u32 extent = RadianceCascadesLevelExtent(cpu.config, cpu.layout, level);
+  for (u32 y = 0; y < extent.y; y++) {
+    memset(&RadianceCascadesCPUTexel(cpu, atlas, rect.x, rect.y + y, rect.layer),
+           0,
+           u64(extent.x) * sizeof(RadianceCascadesKernels::PackedTexel));
+  }
+}
+
+// Executes an update plan, the same sequence RadianceCascadesTick dispatches on GL
+static void
+RadianceCascadesCPUUpdate(RadianceCascadesCPU &cpu,
+                          const RadianceCascadesUpdatePlan &plan) {
+  if (plan.full) {
+    memset(cpu.atlas, 0, cpu.atlasByteSize);
+    if (cpu.atlasOriginal) {
+      memset(cpu.atlasOriginal, 0, cpu.atlasByteSize);
+    }
+  }
+  for (i32 level = 0; level < i32(cpu.layout.totalLevels); level++) {
+    if (plan.full || !(plan.clearLevels & (1u << level))) {
+      continue;
+    }
+    RadianceCascadesCPUClearLevel(cpu, cpu.atlas, level);
+    if (cpu.atlasOriginal) {
+      RadianceCascadesCPUClearLevel(cpu, cpu.atlasOriginal, level);
+    }
+  }
+
+  // Build every level, merge down once a level is built and the one above it is merged
+  // and reduced, then pre-integrate what the final gather reads. The build and merge
+  // write the octahedral borders themselves. cpu.reduced holds one level at a time,
+  // each reduce waits on the merge that read the previous one.
+  RadianceCascadesCPUTaskGraph graph = {};
+  u32 buildTasks[RADIANCE_CASCADES_MAX_LEVELS];
+  u32 mergeTasks[RADIANCE_CASCADES_MAX_LEVELS];
+  for (i32 level = plan.buildMaxLevel; level >= 0; level--) {
+    buildTasks[level] =
+      RadianceCascadesCPUTaskGraphAdd(graph, RadianceCascadesStage_Build, level);
+  }
+  for (i32 level = plan.mergeMaxLevel; level >= 0; level--) {
+    // reduces level + 1 for this merge, the top level has nothing above it
+    const bool hasUpper = level + 1 < i32(cpu.layout.totalLevels);
+    u32 reduceTask = 0;
+    if (hasUpper) {
+      reduceTask =
+        RadianceCascadesCPUTaskGraphAdd(graph, RadianceCascadesStage_Reduce, level + 1);
+      if (level < plan.mergeMaxLevel) {
+        RadianceCascadesCPUTaskGraphDepend(graph, reduceTask, mergeTasks[level + 1]);
+      }
+    }
+    mergeTasks[level] =
+      RadianceCascadesCPUTaskGraphAdd(graph, RadianceCascadesStage_Merge, level);
+    if (level <= plan.buildMaxLevel) {
+      RadianceCascadesCPUTaskGraphDepend(graph, mergeTasks[level], buildTasks[level]);
+    }
+    if (hasUpper) {
+      RadianceCascadesCPUTaskGraphDepend(graph, mergeTasks[level], reduceTask);
+    }
+  }
+  const u32 irradianceTask =
+    RadianceCascadesCPUTaskGraphAdd(graph, RadianceCascadesStage_Irradiance, 0);
+  if (plan.mergeMaxLevel >= 0) {
+    RadianceCascadesCPUTaskGraphDepend(graph, irradianceTask, mergeTasks[0]);
+  } else if (plan.buildMaxLevel >= 0) {
+    RadianceCascadesCPUTaskGraphDepend(graph, irradianceTask, buildTasks[0]);
+  }
+  // the order the tasks were added in is every build, then the reduces and merges from
+  // the top down, then the irradiance
+  if (cpu.serialStages) {
+    for (u32 task = 1; task < graph.taskCount; task++) {
+      RadianceCascadesCPUTaskGraphDepend(graph, task, task - 1);
+    }
+  }
+
+  RadianceCascadesCPUTaskPool pool;
+  cpu.tasks = &pool;
+  auto runTask = [&](const RadianceCascadesCPUTask &task) {
+    auto run = [&](RadianceCascadesStageCounters &c) {
+      switch (task.stage) {
+        case RadianceCascadesStage_Build:
+          RadianceCascadesCPUBuildLevel(cpu, plan, task.level, c);
+          break;
+        case RadianceCascadesStage_Merge:
+          RadianceCascadesCPUMergeLevel(cpu, task.level, plan.merge[task.level], c);
+          break;
+        case RadianceCascadesStage_Reduce:
+          RadianceCascadesCPUReduceLevel(
+            cpu, task.level - 1, plan.merge[task.level - 1], c);
+          break;
+        default: RadianceCascadesCPUIntegrateIrradiance(cpu, plan.merge[0], c); break;
+      }
+    };
+    RadianceCascadesCPUStage(cpu, task.stage, task.level, run);
+  };
+  RadianceCascadesCPUTaskGraphRun(
+    graph, pool, RadianceCascadesCPUThreadCount(cpu), runTask);
+  cpu.tasks = nullptr;
+}
+
+// Full rebuild, sparse storage places its bricks first
+static void
+RadianceCascadesCPUBake(RadianceCascadesCPU &cpu) {
+  if (cpu.sparseBricks) {
+    RadianceCascadesCPUAllocateSparseBricks(cpu, RadianceCascadesCPUThreadCount(cpu));
+  }
+  RadianceCascadesUpdatePlan plan;
+  RadianceCascadesPlanFull(plan, cpu.config, cpu.layout);
+  RadianceCascadesCPUUpdate(cpu, plan);
+}
+
+// Re-trace and re-merge only what the world space box can affect. Needs the unmerged
+// atlas to re-merge from, and with sparse storage the same bricks, without them this
+// falls back to a full rebuild.
+static void
+RadianceCascadesCPUInvalidate(RadianceCascadesCPU &cpu, v3 regionMin, v3 regionMax) {
+  if (!cpu.atlasOriginal ||
+      (cpu.sparseBricks &&
+       RadianceCascadesSparseBricksStale(cpu.config,
+                                         cpu.layout,
+                                         RadianceCascadesCPUThreadCount(cpu),
+                                         cpu.sparseBricks))) {
+    RadianceCascadesCPUBake(cpu);
+    return;
+  }
+
+  RadianceCascadesUpdatePlan plan;
+  RadianceCascadesPlanRegion(plan, cpu.config, cpu.layout, regionMin, regionMax);
+  RadianceCascadesCPUUpdate(cpu, plan);
+}
+
+// Switch to config, re-tracing and re-merging only the levels the change reaches when
+// the atlas layout stays the same, see RadianceCascadesDiffConfig. Returns false on
+// allocation failure.
+static bool
+RadianceCascadesCPUReconfigure(RadianceCascadesCPU &cpu,
+                               const RadianceCascadesConfig &config) {
+  const RadianceCascadesConfig previous = cpu.config;
+  const bool hadAtlas = cpu.atlas != nullptr;
+  const bool hadOriginal = cpu.atlasOriginal != nullptr;
+  if (!RadianceCascadesCPUInit(cpu, config)) {
+    return false;
+  }
+
+  RadianceCascadesStaleLevels stale = {};
+  if (!hadAtlas || (cpu.atlasOriginal && !hadOriginal) ||
+      !RadianceCascadesDiffConfig(previous, cpu.config, cpu.layout, stale)) {
+    RadianceCascadesCPUBake(cpu);
+    return true;
+  }
+  if (RadianceCascadesStaleLevelsEmpty(stale)) {
+    return true;
+  }
+  // e.g. a new probe spacing moves the surfaces to other bricks
+  if (cpu.sparseBricks &&
+      RadianceCascadesSparseBricksStale(
+        cpu.config, cpu.layout, RadianceCascadesCPUThreadCount(cpu), cpu.sparseBricks)) {
+    RadianceCascadesCPUBake(cpu);
+    return true;
+  }
+
+  RadianceCascadesUpdatePlan plan;
+  RadianceCascadesPlanStale(plan, cpu.config, cpu.layout, stale, !cpu.atlasOriginal);
+  RadianceCascadesCPUUpdate(cpu, plan);
+  return true;
+}
@@ -0,0 +1,229 @@
+#pragma once
+
+#include <engine/linalg.h>
+#include <hotcart/types.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "shared.h"
+
+// Sparse cache of the scene distance field so the build can step through empty space
+// without evaluating map(). The cached volume is split into bricks, bricks within
+// reach of a surface get RADIANCE_CASCADES_DISTANCE_BRICK_SAMPLES^3 corner samples and
+// every other brick only keeps the distance at its center. Near surfaces the build
+// still evaluates map(), so hits and materials are exactly what the uncached march
+// finds. Nothing in here touches GL, the bake lives in cpu.h and the GL upload in
+// radiance-cascades.h.
+
+// One texel of the GL_RG32UI indirection texture
+struct RadianceCascadesDistanceBrick {
+  // slot + 1 of the brick's samples, 0 for bricks away from any surface
+  u32 slot;
+  f32 centerDistance;
+};
+
+struct RadianceCascadesDistanceBricks {
+  RadianceCascadesDistanceBricksInfo info;
+
+  // brickDimX * brickDimY * brickDimZ, x fastest
+  RadianceCascadesDistanceBrick *bricks;
+
+  // RADIANCE_CASCADES_DISTANCE_BRICK_SAMPLES^3 distances per slot, x fastest
+  f32 *samples;
+  u32 slotCapacity;
+  // slots handed out so far, freed ones are reused first
+  u32 slotCount;
+  u32 *freeSlots;
+  u32 freeSlotCount;
+
+  // set by the bake, cleared by whoever uploads the cache
+  u8 *dirtySlots;
+  bool dirty;
+};
+
+#define RADIANCE_CASCADES_DISTANCE_BRICK_SAMPLE_COUNT                             \
+  (RADIANCE_CASCADES_DISTANCE_BRICK_SAMPLES * RADIANCE_CASCADES_DISTANCE_BRICK_SAMPLES * \
+   RADIANCE_CASCADES_DISTANCE_BRICK_SAMPLES)
+
+static void
+RadianceCascadesDistanceBricksFree(RadianceCascadesDistanceBricks &bricks) {
+  free(bricks.bricks);
+  free(bricks.samples);
+  free(bricks.freeSlots);
+  free(bricks.dirtySlots);
+  bricks = {};
+}
+
+inline u32
+RadianceCascadesDistanceBrickCount(const RadianceCascadesDistanceBricksInfo &info) {
+  return info.brickDimX * info.brickDimY * info.brickDimZ;
+}
+
+inline f32
+RadianceCascadesDistanceBrickDiameter(const RadianceCascadesDistanceBricksInfo &info) {
+  return info.voxelSize * f32(RADIANCE_CASCADES_DISTANCE_BRICK_CELLS);
+}
+
+inline v3
+RadianceCascadesDistanceBricksOrigin(const RadianceCascadesDistanceBricksInfo &info) {
+  return v3(info.originX, info.originY, info.originZ);
+}
+
+inline v3u32
+RadianceCascadesDistanceBrickPos(const RadianceCascadesDistanceBricksInfo &info,
+                                 u32 brickIndex) {
+  return v3u32(brickIndex % info.brickDimX,
+               (brickIndex / info.brickDimX) % info.brickDimY,
+               brickIndex / (info.brickDimX * info.brickDimY));
+}
+
+// World space position of a brick's corner sample
+inline v3
+RadianceCascadesDistanceBrickSamplePos(const RadianceCascadesDistanceBricksInfo &info,
+                                       v3u32 brick,
+                                       v3u32 sample) {
+  return RadianceCascadesDistanceBricksOrigin(info) +
+         (v3(brick) * f32(RADIANCE_CASCADES_DISTANCE_BRICK_CELLS) + v3(sample)) *
+           info.voxelSize;
+}
+
+inline v3
+RadianceCascadesDistanceBrickCenter(const RadianceCascadesDistanceBricksInfo &info,
+                                    v3u32 brick) {
+  return RadianceCascadesDistanceBricksOrigin(info) +
+         (v3(brick) + 0.5f) * RadianceCascadesDistanceBrickDiameter(info);
+}
+
+// Cover [aabbMin, aabbMax] with bricks of voxelSize voxels. Everything starts out
+// unbaked (zero center distances), which makes every lookup fall back to map() until
+// RadianceCascadesCPUBakeDistanceBricks runs.
+static bool
+RadianceCascadesDistanceBricksInit(RadianceCascadesDistanceBricks &bricks,
+                                   v3 aabbMin,
+                                   v3 aabbMax,
+                                   f32 voxelSize) {
+  RadianceCascadesDistanceBricksFree(bricks);
+  const f32 brickDiameter = voxelSize * f32(RADIANCE_CASCADES_DISTANCE_BRICK_CELLS);
+  const v3 size = aabbMax - aabbMin;
+  bricks.info.originX = aabbMin.x;
+  bricks.info.originY = aabbMin.y;
+  bricks.info.originZ = aabbMin.z;
+  bricks.info.voxelSize = voxelSize;
+  bricks.info.brickDimX = Max(1u, u32(ceilf(size.x / brickDiameter)));
+  bricks.info.brickDimY = Max(1u, u32(ceilf(size.y / brickDiameter)));
+  bricks.info.brickDimZ = Max(1u, u32(ceilf(size.z / brickDiameter)));
+
+  bricks.bricks = (RadianceCascadesDistanceBrick *)calloc(
+    RadianceCascadesDistanceBrickCount(bricks.info),
+    sizeof(RadianceCascadesDistanceBrick));
+  if (!bricks.bricks) {
+    printf("RadianceCascadesDistanceBricksInit: failed to allocate %u bricks\n",
+           RadianceCascadesDistanceBrickCount(bricks.info));
+    RadianceCascadesDistanceBricksFree(bricks);
+    return false;
+  }
+  bricks.info.enabled = 1;
+  bricks.dirty = true;
+  return true;
+}
+
+// Returns slot + 1, or 0 when the sample storage could not grow
+static u32
+RadianceCascadesDistanceBricksAllocSlot(RadianceCascadesDistanceBricks &bricks) {
+  if (bricks.freeSlotCount) {
+    return bricks.freeSlots[--bricks.freeSlotCount] + 1;
+  }
+
+  if (bricks.slotCount == bricks.slotCapacity) {
+    const u32 capacity = Max(bricks.slotCapacity * 2u,
+                             u32(RADIANCE_CASCADES_DISTANCE_BRICK_ATLAS_BRICKS *
+                                 RADIANCE_CASCADES_DISTANCE_BRICK_ATLAS_BRICKS));
+    f32 *samples = (f32 *)realloc(bricks.samples,
+                                  u64(capacity) *
+                                    RADIANCE_CASCADES_DISTANCE_BRICK_SAMPLE_COUNT *
+                                    sizeof(f32));
+    if (!samples) {
+      return 0;
+    }
+    bricks.samples = samples;
+
+    u32 *freeSlots = (u32 *)realloc(bricks.freeSlots, u64(capacity) * sizeof(u32));
+    u8 *dirtySlots = (u8 *)realloc(bricks.dirtySlots, capacity);
+    if (freeSlots) {
+      bricks.freeSlots = freeSlots;
+    }
+    if (dirtySlots) {
+      bricks.dirtySlots = dirtySlots;
+    }
+    if (!freeSlots || !dirtySlots) {
+      return 0;
+    }
+    memset(bricks.dirtySlots + bricks.slotCapacity, 0, capacity - bricks.slotCapacity);
+    bricks.slotCapacity = capacity;
+  }
+  return ++bricks.slotCount;
+}
+
+inline void
+RadianceCascadesDistanceBricksFreeSlot(RadianceCascadesDistanceBricks &bricks, u32 slot) {
+  bricks.freeSlots[bricks.freeSlotCount++] = slot - 1;
+}
+
+inline f32 *
+RadianceCascadesDistanceBrickSamples(const RadianceCascadesDistanceBricks &bricks,
+                                     u32 slot) {
+  return bricks.samples + u64(slot - 1) * RADIANCE_CASCADES_DISTANCE_BRICK_SAMPLE_COUNT;
+}
+
+// Distance the march can safely step from pos, or 0 when pos is close to a surface or
+// outside the cache and map() has to be evaluated. Matches DistanceBricksBound in
+// shaders/distance-bricks.glsl.
+inline f32
+RadianceCascadesDistanceBricksBound(const RadianceCascadesDistanceBricks &bricks,
+                                    v3 pos) {
+  const RadianceCascadesDistanceBricksInfo &info = bricks.info;
+  if (!info.enabled) {
+    return 0.0f;
+  }
+
+  const f32 cells = f32(RADIANCE_CASCADES_DISTANCE_BRICK_CELLS);
+  const v3 cellPos = (pos - RadianceCascadesDistanceBricksOrigin(info)) / info.voxelSize;
+  const v3 brickPos = cellPos / cells;
+  if (brickPos.x < 0.0f || brickPos.y < 0.0f || brickPos.z < 0.0f ||
+      brickPos.x >= f32(info.brickDimX) || brickPos.y >= f32(info.brickDimY) ||
+      brickPos.z >= f32(info.brickDimZ)) {
+    return 0.0f;
+  }
+
+  const v3u32 brick = Min(
+    v3u32(brickPos),
+    v3u32(info.brickDimX - 1, info.brickDimY - 1, info.brickDimZ - 1));
+  const RadianceCascadesDistanceBrick &entry =
+    bricks.bricks[brick.x + info.brickDimX * (brick.y + info.brickDimY * brick.z)];
+
+  f32 d;
+  if (!entry.slot) {
+    // the distance field is 1-Lipschitz
+    const v3 center = RadianceCascadesDistanceBrickCenter(info, brick);
+    d = entry.centerDistance - Length(pos - center);
+  } else {
+    const u32 S = RADIANCE_CASCADES_DISTANCE_BRICK_SAMPLES;
+    const v3 local = Clamp(cellPos - v3(brick) * cells, v3(0.0f), v3(cells));
+    const v3u32 c = Min(v3u32(local), v3u32(RADIANCE_CASCADES_DISTANCE_BRICK_CELLS - 1));
+    const v3 t = local - v3(c);
+    const f32 *s = RadianceCascadesDistanceBrickSamples(bricks, entry.slot) + c.x +
+                   S * (c.y + S * c.z);
+
+    const f32 d00 = s[0] + (s[1] - s[0]) * t.x;
+    const f32 d10 = s[S] + (s[S + 1] - s[S]) * t.x;
+    const f32 d01 = s[S * S] + (s[S * S + 1] - s[S * S]) * t.x;
+    const f32 d11 = s[S * S + S] + (s[S * S + S + 1] - s[S * S + S]) * t.x;
+    const f32 d0 = d00 + (d10 - d00) * t.y;
+    const f32 d1 = d01 + (d11 - d01) * t.y;
+    // trilinear filtering is off by at most half a voxel diagonal
+    d = d0 + (d1 - d0) * t.z - info.voxelSize;
+  }
+
+  return d >= info.voxelSize ? d : 0.0f;
+}
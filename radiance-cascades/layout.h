@@ -0,0 +1,569 @@
+#pragma once
+
+#include <engine/gpu/morton.h>
+#include <engine/linalg.h>
+#include <hotcart/types.h>
+
+#include "shared.h"
+
+// Atlas sizing shared by the GL and CPU backends. Nothing in here touches GL so
+// it can be used by headless tools.
+struct RadianceCascadesLayout {
+  u32 cascade0ProbeCount;
+  // config grid dims rounded up to powers of two
+  v3u32 gridDims;
+  u32 totalLevels;
+  // bytes per GL atlas texel, depends on config.atlasFormat
+  u32 texelByteSize;
+
+  u32 atlasWidth;
+  u32 atlasHeight;
+  u32 atlasLayers;
+  RadianceCascadesLevelRect levels[RADIANCE_CASCADES_MAX_LEVELS];
+  // words of the sparse brick table, 0 for dense storage
+  u32 sparseBrickTableSize;
+  // config.branchingFactor lowered until every level fits in an atlas layer, see
+  // RadianceCascadesFitBranchingFactor
+  u32 branchingFactor;
+};
+
+// Guaranteed minimum GL_MAX_TEXTURE_SIZE for GL 4.5, the packer starts a new layer
+// instead of growing past it
+#define RADIANCE_CASCADES_MAX_ATLAS_DIAMETER 16384
+
+inline u32
+RadianceCascadesAtlasTexelByteSize(const RadianceCascadesConfig &config) {
+  return config.atlasFormat == RADIANCE_CASCADES_ATLAS_FORMAT_COMPACT ? 8 : 16;
+}
+
+inline v3u32
+RadianceCascadesGridDims(const RadianceCascadesConfig &config) {
+  return v3u32(config.gridDimX, config.gridDimY, config.gridDimZ);
+}
+
+inline v3u32
+RadianceCascadesLevelGridDims(const RadianceCascadesConfig &config, i32 level) {
+  if (level >= 32) {
+    return v3u32(0);
+  }
+  return v3u32(config.gridDimX >> level,
+               config.gridDimY >> level,
+               config.gridDimZ >> level);
+}
+
+// Side of the cubic bricks a level's grid is split into. A cubic grid is a single brick
+// so the probe index is plain morton order.
+inline u32
+RadianceCascadesLevelBrickDiameter(const RadianceCascadesConfig &config, i32 level) {
+  v3u32 dims = RadianceCascadesLevelGridDims(config, level);
+  return Min(Min(dims.x, dims.y), dims.z);
+}
+
+inline v3i32
+RadianceCascadesGetLevelScroll(const RadianceCascadesConfig &config, i32 level) {
+  const RadianceCascadesLevelScroll &scroll = config.scroll[level];
+  return v3i32(scroll.x, scroll.y, scroll.z);
+}
+
+// World space center of a probe in the level's (scrolled) window
+inline v3
+RadianceCascadesProbeCenter(const RadianceCascadesConfig &config,
+                            v3u32 gridPos,
+                            i32 level) {
+  const v3 gridRadius = v3(RadianceCascadesLevelGridDims(config, level)) * 0.5f;
+  const f32 cellDiameter = config.scale * f32(1 << level);
+  const v3 cellPos = v3(gridPos) + v3(RadianceCascadesGetLevelScroll(config, level));
+  return ((cellPos + 0.5f) * cellDiameter) - gridRadius * cellDiameter;
+}
+
+// Position of a probe in the level's atlas block: the window position is wrapped by the
+// level's scroll, then bricks in x, y, z order, morton order inside a brick. Dense in
+// [0, probe count) for power of two dims.
+inline u32
+RadianceCascadesProbeIndex(const RadianceCascadesConfig &config,
+                           v3u32 gridPos,
+                           i32 level) {
+  const u32 brickDiameter = RadianceCascadesLevelBrickDiameter(config, level);
+  const v3u32 dims = RadianceCascadesLevelGridDims(config, level);
+  const RadianceCascadesLevelScroll &scroll = config.scroll[level];
+  gridPos = v3u32((gridPos.x + u32(scroll.x)) & (dims.x - 1),
+                  (gridPos.y + u32(scroll.y)) & (dims.y - 1),
+                  (gridPos.z + u32(scroll.z)) & (dims.z - 1));
+
+  const v3u32 bricks = dims / brickDiameter;
+  const v3u32 brick = gridPos / brickDiameter;
+  const u32 brickIndex = brick.x + bricks.x * (brick.y + bricks.y * brick.z);
+  const u32 mask = brickDiameter - 1;
+  return brickIndex * brickDiameter * brickDiameter * brickDiameter +
+         MortonEncode(v3u32(gridPos.x & mask, gridPos.y & mask, gridPos.z & mask));
+}
+
+// Inverse of RadianceCascadesProbeIndex for an unscrolled window. Used to walk the
+// window in brick/morton order, which does not depend on the scroll.
+inline v3u32
+RadianceCascadesProbeGridPos(const RadianceCascadesConfig &config,
+                             u32 probeIndex,
+                             i32 level) {
+  const u32 brickDiameter = RadianceCascadesLevelBrickDiameter(config, level);
+  const u32 brickProbeCount = brickDiameter * brickDiameter * brickDiameter;
+  const v3u32 bricks = RadianceCascadesLevelGridDims(config, level) / brickDiameter;
+  const u32 brickIndex = probeIndex / brickProbeCount;
+  const v3u32 brick(brickIndex % bricks.x,
+                    (brickIndex / bricks.x) % bricks.y,
+                    brickIndex / (bricks.x * bricks.y));
+  return brick * brickDiameter + MortonDecode(probeIndex % brickProbeCount);
+}
+
+inline u32
+RadianceCascadesLevelProbeCount(const RadianceCascadesLayout &layout, i32 level) {
+  return layout.cascade0ProbeCount >> (level * 3);
+}
+
+inline u32
+RadianceCascadesBranchingFactor(const RadianceCascadesConfig &config) {
+  return Min(config.branchingFactor, u32(RADIANCE_CASCADES_MAX_BRANCHING_FACTOR));
+}
+
+inline u32
+RadianceCascadesLevelProbeDiameter(const RadianceCascadesConfig &config, i32 level) {
+  return config.atlasProbeDiameter << (level * RadianceCascadesBranchingFactor(config));
+}
+
+inline bool
+RadianceCascadesStorageSparse(const RadianceCascadesConfig &config) {
+  return config.storage == RADIANCE_CASCADES_STORAGE_SPARSE &&
+         config.atlasLayout == RADIANCE_CASCADES_ATLAS_LAYOUT_PROBE_MAJOR;
+}
+
+// Probes per sparse brick, the whole level when it has fewer than a brick's worth
+inline u32
+RadianceCascadesSparseBrickProbes(const RadianceCascadesLayout &layout, i32 level) {
+  return Min(u32(RADIANCE_CASCADES_SPARSE_BRICK_PROBES),
+             RadianceCascadesLevelProbeCount(layout, level));
+}
+
+inline u32
+RadianceCascadesSparseBrickCount(const RadianceCascadesLayout &layout, i32 level) {
+  const u32 brickProbes = RadianceCascadesSparseBrickProbes(layout, level);
+  return brickProbes ? RadianceCascadesLevelProbeCount(layout, level) / brickProbes : 0;
+}
+
+// First entry of a level in the sparse brick table, one per brick of every level.
+// Matches SparseBrickOffset in shaders/sparse-bricks.glsl.
+inline u32
+RadianceCascadesSparseBrickOffset(const RadianceCascadesLayout &layout, i32 level) {
+  u32 offset = 0;
+  for (i32 l = 0; l < level; l++) {
+    offset += RadianceCascadesSparseBrickCount(layout, l);
+  }
+  return offset;
+}
+
+// Atlas slots of a level, every brick gets one unless the config limits them
+inline u32
+RadianceCascadesSparseBrickCapacity(const RadianceCascadesConfig &config,
+                                    const RadianceCascadesLayout &layout,
+                                    i32 level) {
+  const u32 brickCount = RadianceCascadesSparseBrickCount(layout, level);
+  const u32 capacity = config.sparseBrickCapacity[level];
+  return capacity ? Min(capacity, brickCount) : brickCount;
+}
+
+// Probes with a tile in the atlas
+inline u32
+RadianceCascadesLevelStorageProbeCount(const RadianceCascadesConfig &config,
+                                       const RadianceCascadesLayout &layout,
+                                       i32 level) {
+  if (!RadianceCascadesStorageSparse(config)) {
+    return RadianceCascadesLevelProbeCount(layout, level);
+  }
+  return RadianceCascadesSparseBrickCapacity(config, layout, level) *
+         RadianceCascadesSparseBrickProbes(layout, level);
+}
+
+// One per level 0 probe with storage
+inline u32
+RadianceCascadesIrradianceProbeCount(const RadianceCascadesConfig &config,
+                                     const RadianceCascadesLayout &layout) {
+  return RadianceCascadesLevelStorageProbeCount(config, layout, 0);
+}
+
+// Where a probe's tile, reduced texels and irradiance live: its probe index for dense
+// storage (levelBricks is null), otherwise its offset in the slot its brick maps to.
+// RADIANCE_CASCADES_SPARSE_BRICK_EMPTY for a probe without storage.
+inline u32
+RadianceCascadesProbeSlot(const u32 *levelBricks, u32 brickProbes, u32 probeIndex) {
+  if (!levelBricks) {
+    return probeIndex;
+  }
+  const u32 slot = levelBricks[probeIndex / brickProbes];
+  return slot == RADIANCE_CASCADES_SPARSE_BRICK_EMPTY
+           ? RADIANCE_CASCADES_SPARSE_BRICK_EMPTY
+           : slot * brickProbes + probeIndex % brickProbes;
+}
+
+// Probe tiles along x and y of the rectangle the morton order of the stored probes
+// fills, 2:1 or 1:1 for a power of two count. Any other count is a run of power of
+// two blocks, largest first.
+inline v2u32
+RadianceCascadesLevelTileCount(const RadianceCascadesConfig &config,
+                               const RadianceCascadesLayout &layout,
+                               i32 level) {
+  const u32 probeCount = RadianceCascadesLevelStorageProbeCount(config, layout, level);
+  v2u32 tiles(0);
+  u32 first = 0;
+  for (i32 bit = 31; bit >= 0; bit--) {
+    const u32 blockSize = 1u << bit;
+    if (!(probeCount & blockSize)) {
+      continue;
+    }
+    tiles = Max(tiles, MortonDecode2D(first) + MortonDecode2D(blockSize - 1) + 1u);
+    first += blockSize;
+  }
+  return tiles;
+}
+
+// Direction-major layout: size of one direction's tile in texels, the level's z slices
+// are placed side by side the way RadianceCascadesLevelTileCount places probes
+inline v2u32
+RadianceCascadesDirectionTileExtent(v3u32 levelGridDims) {
+  const v2u32 slices = MortonDecode2D(levelGridDims.z - 1) + 1u;
+  return v2u32(levelGridDims.x * slices.x, levelGridDims.y * slices.y);
+}
+
+// Atlas step between neighboring texels of a probe's padded octahedral tile
+inline v2u32
+RadianceCascadesProbeTexelStride(const RadianceCascadesConfig &config, i32 level) {
+  if (config.atlasLayout == RADIANCE_CASCADES_ATLAS_LAYOUT_DIRECTION_MAJOR) {
+    return RadianceCascadesDirectionTileExtent(
+      RadianceCascadesLevelGridDims(config, level));
+  }
+  return v2u32(1);
+}
+
+// Size of a level's probe block in texels
+inline v2u32
+RadianceCascadesLevelExtent(const RadianceCascadesConfig &config,
+                            const RadianceCascadesLayout &layout,
+                            i32 level) {
+  const u32 ppd = OCTAPROBE_PADDED_DIAMETER(
+    RadianceCascadesLevelProbeDiameter(config, level));
+  if (config.atlasLayout == RADIANCE_CASCADES_ATLAS_LAYOUT_DIRECTION_MAJOR) {
+    // the config dims are not rounded up yet
+    const v3u32 dims = v3u32(layout.gridDims.x >> level,
+                             layout.gridDims.y >> level,
+                             layout.gridDims.z >> level);
+    return RadianceCascadesDirectionTileExtent(dims) * ppd;
+  }
+  return RadianceCascadesLevelTileCount(config, layout, level) * ppd;
+}
+
+// Largest branching factor up to maxFactor whose level blocks are each at most
+// RADIANCE_CASCADES_MAX_ATLAS_DIAMETER on a side. The packer moves whole levels to a new
+// layer, a single level wider or taller than that can't be allocated.
+static u32
+RadianceCascadesFitBranchingFactor(const RadianceCascadesConfig &config,
+                                   const RadianceCascadesLayout &layout,
+                                   u32 maxFactor) {
+  RadianceCascadesConfig sized = config;
+  sized.branchingFactor = Min(maxFactor, u32(RADIANCE_CASCADES_MAX_BRANCHING_FACTOR));
+  for (; sized.branchingFactor > 0; sized.branchingFactor--) {
+    bool fits = true;
+    for (u32 level = 0; level < layout.totalLevels && fits; level++) {
+      const v2u32 extent = RadianceCascadesLevelExtent(sized, layout, level);
+      fits = extent.x <= RADIANCE_CASCADES_MAX_ATLAS_DIAMETER &&
+             extent.y <= RADIANCE_CASCADES_MAX_ATLAS_DIAMETER;
+    }
+    if (fits) {
+      break;
+    }
+  }
+  return sized.branchingFactor;
+}
+
+static RadianceCascadesLayout
+RadianceCascadesComputeLayout(const RadianceCascadesConfig &requested) {
+  RadianceCascadesLayout layout = {};
+  // the levels are sized with the branching factor the layout settles on
+  RadianceCascadesConfig config = requested;
+  layout.gridDims = v3u32(NextPowerOfTwo(Max(config.gridDimX, 1u)),
+                          NextPowerOfTwo(Max(config.gridDimY, 1u)),
+                          NextPowerOfTwo(Max(config.gridDimZ, 1u)));
+  layout.cascade0ProbeCount = layout.gridDims.x * layout.gridDims.y * layout.gridDims.z;
+  layout.texelByteSize = RadianceCascadesAtlasTexelByteSize(config);
+
+  // Compute the total number of levels, a level needs at least one probe on every axis
+  const u32 minDim = Min(Min(layout.gridDims.x, layout.gridDims.y), layout.gridDims.z);
+  while (layout.totalLevels < RADIANCE_CASCADES_MAX_LEVELS &&
+         (minDim >> layout.totalLevels) > 0) {
+    layout.totalLevels++;
+  }
+  if (RadianceCascadesStorageSparse(config)) {
+    layout.sparseBrickTableSize =
+      RadianceCascadesSparseBrickOffset(layout, i32(layout.totalLevels));
+  }
+  layout.branchingFactor = RadianceCascadesFitBranchingFactor(
+    requested, layout, requested.branchingFactor);
+  config.branchingFactor = layout.branchingFactor;
+
+  // Shelf pack the level blocks, each level is about half the area of the one below
+  // so they end up in a column under level 0 instead of a layer each.
+  for (u32 level = 0; level < layout.totalLevels; level++) {
+    layout.atlasWidth = Max(layout.atlasWidth,
+                            RadianceCascadesLevelExtent(config, layout, level).x);
+  }
+
+  u32 x = 0;
+  u32 y = 0;
+  u32 shelfHeight = 0;
+  u32 layer = 0;
+  for (u32 level = 0; level < layout.totalLevels; level++) {
+    v2u32 extent = RadianceCascadesLevelExtent(config, layout, level);
+    if (x + extent.x > layout.atlasWidth) {
+      y += shelfHeight;
+      x = 0;
+      shelfHeight = 0;
+    }
+
+    if (y > 0 && y + extent.y > RADIANCE_CASCADES_MAX_ATLAS_DIAMETER) {
+      layer++;
+      x = 0;
+      y = 0;
+      shelfHeight = 0;
+    }
+
+    layout.levels[level] = {x, y, layer, 0};
+    layout.atlasHeight = Max(layout.atlasHeight, y + extent.y);
+    x += extent.x;
+    shelfHeight = Max(shelfHeight, extent.y);
+  }
+  layout.atlasLayers = layer + 1;
+  return layout;
+}
+
+// Copy the atlas placement into the config the shaders see
+inline void
+RadianceCascadesApplyLayout(RadianceCascadesConfig &config,
+                            const RadianceCascadesLayout &layout) {
+  config.gridDimX = layout.gridDims.x;
+  config.gridDimY = layout.gridDims.y;
+  config.gridDimZ = layout.gridDims.z;
+  config.atlasWidth = layout.atlasWidth;
+  config.atlasHeight = layout.atlasHeight;
+  config.atlasLayers = layout.atlasLayers;
+  config.branchingFactor = layout.branchingFactor;
+  for (u32 level = 0; level < RADIANCE_CASCADES_MAX_LEVELS; level++) {
+    config.levels[level] = layout.levels[level];
+  }
+}
+
+// Atlas texel (x, y, layer) of the padded corner of the tile in a storage slot, see
+// RadianceCascadesProbeSlot. Texel (x, y) of the padded tile is at
+// origin + (x, y) * RadianceCascadesProbeTexelStride.
+inline v3u32
+RadianceCascadesProbeAtlasOrigin(const RadianceCascadesConfig &config,
+                                 u32 slot,
+                                 i32 level) {
+  const RadianceCascadesLevelRect &rect = config.levels[level];
+  v2u32 offset;
+  if (config.atlasLayout == RADIANCE_CASCADES_ATLAS_LAYOUT_DIRECTION_MAJOR) {
+    // the probe's (wrapped) grid position inside the first direction's tile, storage is
+    // always dense
+    const v3u32 dims = RadianceCascadesLevelGridDims(config, level);
+    const v3u32 pos = RadianceCascadesProbeGridPos(config, slot, level);
+    const u32 slicesX = MortonDecode2D(dims.z - 1).x + 1;
+    offset = v2u32(pos.x + dims.x * (pos.z % slicesX),
+                   pos.y + dims.y * (pos.z / slicesX));
+  } else {
+    offset = MortonDecode2D(slot) *
+             u32(OCTAPROBE_PADDED_DIAMETER(
+               RadianceCascadesLevelProbeDiameter(config, level)));
+  }
+  return v3u32(rect.x + offset.x, rect.y + offset.y, rect.layer);
+}
+
+// Atlas texel of texel (x, y) of a probe's padded octahedral tile
+inline v3u32
+RadianceCascadesProbeTexelAtlasCoord(v3u32 probeOrigin, v2u32 stride, u32 x, u32 y) {
+  return v3u32(probeOrigin.x + x * stride.x, probeOrigin.y + y * stride.y, probeOrigin.z);
+}
+
+inline u64
+RadianceCascadesAtlasTexelCount(const RadianceCascadesLayout &layout) {
+  return u64(layout.atlasWidth) * u64(layout.atlasHeight) * u64(layout.atlasLayers);
+}
+
+// Size of a single GL atlas (all layers) in bytes
+inline u64
+RadianceCascadesAtlasByteSize(const RadianceCascadesLayout &layout) {
+  return RadianceCascadesAtlasTexelCount(layout) * layout.texelByteSize;
+}
+
+// Texels of the buffer the reduce pass filters an upper level into, one lower probe's
+// worth of directions per stored upper probe. Only the level being merged into is held
+// at a time so it is sized for the largest.
+inline u64
+RadianceCascadesReducedTexelCount(const RadianceCascadesConfig &config,
+                                  const RadianceCascadesLayout &layout) {
+  u64 count = 0;
+  for (i32 level = 1; level < i32(layout.totalLevels); level++) {
+    const u64 d = RadianceCascadesLevelProbeDiameter(config, level - 1);
+    const u64 probeCount = RadianceCascadesLevelStorageProbeCount(config, layout, level);
+    count = Max(count, probeCount * d * d);
+  }
+  return count;
+}
+
+// First word of a level's bits in the probe validity mask: one bit per probe in
+// RadianceCascadesProbeIndex order, each level starting on a new word. Matches
+// ProbeValidityWordOffset in shaders/probe-validity.glsl.
+inline u32
+RadianceCascadesProbeValidityWordOffset(const RadianceCascadesLayout &layout, i32 level) {
+  u32 offset = 0;
+  for (i32 l = 0; l < level; l++) {
+    offset += (RadianceCascadesLevelProbeCount(layout, l) + 31) / 32;
+  }
+  return offset;
+}
+
+inline u32
+RadianceCascadesProbeValidityWordCount(const RadianceCascadesLayout &layout) {
+  return RadianceCascadesProbeValidityWordOffset(layout, i32(layout.totalLevels));
+}
+
+// levelWords starts at the level's RadianceCascadesProbeValidityWordOffset
+inline bool
+RadianceCascadesProbeValid(const u32 *levelWords, u32 probeIndex) {
+  return (levelWords[probeIndex / 32] >> (probeIndex % 32)) & 1;
+}
+
+// After the sparse bricks were placed: probes without storage are invalid for good, the
+// merge and the gather interpolate around them like around probes inside geometry.
+// The others are valid until their next build classifies them.
+static void
+RadianceCascadesResetSparseProbeValidity(const RadianceCascadesLayout &layout,
+                                         const u32 *bricks,
+                                         u32 *probeValidity) {
+  for (i32 level = 0; level < i32(layout.totalLevels); level++) {
+    const u32 *levelBricks = bricks + RadianceCascadesSparseBrickOffset(layout, level);
+    u32 *levelWords =
+      probeValidity + RadianceCascadesProbeValidityWordOffset(layout, level);
+    // a brick is a whole number of words, or the level is a single brick in one word
+    const u32 brickWords = (RadianceCascadesSparseBrickProbes(layout, level) + 31) / 32;
+    const u32 brickCount = RadianceCascadesSparseBrickCount(layout, level);
+    for (u32 brick = 0; brick < brickCount; brick++) {
+      const u32 bits =
+        levelBricks[brick] == RADIANCE_CASCADES_SPARSE_BRICK_EMPTY ? 0u : ~0u;
+      for (u32 word = 0; word < brickWords; word++) {
+        levelWords[brick * brickWords + word] = bits;
+      }
+    }
+  }
+}
+
+// Raise the slot count of every sparse level that needed more bricks than it has, by an
+// eighth extra so a few scene edits fit without a new atlas, and size the levels left
+// at 0 to what they need. Slots are never given back, a config that only shrinks would
+// rebuild the atlas on every edit. Returns true when config changed.
+static bool
+RadianceCascadesFitSparseBrickCapacity(
+  RadianceCascadesConfig &config,
+  const RadianceCascadesLayout &layout,
+  const u32 neededBricks[RADIANCE_CASCADES_MAX_LEVELS]) {
+  bool changed = false;
+  for (i32 level = 0; level < i32(layout.totalLevels); level++) {
+    const u32 needed = neededBricks[level];
+    u32 &capacity = config.sparseBrickCapacity[level];
+    if (capacity && capacity >= needed) {
+      continue;
+    }
+    const u32 fitted = Min(Max(needed + needed / 8, 1u),
+                           RadianceCascadesSparseBrickCount(layout, level));
+    changed |= fitted != capacity;
+    capacity = fitted;
+  }
+  return changed;
+}
+
+// Interval a level's rays cover, [4^(level - 1), 4^level] * rayLength. The 4x growth
+// follows the probe spacing doubling every level and doesn't depend on
+// config.branchingFactor, that only trades angular resolution per level.
+inline v2
+RadianceCascadesLevelRayRange(const RadianceCascadesConfig &config, i32 level) {
+  u32 scalingFactor = 2;
+  return v2(level == 0 ? 0 : f32(1 << ((level - 1) * scalingFactor)),
+            f32(1 << (level * scalingFactor))) *
+         config.rayLength;
+}
+
+// Angle between neighboring directions of a level's probes, an octahedral texel covers
+// about 4 pi / d^2 steradians. Matches LevelTexelAngle in shaders/probes.glsl.
+inline f32
+RadianceCascadesLevelTexelAngle(const RadianceCascadesConfig &config, i32 level) {
+  return 3.5449077f / f32(RadianceCascadesLevelProbeDiameter(config, level));
+}
+
+// How the build marches the rays of one level, see RadianceCascadesConfig::march*
+struct RadianceCascadesLevelMarch {
+  // hit epsilon and minimum step per unit of t
+  f32 epsilonSlope;
+  f32 minStepSlope;
+  // 0 is unbounded
+  u32 maxSteps;
+};
+
+inline RadianceCascadesLevelMarch
+RadianceCascadesGetLevelMarch(const RadianceCascadesConfig &config, i32 level) {
+  const f32 texelAngle = RadianceCascadesLevelTexelAngle(config, level);
+  return {.epsilonSlope = config.marchConeEpsilonScale * texelAngle,
+          .minStepSlope = config.marchConeMinStepScale * texelAngle,
+          .maxSteps = config.marchMaxSteps[level]};
+}
+
+// RADIANCE_CASCADES_STEP_HISTOGRAM_BUCKETS bucket of a ray that took steps steps
+inline u32
+RadianceCascadesStepHistogramBucket(u32 steps) {
+  u32 bucket = 0;
+  while (steps) {
+    steps >>= 1;
+    bucket++;
+  }
+  return Min(bucket, u32(RADIANCE_CASCADES_STEP_HISTOGRAM_BUCKETS - 1));
+}
+
+// Highest level that gets traced
+inline i32
+RadianceCascadesBuildMaxLevel(const RadianceCascadesConfig &config,
+                              const RadianceCascadesLayout &layout) {
+  return config.maxLevel == -1 ? layout.totalLevels - 2 : config.maxLevel;
+}
+
+// Highest level that gets merged, it reads the level above as its upper cascade
+inline i32
+RadianceCascadesMergeMaxLevel(const RadianceCascadesConfig &config,
+                              const RadianceCascadesLayout &layout) {
+  return config.maxLevel == -1 ? layout.totalLevels - 2 : config.maxLevel + 1;
+}
+
+// Stages of a cascade rebuild. Levels are built, then merged from the top down with
+// each merged level reduced before the merge below reads it, then level 0 is integrated.
+enum RadianceCascadesStage : u32 {
+  RadianceCascadesStage_Build = 0,
+  RadianceCascadesStage_Merge,
+  // a merged level filtered down for the merge of the level below it
+  RadianceCascadesStage_Reduce,
+  // level 0 only
+  RadianceCascadesStage_Irradiance,
+  RadianceCascadesStage_Count,
+};
+
+inline const char *
+RadianceCascadesStageName(RadianceCascadesStage stage) {
+  switch (stage) {
+    case RadianceCascadesStage_Build: return "build";
+    case RadianceCascadesStage_Merge: return "merge";
+    case RadianceCascadesStage_Reduce: return "reduce";
+    case RadianceCascadesStage_Irradiance: return "irradiance";
+    default: return "unknown";
+  }
+}
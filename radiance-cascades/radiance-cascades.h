@@ -3,10 +3,27 @@
 #include <engine/dust.h>
 #include <engine/gpu/morton.h>
 
+#include "bake-cache.h"
+#include "cpu.h"
+#include "layout.h"
 #include "shared.h"
+#include "stats.h"
+#include "update.h"
+
+// Dispatches that can be waiting on their GL_TIME_ELAPSED result, a few frames worth
+#define RADIANCE_CASCADES_GPU_TIMER_CAPACITY 128
+
+enum RadianceCascadesBackend : i32 {
+  RadianceCascadesBackend_GL = 0,
+  RadianceCascadesBackend_CPU,
+};
 
 struct RadianceCascades {
   RadianceCascadesConfig config;
+  RadianceCascadesBackend backend;
+  // Allocate octahedralProbeAtlasOriginal, needed by incremental updates
+  // (RadianceCascadesInvalidate, refresh) and the original atlas debug views
+  bool keepOriginalAtlasCopy;
 
   struct Debug {
     f32 atlasScale;
@@ -24,6 +41,9 @@ struct RadianceCascades {
     float mergeTexelGatherRatio;
     bool mergeTexelSampleOriginal;
 
+    // shade with the pre-integrated irradiance instead of reading the atlas
+    bool gatherIrradiance;
+
     bool dirty;
   };
   Debug debug;
@@ -32,25 +52,323 @@ struct RadianceCascades {
   u32 probeAtlasByteSize;
   u32 totalLevels;
 
+  // World space bounds of everything passed to RadianceCascadesInvalidate since the
+  // last tick
+  bool regionDirty;
+  v3 dirtyRegionMin;
+  v3 dirtyRegionMax;
+
+  // Levels RadianceCascadesReconfigure left stale, redone on the next tick
+  RadianceCascadesStaleLevels staleLevels;
+
+  // Amortized steady state refresh, runs on ticks with nothing else to rebuild
+  RadianceCascadesRefreshSchedule refresh;
+
+  // Keep every level's probe window centered on the eye passed to
+  // RadianceCascadesFollow, see RadianceCascadesPlanScroll
+  struct Clipmap {
+    bool enabled;
+    v3 eye;
+  };
+  Clipmap clipmap;
+
+  // Scene distance cache the build steps through empty space with, only allocated
+  // while config.distanceBricks.enabled is set, see RadianceCascadesEnableDistanceBricks
+  RadianceCascadesDistanceBricks distanceBricks;
+  Texture distanceBrickIndirection;
+  Texture distanceBrickSamples;
+  u32 distanceBrickSampleCapacity;
+
   Texture octahedralProbeAtlas;
+  // Unmerged build results. Merge reads the lower level from here, which is what lets
+  // a region be re-merged without re-tracing everything that feeds into it. Without
+  // it the build writes into octahedralProbeAtlas and the merge runs in place.
   Texture octahedralProbeAtlasOriginal;
   SSBO configUBO;
+  // RadianceCascadesIrradianceProbe per level 0 probe, what the final gather reads
+  SSBO irradiance;
+  // RadianceCascadesReducedTexel, the level above the one being merged filtered down to
+  // its directions, see shaders/radiance-cascades-reduce.glsl
+  SSBO reduced;
+  // a bit per probe, clear for probes inside solid geometry, see
+  // RadianceCascadesProbeValidityWordOffset
+  SSBO probeValidity;
+  // RADIANCE_CASCADES_STORAGE_SPARSE: atlas slot of every brick of every level, see
+  // RadianceCascadesAllocateSparseBricks. sparseBrickTable is the host copy, null for
+  // dense storage.
+  SSBO sparseBricks;
+  u32 *sparseBrickTable;
+  // RadianceCascadesMarchCounters, see RADIANCE_CASCADES_DEBUG_COUNT_MARCH_STEPS
+  SSBO marchStepCounters;
+
+  // Timings and counters of every stage run so far, see stats.h
+  RadianceCascadesStats stats;
+  // GL backend only, the CPU backend keeps its own in cpu.stepHistogram
+  RadianceCascadesStepHistogram stepHistogram;
+
+  // GL_TIME_ELAPSED queries around each dispatch, in dispatch order. The sample is
+  // pushed into stats once its query result is available.
+  struct GPUTimers {
+    GLuint queries[RADIANCE_CASCADES_GPU_TIMER_CAPACITY];
+    RadianceCascadesStatsSample pending[RADIANCE_CASCADES_GPU_TIMER_CAPACITY];
+    // oldest pending query
+    u32 first;
+    u32 count;
+  };
+  GPUTimers gpuTimers;
+
+  // Only allocated once the CPU backend has been selected
+  RadianceCascadesCPU cpu;
+
+  // Load full rebuilds from disk when a bake of the same config and scene is there,
+  // write them out when it isn't, see bake-cache.h. Not used while the clipmap follows
+  // the camera, every window position would get its own file.
+  struct BakeCache {
+    bool enabled;
+    // RADIANCE_CASCADES_BAKE_CACHE_PER_LEVEL
+    bool perLevel;
+    // where cache files live, empty is the working directory
+    char directory[256];
+    // Identifies the scene map() describes. RadianceCascadesInit hashes
+    // shaders/shared.glsl unless it is set beforehand.
+    u64 sceneHash;
+
+    // Bytes of a per level file uploaded per tick, 0 loads it all at once. Nothing is
+    // traced until the whole file is resident.
+    u64 streamBytesPerTick;
+    RadianceCascadesBakeCacheStream stream;
+    u64 streamStart;
+  };
+  BakeCache bakeCache;
 };
 
 inline RadianceCascadesConfig
 RadianceCascadesDefaultConfig() {
-  return {.gridDiameter = 64,
-          .rayLength = 0.05,
-          .scale = 0.25,
-          .atlasProbeDiameter = 6,
-          .maxLevel = -1,
-          .branchingFactor = 1};
+  RadianceCascadesConfig config = {};
+  config.gridDimX = 64;
+  config.gridDimY = 64;
+  config.gridDimZ = 64;
+  config.rayLength = 0.05f;
+  config.scale = 0.25f;
+  config.atlasProbeDiameter = 6;
+  config.maxLevel = -1;
+  config.branchingFactor = 1;
+  config.marchConeEpsilonScale = 0.5f;
+  config.marchConeMinStepScale = 0.25f;
+  return config;
+}
+
+inline GLenum
+RadianceCascadesAtlasInternalFormat(const RadianceCascadesConfig &config) {
+  return config.atlasFormat == RADIANCE_CASCADES_ATLAS_FORMAT_COMPACT ? GL_RG32F
+                                                                      : GL_RGBA32F;
+}
+
+// Image unit the compute shaders expect the atlas on, see shaders/atlas-image.glsl
+inline u32
+RadianceCascadesAtlasImageUnit(const RadianceCascadesConfig &config) {
+  return config.atlasFormat == RADIANCE_CASCADES_ATLAS_FORMAT_COMPACT ? 2 : 1;
+}
+
+// Where the build writes and the merge reads the lower level from
+inline const Texture &
+RadianceCascadesUnmergedAtlas(const RadianceCascades &cascades) {
+  return cascades.octahedralProbeAtlasOriginal.handle
+           ? cascades.octahedralProbeAtlasOriginal
+           : cascades.octahedralProbeAtlas;
+}
+
+// Print what the atlas textures and buffers for the current config take up
+static void
+RadianceCascadesPrintStorage(const RadianceCascades &cascades,
+                             const RadianceCascadesLayout &layout) {
+  const u64 atlasBytes = RadianceCascadesAtlasByteSize(layout);
+  const u64 totalBytes = atlasBytes * (cascades.keepOriginalAtlasCopy ? 2 : 1);
+  // RGBA32F merged + original atlases, each a square power of two layer per level
+  const u32 probe0Diameter = RadianceCascadesLevelProbeDiameter(cascades.config, 0);
+  const u64 levelDiameter = NextPowerOfTwo(
+    NextPowerOfTwo(Sqrt(layout.cascade0ProbeCount)) *
+    OCTAPROBE_PADDED_DIAMETER(probe0Diameter));
+  const u64 uncompactedBytes =
+    levelDiameter * levelDiameter * layout.totalLevels * 16 * 2;
+
+  printf("init texture size: %ux%ux%u\n",
+         cascades.config.atlasWidth,
+         cascades.config.atlasHeight,
+         cascades.config.atlasLayers);
+  printf("      total probes: %u\n", cascades.cascade0ProbeCount);
+  printf("      total levels: %u\n", cascades.totalLevels);
+  printf("  branching factor: %u\n", cascades.config.branchingFactor);
+  printf("         grid dims: %ux%ux%u\n",
+         cascades.config.gridDimX,
+         cascades.config.gridDimY,
+         cascades.config.gridDimZ);
+  printf("      atlas format: %s (%u bytes per texel)\n",
+         cascades.config.atlasFormat == RADIANCE_CASCADES_ATLAS_FORMAT_COMPACT
+           ? "compact rg32f"
+           : "rgba32f",
+         layout.texelByteSize);
+  printf("      atlas layout: %s\n",
+         cascades.config.atlasLayout == RADIANCE_CASCADES_ATLAS_LAYOUT_DIRECTION_MAJOR
+           ? "direction major"
+           : "probe major");
+  printf("    original atlas: %s\n", cascades.keepOriginalAtlasCopy ? "yes" : "no");
+  printf("        irradiance: %.2fMB\n",
+         f64(u64(RadianceCascadesIrradianceProbeCount(cascades.config, layout)) *
+             sizeof(RadianceCascadesIrradianceProbe)) /
+           (1024.0 * 1024.0));
+  printf("     reduced upper: %.2fMB\n",
+         f64(RadianceCascadesReducedTexelCount(cascades.config, layout) *
+             sizeof(RadianceCascadesReducedTexel)) /
+           (1024.0 * 1024.0));
+  printf("    probe validity: %.2fKB\n",
+         f64(u64(RadianceCascadesProbeValidityWordCount(layout)) * sizeof(u32)) / 1024.0);
+  if (layout.sparseBrickTableSize) {
+    u32 slots = 0;
+    for (i32 level = 0; level < i32(layout.totalLevels); level++) {
+      slots += RadianceCascadesSparseBrickCapacity(cascades.config, layout, level);
+    }
+    printf("     sparse bricks: %u of %u (%.2fKB table)\n",
+           slots,
+           layout.sparseBrickTableSize,
+           f64(u64(layout.sparseBrickTableSize) * sizeof(u32)) / 1024.0);
+  } else {
+    printf("     sparse bricks: dense\n");
+  }
+  printf("      total size: %.2fMB (saved %.2fMB vs unpacked rgba32f + original)\n",
+         f64(totalBytes) / (1024.0 * 1024.0),
+         f64(uncompactedBytes - totalBytes) / (1024.0 * 1024.0));
+}
+
+// Say so when a requested branching factor had levels too large for an atlas layer and
+// the layout settled on a lower one
+inline void
+RadianceCascadesReportBranchingFactor(const RadianceCascadesConfig &requested,
+                                      const RadianceCascadesLayout &layout) {
+  if (layout.branchingFactor < RadianceCascadesBranchingFactor(requested)) {
+    printf("RadianceCascades: branching factor %u needs levels over %u texels, "
+           "using %u\n",
+           RadianceCascadesBranchingFactor(requested),
+           RADIANCE_CASCADES_MAX_ATLAS_DIAMETER,
+           layout.branchingFactor);
+  }
+}
+
+// (Re)allocate an atlas texture for the current config
+static void
+RadianceCascadesInitAtlasTexture(const RadianceCascades &cascades,
+                                 Texture &texture,
+                                 const char *label,
+                                 GLint filter) {
+  if (!GLTextureInit2DArray(texture,
+                            cascades.config.atlasWidth,
+                            cascades.config.atlasHeight,
+                            cascades.config.atlasLayers,
+                            RadianceCascadesAtlasInternalFormat(cascades.config))) {
+    printf("RadianceCascadesInitAtlasTexture: failed to allocate %s %ux%ux%u (%.2fMB)\n",
+           label,
+           cascades.config.atlasWidth,
+           cascades.config.atlasHeight,
+           cascades.config.atlasLayers,
+           f64(u64(cascades.config.atlasWidth) * cascades.config.atlasHeight *
+               cascades.config.atlasLayers *
+               RadianceCascadesAtlasTexelByteSize(cascades.config)) /
+             (1024.0 * 1024.0));
+    return;
+  }
+  glObjectLabel(GL_TEXTURE, texture.handle, -1, label);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, filter);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, filter);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+}
+
+// Allocate or drop the unmerged atlas to match keepOriginalAtlasCopy
+static void
+RadianceCascadesInitOriginalAtlasTexture(RadianceCascades &cascades) {
+  if (cascades.keepOriginalAtlasCopy) {
+    RadianceCascadesInitAtlasTexture(cascades,
+                                     cascades.octahedralProbeAtlasOriginal,
+                                     "RadianceCascades/OctahedralProbeAtlasOriginal",
+                                     GL_NEAREST);
+  } else if (cascades.octahedralProbeAtlasOriginal.handle) {
+    glDeleteTextures(1, &cascades.octahedralProbeAtlasOriginal.handle);
+    cascades.octahedralProbeAtlasOriginal = {};
+  }
+}
+
+inline void
+RadianceCascadesInitIrradianceBuffer(RadianceCascades &cascades,
+                                     const RadianceCascadesLayout &layout) {
+  SSBOInit(cascades.irradiance,
+           u64(RadianceCascadesIrradianceProbeCount(cascades.config, layout)) *
+             sizeof(RadianceCascadesIrradianceProbe),
+           "RadianceCascades/Irradiance",
+           GL_DYNAMIC_STORAGE_BIT,
+           GL_SHADER_STORAGE_BUFFER,
+           nullptr);
+}
+
+inline void
+RadianceCascadesInitReducedBuffer(RadianceCascades &cascades,
+                                  const RadianceCascadesLayout &layout) {
+  SSBOInit(cascades.reduced,
+           Max(RadianceCascadesReducedTexelCount(cascades.config, layout), u64(1)) *
+             sizeof(RadianceCascadesReducedTexel),
+           "RadianceCascades/Reduced",
+           GL_DYNAMIC_STORAGE_BIT,
+           GL_SHADER_STORAGE_BUFFER,
+           nullptr);
+}
+
+// Every probe starts out valid, the builds clear the ones inside solid geometry
+inline void
+RadianceCascadesInitProbeValidityBuffer(RadianceCascades &cascades,
+                                        const RadianceCascadesLayout &layout) {
+  SSBOInit(cascades.probeValidity,
+           u64(RadianceCascadesProbeValidityWordCount(layout)) * sizeof(u32),
+           "RadianceCascades/ProbeValidity",
+           GL_DYNAMIC_STORAGE_BIT,
+           GL_SHADER_STORAGE_BUFFER,
+           nullptr);
+  const u32 valid = 0xFFFFFFFF;
+  glClearNamedBufferData(
+    cascades.probeValidity.handle, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &valid);
+}
+
+// No brick has a slot until RadianceCascadesAllocateSparseBricks places them. Dense
+// storage keeps a one word buffer for the shaders to bind.
+static void
+RadianceCascadesInitSparseBricks(RadianceCascades &cascades,
+                                 const RadianceCascadesLayout &layout) {
+  free(cascades.sparseBrickTable);
+  cascades.sparseBrickTable = nullptr;
+  const u64 byteSize = u64(Max(layout.sparseBrickTableSize, 1u)) * sizeof(u32);
+  if (layout.sparseBrickTableSize) {
+    cascades.sparseBrickTable = (u32 *)malloc(byteSize);
+    if (cascades.sparseBrickTable) {
+      memset(cascades.sparseBrickTable, 0xFF, byteSize);
+    }
+  }
+  SSBOInit(cascades.sparseBricks,
+           byteSize,
+           "RadianceCascades/SparseBricks",
+           GL_DYNAMIC_STORAGE_BIT,
+           GL_SHADER_STORAGE_BUFFER,
+           nullptr);
+  const u32 empty = RADIANCE_CASCADES_SPARSE_BRICK_EMPTY;
+  glClearNamedBufferData(
+    cascades.sparseBricks.handle, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &empty);
 }
 
 static void
 RadianceCascadesInit(RadianceCascades &cascades,
                      RadianceCascadesConfig config = RadianceCascadesDefaultConfig()) {
-  if (cascades.config.gridDiameter == 0) {
+  // size the sparse slots for the scene up front, RadianceCascadesAllocateSparseBricks
+  // only has to grow them after edits
+  RadianceCascadesCPUFitSparseStorage(config,
+                                      RadianceCascadesCPUThreadCount(cascades.cpu));
+  if (cascades.config.gridDimX == 0) {
     cascades.config = config;
 
     cascades.debug.atlasScale = 1.0;
@@ -58,69 +376,30 @@ RadianceCascadesInit(RadianceCascades &cascades,
     cascades.debug.mergeTexelGatherOffset = 1.0f;
     cascades.debug.mergeTexelGatherRatio = 0.75f;
     cascades.debug.mergeTexelSampleOriginal = false;
-  }
-  cascades.cascade0ProbeCount = Pow(config.gridDiameter, 3);
+    cascades.debug.gatherIrradiance = true;
 
-  u32 gridDiameter = NextPowerOfTwo(Sqrt(cascades.cascade0ProbeCount));
-  cascades.config.baseDiameter = NextPowerOfTwo(
-    gridDiameter * OCTAPROBE_PADDED_DIAMETER(config.atlasProbeDiameter));
+    cascades.refresh.level0Period = 1;
+    cascades.refresh.periodScale = 2;
 
-  cascades.config.atlasGridDiameter = gridDiameter;
-  cascades.debug.dirty = true;
-  // Compute the total number of levels
-  {
-    cascades.totalLevels = 0;
-
-    f32 level = 0.0;
-    while (true) {
-      u32 level = cascades.totalLevels;
-      f32 spacing = Pow(2.0f, f32(level));
-      f32 invSpacing = 1.0f / spacing;
-
-      f32 probeCount = Pow(invSpacing, 3) * f32(cascades.cascade0ProbeCount);
-      if (probeCount < 1.0) {
-        break;
-      }
-      cascades.totalLevels++;
+    cascades.bakeCache.streamBytesPerTick = u64(64) * 1024 * 1024;
+    if (!cascades.bakeCache.sceneHash) {
+      cascades.bakeCache.sceneHash = RadianceCascadesHashFile("shaders/shared.glsl");
     }
   }
+  RadianceCascadesLayout layout = RadianceCascadesComputeLayout(config);
+  RadianceCascadesReportBranchingFactor(config, layout);
+  cascades.cascade0ProbeCount = layout.cascade0ProbeCount;
+  RadianceCascadesApplyLayout(cascades.config, layout);
+  cascades.totalLevels = layout.totalLevels;
+  cascades.debug.dirty = true;
+  cascades.staleLevels = {};
 
-  printf("init texture width: %u\n", cascades.config.baseDiameter);
-  printf("      total probes: %u\n", cascades.cascade0ProbeCount);
-  printf("      total levels: %u\n", cascades.totalLevels);
-  printf("     grid diameter: %u\n", cascades.config.atlasGridDiameter);
-  printf("      total size: %.2fMB\n",
-         f64(Pow(cascades.config.baseDiameter, 2) * 16 * cascades.totalLevels) /
-           (1024.0 * 1024.0));
-  if (GLTextureInit2DArray(cascades.octahedralProbeAtlas,
-                           cascades.config.baseDiameter,
-                           cascades.config.baseDiameter,
-                           cascades.totalLevels,
-                           GL_RGBA32F)) {
-    glObjectLabel(GL_TEXTURE,
-                  cascades.octahedralProbeAtlas.handle,
-                  -1,
-                  "RadianceCascades/OctahedralProbeAtlas");
-    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-  }
-
-  if (GLTextureInit2DArray(cascades.octahedralProbeAtlasOriginal,
-                           cascades.config.baseDiameter,
-                           cascades.config.baseDiameter,
-                           cascades.totalLevels,
-                           GL_RGBA32F)) {
-    glObjectLabel(GL_TEXTURE,
-                  cascades.octahedralProbeAtlasOriginal.handle,
-                  -1,
-                  "RadianceCascades/OctahedralProbeAtlasOriginal");
-    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-  }
+  RadianceCascadesPrintStorage(cascades, layout);
+  RadianceCascadesInitAtlasTexture(cascades,
+                                   cascades.octahedralProbeAtlas,
+                                   "RadianceCascades/OctahedralProbeAtlas",
+                                   GL_LINEAR);
+  RadianceCascadesInitOriginalAtlasTexture(cascades);
 
   SSBOInit(cascades.configUBO,
            sizeof(RadianceCascadesConfig),
@@ -128,180 +407,1438 @@ RadianceCascadesInit(RadianceCascades &cascades,
            GL_DYNAMIC_STORAGE_BIT,
            GL_UNIFORM_BUFFER,
            (void *)&cascades.config);
+  RadianceCascadesInitIrradianceBuffer(cascades, layout);
+  RadianceCascadesInitReducedBuffer(cascades, layout);
+  RadianceCascadesInitProbeValidityBuffer(cascades, layout);
+  RadianceCascadesInitSparseBricks(cascades, layout);
+  SSBOInit(cascades.marchStepCounters,
+           sizeof(RadianceCascadesMarchCounters),
+           "RadianceCascades/MarchStepCounters",
+           GL_DYNAMIC_STORAGE_BIT,
+           GL_SHADER_STORAGE_BUFFER,
+           nullptr);
 }
 
+inline RadianceCascadesLayout
+RadianceCascadesGetLayout(const RadianceCascades &cascades) {
+  RadianceCascadesLayout layout = {};
+  layout.cascade0ProbeCount = cascades.cascade0ProbeCount;
+  layout.gridDims = RadianceCascadesGridDims(cascades.config);
+  layout.totalLevels = cascades.totalLevels;
+  layout.texelByteSize = RadianceCascadesAtlasTexelByteSize(cascades.config);
+  layout.atlasWidth = cascades.config.atlasWidth;
+  layout.atlasHeight = cascades.config.atlasHeight;
+  layout.atlasLayers = cascades.config.atlasLayers;
+  layout.branchingFactor = cascades.config.branchingFactor;
+  for (u32 level = 0; level < RADIANCE_CASCADES_MAX_LEVELS; level++) {
+    layout.levels[level] = cascades.config.levels[level];
+  }
+  if (RadianceCascadesStorageSparse(cascades.config)) {
+    layout.sparseBrickTableSize =
+      RadianceCascadesSparseBrickOffset(layout, i32(layout.totalLevels));
+  }
+  return layout;
+}
+
+// Storage slot of a probe, RADIANCE_CASCADES_SPARSE_BRICK_EMPTY when it has none
+inline u32
+RadianceCascadesGetProbeSlot(const RadianceCascades &cascades,
+                             u32 probeIndex,
+                             i32 level) {
+  const RadianceCascadesLayout layout = RadianceCascadesGetLayout(cascades);
+  const u32 *levelBricks = cascades.sparseBrickTable
+                             ? cascades.sparseBrickTable +
+                                 RadianceCascadesSparseBrickOffset(layout, level)
+                             : nullptr;
+  return RadianceCascadesProbeSlot(
+    levelBricks, RadianceCascadesSparseBrickProbes(layout, level), probeIndex);
+}
+
+// Finest level the final gather can read, above 0 while a bake cache is still streaming
+// in the finer levels
+inline i32
+RadianceCascadesGatherLevel(const RadianceCascades &cascades) {
+  const RadianceCascadesBakeCacheStream &stream = cascades.bakeCache.stream;
+  if (!RadianceCascadesBakeCacheStreaming(stream)) {
+    return 0;
+  }
+  const i32 mergeMaxLevel =
+    RadianceCascadesMergeMaxLevel(cascades.config, RadianceCascadesGetLayout(cascades));
+  return Min(stream.residentLevel, mergeMaxLevel);
+}
+
+inline bool
+RadianceCascadesIrradianceResident(const RadianceCascades &cascades) {
+  return !RadianceCascadesBakeCacheStreaming(cascades.bakeCache.stream) ||
+         cascades.bakeCache.stream.irradianceResident;
+}
+
+// Mark a world space box as changed, the probes that can see it are rebuilt on the
+// next tick
 static void
-RadianceCascadesTick(RadianceCascades &cascades, const MemoryArena &scratchArena) {
-  if (!cascades.debug.dirty) {
+RadianceCascadesInvalidate(RadianceCascades &cascades, v3 aabbMin, v3 aabbMax) {
+  if (!cascades.regionDirty) {
+    cascades.regionDirty = true;
+    cascades.dirtyRegionMin = aabbMin;
+    cascades.dirtyRegionMax = aabbMax;
     return;
   }
-  cascades.debug.dirty = false;
+  cascades.dirtyRegionMin = Min(cascades.dirtyRegionMin, aabbMin);
+  cascades.dirtyRegionMax = Max(cascades.dirtyRegionMax, aabbMax);
+}
 
-  glClearTexImage(cascades.octahedralProbeAtlas.handle, 0, GL_RGBA, GL_FLOAT, nullptr);
+// Where the clipmap should be centered on the next tick
+inline void
+RadianceCascadesFollow(RadianceCascades &cascades, v3 eye) {
+  cascades.clipmap.eye = eye;
+}
 
-  // Build cascade levels
-  {
-    GLProgram *program = GLComputeProgram(scratchArena,
-                                          "shaders/radiance-cascades-build.comp");
-    if (program) {
-      glUseProgram(program->handle);
-      Bind(cascades.configUBO, 0, GL_UNIFORM_BUFFER);
-      glBindImageTexture(1,
-                         cascades.octahedralProbeAtlas.handle,
-                         0,
-                         0,
-                         0,
-                         GL_WRITE_ONLY,
-                         GL_RGBA32F);
-      ImGui::Text("RadianceCascadesTick/BuildCascadeLevels\n");
+inline void
+RadianceCascadesUploadConfig(const RadianceCascades &cascades) {
+  glNamedBufferSubData(cascades.configUBO.handle,
+                       0,
+                       sizeof(RadianceCascadesConfig),
+                       &cascades.config);
+}
 
-      const int maxLevel = cascades.config.maxLevel == -1 ? cascades.totalLevels - 2
-                                                          : cascades.config.maxLevel;
+// Switch to config and keepOriginalAtlasCopy, keeping everything the change doesn't
+// reach. Textures and buffers whose size and format stay the same are reused. When the
+// atlas layout stays the same too only the levels RadianceCascadesDiffConfig finds stale
+// are re-traced on the next tick, which needs the unmerged atlas for anything that only
+// has to be re-merged. Anything else rebuilds everything.
+static void
+RadianceCascadesReconfigure(RadianceCascades &cascades,
+                            RadianceCascadesConfig config,
+                            bool keepOriginalAtlasCopy) {
+  const RadianceCascadesConfig previous = cascades.config;
+  const bool hadOriginal = cascades.keepOriginalAtlasCopy;
+  const RadianceCascadesLayout previousLayout = RadianceCascadesGetLayout(cascades);
+  // switching to sparse storage or to a new grid starts from unsized slots
+  if (!config.sparseBrickCapacity[0]) {
+    RadianceCascadesCPUFitSparseStorage(config,
+                                        RadianceCascadesCPUThreadCount(cascades.cpu));
+  }
+  const u64 previousReducedTexelCount = RadianceCascadesReducedTexelCount(previous,
+                                                                          previousLayout);
+  const RadianceCascadesLayout layout = RadianceCascadesComputeLayout(config);
+  RadianceCascadesReportBranchingFactor(config, layout);
+  RadianceCascadesApplyLayout(config, layout);
+
+  const bool atlasChanged = config.atlasWidth != previous.atlasWidth ||
+                            config.atlasHeight != previous.atlasHeight ||
+                            config.atlasLayers != previous.atlasLayers ||
+                            config.atlasFormat != previous.atlasFormat;
+  const bool irradianceChanged =
+    RadianceCascadesIrradianceProbeCount(config, layout) !=
+    RadianceCascadesIrradianceProbeCount(previous, previousLayout);
+  const bool reducedChanged = RadianceCascadesReducedTexelCount(config, layout) !=
+                              previousReducedTexelCount;
+  const bool validityChanged = RadianceCascadesProbeValidityWordCount(layout) !=
+                               RadianceCascadesProbeValidityWordCount(previousLayout);
+  const bool sparseBricksChanged = layout.sparseBrickTableSize !=
+                                   previousLayout.sparseBrickTableSize;
+  cascades.config = config;
+  cascades.keepOriginalAtlasCopy = keepOriginalAtlasCopy;
+  cascades.cascade0ProbeCount = layout.cascade0ProbeCount;
+  cascades.totalLevels = layout.totalLevels;
+
+  if (atlasChanged || hadOriginal != keepOriginalAtlasCopy || irradianceChanged ||
+      reducedChanged || validityChanged || sparseBricksChanged) {
+    RadianceCascadesPrintStorage(cascades, layout);
+  }
+  if (atlasChanged) {
+    RadianceCascadesInitAtlasTexture(cascades,
+                                     cascades.octahedralProbeAtlas,
+                                     "RadianceCascades/OctahedralProbeAtlas",
+                                     GL_LINEAR);
+  }
+  if (atlasChanged || hadOriginal != keepOriginalAtlasCopy) {
+    RadianceCascadesInitOriginalAtlasTexture(cascades);
+  }
+  if (irradianceChanged) {
+    RadianceCascadesInitIrradianceBuffer(cascades, layout);
+  }
+  if (reducedChanged) {
+    RadianceCascadesInitReducedBuffer(cascades, layout);
+  }
+  if (validityChanged) {
+    RadianceCascadesInitProbeValidityBuffer(cascades, layout);
+  }
+  if (sparseBricksChanged) {
+    RadianceCascadesInitSparseBricks(cascades, layout);
+  }
+  RadianceCascadesUploadConfig(cascades);
 
-      for (i32 level = maxLevel; level >= 0; level--) {
-        u32 atlasProbeDiameter = cascades.config.atlasProbeDiameter * Pow(2u, level);
-        u32 levelProbeCount = cascades.cascade0ProbeCount >> (level * 3);
-        u32 levelRayCount = atlasProbeDiameter * atlasProbeDiameter;
-        // ImGui::Text("  level %u\n", level);
-        // ImGui::Text("    rays(%u) totalProbes(%u)\n", levelRayCount, levelProbeCount);
+  // a stream still filling in the atlas was for the old config, a new unmerged atlas
+  // has nothing in it yet
+  if (RadianceCascadesBakeCacheStreaming(cascades.bakeCache.stream)) {
+    RadianceCascadesBakeCacheStreamEnd(cascades.bakeCache.stream);
+    cascades.debug.dirty = true;
+  }
+  if (keepOriginalAtlasCopy && !hadOriginal) {
+    cascades.debug.dirty = true;
+  }
+  if (!RadianceCascadesDiffConfig(previous, config, layout, cascades.staleLevels)) {
+    cascades.debug.dirty = true;
+  }
+}
 
-        glUniform1ui(0, level);
+// Place the sparse bricks for the scene before a full rebuild, growing the slot counts
+// (and with them the atlas) when the scene needs more bricks than they hold, and upload
+// the table along with the validity of the probes left without storage. The CPU
+// backend takes the host copy over in RadianceCascadesTickCPU.
+static void
+RadianceCascadesAllocateSparseBricks(RadianceCascades &cascades) {
+  if (!cascades.sparseBrickTable) {
+    return;
+  }
+  const u32 threadCount = RadianceCascadesCPUThreadCount(cascades.cpu);
+  u32 neededBricks[RADIANCE_CASCADES_MAX_LEVELS] = {};
+  RadianceCascadesPlaceSparseBricks(cascades.config,
+                                    RadianceCascadesGetLayout(cascades),
+                                    threadCount,
+                                    cascades.sparseBrickTable,
+                                    neededBricks);
+  RadianceCascadesConfig config = cascades.config;
+  if (RadianceCascadesFitSparseBrickCapacity(
+        config, RadianceCascadesGetLayout(cascades), neededBricks)) {
+    RadianceCascadesReconfigure(cascades, config, cascades.keepOriginalAtlasCopy);
+    RadianceCascadesPlaceSparseBricks(cascades.config,
+                                      RadianceCascadesGetLayout(cascades),
+                                      threadCount,
+                                      cascades.sparseBrickTable,
+                                      neededBricks);
+  }
+
+  const RadianceCascadesLayout layout = RadianceCascadesGetLayout(cascades);
+  glNamedBufferSubData(cascades.sparseBricks.handle,
+                       0,
+                       u64(layout.sparseBrickTableSize) * sizeof(u32),
+                       cascades.sparseBrickTable);
+  const u64 validityByteSize = u64(RadianceCascadesProbeValidityWordCount(layout)) *
+                               sizeof(u32);
+  u32 *probeValidity = (u32 *)malloc(validityByteSize);
+  if (!probeValidity) {
+    return;
+  }
+  memset(probeValidity, 0xFF, validityByteSize);
+  RadianceCascadesResetSparseProbeValidity(
+    layout, cascades.sparseBrickTable, probeValidity);
+  glNamedBufferSubData(cascades.probeValidity.handle, 0, validityByteSize, probeValidity);
+  free(probeValidity);
+}
 
-        u32 scalingFactor = 2;
-        v2 rayRange = v2(level == 0 ? 0 : f32(1 << ((level - 1) * scalingFactor)),
-                         f32(1 << (level * scalingFactor))) *
-                      cascades.config.rayLength;
+// Zero the levels in levelMask of a GL atlas texture
+static void
+RadianceCascadesClearAtlasLevels(const RadianceCascades &cascades,
+                                 const Texture &texture,
+                                 u32 levelMask) {
+  if (!texture.handle) {
+    return;
+  }
+  const RadianceCascadesLayout layout = RadianceCascadesGetLayout(cascades);
+  for (u32 level = 0; level < cascades.totalLevels; level++) {
+    if (!(levelMask & (1u << level))) {
+      continue;
+    }
+    const RadianceCascadesLevelRect &rect = cascades.config.levels[level];
+    const v2u32 extent = RadianceCascadesLevelExtent(cascades.config, layout, level);
+    glClearTexSubImage(texture.handle,
+                       0,
+                       rect.x,
+                       rect.y,
+                       rect.layer,
+                       extent.x,
+                       extent.y,
+                       1,
+                       GL_RGBA,
+                       GL_FLOAT,
+                       nullptr);
+  }
+}
 
-        ImGui::Text("level %u rayRange(%f, %f)\n", level, rayRange.x, rayRange.y);
-        glUniform2f(1, rayRange.x, rayRange.y);
+inline void
+RadianceCascadesDistanceBricksTextureInit(Texture &texture,
+                                          u32 width,
+                                          u32 height,
+                                          u32 depth,
+                                          GLenum internalFormat,
+                                          const char *label) {
+  if (texture.handle) {
+    glDeleteTextures(1, &texture.handle);
+  }
+  texture = {};
+  glCreateTextures(GL_TEXTURE_3D, 1, &texture.handle);
+  glTextureStorage3D(texture.handle, 1, internalFormat, width, height, depth);
+  glTextureParameteri(texture.handle, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTextureParameteri(texture.handle, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glObjectLabel(GL_TEXTURE, texture.handle, -1, label);
+}
 
-        GLDispatch(program, levelRayCount * levelProbeCount);
-      }
+// Push whatever the last distance brick bake changed to the GL textures
+static void
+RadianceCascadesUploadDistanceBricks(RadianceCascades &cascades) {
+  RadianceCascadesDistanceBricks &bricks = cascades.distanceBricks;
+  const RadianceCascadesDistanceBricksInfo &info = bricks.info;
+  if (!bricks.dirty) {
+    return;
+  }
+
+  const u32 S = RADIANCE_CASCADES_DISTANCE_BRICK_SAMPLES;
+  const u32 A = RADIANCE_CASCADES_DISTANCE_BRICK_ATLAS_BRICKS;
+  if (!cascades.distanceBrickIndirection.handle) {
+    RadianceCascadesDistanceBricksTextureInit(
+      cascades.distanceBrickIndirection,
+      info.brickDimX,
+      info.brickDimY,
+      info.brickDimZ,
+      GL_RG32UI,
+      "RadianceCascades/DistanceBrickIndirection");
+  }
+
+  // the sample atlas grows by whole layers of A * A bricks
+  bool reallocated = false;
+  if (bricks.slotCapacity != cascades.distanceBrickSampleCapacity) {
+    const u32 layers = (bricks.slotCapacity + A * A - 1) / (A * A);
+    RadianceCascadesDistanceBricksTextureInit(cascades.distanceBrickSamples,
+                                              A * S,
+                                              A * S,
+                                              layers * S,
+                                              GL_R32F,
+                                              "RadianceCascades/DistanceBrickSamples");
+    cascades.distanceBrickSampleCapacity = bricks.slotCapacity;
+    reallocated = true;
+  }
+
+  glTextureSubImage3D(cascades.distanceBrickIndirection.handle,
+                      0,
+                      0,
+                      0,
+                      0,
+                      info.brickDimX,
+                      info.brickDimY,
+                      info.brickDimZ,
+                      GL_RG_INTEGER,
+                      GL_UNSIGNED_INT,
+                      bricks.bricks);
+
+  for (u32 slot = 0; slot < bricks.slotCount; slot++) {
+    if (!reallocated && !bricks.dirtySlots[slot]) {
+      continue;
     }
+    bricks.dirtySlots[slot] = 0;
+    glTextureSubImage3D(cascades.distanceBrickSamples.handle,
+                        0,
+                        (slot % A) * S,
+                        ((slot / A) % A) * S,
+                        (slot / (A * A)) * S,
+                        S,
+                        S,
+                        S,
+                        GL_RED,
+                        GL_FLOAT,
+                        RadianceCascadesDistanceBrickSamples(bricks, slot + 1));
   }
+  bricks.dirty = false;
+}
 
-  bool keepOriginalAtlasCopy = true;
-  // Copy into debug original texture
-  if (keepOriginalAtlasCopy) {
-    glCopyImageSubData(cascades.octahedralProbeAtlas.handle,
-                       GL_TEXTURE_2D_ARRAY,
-                       0,
-                       0,
-                       0,
-                       0,
-                       cascades.octahedralProbeAtlasOriginal.handle,
-                       GL_TEXTURE_2D_ARRAY,
-                       0,
-                       0,
-                       0,
-                       0,
-                       cascades.octahedralProbeAtlas.width,
-                       cascades.octahedralProbeAtlas.height,
-                       cascades.octahedralProbeAtlas.depth);
+static void
+RadianceCascadesDisableDistanceBricks(RadianceCascades &cascades) {
+  RadianceCascadesDistanceBricksFree(cascades.distanceBricks);
+  if (cascades.distanceBrickIndirection.handle) {
+    glDeleteTextures(1, &cascades.distanceBrickIndirection.handle);
+  }
+  if (cascades.distanceBrickSamples.handle) {
+    glDeleteTextures(1, &cascades.distanceBrickSamples.handle);
+  }
+  cascades.distanceBrickIndirection = {};
+  cascades.distanceBrickSamples = {};
+  cascades.distanceBrickSampleCapacity = 0;
+  cascades.config.distanceBricks = {};
+  RadianceCascadesUploadConfig(cascades);
+  cascades.debug.dirty = true;
+}
+
+// Bake the scene distance field inside [aabbMin, aabbMax] into bricks of voxelSize
+// voxels and have the build step through empty space with it. Rays outside the box
+// evaluate map() as before.
+static bool
+RadianceCascadesEnableDistanceBricks(RadianceCascades &cascades,
+                                     v3 aabbMin,
+                                     v3 aabbMax,
+                                     f32 voxelSize) {
+  RadianceCascadesDisableDistanceBricks(cascades);
+  RadianceCascadesDistanceBricks &bricks = cascades.distanceBricks;
+  if (!RadianceCascadesDistanceBricksInit(bricks, aabbMin, aabbMax, voxelSize)) {
+    return false;
+  }
+
+  u64 start = CartContext()->TimeNowMilliseconds();
+  RadianceCascadesCPUBakeDistanceBricks(bricks,
+                                        RadianceCascadesCPUThreadCount(cascades.cpu));
+  u64 end = CartContext()->TimeNowMilliseconds();
+  const u32 allocated = bricks.slotCount - bricks.freeSlotCount;
+  printf("distance bricks: %ux%ux%u bricks, %u with samples (%.2fMB) in %llums\n",
+         bricks.info.brickDimX,
+         bricks.info.brickDimY,
+         bricks.info.brickDimZ,
+         allocated,
+         f64(u64(bricks.slotCapacity) * RADIANCE_CASCADES_DISTANCE_BRICK_SAMPLE_COUNT *
+             sizeof(f32)) /
+           (1024.0 * 1024.0),
+         (unsigned long long)(end - start));
+
+  RadianceCascadesUploadDistanceBricks(cascades);
+  cascades.config.distanceBricks = bricks.info;
+  RadianceCascadesUploadConfig(cascades);
+  cascades.debug.dirty = true;
+  return true;
+}
+
+// Upload rows of CPU atlas texels starting at src, rowLength texels apart, into a rect
+// of one atlas layer, converting to the compact texel format when the textures use it
+static void
+RadianceCascadesUploadAtlasTexels(const RadianceCascades &cascades,
+                                  const Texture &texture,
+                                  const RadianceCascadesKernels::PackedTexel *src,
+                                  u32 rowLength,
+                                  u32 layer,
+                                  v2u32 lo,
+                                  v2u32 hi) {
+  using namespace RadianceCascadesKernels;
+  const u32 d = rowLength;
+  const u32 width = hi.x - lo.x;
+  const u32 height = hi.y - lo.y;
+
+  if (cascades.config.atlasFormat != RADIANCE_CASCADES_ATLAS_FORMAT_COMPACT) {
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, d);
+    glTextureSubImage3D(texture.handle,
+                        0,
+                        lo.x,
+                        lo.y,
+                        layer,
+                        width,
+                        height,
+                        1,
+                        GL_RGBA,
+                        GL_FLOAT,
+                        src);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    return;
   }
 
-  // Merge and stitch
-  if (1) {
+  CompactTexel *compact = (CompactTexel *)malloc(u64(width) * height *
+                                                 sizeof(CompactTexel));
+  if (!compact) {
+    return;
+  }
+  for (u32 y = 0; y < height; y++) {
+    for (u32 x = 0; x < width; x++) {
+      compact[u64(y) * width + x] = PackMapResultCompact(
+        UnpackMapResult(src[u64(y) * d + x]));
+    }
+  }
+  glTextureSubImage3D(texture.handle,
+                      0,
+                      lo.x,
+                      lo.y,
+                      layer,
+                      width,
+                      height,
+                      1,
+                      GL_RG,
+                      GL_FLOAT,
+                      compact);
+  free(compact);
+}
+
+static void
+RadianceCascadesUploadCPUAtlasRect(const RadianceCascades &cascades,
+                                   const Texture &texture,
+                                   const RadianceCascadesKernels::PackedTexel *atlas,
+                                   u32 layer,
+                                   v2u32 lo,
+                                   v2u32 hi) {
+  const u32 d = cascades.config.atlasWidth;
+  RadianceCascadesUploadAtlasTexels(
+    cascades,
+    texture,
+    atlas + (u64(layer) * cascades.config.atlasHeight + lo.y) * d + lo.x,
+    d,
+    layer,
+    lo,
+    hi);
+}
+
+// Upload the texels covered by the probes in box from a CPU atlas
+static void
+RadianceCascadesUploadCPUProbeBox(const RadianceCascades &cascades,
+                                  const Texture &texture,
+                                  const RadianceCascadesKernels::PackedTexel *atlas,
+                                  i32 level,
+                                  const RadianceCascadesProbeBox &box) {
+  const u32 boxProbeCount = RadianceCascadesProbeBoxCount(box);
+  if (!boxProbeCount) {
+    return;
+  }
 
-    const int maxLevel = cascades.config.maxLevel == -1 ? cascades.totalLevels - 2
-                                                        : cascades.config.maxLevel + 1;
+  // every direction tile of a direction-major level holds some of the box's probes
+  if (cascades.config.atlasLayout == RADIANCE_CASCADES_ATLAS_LAYOUT_DIRECTION_MAJOR) {
+    const RadianceCascadesLevelRect &rect = cascades.config.levels[level];
+    const v2u32 lo(rect.x, rect.y);
+    const v2u32 extent = RadianceCascadesLevelExtent(cascades.config,
+                                                     RadianceCascadesGetLayout(cascades),
+                                                     level);
+    RadianceCascadesUploadCPUAtlasRect(cascades,
+                                       texture,
+                                       atlas,
+                                       rect.layer,
+                                       lo,
+                                       lo + extent);
+    return;
+  }
 
-    GLProgram *octahedronStitchingprogram = GLComputeProgram(
-      scratchArena, "shaders/radiance-cascades-octaprobe-stitch.comp");
+  // bounding rect of the probe tiles, the morton layout keeps a box of probes mostly
+  // contiguous in the atlas
+  const u32 ppd = OCTAPROBE_PADDED_DIAMETER(
+    RadianceCascadesLevelProbeDiameter(cascades.config, level));
+  v2u32 lo(0xFFFFFFFF);
+  v2u32 hi(0);
+  for (u32 boxIndex = 0; boxIndex < boxProbeCount; boxIndex++) {
+    const u32 slot = RadianceCascadesGetProbeSlot(
+      cascades,
+      RadianceCascadesProbeIndex(cascades.config,
+                                 RadianceCascadesProbeBoxGridPos(box, boxIndex),
+                                 level),
+      level);
+    if (slot == RADIANCE_CASCADES_SPARSE_BRICK_EMPTY) {
+      continue;
+    }
+    v3u32 origin = RadianceCascadesProbeAtlasOrigin(cascades.config, slot, level);
+    lo = Min(lo, v2u32(origin.x, origin.y));
+    hi = Max(hi, v2u32(origin.x, origin.y) + ppd);
+  }
+  if (hi.x <= lo.x) {
+    return;
+  }
 
-    // DEBUG: stitch the original atlas probes
-    if (keepOriginalAtlasCopy && octahedronStitchingprogram) {
-      glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
-      glUseProgram(octahedronStitchingprogram->handle);
-      Bind(cascades.configUBO, 0, GL_UNIFORM_BUFFER);
-      glBindImageTexture(1,
-                         cascades.octahedralProbeAtlasOriginal.handle,
-                         0,
-                         0,
-                         0,
-                         GL_READ_WRITE,
-                         GL_RGBA32F);
-
-      for (i32 level = maxLevel; level >= 0; level--) {
-        glUniform1ui(0, level);
-        const u32 levelProbeCount = cascades.cascade0ProbeCount >> (level * 3);
-        glUniform1ui(1, levelProbeCount);
-        ImGui::Text("stitch original: %i probes: %u", level, levelProbeCount);
-        GLDispatch(octahedronStitchingprogram, levelProbeCount);
+  hi = Min(hi, v2u32(cascades.config.atlasWidth, cascades.config.atlasHeight));
+  RadianceCascadesUploadCPUAtlasRect(cascades,
+                                     texture,
+                                     atlas,
+                                     cascades.config.levels[level].layer,
+                                     lo,
+                                     hi);
+}
+
+// Upload the irradiance of the level 0 probes in box, the morton order keeps their
+// slots mostly contiguous so this is a single range
+static void
+RadianceCascadesUploadCPUIrradiance(const RadianceCascades &cascades,
+                                    const RadianceCascadesProbeBox &box) {
+  const u32 boxProbeCount = RadianceCascadesProbeBoxCount(box);
+  if (!boxProbeCount || !cascades.cpu.irradiance) {
+    return;
+  }
+
+  u32 lo = 0xFFFFFFFF;
+  u32 hi = 0;
+  for (u32 boxIndex = 0; boxIndex < boxProbeCount; boxIndex++) {
+    const u32 slot = RadianceCascadesGetProbeSlot(
+      cascades,
+      RadianceCascadesProbeIndex(
+        cascades.config, RadianceCascadesProbeBoxGridPos(box, boxIndex), 0),
+      0);
+    if (slot == RADIANCE_CASCADES_SPARSE_BRICK_EMPTY) {
+      continue;
+    }
+    lo = Min(lo, slot);
+    hi = Max(hi, slot + 1);
+  }
+  if (hi <= lo) {
+    return;
+  }
+  glNamedBufferSubData(cascades.irradiance.handle,
+                       u64(lo) * sizeof(RadianceCascadesIrradianceProbe),
+                       u64(hi - lo) * sizeof(RadianceCascadesIrradianceProbe),
+                       cascades.cpu.irradiance + lo);
+}
+
+// Run the plan on the CPU and upload the results into the same textures the GL path
+// writes
+static void
+RadianceCascadesTickCPU(RadianceCascades &cascades,
+                        const RadianceCascadesUpdatePlan &plan) {
+  cascades.cpu.keepOriginalAtlasCopy = cascades.keepOriginalAtlasCopy;
+  cascades.cpu.stats = &cascades.stats;
+  cascades.cpu.distanceBricks = cascades.config.distanceBricks.enabled
+                                  ? &cascades.distanceBricks
+                                  : nullptr;
+  // a new unmerged atlas has nothing in it yet either
+  const bool hadOriginal = cascades.cpu.atlasOriginal != nullptr;
+  bool reallocated = !cascades.cpu.atlas;
+  if (!RadianceCascadesCPUInit(cascades.cpu, cascades.config)) {
+    return;
+  }
+  reallocated |= cascades.cpu.atlasOriginal && !hadOriginal;
+
+  RadianceCascadesUpdatePlan fullPlan;
+  const RadianceCascadesUpdatePlan *activePlan = &plan;
+  if (reallocated && !plan.full) {
+    RadianceCascadesPlanFull(fullPlan,
+                             cascades.config,
+                             RadianceCascadesGetLayout(cascades));
+    activePlan = &fullPlan;
+  }
+  // the bricks RadianceCascadesAllocateSparseBricks placed, or the ones a reallocated
+  // cpu lost
+  if (activePlan->full && cascades.sparseBrickTable && cascades.cpu.sparseBricks) {
+    memcpy(cascades.cpu.sparseBricks,
+           cascades.sparseBrickTable,
+           u64(cascades.cpu.layout.sparseBrickTableSize) * sizeof(u32));
+    RadianceCascadesResetSparseProbeValidity(
+      cascades.cpu.layout, cascades.cpu.sparseBricks, cascades.cpu.probeValidity);
+  }
+
+  u64 start = CartContext()->TimeNowMilliseconds();
+  RadianceCascadesCPUUpdate(cascades.cpu, *activePlan);
+  u64 end = CartContext()->TimeNowMilliseconds();
+  ImGui::Text("RadianceCascadesTick/CPUUpdate %llums threads(%u) full(%i)\n",
+              (unsigned long long)(end - start),
+              RadianceCascadesCPUThreadCount(cascades.cpu),
+              activePlan->full);
+
+  RadianceCascadesUploadCPUIrradiance(cascades, activePlan->merge[0]);
+  // a bit per probe, small enough to send whole
+  glNamedBufferSubData(cascades.probeValidity.handle,
+                       0,
+                       u64(RadianceCascadesProbeValidityWordCount(cascades.cpu.layout)) *
+                         sizeof(u32),
+                       cascades.cpu.probeValidity);
+
+  const bool hasOriginal = cascades.cpu.atlasOriginal &&
+                           cascades.octahedralProbeAtlasOriginal.handle;
+  if (activePlan->full) {
+    const v2u32 size(cascades.config.atlasWidth, cascades.config.atlasHeight);
+    for (u32 layer = 0; layer < cascades.config.atlasLayers; layer++) {
+      RadianceCascadesUploadCPUAtlasRect(cascades,
+                                         cascades.octahedralProbeAtlas,
+                                         cascades.cpu.atlas,
+                                         layer,
+                                         v2u32(0),
+                                         size);
+      if (hasOriginal) {
+        RadianceCascadesUploadCPUAtlasRect(cascades,
+                                           cascades.octahedralProbeAtlasOriginal,
+                                           cascades.cpu.atlasOriginal,
+                                           layer,
+                                           v2u32(0),
+                                           size);
       }
     }
-    if (octahedronStitchingprogram) {
-      glUseProgram(octahedronStitchingprogram->handle);
-      Bind(cascades.configUBO, 0, GL_UNIFORM_BUFFER);
-      glBindImageTexture(1,
-                         cascades.octahedralProbeAtlas.handle,
-                         0,
-                         0,
-                         0,
-                         GL_READ_WRITE,
-                         GL_RGBA32F);
+    return;
+  }
+
+  if (hasOriginal) {
+    for (i32 level = activePlan->buildMaxLevel; level >= 0; level--) {
+      RadianceCascadesUploadCPUProbeBox(cascades,
+                                        cascades.octahedralProbeAtlasOriginal,
+                                        cascades.cpu.atlasOriginal,
+                                        level,
+                                        activePlan->build[level]);
     }
+  }
+  for (i32 level = activePlan->mergeMaxLevel; level >= 0; level--) {
+    RadianceCascadesUploadCPUProbeBox(cascades,
+                                      cascades.octahedralProbeAtlas,
+                                      cascades.cpu.atlas,
+                                      level,
+                                      activePlan->merge[level]);
+  }
+}
 
-    GLProgram
-      *cascadeMergeProgram = GLComputeProgram(scratchArena,
-                                              "shaders/radiance-cascades-merge.comp");
+inline void
+RadianceCascadesSetProbeBoxUniforms(i32 minLocation,
+                                    i32 sizeLocation,
+                                    const RadianceCascadesProbeBox &box) {
+  v3u32 size = box.max - box.min;
+  glUniform3ui(minLocation, box.min.x, box.min.y, box.min.z);
+  glUniform3ui(sizeLocation, size.x, size.y, size.z);
+}
 
-    if (cascadeMergeProgram) {
-      glUseProgram(cascadeMergeProgram->handle);
-      Bind(cascades.configUBO, 0, GL_UNIFORM_BUFFER);
-      glBindImageTexture(1,
-                         cascades.octahedralProbeAtlas.handle,
-                         0,
-                         0,
-                         0,
-                         GL_READ_WRITE,
-                         GL_RGBA32F);
-      glUniform1f(2, cascades.debug.mergeTexelGatherOffset);
-      glUniform1f(3, cascades.debug.mergeTexelGatherRatio);
-    }
-    // for (i32 level = cascades.totalLevels - 2; level >= 0; level--) {
-    for (i32 level = maxLevel + 1; level >= 0; level--) {
-      ImGui::Text("grid diameter: %u at level: %u / %u",
-                  cascades.config.atlasGridDiameter,
-                  level,
-                  cascades.config.gridDiameter >> (level + 1));
+// Start timing the dispatches of one stage and level, counters are what the stage is
+// about to do. Returns the timer to pass to RadianceCascadesGPUTimerEnd, or -1 when
+// every query is still in flight and this dispatch goes untimed.
+static i32
+RadianceCascadesGPUTimerBegin(RadianceCascades &cascades,
+                              RadianceCascadesStage stage,
+                              i32 level,
+                              const RadianceCascadesStageCounters &counters) {
+  RadianceCascades::GPUTimers &timers = cascades.gpuTimers;
+  if (!timers.queries[0]) {
+    glCreateQueries(GL_TIME_ELAPSED,
+                    RADIANCE_CASCADES_GPU_TIMER_CAPACITY,
+                    timers.queries);
+  }
+  if (timers.count == RADIANCE_CASCADES_GPU_TIMER_CAPACITY) {
+    return -1;
+  }
+
+  const u32 timer =
+    (timers.first + timers.count++) % RADIANCE_CASCADES_GPU_TIMER_CAPACITY;
+  timers.pending[timer] = {.frame = cascades.stats.frame,
+                           .stage = stage,
+                           .level = level,
+                           .clock = RadianceCascadesStatsClock_GPU,
+                           .milliseconds = 0.0,
+                           .counters = counters};
+  glBeginQuery(GL_TIME_ELAPSED, timers.queries[timer]);
+  return i32(timer);
+}
 
-      u32 atlasProbeDiameter = cascades.config.atlasProbeDiameter * Pow(2u, level);
+inline void
+RadianceCascadesGPUTimerEnd(i32 timer) {
+  if (timer >= 0) {
+    glEndQuery(GL_TIME_ELAPSED);
+  }
+}
 
-      // u32 atlasProbeDiameter = cascades.config.atlasProbeDiameter
-      //                          << (level * cascades.config.branchingFactor);
-      u32 levelProbeCount = cascades.cascade0ProbeCount >> (level * 3);
-      u32 levelRayCount = atlasProbeDiameter * atlasProbeDiameter * levelProbeCount;
+// Push every timed dispatch whose result has come back into stats, never waits on the
+// GPU
+static void
+RadianceCascadesCollectGPUTimers(RadianceCascades &cascades) {
+  RadianceCascades::GPUTimers &timers = cascades.gpuTimers;
+  while (timers.count) {
+    const GLuint query = timers.queries[timers.first];
+    GLint available = 0;
+    glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available) {
+      return;
+    }
 
-      // Merge down
-      if (cascadeMergeProgram) {
-        ImGui::Text("merge: %i rays: %i", level, levelRayCount);
-        glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT |
-                        GL_TEXTURE_FETCH_BARRIER_BIT);
-        glUseProgram(cascadeMergeProgram->handle);
-        glUniform1ui(0, level);
+    GLuint64 nanoseconds = 0;
+    glGetQueryObjectui64v(query, GL_QUERY_RESULT, &nanoseconds);
+    RadianceCascadesStatsSample &sample = timers.pending[timers.first];
+    sample.milliseconds = f64(nanoseconds) / 1000000.0;
+    RadianceCascadesStatsPush(cascades.stats, sample);
 
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D_ARRAY, cascades.octahedralProbeAtlas.handle);
-        glUniform1i(1, 0);
+    timers.first = (timers.first + 1) % RADIANCE_CASCADES_GPU_TIMER_CAPACITY;
+    timers.count--;
+  }
+}
+
+// Read back the build's march step counters into this frame's pending build samples and
+// the step histogram of the levels that were built. Waits for the build to finish, only
+// done with RADIANCE_CASCADES_DEBUG_COUNT_MARCH_STEPS.
+static void
+RadianceCascadesReadMarchStepCounters(RadianceCascades &cascades,
+                                      const RadianceCascadesUpdatePlan &plan) {
+  RadianceCascadesMarchCounters counters = {};
+  glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+  glGetNamedBufferSubData(cascades.marchStepCounters.handle,
+                          0,
+                          sizeof(counters),
+                          &counters);
+
+  for (i32 level = plan.buildMaxLevel; level >= 0; level--) {
+    if (!RadianceCascadesProbeBoxCount(plan.build[level])) {
+      continue;
+    }
+    for (u32 bucket = 0; bucket < RADIANCE_CASCADES_STEP_HISTOGRAM_BUCKETS; bucket++) {
+      cascades.stepHistogram.rays[level][bucket] =
+        counters.stepHistogram[level * RADIANCE_CASCADES_STEP_HISTOGRAM_BUCKETS + bucket];
+    }
+  }
+
+  RadianceCascades::GPUTimers &timers = cascades.gpuTimers;
+  for (u32 i = 0; i < timers.count; i++) {
+    RadianceCascadesStatsSample &sample =
+      timers.pending[(timers.first + i) % RADIANCE_CASCADES_GPU_TIMER_CAPACITY];
+    if (sample.frame == cascades.stats.frame &&
+        sample.stage == RadianceCascadesStage_Build) {
+      sample.counters.marchSteps = counters.marchSteps[sample.level];
+    }
+  }
+}
+
+// Trace the plan's probes of one level into the unmerged atlas
+static void
+RadianceCascadesDispatchBuild(RadianceCascades &cascades,
+                              GLProgram *program,
+                              const RadianceCascadesUpdatePlan &plan,
+                              i32 level) {
+  if (!program || level < 0) {
+    return;
+  }
+  const RadianceCascadesProbeBox &box = plan.build[level];
+  u32 boxProbeCount = RadianceCascadesProbeBoxCount(box);
+  if (!boxProbeCount) {
+    return;
+  }
+
+  glUseProgram(program->handle);
+  Bind(cascades.configUBO, 0, GL_UNIFORM_BUFFER);
+  glBindImageTexture(RadianceCascadesAtlasImageUnit(cascades.config),
+                     RadianceCascadesUnmergedAtlas(cascades).handle,
+                     0,
+                     0,
+                     0,
+                     GL_WRITE_ONLY,
+                     RadianceCascadesAtlasInternalFormat(cascades.config));
+
+  glUniform3f(4, plan.regionMin.x, plan.regionMin.y, plan.regionMin.z);
+  glUniform3f(5, plan.regionMax.x, plan.regionMax.y, plan.regionMax.z);
+  glUniform1ui(6, plan.cullToRegion);
+
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_3D, cascades.distanceBrickIndirection.handle);
+  glUniform1i(7, 0);
+  glActiveTexture(GL_TEXTURE1);
+  glBindTexture(GL_TEXTURE_3D, cascades.distanceBrickSamples.handle);
+  glUniform1i(8, 1);
+  glActiveTexture(GL_TEXTURE0);
+
+  Bind(cascades.probeValidity, 6, GL_SHADER_STORAGE_BUFFER);
+  Bind(cascades.sparseBricks, 7, GL_SHADER_STORAGE_BUFFER);
+  if (cascades.config.debugFlags & RADIANCE_CASCADES_DEBUG_COUNT_MARCH_STEPS) {
+    Bind(cascades.marchStepCounters, 4, GL_SHADER_STORAGE_BUFFER);
+  }
+
+  u32 atlasProbeDiameter = RadianceCascadesLevelProbeDiameter(cascades.config, level);
+  u32 levelRayCount = atlasProbeDiameter * atlasProbeDiameter;
+
+  glUniform1ui(0, level);
+
+  v2 rayRange = RadianceCascadesLevelRayRange(cascades.config, level);
+
+  ImGui::Text("level %u rayRange(%f, %f) probes(%u)\n",
+              level,
+              rayRange.x,
+              rayRange.y,
+              boxProbeCount);
+  glUniform2f(1, rayRange.x, rayRange.y);
+  RadianceCascadesSetProbeBoxUniforms(2, 3, box);
+
+  // counts the whole box, probes the shader culls against the region included
+  i32 timer = RadianceCascadesGPUTimerBegin(
+    cascades,
+    RadianceCascadesStage_Build,
+    level,
+    RadianceCascadesProbeTileCounters(
+      boxProbeCount,
+      atlasProbeDiameter,
+      RadianceCascadesAtlasTexelByteSize(cascades.config)));
+  GLDispatch(program, levelRayCount * boxProbeCount);
+  RadianceCascadesGPUTimerEnd(timer);
+}
 
-        glUniform1ui(4, maxLevel);
-        GLDispatch(cascadeMergeProgram, levelRayCount);
+// The reduce kernel specialized on the config's branching factor, the upper texels
+// each lower direction averages are a compile time footprint
+inline const char *
+RadianceCascadesReduceProgramPath(const RadianceCascadesConfig &config) {
+  static const char *paths[RADIANCE_CASCADES_MAX_BRANCHING_FACTOR + 1] = {
+    "shaders/radiance-cascades-reduce-b0.comp",
+    "shaders/radiance-cascades-reduce-b1.comp",
+    "shaders/radiance-cascades-reduce-b2.comp",
+  };
+  return paths[RadianceCascadesBranchingFactor(config)];
+}
+
+// Filter the merged probes of the level above lowerLevel that its merge reads down to
+// lowerLevel's directions
+static void
+RadianceCascadesDispatchReduce(RadianceCascades &cascades,
+                               GLProgram *program,
+                               const RadianceCascadesUpdatePlan &plan,
+                               i32 lowerLevel) {
+  if (!program) {
+    return;
+  }
+  const RadianceCascadesProbeBox box = RadianceCascadesProbeBoxMergeUpperProbes(
+    cascades.config, lowerLevel, plan.merge[lowerLevel]);
+  const u32 boxProbeCount = RadianceCascadesProbeBoxCount(box);
+  if (!boxProbeCount) {
+    return;
+  }
+
+  glUseProgram(program->handle);
+  Bind(cascades.configUBO, 0, GL_UNIFORM_BUFFER);
+  Bind(cascades.reduced, 5, GL_SHADER_STORAGE_BUFFER);
+  Bind(cascades.sparseBricks, 7, GL_SHADER_STORAGE_BUFFER);
+  // the merge above wrote the level and the merge below the last one read the buffer
+  glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+
+  glUniform1ui(0, lowerLevel + 1);
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, cascades.octahedralProbeAtlas.handle);
+  glUniform1i(1, 0);
+  RadianceCascadesSetProbeBoxUniforms(2, 3, box);
+
+  const u32 atlasProbeDiameter = RadianceCascadesLevelProbeDiameter(cascades.config,
+                                                                    lowerLevel);
+  i32 timer = RadianceCascadesGPUTimerBegin(
+    cascades,
+    RadianceCascadesStage_Reduce,
+    lowerLevel + 1,
+    RadianceCascadesReduceCounters(boxProbeCount, atlasProbeDiameter));
+  GLDispatch(program, atlasProbeDiameter * atlasProbeDiameter * boxProbeCount);
+  RadianceCascadesGPUTimerEnd(timer);
+}
+
+// Merge the level above into the plan's probes of one level, the merge also writes the
+// octahedral borders of the texels it produces so there is no stitching pass. Reads
+// the level above through RadianceCascadesDispatchReduce's output.
+static void
+RadianceCascadesDispatchMerge(RadianceCascades &cascades,
+                              GLProgram *program,
+                              const RadianceCascadesUpdatePlan &plan,
+                              i32 level) {
+  if (!program) {
+    return;
+  }
+  const RadianceCascadesProbeBox &box = plan.merge[level];
+  const u32 boxProbeCount = RadianceCascadesProbeBoxCount(box);
+  if (!boxProbeCount) {
+    return;
+  }
+
+  glUseProgram(program->handle);
+  Bind(cascades.configUBO, 0, GL_UNIFORM_BUFFER);
+  Bind(cascades.reduced, 5, GL_SHADER_STORAGE_BUFFER);
+  Bind(cascades.probeValidity, 6, GL_SHADER_STORAGE_BUFFER);
+  Bind(cascades.sparseBricks, 7, GL_SHADER_STORAGE_BUFFER);
+  glBindImageTexture(RadianceCascadesAtlasImageUnit(cascades.config),
+                     cascades.octahedralProbeAtlas.handle,
+                     0,
+                     0,
+                     0,
+                     GL_READ_WRITE,
+                     RadianceCascadesAtlasInternalFormat(cascades.config));
+  u32 atlasProbeDiameter = RadianceCascadesLevelProbeDiameter(cascades.config, level);
+  u32 levelRayCount = atlasProbeDiameter * atlasProbeDiameter * boxProbeCount;
+
+  ImGui::Text("merge: %i rays: %u", level, levelRayCount);
+  glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT |
+                  GL_SHADER_STORAGE_BARRIER_BIT);
+  glUniform1ui(0, level);
+
+  glActiveTexture(GL_TEXTURE1);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, RadianceCascadesUnmergedAtlas(cascades).handle);
+  glUniform1i(5, 1);
+  glActiveTexture(GL_TEXTURE0);
+
+  RadianceCascadesSetProbeBoxUniforms(6, 7, box);
+  i32 timer = RadianceCascadesGPUTimerBegin(
+    cascades,
+    RadianceCascadesStage_Merge,
+    level,
+    RadianceCascadesProbeTileCounters(
+      boxProbeCount,
+      atlasProbeDiameter,
+      RadianceCascadesAtlasTexelByteSize(cascades.config)));
+  const u32 probeRayCount = atlasProbeDiameter * atlasProbeDiameter;
+  GLDispatch(program, RadianceCascadesMergeInvocationCount(box, probeRayCount));
+  RadianceCascadesGPUTimerEnd(timer);
+}
+
+// Run one update plan on the selected backend
+static void
+RadianceCascadesExecutePlan(RadianceCascades &cascades,
+                            RadianceCascadesUpdatePlan plan,
+                            const MemoryArena &scratchArena) {
+  // incremental plans re-merge from the unmerged atlas, unless they re-trace everything
+  // they re-merge
+  if (!plan.full && !cascades.keepOriginalAtlasCopy &&
+      !RadianceCascadesPlanMergesInPlace(plan)) {
+    RadianceCascadesPlanFull(plan, cascades.config, RadianceCascadesGetLayout(cascades));
+  }
+
+  // the CPU backend clears its own atlases, the textures it uploads into are cleared
+  // here for both
+  if (!plan.full && plan.clearLevels) {
+    RadianceCascadesClearAtlasLevels(cascades,
+                                     cascades.octahedralProbeAtlas,
+                                     plan.clearLevels);
+    RadianceCascadesClearAtlasLevels(cascades,
+                                     cascades.octahedralProbeAtlasOriginal,
+                                     plan.clearLevels);
+  }
+
+  if (cascades.backend == RadianceCascadesBackend_CPU) {
+    RadianceCascadesTickCPU(cascades, plan);
+    return;
+  }
+
+  if (plan.full) {
+    glClearTexImage(cascades.octahedralProbeAtlas.handle, 0, GL_RGBA, GL_FLOAT, nullptr);
+    if (cascades.octahedralProbeAtlasOriginal.handle) {
+      glClearTexImage(cascades.octahedralProbeAtlasOriginal.handle,
+                      0,
+                      GL_RGBA,
+                      GL_FLOAT,
+                      nullptr);
+    }
+  }
+
+  GLProgram *buildProgram = GLComputeProgram(scratchArena,
+                                             "shaders/radiance-cascades-build.comp");
+  GLProgram *mergeProgram = GLComputeProgram(scratchArena,
+                                             "shaders/radiance-cascades-merge.comp");
+  GLProgram *reduceProgram = GLComputeProgram(
+    scratchArena, RadianceCascadesReduceProgramPath(cascades.config));
+  // the merge reads the level above only through the reduce pass
+  if (!reduceProgram) {
+    mergeProgram = nullptr;
+  }
+  ImGui::Text("RadianceCascadesTick/BuildCascadeLevels full(%i)\n", plan.full);
+
+  const bool countMarchSteps =
+    buildProgram &&
+    (cascades.config.debugFlags & RADIANCE_CASCADES_DEBUG_COUNT_MARCH_STEPS);
+  if (countMarchSteps) {
+    glClearNamedBufferData(cascades.marchStepCounters.handle,
+                           GL_R32UI,
+                           GL_RED_INTEGER,
+                           GL_UNSIGNED_INT,
+                           nullptr);
+  }
+
+  // A level's merge only waits on its own build and the reduced merge above it, but a
+  // memory barrier waits on everything before it. Each level's build goes out right
+  // after the merge of the level above so the two share a barrier interval: the big
+  // lower level builds fill the GPU next to the small upper merges instead of all of
+  // them finishing before the first merge starts.
+  for (i32 level = plan.buildMaxLevel; level >= plan.mergeMaxLevel; level--) {
+    RadianceCascadesDispatchBuild(cascades, buildProgram, plan, level);
+  }
+  for (i32 level = plan.mergeMaxLevel; level >= 0; level--) {
+    RadianceCascadesDispatchReduce(cascades, reduceProgram, plan, level);
+    RadianceCascadesDispatchMerge(cascades, mergeProgram, plan, level);
+    if (level - 1 <= plan.buildMaxLevel) {
+      RadianceCascadesDispatchBuild(cascades, buildProgram, plan, level - 1);
+    }
+  }
+
+  if (countMarchSteps) {
+    RadianceCascadesReadMarchStepCounters(cascades, plan);
+  }
+
+  // Pre-integrate the merged level 0 probes for the final gather
+  {
+    const RadianceCascadesProbeBox &box = plan.merge[0];
+    const u32 boxProbeCount = RadianceCascadesProbeBoxCount(box);
+    GLProgram *program = GLComputeProgram(scratchArena,
+                                          "shaders/radiance-cascades-irradiance.comp");
+    if (program && boxProbeCount) {
+      glUseProgram(program->handle);
+      Bind(cascades.configUBO, 0, GL_UNIFORM_BUFFER);
+      Bind(cascades.irradiance, 3, GL_SHADER_STORAGE_BUFFER);
+      Bind(cascades.sparseBricks, 7, GL_SHADER_STORAGE_BUFFER);
+      glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+
+      glActiveTexture(GL_TEXTURE0);
+      glBindTexture(GL_TEXTURE_2D_ARRAY, cascades.octahedralProbeAtlas.handle);
+      glUniform1i(0, 0);
+      RadianceCascadesSetProbeBoxUniforms(1, 2, box);
+
+      ImGui::Text("irradiance: probes: %u", boxProbeCount);
+      i32 timer = RadianceCascadesGPUTimerBegin(
+        cascades,
+        RadianceCascadesStage_Irradiance,
+        0,
+        RadianceCascadesIrradianceCounters(
+          boxProbeCount, RadianceCascadesLevelProbeDiameter(cascades.config, 0)));
+      GLDispatch(program, boxProbeCount);
+      RadianceCascadesGPUTimerEnd(timer);
+      glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    }
+  }
+}
+
+// What the cache files are keyed with besides the config, the backends don't agree bit
+// for bit
+inline u64
+RadianceCascadesBakeCacheSceneHash(const RadianceCascades &cascades) {
+  return RadianceCascadesHashBytes(
+    &cascades.backend, sizeof(cascades.backend), cascades.bakeCache.sceneHash);
+}
+
+// Upload (and for the CPU backend copy) the next byteBudget bytes of the bake cache that
+// is streaming in, 0 is all of it. Returns true once all of it is resident.
+static bool
+RadianceCascadesStreamBakeCache(RadianceCascades &cascades, u64 byteBudget) {
+  using namespace RadianceCascadesKernels;
+  RadianceCascadesBakeCacheStream &stream = cascades.bakeCache.stream;
+  const RadianceCascadesLayout layout = RadianceCascadesGetLayout(cascades);
+  const u32 w = cascades.config.atlasWidth;
+  const u32 h = cascades.config.atlasHeight;
+  RadianceCascadesCPU &cpu = cascades.cpu;
+  const bool toCPU = cascades.backend == RadianceCascadesBackend_CPU;
+
+  const bool done = RadianceCascadesBakeCacheStreamStep(
+    stream,
+    cascades.config,
+    byteBudget,
+    [&](const RadianceCascadesBakeCacheSection &section,
+        u32 firstRow,
+        u32 rowCount,
+        const u8 *data) {
+      const PackedTexel *texels = (const PackedTexel *)data;
+      switch (section.kind) {
+        case RadianceCascadesBakeCacheSection_AtlasLevel: {
+          const RadianceCascadesLevelRect &rect = cascades.config.levels[section.level];
+          const u32 width =
+            RadianceCascadesLevelExtent(cascades.config, layout, section.level).x;
+          const v2u32 lo(rect.x, rect.y + firstRow);
+          RadianceCascadesUploadAtlasTexels(cascades,
+                                            cascades.octahedralProbeAtlas,
+                                            texels,
+                                            width,
+                                            rect.layer,
+                                            lo,
+                                            lo + v2u32(width, rowCount));
+          for (u32 row = 0; toCPU && row < rowCount; row++) {
+            PackedTexel &dst =
+              RadianceCascadesCPUTexel(cpu, cpu.atlas, lo.x, lo.y + row, rect.layer);
+            memcpy(&dst,
+                   texels + u64(row) * width,
+                   u64(width) * sizeof(PackedTexel));
+          }
+        } break;
+        case RadianceCascadesBakeCacheSection_Atlas:
+        case RadianceCascadesBakeCacheSection_AtlasOriginal: {
+          const bool original =
+            section.kind == RadianceCascadesBakeCacheSection_AtlasOriginal;
+          const Texture &texture = original ? cascades.octahedralProbeAtlasOriginal
+                                            : cascades.octahedralProbeAtlas;
+          // rows run on from one layer into the next
+          for (u32 row = firstRow; row < firstRow + rowCount;) {
+            const u32 layer = row / h;
+            const u32 y = row % h;
+            const u32 layerRows = Min(h - y, firstRow + rowCount - row);
+            RadianceCascadesUploadAtlasTexels(cascades,
+                                              texture,
+                                              texels + u64(row - firstRow) * w,
+                                              w,
+                                              layer,
+                                              v2u32(0, y),
+                                              v2u32(w, y + layerRows));
+            row += layerRows;
+          }
+          PackedTexel *dst = original ? cpu.atlasOriginal : cpu.atlas;
+          if (toCPU && dst) {
+            memcpy(dst + u64(firstRow) * w,
+                   texels,
+                   u64(rowCount) * w * sizeof(PackedTexel));
+          }
+        } break;
+        case RadianceCascadesBakeCacheSection_Irradiance:
+          glNamedBufferSubData(cascades.irradiance.handle, 0, section.byteSize, data);
+          if (toCPU) {
+            memcpy(cpu.irradiance, data, section.byteSize);
+          }
+          break;
+        case RadianceCascadesBakeCacheSection_ProbeValidity:
+          glNamedBufferSubData(cascades.probeValidity.handle, 0, section.byteSize, data);
+          if (toCPU) {
+            memcpy(cpu.probeValidity, data, section.byteSize);
+          }
+          break;
+        case RadianceCascadesBakeCacheSection_SparseBricks:
+          glNamedBufferSubData(cascades.sparseBricks.handle, 0, section.byteSize, data);
+          if (cascades.sparseBrickTable) {
+            memcpy(cascades.sparseBrickTable, data, section.byteSize);
+          }
+          if (toCPU && cpu.sparseBricks) {
+            memcpy(cpu.sparseBricks, data, section.byteSize);
+          }
+          break;
       }
+    });
 
-      // Stich the Octahedron folds
-      if (octahedronStitchingprogram) {
-        glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT |
-                        GL_TEXTURE_FETCH_BARRIER_BIT);
-        glUseProgram(octahedronStitchingprogram->handle);
-        glUniform1ui(0, level);
-        const u32 levelProbeCount = cascades.cascade0ProbeCount >> (level * 3);
-        glUniform1ui(2, levelProbeCount);
-        ImGui::Text("stitch: %i probes: %u", level, levelProbeCount);
-        GLDispatch(octahedronStitchingprogram, levelProbeCount);
+  if (done) {
+    RadianceCascadesBakeCacheStreamEnd(stream);
+    u64 end = CartContext()->TimeNowMilliseconds();
+    printf("RadianceCascadesStreamBakeCache: resident after %llums\n",
+           (unsigned long long)(end - cascades.bakeCache.streamStart));
+  }
+  return done;
+}
+
+// Replace a full rebuild with the cached bake of the current config, if there is one.
+// The texels are uploaded straight from the mapped file, the CPU backend also copies
+// them into its own atlases so incremental updates can carry on from there. A per level
+// file streams in over the next ticks, coarse levels first, see
+// RadianceCascadesGatherLevel.
+static bool
+RadianceCascadesLoadBakeCache(RadianceCascades &cascades) {
+  const u64 sceneHash = RadianceCascadesBakeCacheSceneHash(cascades);
+  char path[512];
+  RadianceCascadesBakeCachePath(
+    path, sizeof(path), cascades.bakeCache.directory, cascades.config, sceneHash);
+
+  RadianceCascadesBakeCacheFile file;
+  if (!RadianceCascadesBakeCacheOpen(file, path, cascades.config, sceneHash)) {
+    return false;
+  }
+
+  const bool hasOriginal = cascades.octahedralProbeAtlasOriginal.handle != 0;
+  bool loaded = RadianceCascadesBakeCacheComplete(file, cascades.config, hasOriginal);
+  if (loaded && cascades.backend == RadianceCascadesBackend_CPU) {
+    cascades.cpu.keepOriginalAtlasCopy = cascades.keepOriginalAtlasCopy;
+    loaded = RadianceCascadesCPUInit(cascades.cpu, cascades.config);
+  }
+  if (!loaded) {
+    RadianceCascadesBakeCacheClose(file);
+    return false;
+  }
+
+  printf("RadianceCascadesLoadBakeCache: %s %s\n",
+         RadianceCascadesBakeCacheFind(file, RadianceCascadesBakeCacheSection_Atlas)
+           ? "loading"
+           : "streaming",
+         path);
+  // a whole atlas section only becomes usable once it is all there
+  const bool wholeAtlas =
+    RadianceCascadesBakeCacheFind(file, RadianceCascadesBakeCacheSection_Atlas);
+  const u64 byteBudget = wholeAtlas ? 0 : cascades.bakeCache.streamBytesPerTick;
+  const i32 firstLevel =
+    RadianceCascadesMergeMaxLevel(cascades.config, RadianceCascadesGetLayout(cascades));
+  RadianceCascadesBakeCacheStream &stream = cascades.bakeCache.stream;
+  cascades.bakeCache.streamStart = CartContext()->TimeNowMilliseconds();
+  RadianceCascadesBakeCacheStreamBegin(stream, file);
+  // the next frame already has the coarsest merged level to gather from
+  while (RadianceCascadesBakeCacheStreaming(stream) &&
+         stream.residentLevel > firstLevel) {
+    RadianceCascadesStreamBakeCache(cascades, byteBudget);
+  }
+  return true;
+}
+
+// Read a whole GL atlas back as CPU atlas texels, returns false on allocation failure
+static bool
+RadianceCascadesReadBackAtlas(const RadianceCascades &cascades,
+                              const Texture &texture,
+                              RadianceCascadesKernels::PackedTexel *atlas) {
+  using namespace RadianceCascadesKernels;
+  const u64 texelCount = u64(cascades.config.atlasWidth) * cascades.config.atlasHeight *
+                         cascades.config.atlasLayers;
+  if (cascades.config.atlasFormat != RADIANCE_CASCADES_ATLAS_FORMAT_COMPACT) {
+    glGetTextureImage(
+      texture.handle, 0, GL_RGBA, GL_FLOAT, texelCount * sizeof(PackedTexel), atlas);
+    return true;
+  }
+
+  CompactTexel *compact = (CompactTexel *)malloc(texelCount * sizeof(CompactTexel));
+  if (!compact) {
+    return false;
+  }
+  glGetTextureImage(
+    texture.handle, 0, GL_RG, GL_FLOAT, texelCount * sizeof(CompactTexel), compact);
+  for (u64 i = 0; i < texelCount; i++) {
+    atlas[i] = PackMapResult(UnpackMapResultCompact(compact[i]));
+  }
+  free(compact);
+  return true;
+}
+
+// Write the bake that just finished to disk, the GL backend reads its atlases back
+// first. Waits on the GPU.
+static void
+RadianceCascadesWriteBakeCache(RadianceCascades &cascades) {
+  using namespace RadianceCascadesKernels;
+  const u64 sceneHash = RadianceCascadesBakeCacheSceneHash(cascades);
+  char path[512];
+  RadianceCascadesBakeCachePath(
+    path, sizeof(path), cascades.bakeCache.directory, cascades.config, sceneHash);
+
+  u64 start = CartContext()->TimeNowMilliseconds();
+  RadianceCascadesBakeCacheContents contents = {};
+  PackedTexel *atlas = nullptr;
+  PackedTexel *atlasOriginal = nullptr;
+  RadianceCascadesIrradianceProbe *irradiance = nullptr;
+  u32 *probeValidity = nullptr;
+  if (cascades.backend == RadianceCascadesBackend_CPU) {
+    if (!cascades.cpu.atlas) {
+      return;
+    }
+    contents = RadianceCascadesCPUBakeCacheContents(cascades.cpu);
+  } else {
+    const u64 atlasByteSize = RadianceCascadesAtlasTexelCount(
+                                RadianceCascadesGetLayout(cascades)) *
+                              sizeof(PackedTexel);
+    const bool hasOriginal = cascades.octahedralProbeAtlasOriginal.handle != 0;
+    atlas = (PackedTexel *)malloc(atlasByteSize);
+    atlasOriginal = hasOriginal ? (PackedTexel *)malloc(atlasByteSize) : nullptr;
+    const u32 irradianceProbeCount = RadianceCascadesIrradianceProbeCount(
+      cascades.config, RadianceCascadesGetLayout(cascades));
+    irradiance = (RadianceCascadesIrradianceProbe *)malloc(
+      u64(irradianceProbeCount) * sizeof(RadianceCascadesIrradianceProbe));
+    const u64 validityByteSize = u64(RadianceCascadesProbeValidityWordCount(
+                                   RadianceCascadesGetLayout(cascades))) *
+                                 sizeof(u32);
+    probeValidity = (u32 *)malloc(validityByteSize);
+
+    glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+    bool ok = atlas && irradiance && probeValidity && (!hasOriginal || atlasOriginal) &&
+              RadianceCascadesReadBackAtlas(
+                cascades, cascades.octahedralProbeAtlas, atlas) &&
+              (!hasOriginal ||
+               RadianceCascadesReadBackAtlas(
+                 cascades, cascades.octahedralProbeAtlasOriginal, atlasOriginal));
+    if (!ok) {
+      printf("RadianceCascadesWriteBakeCache: failed to read back %.2fMB atlas\n",
+             f64(atlasByteSize) / (1024.0 * 1024.0));
+      free(atlas);
+      free(atlasOriginal);
+      free(irradiance);
+      free(probeValidity);
+      return;
+    }
+    glGetNamedBufferSubData(cascades.irradiance.handle,
+                            0,
+                            u64(irradianceProbeCount) *
+                              sizeof(RadianceCascadesIrradianceProbe),
+                            irradiance);
+    glGetNamedBufferSubData(cascades.probeValidity.handle,
+                            0,
+                            validityByteSize,
+                            probeValidity);
+    contents = {.atlas = atlas,
+                .atlasOriginal = atlasOriginal,
+                .irradiance = irradiance,
+                .irradianceProbeCount = irradianceProbeCount,
+                .probeValidity = probeValidity,
+                .sparseBricks = cascades.sparseBrickTable};
+  }
+
+  if (RadianceCascadesBakeCacheWrite(path,
+                                     cascades.config,
+                                     sceneHash,
+                                     contents,
+                                     cascades.bakeCache.perLevel
+                                       ? RADIANCE_CASCADES_BAKE_CACHE_PER_LEVEL
+                                       : 0)) {
+    u64 end = CartContext()->TimeNowMilliseconds();
+    printf("RadianceCascadesWriteBakeCache: wrote %s in %llums\n",
+           path,
+           (unsigned long long)(end - start));
+  }
+  free(atlas);
+  free(atlasOriginal);
+  free(irradiance);
+  free(probeValidity);
+}
+
+static void
+RadianceCascadesTick(RadianceCascades &cascades, const MemoryArena &scratchArena) {
+  const RadianceCascadesLayout layout = RadianceCascadesGetLayout(cascades);
+  // sparse bricks are placed for a fixed window, the clipmap would scroll probes into
+  // bricks without storage
+  const bool sparse = cascades.sparseBrickTable != nullptr;
+  const v3 eye = cascades.clipmap.enabled && !sparse ? cascades.clipmap.eye : v3(0.0f);
+  RadianceCascadesUpdatePlan plan;
+
+  RadianceCascadesCollectGPUTimers(cascades);
+  cascades.stats.frame++;
+
+  // nothing is traced while a bake cache streams in, scene edits wait for it to finish
+  if (RadianceCascadesBakeCacheStreaming(cascades.bakeCache.stream)) {
+    if (!cascades.debug.dirty && !cascades.clipmap.enabled) {
+      RadianceCascadesStreamBakeCache(cascades, cascades.bakeCache.streamBytesPerTick);
+      return;
+    }
+    RadianceCascadesBakeCacheStreamEnd(cascades.bakeCache.stream);
+    cascades.debug.dirty = true;
+  }
+
+  // scene changes re-bake the distance bricks they can reach before anything is traced
+  if (cascades.regionDirty && cascades.config.distanceBricks.enabled) {
+    RadianceCascadesCPUInvalidateDistanceBricks(
+      cascades.distanceBricks,
+      RadianceCascadesCPUThreadCount(cascades.cpu),
+      cascades.dirtyRegionMin,
+      cascades.dirtyRegionMax);
+    RadianceCascadesUploadDistanceBricks(cascades);
+  }
+
+  // nothing is traced into a brick without storage, an edit or reconfigure that moves
+  // the scene's surfaces to other bricks places them again
+  if (sparse && !cascades.debug.dirty &&
+      (cascades.regionDirty || !RadianceCascadesStaleLevelsEmpty(cascades.staleLevels)) &&
+      RadianceCascadesSparseBricksStale(cascades.config,
+                                        layout,
+                                        RadianceCascadesCPUThreadCount(cascades.cpu),
+                                        cascades.sparseBrickTable)) {
+    cascades.debug.dirty = true;
+  }
+
+  // A rebuild or a camera jump recenters every level and traces everything
+  if (cascades.debug.dirty ||
+      RadianceCascadesScrollIsJump(cascades.config, layout, eye)) {
+    RadianceCascadesScrollTo(cascades.config, layout, eye);
+    RadianceCascadesUploadConfig(cascades);
+    RadianceCascadesPlanFull(plan, cascades.config, layout);
+    // a scene edit since the last tick isn't part of the cache key
+    const bool bakeCache = cascades.bakeCache.enabled && !cascades.clipmap.enabled &&
+                           !cascades.regionDirty;
+    cascades.debug.dirty = false;
+    cascades.regionDirty = false;
+    cascades.staleLevels = {};
+    if (bakeCache && RadianceCascadesLoadBakeCache(cascades)) {
+      return;
+    }
+    if (sparse) {
+      // growing the slots reconfigures, which asks for the rebuild this is
+      RadianceCascadesAllocateSparseBricks(cascades);
+      RadianceCascadesPlanFull(
+        plan, cascades.config, RadianceCascadesGetLayout(cascades));
+      cascades.debug.dirty = false;
+      cascades.staleLevels = {};
+    }
+    RadianceCascadesExecutePlan(cascades, plan, scratchArena);
+    if (bakeCache) {
+      RadianceCascadesWriteBakeCache(cascades);
+    }
+    return;
+  }
+
+  // a reconfigure that kept the atlas only redoes the levels it changed
+  if (!RadianceCascadesStaleLevelsEmpty(cascades.staleLevels)) {
+    RadianceCascadesPlanStale(plan,
+                              cascades.config,
+                              layout,
+                              cascades.staleLevels,
+                              !cascades.keepOriginalAtlasCopy);
+    cascades.staleLevels = {};
+    RadianceCascadesExecutePlan(cascades, plan, scratchArena);
+  }
+
+  bool scrolled = false;
+  if (cascades.clipmap.enabled && !sparse) {
+    for (u32 axis = 0; axis < 3; axis++) {
+      if (!RadianceCascadesPlanScroll(plan, cascades.config, layout, axis, eye)) {
+        continue;
       }
+      RadianceCascadesUploadConfig(cascades);
+      RadianceCascadesExecutePlan(cascades, plan, scratchArena);
+      scrolled = true;
     }
   }
+
+  if (cascades.regionDirty) {
+    RadianceCascadesPlanRegion(plan,
+                               cascades.config,
+                               layout,
+                               cascades.dirtyRegionMin,
+                               cascades.dirtyRegionMax);
+  } else if (cascades.refresh.enabled && !scrolled) {
+    RadianceCascadesPlanScheduled(plan, cascades.config, layout, cascades.refresh);
+  } else {
+    return;
+  }
+  cascades.regionDirty = false;
+  RadianceCascadesExecutePlan(cascades, plan, scratchArena);
 }
 
 static void
@@ -310,6 +1847,9 @@ RadianceCascadesDebugInfo(RadianceCascades &cascades,
                           v3 cameraEye) {
   CartridgeContext *ctx = CartContext();
 
+  // the widgets edit the live config, RadianceCascadesReconfigure diffs it against this
+  const RadianceCascadesConfig previousConfig = cascades.config;
+  const bool previousKeepOriginalAtlasCopy = cascades.keepOriginalAtlasCopy;
   bool configDirty = false;
   if (!ImGui::GetIO().WantCaptureKeyboard) {
     if (ButtonReleased(ctx->inputs.keyboard, Key1)) {
@@ -357,24 +1897,181 @@ RadianceCascadesDebugInfo(RadianceCascades &cascades,
                                 0.05f,
                                 -1,
                                 cascades.totalLevels - 2));
+    {
+      const char *backends[] = {"GL", "CPU"};
+      // the backends don't share their atlases
+      AccumulateOr(cascades.debug.dirty,
+                   ImGui::Combo("backend", (i32 *)&cascades.backend, backends, 2));
+    }
+
+    // these change the atlas textures
+    bool storageDirty = false;
+    AccumulateOr(storageDirty,
+                 ImGui::DragInt3("probe grid dims (pow2)",
+                                 (i32 *)&cascades.config.gridDimX,
+                                 0.05f,
+                                 1,
+                                 1024));
+    {
+      const char *formats[] = {"rgba32f", "compact rg32f"};
+      AccumulateOr(storageDirty,
+                   ImGui::Combo("atlas format",
+                                (i32 *)&cascades.config.atlasFormat,
+                                formats,
+                                2));
+    }
+    {
+      const char *layouts[] = {"probe major", "direction major"};
+      AccumulateOr(storageDirty,
+                   ImGui::Combo("atlas layout",
+                                (i32 *)&cascades.config.atlasLayout,
+                                layouts,
+                                2));
+    }
+    {
+      // sparse needs the probe major layout and keeps the window where it is
+      const char *storages[] = {"dense", "sparse bricks"};
+      AccumulateOr(storageDirty,
+                   ImGui::Combo("probe storage",
+                                (i32 *)&cascades.config.storage,
+                                storages,
+                                2));
+    }
+    {
+      // up to what keeps every level inside an atlas layer
+      const RadianceCascadesLayout layout = RadianceCascadesGetLayout(cascades);
+      const u32 maxBranchingFactor = RadianceCascadesFitBranchingFactor(
+        cascades.config, layout, RADIANCE_CASCADES_MAX_BRANCHING_FACTOR);
+      // each level has 4^branchingFactor times the directions of the one below
+      AccumulateOr(storageDirty,
+                   ImGui::DragInt("branching factor (4^b directions per level)",
+                                  (int *)&cascades.config.branchingFactor,
+                                  0.05f,
+                                  0,
+                                  i32(maxBranchingFactor)));
+      cascades.config.branchingFactor = Min(cascades.config.branchingFactor,
+                                            maxBranchingFactor);
+      u64 totalRays = 0;
+      for (u32 i = 0; i < cascades.totalLevels; i++) {
+        const u32 diameter = RadianceCascadesLevelProbeDiameter(cascades.config, i32(i));
+        const u32 probeCount = RadianceCascadesLevelProbeCount(layout, i32(i));
+        totalRays += u64(probeCount) * diameter * diameter;
+        ImGui::Text("  level %u: %ux%u rays per probe, %u probes",
+                    i,
+                    diameter,
+                    diameter,
+                    probeCount);
+      }
+      ImGui::Text("  total rays: %llu", (unsigned long long)totalRays);
+    }
+    AccumulateOr(storageDirty,
+                 ImGui::Checkbox("keep original atlas", &cascades.keepOriginalAtlasCopy));
+    ImGui::Checkbox("bake cache", &cascades.bakeCache.enabled);
+    if (cascades.bakeCache.enabled) {
+      ImGui::SameLine();
+      ImGui::Checkbox("per level sections", &cascades.bakeCache.perLevel);
+      ImGui::Text("bake cache scene hash %016llx",
+                  (unsigned long long)cascades.bakeCache.sceneHash);
+      i32 streamMB = i32(cascades.bakeCache.streamBytesPerTick / (1024 * 1024));
+      if (ImGui::DragInt("bake cache stream MB per tick (0 all)",
+                         &streamMB,
+                         0.5f,
+                         0,
+                         4096)) {
+        cascades.bakeCache.streamBytesPerTick = u64(streamMB) * 1024 * 1024;
+      }
+      if (RadianceCascadesBakeCacheStreaming(cascades.bakeCache.stream)) {
+        ImGui::Text("streaming, gathering from level %i",
+                    RadianceCascadesGatherLevel(cascades));
+      }
+    }
+    // in units of the level's texel angle
     AccumulateOr(configDirty,
-                 ImGui::DragInt("branching factor 2^i",
-                                (int *)&cascades.config.branchingFactor,
-                                0.05f,
-                                1,
-                                4));
+                 ImGui::DragFloat("march cone epsilon",
+                                  &cascades.config.marchConeEpsilonScale,
+                                  0.01f,
+                                  0.0f,
+                                  4.0f));
+    AccumulateOr(configDirty,
+                 ImGui::DragFloat("march cone min step",
+                                  &cascades.config.marchConeMinStepScale,
+                                  0.01f,
+                                  0.0f,
+                                  4.0f));
     for (u32 i = 0; i < cascades.totalLevels; i++) {
-      ImGui::Text("%u %u", i, cascades.config.atlasProbeDiameter * Pow(2u, i));
+      char label[64];
+      snprintf(label, sizeof(label), "level %u max steps (0 unbounded)", i);
+      AccumulateOr(configDirty,
+                   ImGui::DragInt(label,
+                                  (int *)&cascades.config.marchMaxSteps[i],
+                                  1.0f,
+                                  0,
+                                  4096));
+    }
+
+    if (ImGui::Checkbox("amortized refresh", &cascades.refresh.enabled) &&
+        cascades.refresh.enabled && !cascades.keepOriginalAtlasCopy) {
+      cascades.keepOriginalAtlasCopy = true;
+      storageDirty = true;
+    }
+    ImGui::DragInt("c0 refresh period",
+                   (int *)&cascades.refresh.level0Period,
+                   0.05f,
+                   1,
+                   64);
+    ImGui::DragInt("refresh period scale",
+                   (int *)&cascades.refresh.periodScale,
+                   0.05f,
+                   1,
+                   8);
+
+    {
+      bool distanceBricks = cascades.config.distanceBricks.enabled;
+      if (ImGui::Checkbox("distance brick cache", &distanceBricks)) {
+        if (distanceBricks) {
+          // the probe window plus as much again on every side
+          const RadianceCascadesConfig &config = cascades.config;
+          const u32 gridDimMax =
+            Max(Max(config.gridDimX, config.gridDimY), config.gridDimZ);
+          const f32 extent = f32(gridDimMax) * cascades.config.scale;
+          RadianceCascadesEnableDistanceBricks(cascades,
+                                               v3(-extent),
+                                               v3(extent),
+                                               cascades.config.scale);
+        } else {
+          RadianceCascadesDisableDistanceBricks(cascades);
+        }
+      }
+      if (distanceBricks) {
+        const RadianceCascadesDistanceBricks &bricks = cascades.distanceBricks;
+        ImGui::Text("distance bricks %u/%u with samples",
+                    bricks.slotCount - bricks.freeSlotCount,
+                    RadianceCascadesDistanceBrickCount(bricks.info));
+      }
     }
 
-    if (configDirty) {
-      glNamedBufferSubData(cascades.configUBO.handle,
-                           0,
-                           sizeof(RadianceCascadesConfig),
-                           &cascades.config);
+    // scrolling only traces the exposed slabs and re-merges from the unmerged atlas
+    if (ImGui::Checkbox("follow camera (clipmap)", &cascades.clipmap.enabled)) {
+      if (cascades.clipmap.enabled && !cascades.keepOriginalAtlasCopy) {
+        cascades.keepOriginalAtlasCopy = true;
+        storageDirty = true;
+      }
       cascades.debug.dirty = true;
     }
 
+    if (storageDirty || configDirty) {
+      RadianceCascadesConfig config = cascades.config;
+      const bool keepOriginalAtlasCopy = cascades.keepOriginalAtlasCopy;
+      cascades.config = previousConfig;
+      cascades.keepOriginalAtlasCopy = previousKeepOriginalAtlasCopy;
+      // the distance brick toggle applies its change itself
+      cascades.config.distanceBricks = config.distanceBricks;
+      if (storageDirty) {
+        memset(config.sparseBrickCapacity, 0, sizeof(config.sparseBrickCapacity));
+      }
+      RadianceCascadesReconfigure(cascades, config, keepOriginalAtlasCopy);
+    }
+
     ImGui::Spacing();
     ImGui::Text("Debug - Render Atlas");
     ImGui::Indent();
@@ -399,21 +2096,101 @@ RadianceCascadesDebugInfo(RadianceCascades &cascades,
                     (i32 *)&cascades.debug.debugProbeMergeGridPos,
                     0.1f,
                     0,
-                    cascades.config.atlasGridDiameter);
+                    Max(Max(cascades.config.gridDimX, cascades.config.gridDimY),
+                        cascades.config.gridDimZ) -
+                      1);
     ImGui::Checkbox("debug merge", &cascades.debug.debugMerge);
+    ImGui::Checkbox("irradiance gather", &cascades.debug.gatherIrradiance);
 
-    AccumulateOr(cascades.debug.dirty,
-                 ImGui::DragFloat("gather radius",
-                                  &cascades.debug.mergeTexelGatherOffset,
-                                  0.01f,
-                                  0.00f,
-                                  10.0f));
-    AccumulateOr(cascades.debug.dirty,
-                 ImGui::DragFloat("gather ratio",
-                                  &cascades.debug.mergeTexelGatherRatio,
-                                  0.01f,
-                                  0.0f,
-                                  1.0f));
+    ImGui::Spacing();
+    ImGui::Text("Stats");
+    ImGui::Indent();
+    {
+      bool countMarchSteps = cascades.config.debugFlags &
+                             RADIANCE_CASCADES_DEBUG_COUNT_MARCH_STEPS;
+      // the CPU backend always counts them
+      if (ImGui::Checkbox("count gpu march steps (waits on the build)",
+                          &countMarchSteps)) {
+        cascades.config.debugFlags ^= RADIANCE_CASCADES_DEBUG_COUNT_MARCH_STEPS;
+        RadianceCascadesUploadConfig(cascades);
+      }
+
+      // the newest frame whose samples are in, gpu timings lag a few frames behind
+      const RadianceCascadesStats &stats = cascades.stats;
+      const u32 count = RadianceCascadesStatsCount(stats);
+      if (count) {
+        const u64 frame = RadianceCascadesStatsGet(stats, count - 1).frame;
+        for (u32 stage = 0; stage < RadianceCascadesStage_Count; stage++) {
+          RadianceCascadesStatsSample total = RadianceCascadesStatsFrameTotal(
+            stats, frame, RadianceCascadesStage(stage), -1);
+          if (!total.counters.probes) {
+            continue;
+          }
+          ImGui::Text("frame %llu %s: %.3fms rays(%llu) steps(%llu) probes(%llu) %.2fMB",
+                      (unsigned long long)frame,
+                      RadianceCascadesStageName(RadianceCascadesStage(stage)),
+                      total.milliseconds,
+                      (unsigned long long)total.counters.rays,
+                      (unsigned long long)total.counters.marchSteps,
+                      (unsigned long long)total.counters.probes,
+                      f64(total.counters.bytesWritten) / (1024.0 * 1024.0));
+        }
+      }
+
+      // rays per step count bucket, from the most recent build of each level
+      const RadianceCascadesStepHistogram &histogram =
+        cascades.backend == RadianceCascadesBackend_CPU ? cascades.cpu.stepHistogram
+                                                        : cascades.stepHistogram;
+      for (u32 level = 0; level < cascades.totalLevels; level++) {
+        const u64 *rays = histogram.rays[level];
+        u64 total = 0;
+        for (u32 bucket = 0; bucket < RADIANCE_CASCADES_STEP_HISTOGRAM_BUCKETS;
+             bucket++) {
+          total += rays[bucket];
+        }
+        if (!total) {
+          continue;
+        }
+        ImGui::Text("level %u steps per ray", level);
+        for (u32 bucket = 0; bucket < RADIANCE_CASCADES_STEP_HISTOGRAM_BUCKETS;
+             bucket++) {
+          if (!rays[bucket]) {
+            continue;
+          }
+          u32 lo;
+          u32 hi;
+          RadianceCascadesStepHistogramBucketRange(bucket, lo, hi);
+          const f64 percent = 100.0 * f64(rays[bucket]) / f64(total);
+          if (hi) {
+            ImGui::Text("  [%u, %u): %5.1f%%", lo, hi, percent);
+          } else {
+            ImGui::Text("  [%u, ...): %5.1f%%", lo, percent);
+          }
+        }
+      }
+
+      if (ImGui::Button("write radiance-cascades-stats.csv")) {
+        FILE *file = fopen("radiance-cascades-stats.csv", "w");
+        if (file) {
+          RadianceCascadesStatsWriteCSVHeader(file);
+          RadianceCascadesStatsWriteCSV(stats, file);
+          fclose(file);
+        }
+      }
+    }
+    ImGui::Unindent();
+
+    // only the debug merge view reads these, nothing has to be rebuilt
+    ImGui::DragFloat("gather radius",
+                     &cascades.debug.mergeTexelGatherOffset,
+                     0.01f,
+                     0.00f,
+                     10.0f);
+    ImGui::DragFloat("gather ratio",
+                     &cascades.debug.mergeTexelGatherRatio,
+                     0.01f,
+                     0.0f,
+                     1.0f);
     ImGui::Checkbox("sample original", &cascades.debug.mergeTexelSampleOriginal);
 
     ImGui::End();
@@ -426,6 +2203,7 @@ RadianceCascadesDebugInfo(RadianceCascades &cascades,
                                          "shaders/quad.vert");
     if (program) {
       glUseProgram(program->handle);
+      Bind(cascades.sparseBricks, 7, GL_SHADER_STORAGE_BUFFER);
 
       v2 screenDims(ctx->opengl.width, ctx->opengl.height);
       glUniform2fv(0, 1, (const GLfloat *)&screenDims);
@@ -490,7 +2268,8 @@ RadianceCascadesDebugInfo(RadianceCascades &cascades,
         labelPos.y = screenDims.y - labelPos.y;
         dl->AddText(labelPos, 0xFFFFFFFF, "original");
         glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D_ARRAY, cascades.octahedralProbeAtlasOriginal.handle);
+        glBindTexture(GL_TEXTURE_2D_ARRAY,
+                      RadianceCascadesUnmergedAtlas(cascades).handle);
         glUniform1i(1, 0);
 
         glUniform1i(2, cascades.debug.debugProbeMergeLevel);
@@ -551,7 +2330,8 @@ RadianceCascadesDebugInfo(RadianceCascades &cascades,
         dl->AddText(labelPos, 0xFFFFFFFF, "computed");
 
         glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D_ARRAY, cascades.octahedralProbeAtlasOriginal.handle);
+        glBindTexture(GL_TEXTURE_2D_ARRAY,
+                      RadianceCascadesUnmergedAtlas(cascades).handle);
         glUniform1i(1, 0);
 
         glUniform1i(2, cascades.debug.debugProbeMergeLevel);
@@ -574,11 +2354,13 @@ RadianceCascadesDebugInfo(RadianceCascades &cascades,
 
         u32 lowerLevel = cascades.debug.debugProbeMergeLevel;
         v3 lowerGridPos = v3(cascades.debug.debugProbeMergeGridPos) + 0.5;
-        f32 upperGridDiameter = f32(cascades.config.gridDiameter >> (lowerLevel + 1));
+        v3 upperGridMax = v3(RadianceCascadesLevelGridDims(cascades.config,
+                                                           lowerLevel + 1)) -
+                          1.0f;
         v3 upperOffset = v3(MortonDecode(upper));
         v3 upperGridPos = Clamp(Floor(lowerGridPos * 0.5f - 0.5f) + upperOffset,
                                 v3(0.0f),
-                                upperGridDiameter);
+                                upperGridMax);
         v3 uvw = Fract(lowerGridPos * 0.5f + 0.5f);
         Dust::Info("upperGridPos: %.2f, %.2f, %.2f uvw: %.2f, %.2f, %.2f",
                    upperGridPos.x,
@@ -607,7 +2389,8 @@ RadianceCascadesDebugInfo(RadianceCascades &cascades,
         }
 
         glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D_ARRAY, cascades.octahedralProbeAtlasOriginal.handle);
+        glBindTexture(GL_TEXTURE_2D_ARRAY,
+                      RadianceCascadesUnmergedAtlas(cascades).handle);
         glUniform1i(1, 0);
 
         glUniform1i(2, cascades.debug.debugProbeMergeLevel + 1);
@@ -665,17 +2448,23 @@ RadianceCascadesDebugInfo(RadianceCascades &cascades,
         v2 offset(0.0f);
 
         if (cascades.debug.renderAtlasFollowCamera) {
-          v3 gridDiameter = v3(cascades.config.gridDiameter >> level);
-          v3 gridRadius = gridDiameter * 0.5f;
+          v3 gridDims = v3(RadianceCascadesLevelGridDims(cascades.config, level));
+          v3 gridRadius = gridDims * 0.5f;
           v3 cellDiameter = v3(1 << level) * cascades.config.scale;
           v3 cellRadius = cellDiameter * 0.5f;
 
-          v3 probeGridPos = (cameraEye / cellDiameter) + gridRadius;
-          u32 probeIndex = MortonEncode(
-            v3u32(Clamp(probeGridPos, v3(0.0f), v3(cascades.config.atlasGridDiameter))));
-          u32 atlasProbeDiameter = cascades.config.atlasProbeDiameter * Pow(2, level);
-          offset = v2(MortonDecode2D(probeIndex) *
-                      OCTAPROBE_PADDED_DIAMETER(atlasProbeDiameter));
+          v3 probeGridPos = (cameraEye / cellDiameter) + gridRadius -
+                            v3(RadianceCascadesGetLevelScroll(cascades.config, level));
+          u32 probeIndex = RadianceCascadesProbeIndex(
+            cascades.config,
+            v3u32(Clamp(probeGridPos, v3(0.0f), gridDims - 1.0f)),
+            level);
+          const u32 slot = RadianceCascadesGetProbeSlot(cascades, probeIndex, level);
+          if (slot != RADIANCE_CASCADES_SPARSE_BRICK_EMPTY) {
+            const RadianceCascadesLevelRect &rect = cascades.config.levels[level];
+            v3u32 origin = RadianceCascadesProbeAtlasOrigin(cascades.config, slot, level);
+            offset = v2(f32(origin.x - rect.x), f32(origin.y - rect.y));
+          }
 
           ImGui::Text("%u offset(%f, %f) grid(%.0f, %.0f, %.0f)",
                       level,
@@ -720,13 +2509,16 @@ RadianceCascadesDebugInfo(RadianceCascades &cascades,
       f32 invSpacing = 1.0f / spacing;
 
       f32 probeCount = Pow(invSpacing, 3) * f32(cascades.cascade0ProbeCount);
-      if (probeCount < 1.0) {
+      if (level >= cascades.totalLevels) {
         break;
       }
 
-      ImGui::Text("Level %u ProbeGridDiameter(%u)\n",
+      v3u32 levelGridDims = RadianceCascadesLevelGridDims(cascades.config, level);
+      ImGui::Text("Level %u ProbeGridDims(%u, %u, %u)\n",
                   level,
-                  cascades.config.gridDiameter << level);
+                  levelGridDims.x,
+                  levelGridDims.y,
+                  levelGridDims.z);
 
       f32 probeDiameter = spacing * f32(cascades.config.atlasProbeDiameter);
       f32 probeTexels = Pow(probeDiameter, 2);
@@ -757,12 +2549,12 @@ RadianceCascadesDebugInfo(RadianceCascades &cascades,
 
       // Rectangle
       {
-        const v2 BaseDims(f32(cascades.config.gridDiameter *
-                              cascades.config.atlasProbeDiameter),
-                          Pow(f32(cascades.config.gridDiameter), 2.0f) *
-                            cascades.config.atlasProbeDiameter);
+        const v2 BaseDims(
+          f32(cascades.config.gridDimX * cascades.config.atlasProbeDiameter),
+          f32(cascades.config.gridDimY * cascades.config.gridDimZ) *
+            cascades.config.atlasProbeDiameter);
 
-        f32 height = Pow(cascades.config.gridDiameter >> level, 2);
+        f32 height = f32(levelGridDims.y * levelGridDims.z);
 
         v2 lo(0.0, 0.0f);
         v2 dims(BaseDims.x, height * probeDiameter);
@@ -793,22 +2585,20 @@ RadianceCascadesDebugInfo(RadianceCascades &cascades,
   if (0) {
     for (i32 level = 0; level < i32(cascades.totalLevels); level++) {
 
-      const f32 gridDiameter = f32(cascades.config.gridDiameter >> level);
-      const f32 gridRadius = gridDiameter * 0.5f;
-      const f32 cellDiameter = cascades.config.scale * f32(1 << level);
-      const f32 cellRadius = cellDiameter * 0.5f;
+      const v3u32 gridDims = RadianceCascadesLevelGridDims(cascades.config, level);
 
       const f32 circleRadius = f32(level + 1) * 3.0;
       ImDrawList *dl = ImGui::GetBackgroundDrawList();
-      for (u32 gx = 0; gx < gridDiameter; gx++) {
-        for (u32 gy = 0; gy < gridDiameter; gy++) {
-          for (u32 gz = 0; gz < gridDiameter; gz++) {
+      for (u32 gx = 0; gx < gridDims.x; gx++) {
+        for (u32 gy = 0; gy < gridDims.y; gy++) {
+          for (u32 gz = 0; gz < gridDims.z; gz++) {
 
-            v3 p = (v3(gx, gy, gz) * cellDiameter) - gridRadius * cellDiameter +
-                   cellRadius;
+            v3 p = RadianceCascadesProbeCenter(cascades.config, v3u32(gx, gy, gz), level);
 
             v2 center = Dust::ProjectPoint(p);
-            u32 index = MortonEncode(gx, gy, gz);
+            u32 index = RadianceCascadesProbeIndex(cascades.config,
+                                                   v3u32(gx, gy, gz),
+                                                   level);
 
             v3i32 col = i32(index + 1) * v3i32(158, 2 * 156, 3 * 159);
             v3 color = v3(col.x % 255, col.y % 253, col.y % 127) / 255.0f;
@@ -821,32 +2611,6 @@ RadianceCascadesDebugInfo(RadianceCascades &cascades,
     }
   }
 
-  // // DEBUG: output probe/ray counts per cascade
-  // if (1) {
-  //   u32 diameter = cascades.config.gridDiameter;
-  //   u32 cascadeIndex = 0;
-  //   ImGui::Text("probe counts");
-  //   u32 totalRays = 0;
-  //   u32 branchingFactor = 4;
-  //   while (diameter > 0) {
-
-  //     u32 raysPerFace = Pow(branchingFactor, cascadeIndex);
-  //     u32 probeRayCount = raysPerFace * 6;
-
-  //     u32 probeCount = Pow(diameter, 3);
-  //     totalRays += probeRayCount * probeCount;
-  //     ImGui::Text("  %u probes: %u probeRayCount: %u total: %u",
-  //                 cascadeIndex,
-  //                 probeCount,
-  //                 probeRayCount,
-  //                 probeRayCount * probeCount);
-
-  //     cascadeIndex++;
-  //     diameter = diameter >> 1;
-  //   }
-  //   ImGui::Text("total rays: %u", totalRays);
-  // }
-
   // DEBUG: Draw a vertical line in the center of the screen
   if (false) {
     ImDrawList *dl = ImGui::GetBackgroundDrawList();
@@ -3,27 +3,177 @@
 
 #include <hotcart/types.h>
 
+#define RADIANCE_CASCADES_MAX_LEVELS 16
+// The reduce pass has a kernel per branching factor, see
+// RadianceCascadesReduceProgramPath
+#define RADIANCE_CASCADES_MAX_BRANCHING_FACTOR 2
+
+// Where a level's block of probe tiles lives in the atlas
+struct RadianceCascadesLevelRect {
+  u32 x;
+  u32 y;
+  u32 layer;
+  u32 pad0;
+};
+
+// How far a level's probe window has scrolled, in that level's cells. Storage is
+// toroidal: a probe lives at (gridPos + scroll) mod dims so it keeps its tile while it
+// stays inside the window.
+struct RadianceCascadesLevelScroll {
+  i32 x;
+  i32 y;
+  i32 z;
+  i32 pad0;
+};
+
+// Sparse distance brick cache, see radiance-cascades/distance-bricks.h. A brick is
+// RADIANCE_CASCADES_DISTANCE_BRICK_CELLS voxels along each axis and stores the distance
+// at its voxel corners, so it can be filtered without reading its neighbors.
+#define RADIANCE_CASCADES_DISTANCE_BRICK_CELLS 7
+#define RADIANCE_CASCADES_DISTANCE_BRICK_SAMPLES \
+  (RADIANCE_CASCADES_DISTANCE_BRICK_CELLS + 1)
+// The GL sample atlas is this many bricks along x and y and grows along z
+#define RADIANCE_CASCADES_DISTANCE_BRICK_ATLAS_BRICKS 32
+
+struct RadianceCascadesDistanceBricksInfo {
+  // world space corner of brick (0, 0, 0)
+  f32 originX;
+  f32 originY;
+  f32 originZ;
+  f32 voxelSize;
+  u32 brickDimX;
+  u32 brickDimY;
+  u32 brickDimZ;
+  // 0 means the build evaluates map() at every step
+  u32 enabled;
+};
+
 struct RadianceCascadesConfig {
-  // cascade level 0 config
-  u32 gridDiameter;
+  // cascade level 0 config, probes along x/y/z. Each is rounded up to a power of two,
+  // the grid is split into cubic morton ordered bricks of the smallest one.
+  u32 gridDimX;
+  u32 gridDimY;
+  u32 gridDimZ;
   f32 rayLength;
   f32 scale;
 
   // octahedral atlas config
   u32 atlasProbeDiameter;
-  u32 atlasGridDiameter;
 
   u32 debugFlags;
-  u32 baseDiameter;
+  u32 atlasWidth;
   i32 maxLevel;
 
+  // log2 of how much a probe's atlas diameter grows per level: level L probes are
+  // atlasProbeDiameter << (L * branchingFactor) texels across, so each level has 4^b
+  // times the directions of the one below. 1 is the classic 4x, 0 keeps every level at
+  // level 0's directions. At most RADIANCE_CASCADES_MAX_BRANCHING_FACTOR, lowered by
+  // the layout until every level fits in an atlas layer. Only the angular resolution
+  // changes, the ray intervals grow 4x per level whatever the factor (see
+  // RadianceCascadesLevelRayRange).
   u32 branchingFactor;
-  u32 pad0;
-  u32 pad1;
-  u32 pad2;
+  // RADIANCE_CASCADES_ATLAS_FORMAT_*
+  u32 atlasFormat;
+  u32 atlasHeight;
+  u32 atlasLayers;
+  // RADIANCE_CASCADES_ATLAS_LAYOUT_*
+  u32 atlasLayout;
+  // RADIANCE_CASCADES_STORAGE_*
+  u32 storage;
+
+  // The build's hit epsilon and minimum step grow with the width of the cone a texel
+  // of the level covers at t: max(0.001, t * texelAngle * marchConeEpsilonScale) and
+  // t * texelAngle * marchConeMinStepScale, see RadianceCascadesLevelTexelAngle. 0
+  // keeps the fixed epsilon and step.
+  f32 marchConeEpsilonScale;
+  f32 marchConeMinStepScale;
+  // Steps a ray of the level may take before it is given up on as a miss, 0 is
+  // unbounded
+  u32 marchMaxSteps[RADIANCE_CASCADES_MAX_LEVELS];
+  // RADIANCE_CASCADES_STORAGE_SPARSE: atlas slots per level in bricks, 0 is one for every
+  // brick of the level. See RadianceCascadesFitSparseBrickCapacity.
+  u32 sparseBrickCapacity[RADIANCE_CASCADES_MAX_LEVELS];
+
+  // filled in from RadianceCascadesComputeLayout
+  RadianceCascadesLevelRect levels[RADIANCE_CASCADES_MAX_LEVELS];
+  // zero unless the cascades follow the camera, see RadianceCascadesPlanScroll
+  RadianceCascadesLevelScroll scroll[RADIANCE_CASCADES_MAX_LEVELS];
+
+  // copied from RadianceCascadesDistanceBricks::info
+  RadianceCascadesDistanceBricksInfo distanceBricks;
 };
 
 #define OCTAPROBE_DEBUG_RENDER_PROBES (1<<0)
+// The GL build adds up its march steps per level into RadianceCascadesMarchCounters,
+// see RadianceCascadesStats
+#define RADIANCE_CASCADES_DEBUG_COUNT_MARCH_STEPS (1<<1)
+
+// Rays per march step count: bucket 0 is rays that took no steps, bucket i > 0 is
+// [2^(i - 1), 2^i) steps and the last bucket is open ended
+#define RADIANCE_CASCADES_STEP_HISTOGRAM_BUCKETS 16
+
+struct RadianceCascadesMarchCounters {
+  u32 marchSteps[RADIANCE_CASCADES_MAX_LEVELS];
+  u32 stepHistogram[RADIANCE_CASCADES_MAX_LEVELS *
+                    RADIANCE_CASCADES_STEP_HISTOGRAM_BUCKETS];
+};
+
+// GL_RGBA32F, 16 bytes: unorm8 color + half emission/throughput (PackMapResult)
+#define RADIANCE_CASCADES_ATLAS_FORMAT_RGBA32F 0
+// GL_RG32F, 8 bytes: unorm8 color + unorm8 throughput, rgb9e5 emission
+// (PackMapResultCompact). Throughput is stored as a single channel, it is always
+// grey for the materials in map().
+#define RADIANCE_CASCADES_ATLAS_FORMAT_COMPACT 1
+
+// Each probe is a padded octahedral tile, tiles are placed in morton order
+#define RADIANCE_CASCADES_ATLAS_LAYOUT_PROBE_MAJOR 0
+// Each padded octahedral texel (direction) is a tile holding that direction for every
+// probe of the level: z slices of the probe grid placed side by side. Spatial neighbors
+// are neighboring texels, so interpolating between probes reads 2x2 texel footprints of
+// two slices instead of 8 tiles scattered across the atlas.
+#define RADIANCE_CASCADES_ATLAS_LAYOUT_DIRECTION_MAJOR 1
+
+// Every probe of the grid has a tile in the atlas
+#define RADIANCE_CASCADES_STORAGE_DENSE 0
+// Probes only have a tile in the bricks near the scene's surfaces, the others read as
+// invalid. A per level table maps each brick to an atlas slot of
+// RADIANCE_CASCADES_SPARSE_BRICK_PROBES tiles or to RADIANCE_CASCADES_SPARSE_BRICK_EMPTY,
+// see RadianceCascadesProbeSlot. Probe-major atlases only.
+#define RADIANCE_CASCADES_STORAGE_SPARSE 1
+// a 4x4x4 morton block, consecutive probe indices
+#define RADIANCE_CASCADES_SPARSE_BRICK_DIAMETER 4
+#define RADIANCE_CASCADES_SPARSE_BRICK_PROBES 64
+#define RADIANCE_CASCADES_SPARSE_BRICK_EMPTY 0xFFFFFFFFu
+
+// The merge works on 2x2x2 blocks of lower probes, RADIANCE_CASCADES_MERGE_TILE_TEXELS
+// texels at a time. The upper probes a block interpolates between always fit in a 3x3x3
+// neighborhood, so each of them is read once per block instead of once per lower probe.
+#define RADIANCE_CASCADES_MERGE_BLOCK_DIAMETER 2
+#define RADIANCE_CASCADES_MERGE_BLOCK_PROBES 8
+#define RADIANCE_CASCADES_MERGE_UPPER_DIAMETER 3
+#define RADIANCE_CASCADES_MERGE_UPPER_PROBES 27
+#define RADIANCE_CASCADES_MERGE_TILE_TEXELS 8
+
+// A direction of an upper level probe box filtered down to the direction resolution of
+// the level below, what the merge interpolates between. Written by the reduce pass
+// once per upper probe instead of by every lower probe that reads it, and kept
+// unpacked so the average isn't quantized a second time. Indexed by the upper probe's
+// RadianceCascadesProbeSlot * lower probe rays + lower probe ray.
+struct RadianceCascadesReducedTexel {
+  f32 color[3];
+  f32 emission[3];
+  f32 throughput[3];
+};
+
+// Merged radiance (emission) of a level 0 probe projected onto L1 spherical harmonics
+// and convolved with a clamped cosine, per channel (ambient, x, y, z). For a unit
+// surface normal n, irradiance / pi = max(0, ambient + dot(xyz, n)). One per level 0
+// probe, indexed like the probe's atlas tile (RadianceCascadesProbeSlot).
+struct RadianceCascadesIrradianceProbe {
+  f32 r[4];
+  f32 g[4];
+  f32 b[4];
+};
 
 #define OCTAPROBE_PADDING 1
 #define OCTAPROBE_PADDED_DIAMETER(v) ((v) + OCTAPROBE_PADDING * 2)
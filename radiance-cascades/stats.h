@@ -0,0 +1,207 @@
+#pragma once
+
+#include <hotcart/types.h>
+
+#include <stdio.h>
+
+#include "layout.h"
+
+// Per stage, per level timings and work counters of cascade updates. Both backends
+// push one sample per stage and level they run: the CPU backend times with a steady
+// clock when the stage returns, the GL backend with GL_TIME_ELAPSED queries once their
+// results come back a few frames later. Nothing in here touches GL or ImGui so headless
+// tools can fill and export it.
+
+// Work done by one stage of one level
+struct RadianceCascadesStageCounters {
+  // rays traced (build), texels produced (merge, reduce) or read (irradiance)
+  u64 rays;
+  // build only: distance evaluations and brick steps, 0 when not counted
+  u64 marchSteps;
+  u64 probes;
+  u64 bytesWritten;
+};
+
+// Build and merge write every texel of each probe's padded tile, borders included
+inline RadianceCascadesStageCounters
+RadianceCascadesProbeTileCounters(u64 probes, u32 atlasProbeDiameter, u32 texelByteSize) {
+  const u64 d = atlasProbeDiameter;
+  const u64 rays = probes * d * d;
+  return {.rays = rays,
+          .marchSteps = 0,
+          .probes = probes,
+          .bytesWritten = (rays + probes * (d * 4 + 4)) * texelByteSize};
+}
+
+// Writes one RadianceCascadesReducedTexel per direction of the lower level for each
+// upper probe
+inline RadianceCascadesStageCounters
+RadianceCascadesReduceCounters(u64 upperProbes, u32 lowerAtlasProbeDiameter) {
+  const u64 d = lowerAtlasProbeDiameter;
+  return {.rays = upperProbes * d * d,
+          .marchSteps = 0,
+          .probes = upperProbes,
+          .bytesWritten = upperProbes * d * d * sizeof(RadianceCascadesReducedTexel)};
+}
+
+// Reads every interior texel, writes one RadianceCascadesIrradianceProbe per probe
+inline RadianceCascadesStageCounters
+RadianceCascadesIrradianceCounters(u64 probes, u32 atlasProbeDiameter) {
+  const u64 d = atlasProbeDiameter;
+  return {.rays = probes * d * d,
+          .marchSteps = 0,
+          .probes = probes,
+          .bytesWritten = probes * sizeof(RadianceCascadesIrradianceProbe)};
+}
+
+// Rays per RADIANCE_CASCADES_STEP_HISTOGRAM_BUCKETS bucket of march steps, from the
+// most recent build of each level
+struct RadianceCascadesStepHistogram {
+  u64 rays[RADIANCE_CASCADES_MAX_LEVELS][RADIANCE_CASCADES_STEP_HISTOGRAM_BUCKETS];
+};
+
+// Steps covered by a bucket, [lo, hi). The last bucket has no upper bound and gets 0.
+inline void
+RadianceCascadesStepHistogramBucketRange(u32 bucket, u32 &lo, u32 &hi) {
+  lo = bucket ? 1u << (bucket - 1) : 0;
+  hi = bucket + 1 < RADIANCE_CASCADES_STEP_HISTOGRAM_BUCKETS ? 1u << bucket : 0;
+}
+
+inline void
+RadianceCascadesStepHistogramWriteCSVHeader(FILE *file, const char *prefixColumns = "") {
+  fprintf(file, "%slevel,stepsMin,stepsMax,rays\n", prefixColumns);
+}
+
+// One row per level and non empty bucket, see RadianceCascadesStatsWriteCSVHeader for
+// rowPrefix
+static void
+RadianceCascadesStepHistogramWriteCSV(const RadianceCascadesStepHistogram &histogram,
+                                      FILE *file,
+                                      const char *rowPrefix = "") {
+  for (u32 level = 0; level < RADIANCE_CASCADES_MAX_LEVELS; level++) {
+    for (u32 bucket = 0; bucket < RADIANCE_CASCADES_STEP_HISTOGRAM_BUCKETS; bucket++) {
+      if (!histogram.rays[level][bucket]) {
+        continue;
+      }
+      u32 lo;
+      u32 hi;
+      RadianceCascadesStepHistogramBucketRange(bucket, lo, hi);
+      fprintf(file,
+              "%s%u,%u,%u,%llu\n",
+              rowPrefix,
+              level,
+              lo,
+              hi,
+              (unsigned long long)histogram.rays[level][bucket]);
+    }
+  }
+}
+
+enum RadianceCascadesStatsClock : u32 {
+  RadianceCascadesStatsClock_CPU = 0,
+  RadianceCascadesStatsClock_GPU,
+};
+
+struct RadianceCascadesStatsSample {
+  // RadianceCascadesStats::frame when the stage was run
+  u64 frame;
+  RadianceCascadesStage stage;
+  i32 level;
+  RadianceCascadesStatsClock clock;
+  f64 milliseconds;
+  RadianceCascadesStageCounters counters;
+};
+
+#define RADIANCE_CASCADES_STATS_CAPACITY 1024
+
+// Ring buffer of the most recent RADIANCE_CASCADES_STATS_CAPACITY samples
+struct RadianceCascadesStats {
+  RadianceCascadesStatsSample samples[RADIANCE_CASCADES_STATS_CAPACITY];
+  // samples pushed so far, the oldest one still held is pushed - count
+  u64 pushed;
+  // bumped by whoever drives the updates, RadianceCascadesTick once per tick
+  u64 frame;
+};
+
+inline u32
+RadianceCascadesStatsCount(const RadianceCascadesStats &stats) {
+  return u32(Min(stats.pushed, u64(RADIANCE_CASCADES_STATS_CAPACITY)));
+}
+
+// index 0 is the oldest sample still held
+inline const RadianceCascadesStatsSample &
+RadianceCascadesStatsGet(const RadianceCascadesStats &stats, u32 index) {
+  const u64 first = stats.pushed - RadianceCascadesStatsCount(stats);
+  return stats.samples[(first + index) % RADIANCE_CASCADES_STATS_CAPACITY];
+}
+
+inline void
+RadianceCascadesStatsPush(RadianceCascadesStats &stats,
+                          const RadianceCascadesStatsSample &sample) {
+  stats.samples[stats.pushed % RADIANCE_CASCADES_STATS_CAPACITY] = sample;
+  stats.pushed++;
+}
+
+inline void
+RadianceCascadesStatsClear(RadianceCascadesStats &stats) {
+  stats.pushed = 0;
+}
+
+// Sum of the samples of one stage and level (-1 for every level) pushed for frame
+static RadianceCascadesStatsSample
+RadianceCascadesStatsFrameTotal(const RadianceCascadesStats &stats,
+                                u64 frame,
+                                RadianceCascadesStage stage,
+                                i32 level) {
+  RadianceCascadesStatsSample total = {};
+  total.frame = frame;
+  total.stage = stage;
+  total.level = level;
+  const u32 count = RadianceCascadesStatsCount(stats);
+  for (u32 i = 0; i < count; i++) {
+    const RadianceCascadesStatsSample &sample = RadianceCascadesStatsGet(stats, i);
+    if (sample.frame != frame || sample.stage != stage ||
+        (level != -1 && sample.level != level)) {
+      continue;
+    }
+    total.clock = sample.clock;
+    total.milliseconds += sample.milliseconds;
+    total.counters.rays += sample.counters.rays;
+    total.counters.marchSteps += sample.counters.marchSteps;
+    total.counters.probes += sample.counters.probes;
+    total.counters.bytesWritten += sample.counters.bytesWritten;
+  }
+  return total;
+}
+
+// prefixColumns and rowPrefix let callers add their own leading columns, each ending
+// in a comma
+inline void
+RadianceCascadesStatsWriteCSVHeader(FILE *file, const char *prefixColumns = "") {
+  fprintf(file,
+          "%sframe,clock,stage,level,ms,rays,marchSteps,probes,bytesWritten\n",
+          prefixColumns);
+}
+
+// Every held sample, oldest first
+static void
+RadianceCascadesStatsWriteCSV(const RadianceCascadesStats &stats,
+                              FILE *file,
+                              const char *rowPrefix = "") {
+  const u32 count = RadianceCascadesStatsCount(stats);
+  for (u32 i = 0; i < count; i++) {
+    const RadianceCascadesStatsSample &sample = RadianceCascadesStatsGet(stats, i);
+    fprintf(file,
+            "%s%llu,%s,%s,%i,%.4f,%llu,%llu,%llu,%llu\n",
+            rowPrefix,
+            (unsigned long long)sample.frame,
+            sample.clock == RadianceCascadesStatsClock_GPU ? "gpu" : "cpu",
+            RadianceCascadesStageName(sample.stage),
+            sample.level,
+            sample.milliseconds,
+            (unsigned long long)sample.counters.rays,
+            (unsigned long long)sample.counters.marchSteps,
+            (unsigned long long)sample.counters.probes,
+            (unsigned long long)sample.counters.bytesWritten);
+  }
+}
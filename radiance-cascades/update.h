@@ -0,0 +1,602 @@
+#pragma once
+
+#include <engine/linalg.h>
+#include <hotcart/types.h>
+
+#include <string.h>
+
+#include "layout.h"
+#include "shared.h"
+
+#include <engine/gpu/morton.h>
+
+// A box of probes in a level's grid, max is exclusive
+struct RadianceCascadesProbeBox {
+  v3u32 min;
+  v3u32 max;
+};
+
+// Which probes of which levels need to be traced and merged this tick. Built by
+// RadianceCascadesPlanFull / RadianceCascadesPlanRegion and executed by both the GL
+// and CPU backends.
+struct RadianceCascadesUpdatePlan {
+  // clear the atlases and rebuild everything
+  bool full;
+
+  // world space bounds of the change, when cullToRegion is set probes whose ray
+  // interval cannot reach this are skipped by the build kernel
+  bool cullToRegion;
+  v3 regionMin;
+  v3 regionMax;
+
+  i32 buildMaxLevel;
+  i32 mergeMaxLevel;
+
+  // bit L: clear level L of both atlases before anything is traced, see
+  // RadianceCascadesPlanStale
+  u32 clearLevels;
+
+  RadianceCascadesProbeBox build[RADIANCE_CASCADES_MAX_LEVELS];
+  RadianceCascadesProbeBox merge[RADIANCE_CASCADES_MAX_LEVELS];
+};
+
+inline RadianceCascadesProbeBox
+RadianceCascadesLevelProbeBox(const RadianceCascadesConfig &config, i32 level) {
+  return {v3u32(0u), RadianceCascadesLevelGridDims(config, level)};
+}
+
+inline bool
+RadianceCascadesProbeBoxEmpty(const RadianceCascadesProbeBox &box) {
+  return box.min.x >= box.max.x || box.min.y >= box.max.y || box.min.z >= box.max.z;
+}
+
+inline u32
+RadianceCascadesProbeBoxCount(const RadianceCascadesProbeBox &box) {
+  if (RadianceCascadesProbeBoxEmpty(box)) {
+    return 0;
+  }
+  return (box.max.x - box.min.x) * (box.max.y - box.min.y) * (box.max.z - box.min.z);
+}
+
+// Grid position of the index'th probe in the box, x fastest
+inline v3u32
+RadianceCascadesProbeBoxGridPos(const RadianceCascadesProbeBox &box, u32 index) {
+  v3u32 size = box.max - box.min;
+  return box.min + v3u32(index % size.x,
+                         (index / size.x) % size.y,
+                         index / (size.x * size.y));
+}
+
+// Blocks of RADIANCE_CASCADES_MERGE_BLOCK_DIAMETER^3 probes covering the box, the
+// merge's unit of work. Blocks along the max faces can hang over the box.
+inline v3u32
+RadianceCascadesProbeBoxBlockDims(const RadianceCascadesProbeBox &box) {
+  const u32 D = RADIANCE_CASCADES_MERGE_BLOCK_DIAMETER;
+  if (RadianceCascadesProbeBoxEmpty(box)) {
+    return v3u32(0);
+  }
+  return v3u32((box.max.x - box.min.x + D - 1) / D,
+               (box.max.y - box.min.y + D - 1) / D,
+               (box.max.z - box.min.z + D - 1) / D);
+}
+
+// Grid position of the first probe of the index'th block, x fastest
+inline v3u32
+RadianceCascadesProbeBoxBlockMin(const RadianceCascadesProbeBox &box, u32 index) {
+  v3u32 dims = RadianceCascadesProbeBoxBlockDims(box);
+  const v3u32 block(index % dims.x, (index / dims.x) % dims.y, index / (dims.x * dims.y));
+  return box.min + block * u32(RADIANCE_CASCADES_MERGE_BLOCK_DIAMETER);
+}
+
+// Invocations of shaders/radiance-cascades-merge.comp for a box, one workgroup per
+// block and tile of texels
+inline u32
+RadianceCascadesMergeInvocationCount(const RadianceCascadesProbeBox &box,
+                                     u32 probeRayCount) {
+  const v3u32 dims = RadianceCascadesProbeBoxBlockDims(box);
+  const u32 tileCount = (probeRayCount + RADIANCE_CASCADES_MERGE_TILE_TEXELS - 1) /
+                        RADIANCE_CASCADES_MERGE_TILE_TEXELS;
+  return dims.x * dims.y * dims.z * tileCount * RADIANCE_CASCADES_MERGE_BLOCK_PROBES *
+         RADIANCE_CASCADES_MERGE_TILE_TEXELS;
+}
+
+inline RadianceCascadesProbeBox
+RadianceCascadesProbeBoxUnion(const RadianceCascadesProbeBox &a,
+                              const RadianceCascadesProbeBox &b) {
+  if (RadianceCascadesProbeBoxEmpty(a)) {
+    return b;
+  }
+  if (RadianceCascadesProbeBoxEmpty(b)) {
+    return a;
+  }
+  return {Min(a.min, b.min), Max(a.max, b.max)};
+}
+
+// The lower level probes whose merge reads any of the upper probes in upperBox.
+// In scrolled cell coordinates lower probe p interpolates upper probes
+// floor(p * 0.5 - 0.25) and the one after it, clamped to the upper window.
+inline RadianceCascadesProbeBox
+RadianceCascadesProbeBoxLowerDependents(const RadianceCascadesConfig &config,
+                                        i32 lowerLevel,
+                                        const RadianceCascadesProbeBox &upperBox) {
+  if (RadianceCascadesProbeBoxEmpty(upperBox)) {
+    return {};
+  }
+  const v3u32 lowerGridDims = RadianceCascadesLevelGridDims(config, lowerLevel);
+  const v3u32 upperGridDims = RadianceCascadesLevelGridDims(config, lowerLevel + 1);
+  const v3i32 lowerScroll = RadianceCascadesGetLevelScroll(config, lowerLevel);
+  const v3i32 upperScroll = RadianceCascadesGetLevelScroll(config, lowerLevel + 1);
+  RadianceCascadesProbeBox box;
+  for (u32 axis = 0; axis < 3; axis++) {
+    const i32 dim = i32(lowerGridDims[axis]);
+    i32 lo = (i32(upperBox.min[axis]) + upperScroll[axis]) * 2 - 2 - lowerScroll[axis];
+    i32 hi = (i32(upperBox.max[axis]) + upperScroll[axis]) * 2 + 2 - lowerScroll[axis];
+    // probes past the edge of the upper window read the clamped edge probe
+    if (upperBox.min[axis] == 0) {
+      lo = 0;
+    }
+    if (upperBox.max[axis] >= upperGridDims[axis]) {
+      hi = dim;
+    }
+    box.min[axis] = u32(Clamp(lo, 0, dim));
+    box.max[axis] = u32(Clamp(hi, 0, dim));
+  }
+  return box;
+}
+
+// The upper probes the merge of the lower probes in box interpolates between, what the
+// reduce pass has to filter for it. Empty for the top level, it has nothing above it.
+inline RadianceCascadesProbeBox
+RadianceCascadesProbeBoxMergeUpperProbes(const RadianceCascadesConfig &config,
+                                         i32 lowerLevel,
+                                         const RadianceCascadesProbeBox &box) {
+  const v3u32 upperGridDims = RadianceCascadesLevelGridDims(config, lowerLevel + 1);
+  if (RadianceCascadesProbeBoxEmpty(box) || !upperGridDims.x || !upperGridDims.y ||
+      !upperGridDims.z) {
+    return {};
+  }
+  // same math as MergeUpperIndex in shaders/radiance-cascades-merge.comp, lower probe
+  // p reads floor(index) clamped to the window and the one after it
+  const v3 lowerScroll = v3(RadianceCascadesGetLevelScroll(config, lowerLevel));
+  const v3 upperScroll = v3(RadianceCascadesGetLevelScroll(config, lowerLevel + 1));
+  const v3 hi = v3(upperGridDims) - 1.0f;
+  auto upperProbe = [&](v3u32 gridPos) {
+    const v3 index = (v3(gridPos) + lowerScroll + 0.5f) * 0.5f - 0.5f - upperScroll;
+    return Clamp(Floor(index), v3(0.0f), hi);
+  };
+  const v3 first = upperProbe(box.min);
+  const v3 last = Min(upperProbe(box.max - 1u) + 1.0f, hi);
+  return {v3u32(first), v3u32(last) + 1u};
+}
+
+// Probes in a level whose centers are within rayRange.y of the world space box
+inline RadianceCascadesProbeBox
+RadianceCascadesProbeBoxFromWorld(const RadianceCascadesConfig &config,
+                                  i32 level,
+                                  v3 regionMin,
+                                  v3 regionMax) {
+  const v3u32 gridDims = RadianceCascadesLevelGridDims(config, level);
+  if (!gridDims.x || !gridDims.y || !gridDims.z) {
+    return {};
+  }
+
+  const v3 gridRadius = v3(gridDims) * 0.5f;
+  const f32 cellDiameter = config.scale * f32(1 << level);
+  // the sphere tracer stops within eps of a surface
+  const f32 reach = RadianceCascadesLevelRayRange(config, level).y + 0.001f;
+
+  // probe centers are at (gridPos + scroll + 0.5 - gridRadius) * cellDiameter
+  const v3 scroll = v3(RadianceCascadesGetLevelScroll(config, level));
+  v3 lo = (regionMin - reach) / cellDiameter + gridRadius - 0.5f - scroll;
+  v3 hi = (regionMax + reach) / cellDiameter + gridRadius - 0.5f - scroll;
+
+  RadianceCascadesProbeBox box;
+  for (u32 axis = 0; axis < 3; axis++) {
+    f32 first = Max(ceilf(lo[axis]), 0.0f);
+    f32 last = Min(floorf(hi[axis]), f32(gridDims[axis]) - 1.0f);
+    if (last < first) {
+      return {};
+    }
+    box.min[axis] = u32(first);
+    box.max[axis] = u32(last) + 1;
+  }
+  return box;
+}
+
+// merge[L] = build[L] plus every lower probe that reads a re-merged upper probe
+static void
+RadianceCascadesPlanMergeDependents(RadianceCascadesUpdatePlan &plan,
+                                    const RadianceCascadesConfig &config) {
+  RadianceCascadesProbeBox upper = {};
+  for (i32 level = plan.mergeMaxLevel; level >= 0; level--) {
+    RadianceCascadesProbeBox box = RadianceCascadesProbeBoxLowerDependents(config,
+                                                                           level,
+                                                                           upper);
+    if (level <= plan.buildMaxLevel) {
+      box = RadianceCascadesProbeBoxUnion(box, plan.build[level]);
+    }
+    plan.merge[level] = box;
+    upper = box;
+  }
+}
+
+// Rebuild every probe, same coverage as the original full RadianceCascadesTick
+static void
+RadianceCascadesPlanFull(RadianceCascadesUpdatePlan &plan,
+                         const RadianceCascadesConfig &config,
+                         const RadianceCascadesLayout &layout) {
+  plan = {};
+  plan.full = true;
+  plan.regionMin = v3(-FLT_MAX);
+  plan.regionMax = v3(FLT_MAX);
+  plan.buildMaxLevel = Min(RadianceCascadesBuildMaxLevel(config, layout),
+                           RADIANCE_CASCADES_MAX_LEVELS - 1);
+  plan.mergeMaxLevel = Min(RadianceCascadesMergeMaxLevel(config, layout) + 1,
+                           RADIANCE_CASCADES_MAX_LEVELS - 1);
+
+  for (i32 level = 0; level <= plan.buildMaxLevel; level++) {
+    plan.build[level] = RadianceCascadesLevelProbeBox(config, level);
+  }
+
+  for (i32 level = 0; level <= plan.mergeMaxLevel; level++) {
+    plan.merge[level] = RadianceCascadesLevelProbeBox(config, level);
+  }
+}
+
+// Re-trace only the probes whose ray interval can reach the world space box, then
+// re-merge those probes plus every lower probe that reads a re-merged upper probe.
+static void
+RadianceCascadesPlanRegion(RadianceCascadesUpdatePlan &plan,
+                           const RadianceCascadesConfig &config,
+                           const RadianceCascadesLayout &layout,
+                           v3 regionMin,
+                           v3 regionMax) {
+  RadianceCascadesPlanFull(plan, config, layout);
+  plan.full = false;
+  plan.cullToRegion = true;
+  plan.regionMin = regionMin;
+  plan.regionMax = regionMax;
+
+  for (i32 level = 0; level <= plan.buildMaxLevel; level++) {
+    plan.build[level] = RadianceCascadesProbeBoxFromWorld(config,
+                                                          level,
+                                                          regionMin,
+                                                          regionMax);
+  }
+
+  RadianceCascadesPlanMergeDependents(plan, config);
+}
+
+// Levels a config change left stale, see RadianceCascadesDiffConfig. Changes accumulate
+// until the next tick plans them with RadianceCascadesPlanStale.
+struct RadianceCascadesStaleLevels {
+  // bit L: re-trace all of level L
+  u32 build;
+  // bit L: re-merge all of level L, without re-tracing it
+  u32 merge;
+  // bit L: clear level L of both atlases, levels a lowered maxLevel no longer traces
+  // read as empty the way they do after a full rebuild
+  u32 clear;
+};
+
+inline bool
+RadianceCascadesStaleLevelsEmpty(const RadianceCascadesStaleLevels &stale) {
+  return !stale.build && !stale.merge && !stale.clear;
+}
+
+// Levels of an atlas built with from that no longer match to. Returns false when the
+// change moves the atlas layout around, nothing in it can be kept then.
+static bool
+RadianceCascadesDiffConfig(const RadianceCascadesConfig &from,
+                           const RadianceCascadesConfig &to,
+                           const RadianceCascadesLayout &layout,
+                           RadianceCascadesStaleLevels &stale) {
+  // anything not compared below (grid dims, probe diameter, branching factor, atlas
+  // format and layout, storage and sparse brick capacities) is part of the layout
+  RadianceCascadesConfig rest = to;
+  rest.rayLength = from.rayLength;
+  rest.scale = from.scale;
+  rest.debugFlags = from.debugFlags;
+  rest.maxLevel = from.maxLevel;
+  rest.marchConeEpsilonScale = from.marchConeEpsilonScale;
+  rest.marchConeMinStepScale = from.marchConeMinStepScale;
+  memcpy(rest.marchMaxSteps, from.marchMaxSteps, sizeof(rest.marchMaxSteps));
+  memcpy(rest.scroll, from.scroll, sizeof(rest.scroll));
+  rest.distanceBricks = from.distanceBricks;
+  if (memcmp(&rest, &from, sizeof(rest)) != 0) {
+    return false;
+  }
+
+  // debugFlags only count
+  const i32 levelCount = i32(layout.totalLevels);
+  if (from.rayLength != to.rayLength || from.scale != to.scale ||
+      from.marchConeEpsilonScale != to.marchConeEpsilonScale ||
+      from.marchConeMinStepScale != to.marchConeMinStepScale ||
+      memcmp(from.scroll, to.scroll, sizeof(to.scroll)) != 0 ||
+      memcmp(&from.distanceBricks, &to.distanceBricks, sizeof(to.distanceBricks)) != 0) {
+    for (i32 level = 0; level < levelCount; level++) {
+      stale.build |= 1u << level;
+    }
+  }
+  for (i32 level = 0; level < levelCount; level++) {
+    if (from.marchMaxSteps[level] != to.marchMaxSteps[level]) {
+      stale.build |= 1u << level;
+    }
+  }
+
+  // a raised maxLevel traces the new levels, a lowered one drops the levels above and
+  // re-merges the new top level without them
+  const i32 fromBuildMaxLevel = RadianceCascadesBuildMaxLevel(from, layout);
+  const i32 toBuildMaxLevel = RadianceCascadesBuildMaxLevel(to, layout);
+  for (i32 level = fromBuildMaxLevel + 1; level <= toBuildMaxLevel; level++) {
+    stale.build |= 1u << level;
+  }
+  if (toBuildMaxLevel < fromBuildMaxLevel) {
+    for (i32 level = Max(toBuildMaxLevel + 1, 0); level < levelCount; level++) {
+      stale.clear |= 1u << level;
+    }
+    if (toBuildMaxLevel >= 0) {
+      stale.merge |= 1u << toBuildMaxLevel;
+    }
+  }
+  return true;
+}
+
+// Re-trace and re-merge the stale levels. Every level below the highest stale one is
+// re-merged, it reads the re-merged level above it. Without the unmerged atlas the
+// merge runs in place (mergeInPlace), so every level it re-merges is re-traced too.
+static void
+RadianceCascadesPlanStale(RadianceCascadesUpdatePlan &plan,
+                          const RadianceCascadesConfig &config,
+                          const RadianceCascadesLayout &layout,
+                          const RadianceCascadesStaleLevels &stale,
+                          bool mergeInPlace) {
+  RadianceCascadesPlanFull(plan, config, layout);
+  plan.full = false;
+  plan.clearLevels = stale.clear;
+
+  i32 topLevel = -1;
+  for (i32 level = 0; level <= plan.mergeMaxLevel; level++) {
+    const bool traced = level <= plan.buildMaxLevel && (stale.build & (1u << level));
+    if (traced || (stale.merge & (1u << level))) {
+      topLevel = level;
+    }
+  }
+
+  for (i32 level = 0; level <= plan.buildMaxLevel; level++) {
+    const bool traced =
+      (stale.build & (1u << level)) || (mergeInPlace && level <= topLevel);
+    if (!traced) {
+      plan.build[level] = {};
+    }
+  }
+  for (i32 level = topLevel + 1; level <= plan.mergeMaxLevel; level++) {
+    plan.merge[level] = {};
+  }
+}
+
+// Whether the plan can run without the unmerged atlas: every probe it re-merges is
+// re-traced first, so the in place merge reads fresh build results
+inline bool
+RadianceCascadesPlanMergesInPlace(const RadianceCascadesUpdatePlan &plan) {
+  for (i32 level = 0; level <= plan.mergeMaxLevel; level++) {
+    const RadianceCascadesProbeBox &merge = plan.merge[level];
+    if (RadianceCascadesProbeBoxEmpty(merge)) {
+      continue;
+    }
+    if (level > plan.buildMaxLevel) {
+      // nothing traced this level, it was left empty by the last full rebuild
+      continue;
+    }
+    const RadianceCascadesProbeBox &build = plan.build[level];
+    if (RadianceCascadesProbeBoxEmpty(build) || build.min.x > merge.min.x ||
+        build.min.y > merge.min.y || build.min.z > merge.min.z ||
+        build.max.x < merge.max.x || build.max.y < merge.max.y ||
+        build.max.z < merge.max.z) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Steady state refresh: instead of rebuilding everything at once, every tick
+// re-traces one aligned morton block of each level so a whole level is refreshed
+// every `period` ticks.
+struct RadianceCascadesRefreshSchedule {
+  bool enabled;
+  // ticks to refresh all of level 0, rounded up to a power of two
+  u32 level0Period;
+  // level L takes level0Period * periodScale^L ticks, rounded up to a power of two
+  u32 periodScale;
+  u32 tick;
+};
+
+// Number of morton blocks a level is split into, a power of two <= the probe count
+inline u32
+RadianceCascadesLevelRefreshPeriod(const RadianceCascadesRefreshSchedule &schedule,
+                                   const RadianceCascadesLayout &layout,
+                                   i32 level) {
+  u64 period = Max(1u, schedule.level0Period);
+  for (i32 i = 0; i < level; i++) {
+    period *= Max(1u, schedule.periodScale);
+  }
+  u64 probeCount = RadianceCascadesLevelProbeCount(layout, level);
+  period = Min(period, Max(u64(1), probeCount));
+
+  u32 pot = 1;
+  while (pot < period) {
+    pot <<= 1;
+  }
+  return pot;
+}
+
+inline u32
+RadianceCascadesReverseBits(u32 value, u32 bitCount) {
+  u32 result = 0;
+  for (u32 bit = 0; bit < bitCount; bit++) {
+    result = (result << 1) | ((value >> bit) & 1);
+  }
+  return result;
+}
+
+// An aligned power of two run of probe indices covers a box of the grid, either part of
+// one morton ordered brick or a run of whole bricks
+inline RadianceCascadesProbeBox
+RadianceCascadesMortonBlockBox(const RadianceCascadesConfig &config,
+                               i32 level,
+                               u32 first,
+                               u32 count) {
+  return {RadianceCascadesProbeGridPos(config, first, level),
+          RadianceCascadesProbeGridPos(config, first + count - 1, level) + 1u};
+}
+
+// Re-trace the next morton block of every level. Consecutive ticks visit the blocks
+// in bit reversed order so the refreshed probes are spread out over the grid rather
+// than sweeping across it.
+static void
+RadianceCascadesPlanScheduled(RadianceCascadesUpdatePlan &plan,
+                              const RadianceCascadesConfig &config,
+                              const RadianceCascadesLayout &layout,
+                              RadianceCascadesRefreshSchedule &schedule) {
+  RadianceCascadesPlanFull(plan, config, layout);
+  plan.full = false;
+
+  for (i32 level = 0; level <= plan.buildMaxLevel; level++) {
+    const u32 period = RadianceCascadesLevelRefreshPeriod(schedule, layout, level);
+    const u32 probeCount = RadianceCascadesLevelProbeCount(layout, level);
+    if (!probeCount) {
+      plan.build[level] = {};
+      continue;
+    }
+
+    u32 bitCount = 0;
+    while ((1u << bitCount) < period) {
+      bitCount++;
+    }
+
+    const u32 block = RadianceCascadesReverseBits(schedule.tick & (period - 1), bitCount);
+    const u32 blockProbeCount = probeCount / period;
+    plan.build[level] = RadianceCascadesMortonBlockBox(config,
+                                                       level,
+                                                       block * blockProbeCount,
+                                                       blockProbeCount);
+  }
+
+  RadianceCascadesPlanMergeDependents(plan, config);
+  schedule.tick++;
+}
+
+// Scroll (in the level's cells) that centers a level's window on eye
+inline v3i32
+RadianceCascadesLevelScrollTarget(const RadianceCascadesConfig &config,
+                                  i32 level,
+                                  v3 eye) {
+  const f32 cellDiameter = config.scale * f32(1 << level);
+  return v3i32(i32(floorf(eye.x / cellDiameter + 0.5f)),
+               i32(floorf(eye.y / cellDiameter + 0.5f)),
+               i32(floorf(eye.z / cellDiameter + 0.5f)));
+}
+
+inline i32 &
+RadianceCascadesLevelScrollAxis(RadianceCascadesConfig &config, i32 level, u32 axis) {
+  RadianceCascadesLevelScroll &scroll = config.scroll[level];
+  return axis == 0 ? scroll.x : (axis == 1 ? scroll.y : scroll.z);
+}
+
+// Move every level straight to the scroll for eye. Whatever is in the atlas is stale
+// afterwards, so this goes with a full rebuild.
+static void
+RadianceCascadesScrollTo(RadianceCascadesConfig &config,
+                         const RadianceCascadesLayout &layout,
+                         v3 eye) {
+  for (i32 level = 0; level < RADIANCE_CASCADES_MAX_LEVELS; level++) {
+    const v3i32 target = level < i32(layout.totalLevels)
+                           ? RadianceCascadesLevelScrollTarget(config, level, eye)
+                           : v3i32(0);
+    config.scroll[level] = {target.x, target.y, target.z, 0};
+  }
+}
+
+// Following eye moves some level by half its window or more, tracing the exposed slabs
+// would cost about as much as a full rebuild
+static bool
+RadianceCascadesScrollIsJump(const RadianceCascadesConfig &config,
+                             const RadianceCascadesLayout &layout,
+                             v3 eye) {
+  for (i32 level = 0; level < i32(layout.totalLevels); level++) {
+    const v3i32 delta = RadianceCascadesLevelScrollTarget(config, level, eye) -
+                        RadianceCascadesGetLevelScroll(config, level);
+    const v3u32 dims = RadianceCascadesLevelGridDims(config, level);
+    for (u32 axis = 0; axis < 3; axis++) {
+      const i32 distance = delta[axis] < 0 ? -delta[axis] : delta[axis];
+      if (u32(distance) * 2 >= dims[axis]) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+// Clipmap update: scroll every level's window along one axis so it stays centered on
+// eye. Probes that stay inside the window keep their (toroidal) storage, only the slab
+// that scrolled into view is traced, and the merge redoes that slab plus the lower
+// probes that read it. Axes are done one at a time so the slab is a single box per
+// level. Returns false when no level moved along the axis.
+static bool
+RadianceCascadesPlanScroll(RadianceCascadesUpdatePlan &plan,
+                           RadianceCascadesConfig &config,
+                           const RadianceCascadesLayout &layout,
+                           u32 axis,
+                           v3 eye) {
+  RadianceCascadesPlanFull(plan, config, layout);
+  plan.full = false;
+
+  bool moved = false;
+  for (i32 level = 0; level < i32(layout.totalLevels); level++) {
+    i32 &scroll = RadianceCascadesLevelScrollAxis(config, level, axis);
+    const v3i32 target = RadianceCascadesLevelScrollTarget(config, level, eye);
+    const i32 delta = target[axis] - scroll;
+
+    RadianceCascadesProbeBox slab = {};
+    if (delta) {
+      const u32 dim = RadianceCascadesLevelGridDims(config, level)[axis];
+      const u32 exposed = Min(u32(delta < 0 ? -delta : delta), dim);
+      slab = RadianceCascadesLevelProbeBox(config, level);
+      if (delta > 0) {
+        slab.min[axis] = dim - exposed;
+      } else {
+        slab.max[axis] = exposed;
+      }
+      scroll += delta;
+      moved = true;
+    }
+
+    if (level <= plan.buildMaxLevel) {
+      plan.build[level] = slab;
+    }
+  }
+
+  if (!moved) {
+    return false;
+  }
+  RadianceCascadesPlanMergeDependents(plan, config);
+  return true;
+}
+
+// Used by the build kernels to skip probes inside a box that still cannot see the
+// region, either because it is too far away or entirely inside the level's inner
+// ray interval.
+inline bool
+RadianceCascadesRayIntervalReachesRegion(v3 probeCenter,
+                                         v2 rayRange,
+                                         v3 regionMin,
+                                         v3 regionMax) {
+  v3 nearest = Clamp(probeCenter, regionMin, regionMax);
+  v3 farthest = v3(
+    Max(Abs(probeCenter.x - regionMin.x), Abs(probeCenter.x - regionMax.x)),
+    Max(Abs(probeCenter.y - regionMin.y), Abs(probeCenter.y - regionMax.y)),
+    Max(Abs(probeCenter.z - regionMin.z), Abs(probeCenter.z - regionMax.z)));
+  const f32 eps = 0.001f;
+  return Length(nearest - probeCenter) <= rayRange.y + eps &&
+         Length(farthest) + eps >= rayRange.x;
+}
@@ -0,0 +1,66 @@
+#ifndef ATLAS_IMAGE_GLSL
+#define ATLAS_IMAGE_GLSL
+
+// Writable octahedral probe atlas. The host binds the texture to the unit matching
+// config.atlasFormat, the other image is never touched.
+layout(binding = 1, rgba32f) restrict uniform image2DArray octahedralProbeAtlas;
+layout(binding = 2, rg32f) restrict uniform image2DArray octahedralProbeAtlasCompact;
+
+vec4
+AtlasImageLoad(ivec3 coord) {
+  if (config.atlasFormat == RADIANCE_CASCADES_ATLAS_FORMAT_COMPACT) {
+    return imageLoad(octahedralProbeAtlasCompact, coord);
+  }
+  return imageLoad(octahedralProbeAtlas, coord);
+}
+
+void
+AtlasImageStore(ivec3 coord, vec4 texel) {
+  if (config.atlasFormat == RADIANCE_CASCADES_ATLAS_FORMAT_COMPACT) {
+    imageStore(octahedralProbeAtlasCompact, coord, texel);
+  } else {
+    imageStore(octahedralProbeAtlas, coord, texel);
+  }
+}
+
+// Store an interior probe texel along with its copies in the probe's octahedral border,
+// the texels bilinear filtering reads past each fold. Every border texel has exactly
+// one source so the build and merge write them directly, without a stitching pass.
+// texel is relative to the interior, d is the level's probe diameter and stride the
+// level's ProbeTexelStride.
+void
+AtlasImageStoreProbeTexel(ivec3 probeOrigin, ivec2 stride, ivec2 texel, int d, vec4 value) {
+  const int pd = d + OCTAPROBE_PADDING;
+  const ivec2 src = texel + OCTAPROBE_PADDING;
+  AtlasImageStore(probeOrigin + ivec3(src * stride, 0), value);
+
+  // edges are mirrored along the fold
+  if (src.y == OCTAPROBE_PADDING) {
+    AtlasImageStore(probeOrigin + ivec3(ivec2(pd - src.x, 0) * stride, 0), value);
+  }
+  if (src.y == d) {
+    AtlasImageStore(probeOrigin + ivec3(ivec2(pd - src.x, pd) * stride, 0), value);
+  }
+  if (src.x == OCTAPROBE_PADDING) {
+    AtlasImageStore(probeOrigin + ivec3(ivec2(0, pd - src.y) * stride, 0), value);
+  }
+  if (src.x == d) {
+    AtlasImageStore(probeOrigin + ivec3(ivec2(pd, pd - src.y) * stride, 0), value);
+  }
+
+  // corners take the diagonally opposite texel
+  if (src == ivec2(d, d)) {
+    AtlasImageStore(probeOrigin, value);
+  }
+  if (src == ivec2(OCTAPROBE_PADDING, d)) {
+    AtlasImageStore(probeOrigin + ivec3(ivec2(pd, 0) * stride, 0), value);
+  }
+  if (src == ivec2(OCTAPROBE_PADDING, OCTAPROBE_PADDING)) {
+    AtlasImageStore(probeOrigin + ivec3(ivec2(pd, pd) * stride, 0), value);
+  }
+  if (src == ivec2(d, OCTAPROBE_PADDING)) {
+    AtlasImageStore(probeOrigin + ivec3(ivec2(0, pd) * stride, 0), value);
+  }
+}
+
+#endif
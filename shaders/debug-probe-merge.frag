@@ -28,6 +28,7 @@ layout(std430, binding = 0) uniform RadianceCascadeConfigUBO {
 
 #include "probes.glsl"
 #include "shared.glsl"
+#include "sparse-bricks.glsl"
 
 // sphere of size ra centered at point ce
 vec2
@@ -44,23 +45,32 @@ sphIntersect(in vec3 ro, in vec3 rd, in vec3 ce, float ra) {
 
 vec4
 ReadProbeLinearOffset(uvec3 probeGridPos, vec3 normal, int level, vec2 texelOffset) {
-  uint probeIndex = MortonEncode(probeGridPos);
-  uint atlasProbeDiameter = config.atlasProbeDiameter *
-                            uint(pow(2, level));
-  ivec2 probeOffset = ivec2(MortonDecode2D(probeIndex) *
-                            OCTAPROBE_PADDED_DIAMETER(atlasProbeDiameter));
+  uint slot = ProbeSlot(ProbeIndex(probeGridPos, level), level);
+  if (slot == RADIANCE_CASCADES_SPARSE_BRICK_EMPTY) {
+    return vec4(0.0);
+  }
+  uint atlasProbeDiameter = LevelProbeDiameter(level);
+  ivec3 probeOrigin = ProbeAtlasOrigin(slot, level);
 
   vec2 probeUV = OctahedralEncode(normal);
-  vec2 src = vec2(probeOffset) +
-             clamp(texelOffset * vec2(level + 1) + probeUV * atlasProbeDiameter,
+  vec2 src = clamp(texelOffset * vec2(level + 1) + probeUV * atlasProbeDiameter,
                    vec2(0),
                    vec2(atlasProbeDiameter)) +
              OCTAPROBE_PADDING;
-
-  vec4 c00 = texelFetch(octahedralProbeAtlasTexture, ivec3(src + vec2(0, 0), level), 0);
-  vec4 c10 = texelFetch(octahedralProbeAtlasTexture, ivec3(src + vec2(1, 0), level), 0);
-  vec4 c01 = texelFetch(octahedralProbeAtlasTexture, ivec3(src + vec2(0, 1), level), 0);
-  vec4 c11 = texelFetch(octahedralProbeAtlasTexture, ivec3(src + vec2(1, 1), level), 0);
+  ivec2 srcTexel = ivec2(src);
+
+  vec4 c00 = texelFetch(octahedralProbeAtlasTexture,
+                        ProbeTexelCoord(probeOrigin, srcTexel + ivec2(0, 0), level),
+                        0);
+  vec4 c10 = texelFetch(octahedralProbeAtlasTexture,
+                        ProbeTexelCoord(probeOrigin, srcTexel + ivec2(1, 0), level),
+                        0);
+  vec4 c01 = texelFetch(octahedralProbeAtlasTexture,
+                        ProbeTexelCoord(probeOrigin, srcTexel + ivec2(0, 1), level),
+                        0);
+  vec4 c11 = texelFetch(octahedralProbeAtlasTexture,
+                        ProbeTexelCoord(probeOrigin, srcTexel + ivec2(1, 1), level),
+                        0);
 
   return Lerp2D(c00, c10, c01, c11, fract(src));
 }
@@ -103,7 +113,7 @@ ReadProbesSpatialLinearAngularLinearGather(vec3 pos,
 
   uvec3 p = uvec3(pos);
   vec3 lo = vec3(0.0);
-  vec3 hi = vec3(config.gridDiameter << level);
+  vec3 hi = vec3(LevelGridDims(0) << level);
   vec2 probeUV = OctahedralEncode(normal);
 
   return Lerp3D(ReadProbeLinearGather(ComputeUpperGridPos(pos, vec3(0, 0, 0), hi),
@@ -152,16 +162,19 @@ ReadProbesSpatialLinearAngularLinearGather(vec3 pos,
 
 vec4
 ReadProbeNearest(v3u32 probeGridPos, vec3 normal, int level) {
-  uint probeIndex = MortonEncode(probeGridPos);
-  uint atlasProbeDiameter = config.atlasProbeDiameter *
-                            uint(pow(2, level));
-  ivec2 probeOffset = ivec2(MortonDecode2D(probeIndex) *
-                            OCTAPROBE_PADDED_DIAMETER(atlasProbeDiameter));
+  uint slot = ProbeSlot(ProbeIndex(probeGridPos, level), level);
+  if (slot == RADIANCE_CASCADES_SPARSE_BRICK_EMPTY) {
+    return vec4(0.0);
+  }
+  uint atlasProbeDiameter = LevelProbeDiameter(level);
+  ivec3 probeOrigin = ProbeAtlasOrigin(slot, level);
 
   vec2 probeUV = OctahedralEncode(normal);
-  vec2 src = vec2(probeOffset) + probeUV * atlasProbeDiameter + OCTAPROBE_PADDING;
+  vec2 src = probeUV * atlasProbeDiameter + OCTAPROBE_PADDING;
 
-  return texelFetch(octahedralProbeAtlasTexture, ivec3(src, level), 0);
+  return texelFetch(octahedralProbeAtlasTexture,
+                    ProbeTexelCoord(probeOrigin, ivec2(src), level),
+                    0);
 }
 
 
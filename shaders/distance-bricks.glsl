@@ -0,0 +1,73 @@
+#ifndef DISTANCE_BRICKS_GLSL
+#define DISTANCE_BRICKS_GLSL
+
+// Sparse distance brick cache, see radiance-cascades/distance-bricks.h. The including
+// shader declares the config UBO and
+//   usampler3D distanceBrickIndirection - GL_RG32UI, (slot + 1, center distance bits)
+//   sampler3D distanceBrickSamples - GL_R32F, RADIANCE_CASCADES_DISTANCE_BRICK_ATLAS_BRICKS
+//                                    bricks along x and y
+
+// Distance the march can safely step from pos, or 0 when pos is close to a surface or
+// outside the cache and map() has to be evaluated. Matches
+// RadianceCascadesDistanceBricksBound.
+float
+DistanceBricksBound(vec3 pos) {
+  RadianceCascadesDistanceBricksInfo info = config.distanceBricks;
+  if (info.enabled == 0) {
+    return 0.0;
+  }
+
+  const float cells = float(RADIANCE_CASCADES_DISTANCE_BRICK_CELLS);
+  const vec3 origin = vec3(info.originX, info.originY, info.originZ);
+  const uvec3 brickDims = uvec3(info.brickDimX, info.brickDimY, info.brickDimZ);
+  const vec3 cellPos = (pos - origin) / info.voxelSize;
+  const vec3 brickPos = cellPos / cells;
+  if (any(lessThan(brickPos, vec3(0.0))) ||
+      any(greaterThanEqual(brickPos, vec3(brickDims)))) {
+    return 0.0;
+  }
+
+  const uvec3 brick = min(uvec3(brickPos), brickDims - 1);
+  const uvec2 entry = texelFetch(distanceBrickIndirection, ivec3(brick), 0).xy;
+
+  float d;
+  if (entry.x == 0) {
+    // the distance field is 1-Lipschitz
+    vec3 center = origin + (vec3(brick) + 0.5) * cells * info.voxelSize;
+    d = uintBitsToFloat(entry.y) - length(pos - center);
+  } else {
+    const vec3 local = clamp(cellPos - vec3(brick) * cells, vec3(0.0), vec3(cells));
+    const uvec3 c = min(uvec3(local), uvec3(RADIANCE_CASCADES_DISTANCE_BRICK_CELLS - 1));
+    const vec3 t = local - vec3(c);
+
+    const uint slot = entry.x - 1;
+    const uint atlasBricks = RADIANCE_CASCADES_DISTANCE_BRICK_ATLAS_BRICKS;
+    const ivec3 s = ivec3(uvec3(slot % atlasBricks,
+                                (slot / atlasBricks) % atlasBricks,
+                                slot / (atlasBricks * atlasBricks)) *
+                            RADIANCE_CASCADES_DISTANCE_BRICK_SAMPLES +
+                          c);
+
+    const float s000 = texelFetch(distanceBrickSamples, s + ivec3(0, 0, 0), 0).x;
+    const float s100 = texelFetch(distanceBrickSamples, s + ivec3(1, 0, 0), 0).x;
+    const float s010 = texelFetch(distanceBrickSamples, s + ivec3(0, 1, 0), 0).x;
+    const float s110 = texelFetch(distanceBrickSamples, s + ivec3(1, 1, 0), 0).x;
+    const float s001 = texelFetch(distanceBrickSamples, s + ivec3(0, 0, 1), 0).x;
+    const float s101 = texelFetch(distanceBrickSamples, s + ivec3(1, 0, 1), 0).x;
+    const float s011 = texelFetch(distanceBrickSamples, s + ivec3(0, 1, 1), 0).x;
+    const float s111 = texelFetch(distanceBrickSamples, s + ivec3(1, 1, 1), 0).x;
+
+    const float d00 = s000 + (s100 - s000) * t.x;
+    const float d10 = s010 + (s110 - s010) * t.x;
+    const float d01 = s001 + (s101 - s001) * t.x;
+    const float d11 = s011 + (s111 - s011) * t.x;
+    const float d0 = d00 + (d10 - d00) * t.y;
+    const float d1 = d01 + (d11 - d01) * t.y;
+    // trilinear filtering is off by at most half a voxel diagonal
+    d = d0 + (d1 - d0) * t.z - info.voxelSize;
+  }
+
+  return d >= info.voxelSize ? d : 0.0;
+}
+
+#endif
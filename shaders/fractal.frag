@@ -14,6 +14,10 @@ layout(location = 5) uniform sampler2DArray octahedralProbeAtlasTexture;
 layout(location = 6) uniform int debugRenderProbeLevel;
 layout(location = 7) uniform float mergeTexelGatherOffset;
 layout(location = 8) uniform float mergeTexelGatherRatio;
+// shade with the pre-integrated irradiance instead of reading the atlas
+layout(location = 9) uniform int gatherIrradiance;
+// finest level with probes to gather from, see RadianceCascadesGatherLevel
+layout(location = 10) uniform int gatherLevel;
 
 #include "../radiance-cascades/shared.h"
 
@@ -21,41 +25,73 @@ layout(std430, binding = 0) uniform RadianceCascadeConfigUBO {
   RadianceCascadesConfig config;
 };
 
+layout(std430, binding = 3) restrict readonly buffer RadianceCascadesIrradianceBuffer {
+  RadianceCascadesIrradianceProbe irradianceProbes[];
+};
+
 #include "octahedral.glsl"
 #include "probes.glsl"
+#include "probe-validity.glsl"
 #include "shared.glsl"
+#include "sparse-bricks.glsl"
 #include <engine/gpu/morton.h>
 #include <hotcart/types.h>
 
-#define Sample(offset) ReadProbeLinear(probeGridPos + offset, sampleNormal, 0)
+#define Sample(offset) ReadProbeLinear(probeGridPos + offset, sampleNormal, gatherLevel)
 
 MapResult
 ReadProbeLinear(vec3 probeGridPos, vec3 normal, int level) {
-  uint probeIndex = MortonEncode(uvec3(probeGridPos));
-  uint atlasProbeDiameter = config.atlasProbeDiameter * uint(pow(2, level));
-  ivec2 probeOffset = ivec2(MortonDecode2D(probeIndex) *
-                            OCTAPROBE_PADDED_DIAMETER(atlasProbeDiameter));
+  // stay inside the grid, past the end of an axis is another brick's probe
+  vec3 gridMax = vec3(LevelGridDims(level)) - 1.0;
+  uint probeIndex = ProbeIndex(uvec3(clamp(probeGridPos, vec3(0.0), gridMax)), level);
+  // no storage, GatherValidMask leaves it out
+  uint slot = ProbeSlot(probeIndex, level);
+  if (slot == RADIANCE_CASCADES_SPARSE_BRICK_EMPTY) {
+    MapResult empty;
+    empty.color = vec3(0.0);
+    empty.emission = vec3(0.0);
+    empty.throughput = vec3(0.0);
+    empty.d = 0.0;
+    empty.level = level;
+    return empty;
+  }
+  uint atlasProbeDiameter = LevelProbeDiameter(level);
+  ivec3 probeOrigin = ProbeAtlasOrigin(slot, level);
 
   vec2 probeUV = OctahedralEncode(normal);
-  vec2 src = vec2(probeOffset) + probeUV * atlasProbeDiameter + 0.5;
+  vec2 src = probeUV * atlasProbeDiameter + 0.5;
+  ivec2 srcTexel = ivec2(src);
 
-  MapResult c00 = UnpackMapResult(
-    texelFetch(octahedralProbeAtlasTexture, ivec3(src + vec2(0, 0), level), 0));
-  MapResult c10 = UnpackMapResult(
-    texelFetch(octahedralProbeAtlasTexture, ivec3(src + vec2(1, 0), level), 0));
-  MapResult c01 = UnpackMapResult(
-    texelFetch(octahedralProbeAtlasTexture, ivec3(src + vec2(0, 1), level), 0));
-  MapResult c11 = UnpackMapResult(
-    texelFetch(octahedralProbeAtlasTexture, ivec3(src + vec2(1, 1), level), 0));
+  MapResult c00 = UnpackAtlasTexel(texelFetch(
+    octahedralProbeAtlasTexture, ProbeTexelCoord(probeOrigin, srcTexel + ivec2(0, 0), level), 0));
+  MapResult c10 = UnpackAtlasTexel(texelFetch(
+    octahedralProbeAtlasTexture, ProbeTexelCoord(probeOrigin, srcTexel + ivec2(1, 0), level), 0));
+  MapResult c01 = UnpackAtlasTexel(texelFetch(
+    octahedralProbeAtlasTexture, ProbeTexelCoord(probeOrigin, srcTexel + ivec2(0, 1), level), 0));
+  MapResult c11 = UnpackAtlasTexel(texelFetch(
+    octahedralProbeAtlasTexture, ProbeTexelCoord(probeOrigin, srcTexel + ivec2(1, 1), level), 0));
 
   return Lerp2D(c00, c10, c01, c11, fract(src));
 }
 
+// Which of the 8 probes around probeGridPos are outside solid geometry, in Lerp3D
+// order. The probes inside are dark and would bleed that into the surface next to them.
+uint
+GatherValidMask(vec3 probeGridPos, int level) {
+  vec3 gridMax = vec3(LevelGridDims(level)) - 1.0;
+  uint validMask = 0;
+  for (uint corner = 0; corner < 8; corner++) {
+    uvec3 gridPos = uvec3(clamp(probeGridPos + vec3(MortonDecode(corner)), vec3(0.0), gridMax));
+    validMask |= ProbeValid(gridPos, level) ? 1u << corner : 0u;
+  }
+  return validMask;
+}
+
 MapResult
 SampleProbesWorldSpace(vec3 pos, vec3 surfaceNormal, vec3 sampleNormal) {
-  vec3 probeGridPos = WorldToProbeGrid(pos, 0);
+  vec3 probeGridPos = WorldToProbeGrid(pos, gatherLevel);
 
-  vec3 hi = vec3(config.gridDiameter);
+  vec3 hi = vec3(LevelGridDims(gatherLevel));
   MapResult c000 = Sample(vec3(0, 0, 0));
   MapResult c100 = Sample(vec3(1, 0, 0));
   MapResult c010 = Sample(vec3(0, 1, 0));
@@ -68,7 +104,58 @@ SampleProbesWorldSpace(vec3 pos, vec3 surfaceNormal, vec3 sampleNormal) {
   // return (c000 + c100 + c010 + c110 + c001 + c101 + c011 + c111) * 0.125;
   vec3 t = fract(probeGridPos);
   // t = vec3(0.5);
-  return Lerp3D(c000, c100, c010, c110, c001, c101, c011, c111, t);
+  return Lerp3DValid(c000,
+                     c100,
+                     c010,
+                     c110,
+                     c001,
+                     c101,
+                     c011,
+                     c111,
+                     t,
+                     GatherValidMask(probeGridPos, gatherLevel));
+}
+
+// Irradiance / pi of a level 0 probe for a unit normal, see
+// RadianceCascadesIrradianceProbe
+vec3
+ReadProbeIrradiance(vec3 probeGridPos, vec3 normal) {
+  // stay inside the grid, past the end of an axis is another brick's probe
+  vec3 gridMax = vec3(LevelGridDims(0)) - 1.0;
+  uint slot = ProbeSlot(ProbeIndex(uvec3(clamp(probeGridPos, vec3(0.0), gridMax)), 0), 0);
+  if (slot == RADIANCE_CASCADES_SPARSE_BRICK_EMPTY) {
+    return vec3(0.0);
+  }
+  RadianceCascadesIrradianceProbe probe = irradianceProbes[slot];
+  vec4 n = vec4(1.0, normal);
+  return max(vec3(dot(vec4(probe.r[0], probe.r[1], probe.r[2], probe.r[3]), n),
+                  dot(vec4(probe.g[0], probe.g[1], probe.g[2], probe.g[3]), n),
+                  dot(vec4(probe.b[0], probe.b[1], probe.b[2], probe.b[3]), n)),
+             vec3(0.0));
+}
+
+// Same probe footprint and weights as SampleProbesWorldSpace, one small fetch per probe
+vec3
+SampleIrradianceWorldSpace(vec3 pos, vec3 normal) {
+  vec3 probeGridPos = WorldToProbeGrid(pos, 0);
+  vec3 c000 = ReadProbeIrradiance(probeGridPos + vec3(0, 0, 0), normal);
+  vec3 c100 = ReadProbeIrradiance(probeGridPos + vec3(1, 0, 0), normal);
+  vec3 c010 = ReadProbeIrradiance(probeGridPos + vec3(0, 1, 0), normal);
+  vec3 c110 = ReadProbeIrradiance(probeGridPos + vec3(1, 1, 0), normal);
+  vec3 c001 = ReadProbeIrradiance(probeGridPos + vec3(0, 0, 1), normal);
+  vec3 c101 = ReadProbeIrradiance(probeGridPos + vec3(1, 0, 1), normal);
+  vec3 c011 = ReadProbeIrradiance(probeGridPos + vec3(0, 1, 1), normal);
+  vec3 c111 = ReadProbeIrradiance(probeGridPos + vec3(1, 1, 1), normal);
+  return Lerp3DValid(c000,
+                     c100,
+                     c010,
+                     c110,
+                     c001,
+                     c101,
+                     c011,
+                     c111,
+                     fract(probeGridPos),
+                     GatherValidMask(probeGridPos, 0));
 }
 
 MapResult
@@ -140,31 +227,33 @@ main() {
           vec3 probeGridPos = WorldToProbeGrid(pos, result.level);
           outColor = vec4(fract(probeGridPos), 1.0);
 
-          uint probeIndex = MortonEncode(uvec3(probeGridPos));
-          uint atlasProbeDiameter = config.atlasProbeDiameter *
-                                    uint(pow(2, result.level));
-          ivec2 probeOffset = ivec2(MortonDecode2D(probeIndex) *
-                                    OCTAPROBE_PADDED_DIAMETER(atlasProbeDiameter));
+          uint slot = ProbeSlot(ProbeIndex(uvec3(probeGridPos), result.level), result.level);
+          if (slot == RADIANCE_CASCADES_SPARSE_BRICK_EMPTY) {
+            outColor = vec4(0.0, 0.0, 0.0, 1.0);
+            return;
+          }
+          uint atlasProbeDiameter = LevelProbeDiameter(result.level);
+          ivec3 probeOrigin = ProbeAtlasOrigin(slot, result.level);
 
           vec2 probeUV = OctahedralEncode(probeNormal);
-          vec2 src = vec2(probeOffset) + probeUV * atlasProbeDiameter + 0.5;
+          vec2 src = probeUV * atlasProbeDiameter + 0.5;
 
           ivec2 srcTexel = ivec2(src);
-          MapResult c00 = UnpackMapResult(
+          MapResult c00 = UnpackAtlasTexel(
             texelFetch(octahedralProbeAtlasTexture,
-                       ivec3(srcTexel + ivec2(0, 0), result.level),
+                       ProbeTexelCoord(probeOrigin, srcTexel + ivec2(0, 0), result.level),
                        0));
-          MapResult c10 = UnpackMapResult(
+          MapResult c10 = UnpackAtlasTexel(
             texelFetch(octahedralProbeAtlasTexture,
-                       ivec3(srcTexel + ivec2(1, 0), result.level),
+                       ProbeTexelCoord(probeOrigin, srcTexel + ivec2(1, 0), result.level),
                        0));
-          MapResult c01 = UnpackMapResult(
+          MapResult c01 = UnpackAtlasTexel(
             texelFetch(octahedralProbeAtlasTexture,
-                       ivec3(srcTexel + ivec2(0, 1), result.level),
+                       ProbeTexelCoord(probeOrigin, srcTexel + ivec2(0, 1), result.level),
                        0));
-          MapResult c11 = UnpackMapResult(
+          MapResult c11 = UnpackAtlasTexel(
             texelFetch(octahedralProbeAtlasTexture,
-                       ivec3(srcTexel + vec2(1, 1), result.level),
+                       ProbeTexelCoord(probeOrigin, srcTexel + ivec2(1, 1), result.level),
                        0));
 
 
@@ -174,6 +263,10 @@ main() {
         return;
       } else {
         vec3 normal = CalcNormal(pos);
+        if (gatherIrradiance != 0) {
+          outColor = vec4(SampleIrradianceWorldSpace(pos, normal), 1.0);
+          return;
+        }
         // MapResult probeValue = SampleProbesWorldSpace(pos, normal, reflect(rayDir, normal));
         MapResult probeValue = SampleProbesWorldSpace(pos, normal, normal);
         outColor = vec4(probeValue.emission.rgb, 1.0);
@@ -42,4 +42,13 @@ OctahedralDecode(vec2 uv) {
   return normalize(vec3(uv.s, 1.0 - l, uv.t));
 }
 
+// Solid angle of the octahedral texel facing dir relative to the others of its probe.
+// Texels are evenly spaced on the |p|_1 = 1 octahedron, which projects onto the sphere
+// with 1 / |p|_2^3 = |dir|_1^3.
+float
+OctahedralTexelWeight(vec3 dir) {
+  float l = sum(abs(dir));
+  return l * l * l;
+}
+
 #endif
\ No newline at end of file
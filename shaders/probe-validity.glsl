@@ -0,0 +1,134 @@
+#ifndef PROBE_VALIDITY_GLSL
+#define PROBE_VALIDITY_GLSL
+
+// One bit per probe, clear for probes inside solid geometry. The build classifies the
+// probes it traces, see RadianceCascadesProbeValidityWordOffset for the layout.
+layout(std430, binding = 6) restrict buffer RadianceCascadesProbeValidityBuffer {
+  uint probeValidity[];
+};
+
+// Each level starts on a new word, matches RadianceCascadesProbeValidityWordOffset
+uint
+ProbeValidityWordOffset(int level) {
+  uint offset = 0;
+  for (int l = 0; l < level; l++) {
+    uvec3 dims = LevelGridDims(l);
+    offset += (dims.x * dims.y * dims.z + 31) / 32;
+  }
+  return offset;
+}
+
+bool
+ProbeIndexValid(uint probeIndex, int level) {
+  uint word = probeValidity[ProbeValidityWordOffset(level) + probeIndex / 32];
+  return ((word >> (probeIndex % 32)) & 1) != 0;
+}
+
+bool
+ProbeValid(uvec3 gridPos, int level) {
+  return ProbeIndexValid(ProbeIndex(gridPos, level), level);
+}
+
+void
+SetProbeIndexValid(uint probeIndex, int level, bool valid) {
+  uint word = ProbeValidityWordOffset(level) + probeIndex / 32;
+  uint bit = 1u << (probeIndex % 32);
+  if (valid) {
+    atomicOr(probeValidity[word], bit);
+  } else {
+    atomicAnd(probeValidity[word], ~bit);
+  }
+}
+
+// Trilinear weights of the 8 corners in Lerp3D order, bit i of validMask set when
+// corner i is valid. The invalid corners get nothing and the rest are scaled back up to
+// one, matches RadianceCascadesKernels::ValidTrilinearWeights.
+void
+ValidTrilinearWeights(vec3 t, uint validMask, out float w[8]) {
+  float sum = 0.0;
+  for (uint i = 0; i < 8; i++) {
+    const float wx = (i & 1) != 0 ? t.x : 1.0 - t.x;
+    const float wy = (i & 2) != 0 ? t.y : 1.0 - t.y;
+    const float wz = (i & 4) != 0 ? t.z : 1.0 - t.z;
+    w[i] = ((validMask >> i) & 1) != 0 ? max(wx * wy * wz, 0.0001) : 0.0;
+    sum += w[i];
+  }
+  for (uint i = 0; i < 8; i++) {
+    w[i] /= sum;
+  }
+}
+
+// Lerp3D over the valid corners only. With all of them or none of them valid it is the
+// plain Lerp3D.
+vec3
+Lerp3DValid(vec3 c000,
+            vec3 c100,
+            vec3 c010,
+            vec3 c110,
+
+            vec3 c001,
+            vec3 c101,
+            vec3 c011,
+            vec3 c111,
+
+            vec3 t,
+            uint validMask) {
+  if (validMask == 0xFF || validMask == 0) {
+    return Lerp3D(c000, c100, c010, c110, c001, c101, c011, c111, t);
+  }
+  float w[8];
+  ValidTrilinearWeights(t, validMask, w);
+  return c000 * w[0] + c100 * w[1] + c010 * w[2] + c110 * w[3] + c001 * w[4] + c101 * w[5] +
+         c011 * w[6] + c111 * w[7];
+}
+
+MapResult
+Lerp3DValid(MapResult c000,
+            MapResult c100,
+            MapResult c010,
+            MapResult c110,
+
+            MapResult c001,
+            MapResult c101,
+            MapResult c011,
+            MapResult c111,
+
+            vec3 t,
+            uint validMask) {
+  MapResult r;
+  r.color = Lerp3DValid(c000.color,
+                        c100.color,
+                        c010.color,
+                        c110.color,
+                        c001.color,
+                        c101.color,
+                        c011.color,
+                        c111.color,
+                        t,
+                        validMask);
+
+  r.emission = Lerp3DValid(c000.emission,
+                           c100.emission,
+                           c010.emission,
+                           c110.emission,
+                           c001.emission,
+                           c101.emission,
+                           c011.emission,
+                           c111.emission,
+                           t,
+                           validMask);
+
+  r.throughput = Lerp3DValid(c000.throughput,
+                             c100.throughput,
+                             c010.throughput,
+                             c110.throughput,
+                             c001.throughput,
+                             c101.throughput,
+                             c011.throughput,
+                             c111.throughput,
+                             t,
+                             validMask);
+  return r;
+}
+
+#endif
@@ -1,27 +1,144 @@
 
 #include "lerp.glsl"
 #include "octahedral.glsl"
+#include "shared.glsl"
 #include <engine/gpu/morton.h>
 
+// Atlas texel encoding selected by config.atlasFormat
+vec4
+PackAtlasTexel(MapResult mapResult) {
+  if (config.atlasFormat == RADIANCE_CASCADES_ATLAS_FORMAT_COMPACT) {
+    return PackMapResultCompact(mapResult);
+  }
+  return PackMapResult(mapResult);
+}
+
+MapResult
+UnpackAtlasTexel(vec4 packed) {
+  if (config.atlasFormat == RADIANCE_CASCADES_ATLAS_FORMAT_COMPACT) {
+    return UnpackMapResultCompact(packed);
+  }
+  return UnpackMapResult(packed);
+}
+
+uvec3
+LevelGridDims(int level) {
+  return uvec3(config.gridDimX, config.gridDimY, config.gridDimZ) >> level;
+}
+
+ivec3
+LevelScroll(int level) {
+  RadianceCascadesLevelScroll scroll = config.scroll[level];
+  return ivec3(scroll.x, scroll.y, scroll.z);
+}
+
+// Toroidally wrapped window position, then bricks in x, y, z order, morton order inside
+// a brick, matches RadianceCascadesProbeIndex
+uint
+ProbeIndex(uvec3 gridPos, int level) {
+  uvec3 dims = LevelGridDims(level);
+  gridPos = (gridPos + uvec3(LevelScroll(level))) & (dims - 1);
+  uint brickDiameter = min(min(dims.x, dims.y), dims.z);
+  uvec3 bricks = dims / brickDiameter;
+  uvec3 brick = gridPos / brickDiameter;
+  uint brickIndex = brick.x + bricks.x * (brick.y + bricks.y * brick.z);
+  return brickIndex * brickDiameter * brickDiameter * brickDiameter +
+         MortonEncode(gridPos & (brickDiameter - 1));
+}
+
+// Wrapped grid position of a probe index, matches RadianceCascadesProbeGridPos
+uvec3
+ProbeStoragePos(uint probeIndex, int level) {
+  uvec3 dims = LevelGridDims(level);
+  uint brickDiameter = min(min(dims.x, dims.y), dims.z);
+  uint brickProbeCount = brickDiameter * brickDiameter * brickDiameter;
+  uvec3 bricks = dims / brickDiameter;
+  uint brickIndex = probeIndex / brickProbeCount;
+  uvec3 brick = uvec3(brickIndex % bricks.x,
+                      (brickIndex / bricks.x) % bricks.y,
+                      brickIndex / (bricks.x * bricks.y));
+  return brick * brickDiameter + MortonDecode(probeIndex % brickProbeCount);
+}
+
+// Texels across a level's probe tiles without padding, matches
+// RadianceCascadesLevelProbeDiameter. Kernels specialized on a branching factor define
+// RADIANCE_CASCADES_BRANCHING_FACTOR so the shift is a constant.
+uint
+LevelProbeDiameter(int level) {
+#ifdef RADIANCE_CASCADES_BRANCHING_FACTOR
+  const uint branchingFactor = RADIANCE_CASCADES_BRANCHING_FACTOR;
+#else
+  const uint branchingFactor = min(config.branchingFactor,
+                                   uint(RADIANCE_CASCADES_MAX_BRANCHING_FACTOR));
+#endif
+  return config.atlasProbeDiameter << (uint(level) * branchingFactor);
+}
+
+// Atlas texel (x, y, layer) of the padded corner of the tile in a storage slot (see
+// ProbeSlot in sparse-bricks.glsl), matches RadianceCascadesProbeAtlasOrigin. Texel
+// (x, y) of the padded tile is at origin + (x, y) * ProbeTexelStride.
+ivec3
+ProbeAtlasOrigin(uint slot, int level) {
+  RadianceCascadesLevelRect rect = config.levels[level];
+  if (config.atlasLayout == RADIANCE_CASCADES_ATLAS_LAYOUT_DIRECTION_MAJOR) {
+    // storage is always dense
+    uvec3 dims = LevelGridDims(level);
+    uvec3 pos = ProbeStoragePos(slot, level);
+    uint slicesX = MortonDecode2D(dims.z - 1).x + 1;
+    uvec2 offset = uvec2(pos.x + dims.x * (pos.z % slicesX),
+                         pos.y + dims.y * (pos.z / slicesX));
+    return ivec3(offset + uvec2(rect.x, rect.y), rect.layer);
+  }
+  uint ppd = OCTAPROBE_PADDED_DIAMETER(LevelProbeDiameter(level));
+  return ivec3(MortonDecode2D(slot) * ppd + uvec2(rect.x, rect.y), rect.layer);
+}
+
+// Atlas step between neighboring texels of a probe's padded octahedral tile, matches
+// RadianceCascadesProbeTexelStride
+ivec2
+ProbeTexelStride(int level) {
+  if (config.atlasLayout == RADIANCE_CASCADES_ATLAS_LAYOUT_DIRECTION_MAJOR) {
+    uvec3 dims = LevelGridDims(level);
+    return ivec2(dims.xy * (MortonDecode2D(dims.z - 1) + 1));
+  }
+  return ivec2(1);
+}
+
+// Atlas texel of texel (x, y) of a probe's padded octahedral tile
+ivec3
+ProbeTexelCoord(ivec3 probeOrigin, ivec2 texel, int level) {
+  return probeOrigin + ivec3(texel * ProbeTexelStride(level), 0);
+}
+
+// Angle between neighboring directions of a level's probes, matches
+// RadianceCascadesLevelTexelAngle
+float
+LevelTexelAngle(int level) {
+  return 3.5449077 / float(LevelProbeDiameter(level));
+}
+
 vec3
 WorldToProbeGrid(vec3 worldPos, int level) {
-  vec3 gridDiameter = vec3(config.gridDiameter >> level);
-  vec3 gridRadius = gridDiameter * 0.5f;
+  vec3 gridDims = vec3(LevelGridDims(level));
+  vec3 gridRadius = gridDims * 0.5f;
   vec3 cellDiameter = vec3(1 << level) * config.scale;
   vec3 cellRadius = cellDiameter * 0.5f;
 
-  return (worldPos / cellDiameter) + gridRadius;
+  return (worldPos / cellDiameter) + gridRadius - vec3(LevelScroll(level));
 }
 
 float
 ProbesMapDistance(vec3 pos, int level) {
-  const vec3 gridDiameter = vec3(float(config.gridDiameter >> level));
-  const vec3 gridRadius = gridDiameter * 0.5;
+  const vec3 gridDims = vec3(LevelGridDims(level));
+  const vec3 gridRadius = gridDims * 0.5;
   const vec3 cellDiameter = vec3(1 << level);
   const vec3 cellRadius = cellDiameter * 0.5;
   const vec3 spacing = cellDiameter * config.scale;
   const vec3 p = pos - cellRadius * config.scale;
-  const vec3 q = p - spacing * clamp(round(p / spacing), -gridRadius, gridRadius - 1);
+  const vec3 scroll = vec3(LevelScroll(level));
+  const vec3 q = p - spacing * clamp(round(p / spacing),
+                                     scroll - gridRadius,
+                                     scroll + gridRadius - 1);
   const float probeRadius = 0.1 * float(1 << level);
   return length(q) - probeRadius * config.scale;
 }
@@ -35,3 +152,21 @@ uvec3
 ComputeGridPos(vec3 pos, vec3 offset, vec3 gridDiameter) {
   return uvec3(clamp(floor(pos) + offset, v3(0.0f), gridDiameter));
 }
+
+// Grid position of the index'th probe in a box of probes, x fastest
+uvec3
+ProbeBoxGridPos(uvec3 boxMin, uvec3 boxSize, uint index) {
+  return boxMin + uvec3(index % boxSize.x,
+                        (index / boxSize.x) % boxSize.y,
+                        index / (boxSize.x * boxSize.y));
+}
+
+// Can a ray interval starting at probeCenter reach into the world space region?
+bool
+RayIntervalReachesRegion(vec3 probeCenter, vec2 rayRange, vec3 regionMin, vec3 regionMax) {
+  vec3 nearest = clamp(probeCenter, regionMin, regionMax);
+  vec3 farthest = max(abs(probeCenter - regionMin), abs(probeCenter - regionMax));
+  const float eps = 0.001;
+  return length(nearest - probeCenter) <= rayRange.y + eps &&
+         length(farthest) + eps >= rayRange.x;
+}
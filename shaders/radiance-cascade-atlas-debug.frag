@@ -22,6 +22,7 @@ layout(std430, binding = 0) uniform RadianceCascadeConfigUBO {
 #include <engine/gpu/morton.h>
 #include <hotcart/types.h>
 
+#include "probes.glsl"
 #include "shared.glsl"
 
 void
@@ -38,11 +39,13 @@ main() {
     outColor = vec4(0.0, 0.0, 0.0, 0.125);
   } else {
     vec3 size = textureSize(octahedralProbeAtlasTexture, 0);
-    vec4 textureValue = texelFetch(octahedralProbeAtlasTexture,
-                                   ivec3(floor(scaledUV * size.xy) + debugOffset, level),
-                                   0);
+    RadianceCascadesLevelRect rect = config.levels[level];
+    vec4 textureValue = texelFetch(
+      octahedralProbeAtlasTexture,
+      ivec3(floor(scaledUV * size.xy) + debugOffset + vec2(rect.x, rect.y), rect.layer),
+      0);
 
-    MapResult r = UnpackMapResult(textureValue);
+    MapResult r = UnpackAtlasTexel(textureValue);
 
     outColor = vec4(r.color, 1.0);
     outColor = vec4(r.emission, 1.0);
@@ -0,0 +1,85 @@
+// Body of the reduce kernels, shaders/radiance-cascades-reduce-b<N>.comp define
+// RADIANCE_CASCADES_BRANCHING_FACTOR and include it so each factor gets its own kernel
+// with the footprint below unrolled. The host picks one with
+// RadianceCascadesReduceProgramPath.
+#ifndef RADIANCE_CASCADES_BRANCHING_FACTOR
+#error RADIANCE_CASCADES_BRANCHING_FACTOR must be defined
+#endif
+
+#include "../radiance-cascades/shared.h"
+#include "shared.glsl"
+
+// the merged level being filtered for the merge of the level below it
+layout(location = 0) uniform uint upperLevel;
+layout(location = 1) uniform sampler2DArray octahedralProbeAtlasTexture;
+layout(location = 2) uniform uvec3 probeBoxMin;
+layout(location = 3) uniform uvec3 probeBoxSize;
+
+layout(std430, binding = 0) uniform RadianceCascadeConfigUBO {
+  RadianceCascadesConfig config;
+};
+
+layout(std430, binding = 5) restrict writeonly buffer RadianceCascadesReducedBuffer {
+  RadianceCascadesReducedTexel reducedTexels[];
+};
+
+#include "probes.glsl"
+#include "sparse-bricks.glsl"
+
+// one upper probe and one direction of the lower level per invocation
+layout(local_size_x = 128) in;
+
+// upper texels along each axis that filter into one lower direction
+#define REDUCE_FOOTPRINT (1 << RADIANCE_CASCADES_BRANCHING_FACTOR)
+
+// Box filters each REDUCE_FOOTPRINT x REDUCE_FOOTPRINT block of an upper probe's texels
+// down to the lower level's direction resolution, matches
+// RadianceCascadesCPUReduceLevel. Every lower probe that interpolates from the upper
+// probe reads the result instead of filtering it again.
+void
+main() {
+  const uint lowerAtlasProbeDiameter = LevelProbeDiameter(int(upperLevel) - 1);
+  const uint probeRayCount = lowerAtlasProbeDiameter * lowerAtlasProbeDiameter;
+  const uint boxProbeIndex = gl_GlobalInvocationID.x / probeRayCount;
+  const uint probeRayIndex = gl_GlobalInvocationID.x % probeRayCount;
+  if (boxProbeIndex >= probeBoxSize.x * probeBoxSize.y * probeBoxSize.z) {
+    return;
+  }
+
+  const int level = int(upperLevel);
+  const uvec3 probeGridCoord = ProbeBoxGridPos(probeBoxMin, probeBoxSize, boxProbeIndex);
+  const uint slot = ProbeSlot(ProbeIndex(probeGridCoord, level), level);
+  if (slot == RADIANCE_CASCADES_SPARSE_BRICK_EMPTY) {
+    return;
+  }
+  const ivec3 probeOrigin = ProbeAtlasOrigin(slot, level);
+  const ivec2 src = ivec2(probeRayIndex % lowerAtlasProbeDiameter,
+                          probeRayIndex / lowerAtlasProbeDiameter) *
+                      REDUCE_FOOTPRINT +
+                    OCTAPROBE_PADDING;
+
+  vec3 color = vec3(0.0);
+  vec3 emission = vec3(0.0);
+  vec3 throughput = vec3(0.0);
+  for (int y = 0; y < REDUCE_FOOTPRINT; y++) {
+    for (int x = 0; x < REDUCE_FOOTPRINT; x++) {
+      MapResult c = UnpackAtlasTexel(texelFetch(
+        octahedralProbeAtlasTexture, ProbeTexelCoord(probeOrigin, src + ivec2(x, y), level), 0));
+      color += c.color;
+      emission += c.emission;
+      throughput += c.throughput;
+    }
+  }
+  const float scale = 1.0 / float(REDUCE_FOOTPRINT * REDUCE_FOOTPRINT);
+  color *= scale;
+  emission *= scale;
+  throughput *= scale;
+
+  RadianceCascadesReducedTexel reduced;
+  for (int i = 0; i < 3; i++) {
+    reduced.color[i] = color[i];
+    reduced.emission[i] = emission[i];
+    reduced.throughput[i] = throughput[i];
+  }
+  reducedTexels[slot * probeRayCount + probeRayIndex] = reduced;
+}
@@ -1,3 +1,6 @@
+#ifndef SHARED_GLSL
+#define SHARED_GLSL
+
 #include "lerp.glsl"
 #include <engine/gpu/colormap-turbo.glsl>
 #include <hotcart/types.h>
@@ -41,6 +44,48 @@ UnpackMapResult(vec4 packed) {
   return mapResult;
 }
 
+// Shared exponent encoding from EXT_texture_shared_exponent, 9 bit mantissas and a 5
+// bit exponent. Negative values are clamped to 0.
+uint
+PackRGB9E5(vec3 rgb) {
+  const float maxValue = 65408.0;
+  vec3 c = clamp(rgb, vec3(0.0), vec3(maxValue));
+  float maxChannel = max(c.x, max(c.y, c.z));
+  int exponent = max(-16, int(floor(log2(max(maxChannel, 1e-30))))) + 16;
+  float scale = exp2(float(exponent - 24));
+  if (floor(maxChannel / scale + 0.5) >= 512.0) {
+    exponent++;
+    scale *= 2.0;
+  }
+  uvec3 m = uvec3(min(floor(c / scale + 0.5), vec3(511.0)));
+  return m.x | (m.y << 9) | (m.z << 18) | (uint(exponent) << 27);
+}
+
+vec3
+UnpackRGB9E5(uint bits) {
+  uvec3 m = uvec3(bits, bits >> 9, bits >> 18) & 0x1FFu;
+  return vec3(m) * exp2(float(int(bits >> 27) - 24));
+}
+
+vec4
+PackMapResultCompact(MapResult mapResult) {
+  vec4 packed = vec4(0.0);
+  float throughput = dot(mapResult.throughput, vec3(1.0 / 3.0));
+  packed.x = uintBitsToFloat(packUnorm4x8(vec4(mapResult.color, throughput)));
+  packed.y = uintBitsToFloat(PackRGB9E5(mapResult.emission));
+  return packed;
+}
+
+MapResult
+UnpackMapResultCompact(vec4 packed) {
+  MapResult mapResult;
+  vec4 colorThroughput = unpackUnorm4x8(floatBitsToUint(packed.x));
+  mapResult.color = colorThroughput.xyz;
+  mapResult.throughput = vec3(colorThroughput.w);
+  mapResult.emission = UnpackRGB9E5(floatBitsToUint(packed.y));
+  return mapResult;
+}
+
 MapResult
 Lerp3D(MapResult c000,
        MapResult c100,
@@ -242,4 +287,6 @@ ComputeRayDirection(vec2 uv, mat4 inv) {
 float
 MaxComponent(vec2 p) {
   return max(p.x, p.y);
-}
\ No newline at end of file
+}
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef SPARSE_BRICKS_GLSL
+#define SPARSE_BRICKS_GLSL
+
+// Atlas slot of every brick of every level with RADIANCE_CASCADES_STORAGE_SPARSE, see
+// RadianceCascadesPlaceSparseBricks. Not read with dense storage.
+layout(std430, binding = 7) restrict readonly buffer RadianceCascadesSparseBricksBuffer {
+  uint sparseBricks[];
+};
+
+bool
+StorageSparse() {
+  return config.storage == RADIANCE_CASCADES_STORAGE_SPARSE &&
+         config.atlasLayout == RADIANCE_CASCADES_ATLAS_LAYOUT_PROBE_MAJOR;
+}
+
+uint
+SparseBrickProbes(int level) {
+  uvec3 dims = LevelGridDims(level);
+  return min(uint(RADIANCE_CASCADES_SPARSE_BRICK_PROBES), dims.x * dims.y * dims.z);
+}
+
+// Matches RadianceCascadesSparseBrickOffset
+uint
+SparseBrickOffset(int level) {
+  uint offset = 0;
+  for (int l = 0; l < level; l++) {
+    uvec3 dims = LevelGridDims(l);
+    offset += (dims.x * dims.y * dims.z) / SparseBrickProbes(l);
+  }
+  return offset;
+}
+
+// Where a probe's tile, reduced texels and irradiance live, matches
+// RadianceCascadesProbeSlot. RADIANCE_CASCADES_SPARSE_BRICK_EMPTY for a probe without
+// storage.
+uint
+ProbeSlot(uint probeIndex, int level) {
+  if (!StorageSparse()) {
+    return probeIndex;
+  }
+  uint brickProbes = SparseBrickProbes(level);
+  uint slot = sparseBricks[SparseBrickOffset(level) + probeIndex / brickProbes];
+  return slot == RADIANCE_CASCADES_SPARSE_BRICK_EMPTY
+           ? RADIANCE_CASCADES_SPARSE_BRICK_EMPTY
+           : slot * brickProbes + probeIndex % brickProbes;
+}
+
+#endif
@@ -0,0 +1,517 @@
+// Headless batch baker for the CPU cascade pipeline.
+//
+// Reads a list of bake jobs and runs them concurrently, each one writing its merged
+// atlas as a bake cache file (radiance-cascades/bake-cache.h) plus a row of stats.
+// Jobs are admitted in order while the memory RadianceCascadesCPUInit will allocate for
+// them fits the budget, so a few large variants don't run the machine out of memory
+// while the small ones share it.
+//
+// build (needs the hotcart and dust include directories, no GL):
+//   c++ -std=c++20 -O3 -march=native -I<hotcart>/include -I<dust>
+//     tools/radiance-cascades-bake.cpp -o radiance-cascades-bake -lpthread
+//
+// usage:
+//   radiance-cascades-bake <jobs file> [--jobs 2] [--threads 0] [--max-memory-mb 4096]
+//                          [--output-dir .] [--scene shaders/shared.glsl]
+//                          [--summary path] [--stats path]
+//
+// One job per line, blank lines and lines starting with # are skipped. A job is a list
+// of key=value pairs, anything left out keeps the app's default config:
+//   name=castle-64 grid=64 probe=6 ray-length=0.05 scale=0.25 max-level=-1
+//   layout=probe|direction storage=dense|sparse branching=1 cone-epsilon=0.5
+//   cone-min-step=0.25 max-steps=0 original=1 per-level=1 output=path
+// grid is a cube diameter or XxYxZ probe counts. original keeps the unmerged atlas in
+// the file (incremental updates need it), per-level writes one section per level so
+// the app can stream it in. sparse storage is sized for the scene before the job is
+// admitted, like RadianceCascadesInit does.
+//
+// --jobs is how many jobs run at once, --threads the hardware threads they share (0 is
+// all of them). A job that needs more than --max-memory-mb on its own is skipped.
+//
+// Without output= a job is written to the bake cache path the app looks for in
+// --output-dir, with the scene hashed from --scene like RadianceCascadesInit does. So
+// the results can be dropped into the app's bake cache directory as-is.
+//
+// --summary writes one CSV row per job (status, stage timings, counters, file),
+// --stats every RadianceCascadesStats sample of every job.
+
+#include "../radiance-cascades/bake-cache.h"
+#include "../radiance-cascades/cpu.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BAKE_MAX_JOBS 1024
+#define BAKE_MAX_CONCURRENT_JOBS 64
+
+enum BakeStatus : u32 {
+  BakeStatus_Pending = 0,
+  BakeStatus_Ok,
+  BakeStatus_Skipped,
+  BakeStatus_Failed,
+};
+
+inline const char *
+BakeStatusName(BakeStatus status) {
+  switch (status) {
+    case BakeStatus_Ok: return "ok";
+    case BakeStatus_Skipped: return "skipped";
+    case BakeStatus_Failed: return "failed";
+    default: return "pending";
+  }
+}
+
+struct BakeJob {
+  char name[64];
+  RadianceCascadesConfig config;
+  bool keepOriginalAtlasCopy;
+  bool perLevel;
+  char output[512];
+
+  // filled in when the job runs
+  u64 requiredBytes;
+  BakeStatus status;
+  f64 milliseconds;
+  RadianceCascadesStatsSample stages[RadianceCascadesStage_Count];
+  u64 fileBytes;
+};
+
+struct BakeOptions {
+  u32 concurrentJobs;
+  u32 threadCount;
+  u64 maxMemoryBytes;
+  const char *outputDir;
+  const char *scene;
+  const char *summary;
+  const char *stats;
+};
+
+// Jobs start in file order, each one once the memory of the jobs running alongside it
+// leaves room for it
+struct BakeQueue {
+  std::mutex mutex;
+  std::condition_variable admitted;
+  u32 next;
+  u32 running;
+  u64 reservedBytes;
+  FILE *statsOut;
+};
+
+// Same defaults as RadianceCascadesDefaultConfig, that one lives in the GL header
+static RadianceCascadesConfig
+BakeDefaultConfig() {
+  RadianceCascadesConfig config = {};
+  config.gridDimX = 64;
+  config.gridDimY = 64;
+  config.gridDimZ = 64;
+  config.rayLength = 0.05f;
+  config.scale = 0.25f;
+  config.atlasProbeDiameter = 6;
+  config.maxLevel = -1;
+  config.branchingFactor = 1;
+  config.marchConeEpsilonScale = 0.5f;
+  config.marchConeMinStepScale = 0.25f;
+  return config;
+}
+
+// "64" -> 64x64x64, "64x16x64" -> 64x16x64
+static bool
+BakeParseGrid(RadianceCascadesConfig &config, const char *str) {
+  u32 dims[3];
+  for (u32 axis = 0; axis < 3; axis++) {
+    char *end = nullptr;
+    dims[axis] = u32(strtoul(str, &end, 10));
+    if (end == str || !dims[axis]) {
+      return false;
+    }
+    str = end;
+    if (*str == 'x' && axis < 2) {
+      str++;
+      continue;
+    }
+    if (*str) {
+      return false;
+    }
+    // a single value is a cube
+    for (u32 rest = axis + 1; rest < 3; rest++) {
+      dims[rest] = dims[axis];
+    }
+    break;
+  }
+  config.gridDimX = dims[0];
+  config.gridDimY = dims[1];
+  config.gridDimZ = dims[2];
+  return true;
+}
+
+// Parses one key=value pair into job, returns false for anything it doesn't know
+static bool
+BakeParseJobValue(BakeJob &job, const char *key, const char *value) {
+  RadianceCascadesConfig &config = job.config;
+  if (!strcmp(key, "name")) {
+    snprintf(job.name, sizeof(job.name), "%s", value);
+  } else if (!strcmp(key, "grid")) {
+    return BakeParseGrid(config, value);
+  } else if (!strcmp(key, "probe")) {
+    config.atlasProbeDiameter = u32(atoi(value));
+    return config.atlasProbeDiameter > 0;
+  } else if (!strcmp(key, "ray-length")) {
+    config.rayLength = strtof(value, nullptr);
+  } else if (!strcmp(key, "scale")) {
+    config.scale = strtof(value, nullptr);
+  } else if (!strcmp(key, "max-level")) {
+    config.maxLevel = atoi(value);
+  } else if (!strcmp(key, "layout")) {
+    if (!strcmp(value, "probe")) {
+      config.atlasLayout = RADIANCE_CASCADES_ATLAS_LAYOUT_PROBE_MAJOR;
+    } else if (!strcmp(value, "direction")) {
+      config.atlasLayout = RADIANCE_CASCADES_ATLAS_LAYOUT_DIRECTION_MAJOR;
+    } else {
+      return false;
+    }
+  } else if (!strcmp(key, "storage")) {
+    if (!strcmp(value, "dense")) {
+      config.storage = RADIANCE_CASCADES_STORAGE_DENSE;
+    } else if (!strcmp(value, "sparse")) {
+      config.storage = RADIANCE_CASCADES_STORAGE_SPARSE;
+    } else {
+      return false;
+    }
+  } else if (!strcmp(key, "branching")) {
+    config.branchingFactor = u32(atoi(value));
+    return config.branchingFactor <= RADIANCE_CASCADES_MAX_BRANCHING_FACTOR;
+  } else if (!strcmp(key, "cone-epsilon")) {
+    config.marchConeEpsilonScale = strtof(value, nullptr);
+  } else if (!strcmp(key, "cone-min-step")) {
+    config.marchConeMinStepScale = strtof(value, nullptr);
+  } else if (!strcmp(key, "max-steps")) {
+    for (u32 level = 0; level < RADIANCE_CASCADES_MAX_LEVELS; level++) {
+      config.marchMaxSteps[level] = u32(atoi(value));
+    }
+  } else if (!strcmp(key, "original")) {
+    job.keepOriginalAtlasCopy = atoi(value) != 0;
+  } else if (!strcmp(key, "per-level")) {
+    job.perLevel = atoi(value) != 0;
+  } else if (!strcmp(key, "output")) {
+    snprintf(job.output, sizeof(job.output), "%s", value);
+  } else {
+    return false;
+  }
+  return true;
+}
+
+// Returns the number of jobs read, or -1 after reporting a malformed line
+static i32
+BakeReadJobs(BakeJob *jobs, const char *path) {
+  FILE *file = fopen(path, "r");
+  if (!file) {
+    fprintf(stderr, "unable to open %s\n", path);
+    return -1;
+  }
+
+  u32 count = 0;
+  u32 lineNumber = 0;
+  char line[1024];
+  while (fgets(line, sizeof(line), file)) {
+    lineNumber++;
+    char *token = strtok(line, " \t\r\n");
+    if (!token || token[0] == '#') {
+      continue;
+    }
+    if (count == BAKE_MAX_JOBS) {
+      fprintf(stderr, "%s: more than %u jobs\n", path, BAKE_MAX_JOBS);
+      break;
+    }
+
+    BakeJob &job = jobs[count];
+    job = {};
+    job.config = BakeDefaultConfig();
+    snprintf(job.name, sizeof(job.name), "job-%u", count);
+    for (; token; token = strtok(nullptr, " \t\r\n")) {
+      char *value = strchr(token, '=');
+      if (value) {
+        *value++ = 0;
+      }
+      if (!value || !BakeParseJobValue(job, token, value)) {
+        fprintf(stderr, "%s:%u: bad job value '%s'\n", path, lineNumber, token);
+        fclose(file);
+        return -1;
+      }
+    }
+    count++;
+  }
+  fclose(file);
+  return i32(count);
+}
+
+static void
+BakeRunJob(BakeJob &job, const BakeOptions &options, BakeQueue &queue, u64 sceneHash) {
+  RadianceCascadesCPU cpu = {};
+  cpu.threadCount = Max(1u, options.threadCount / options.concurrentJobs);
+  cpu.keepOriginalAtlasCopy = job.keepOriginalAtlasCopy;
+  RadianceCascadesStats *stats = (RadianceCascadesStats *)calloc(
+    1, sizeof(RadianceCascadesStats));
+  if (!stats || !RadianceCascadesCPUInit(cpu, job.config)) {
+    free(stats);
+    job.status = BakeStatus_Failed;
+    return;
+  }
+  cpu.stats = stats;
+  stats->frame = 1;
+
+  auto start = std::chrono::steady_clock::now();
+  RadianceCascadesCPUBake(cpu);
+  auto end = std::chrono::steady_clock::now();
+  job.milliseconds = std::chrono::duration<f64, std::milli>(end - start).count();
+  for (u32 stage = 0; stage < RadianceCascadesStage_Count; stage++) {
+    job.stages[stage] = RadianceCascadesStatsFrameTotal(
+      *stats, stats->frame, RadianceCascadesStage(stage), -1);
+  }
+
+  if (!job.output[0]) {
+    RadianceCascadesBakeCachePath(
+      job.output, sizeof(job.output), options.outputDir, cpu.config, sceneHash);
+  }
+  const bool written = RadianceCascadesBakeCacheWrite(
+    job.output,
+    cpu.config,
+    sceneHash,
+    RadianceCascadesCPUBakeCacheContents(cpu),
+    job.perLevel ? RADIANCE_CASCADES_BAKE_CACHE_PER_LEVEL : 0);
+  job.status = written ? BakeStatus_Ok : BakeStatus_Failed;
+  struct stat info = {};
+  if (written && stat(job.output, &info) == 0) {
+    job.fileBytes = u64(info.st_size);
+  }
+
+  if (queue.statsOut) {
+    char prefix[80];
+    snprintf(prefix, sizeof(prefix), "%s,", job.name);
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    RadianceCascadesStatsWriteCSV(*stats, queue.statsOut, prefix);
+  }
+  free(stats);
+  RadianceCascadesCPUFree(cpu);
+}
+
+static void
+BakeWorker(BakeJob *jobs,
+           u32 jobCount,
+           const BakeOptions &options,
+           BakeQueue &queue,
+           u64 sceneHash) {
+  for (;;) {
+    BakeJob *job = nullptr;
+    {
+      std::unique_lock<std::mutex> lock(queue.mutex);
+      while (queue.next < jobCount) {
+        BakeJob &head = jobs[queue.next];
+        if (head.requiredBytes > options.maxMemoryBytes) {
+          head.status = BakeStatus_Skipped;
+          fprintf(stderr,
+                  "%s: skipped, needs %.2fMB\n",
+                  head.name,
+                  f64(head.requiredBytes) / (1024.0 * 1024.0));
+          queue.next++;
+          continue;
+        }
+        if (queue.reservedBytes + head.requiredBytes <= options.maxMemoryBytes) {
+          job = &head;
+          queue.next++;
+          queue.running++;
+          queue.reservedBytes += head.requiredBytes;
+          break;
+        }
+        queue.admitted.wait(lock);
+      }
+    }
+    if (!job) {
+      return;
+    }
+
+    fprintf(stderr,
+            "%s: baking grid(%ux%ux%u) probe(%u), %.2fMB\n",
+            job->name,
+            job->config.gridDimX,
+            job->config.gridDimY,
+            job->config.gridDimZ,
+            job->config.atlasProbeDiameter,
+            f64(job->requiredBytes) / (1024.0 * 1024.0));
+    BakeRunJob(*job, options, queue, sceneHash);
+    fprintf(stderr,
+            "%s: %s in %.2fms -> %s\n",
+            job->name,
+            BakeStatusName(job->status),
+            job->milliseconds,
+            job->output);
+
+    {
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      queue.running--;
+      queue.reservedBytes -= job->requiredBytes;
+    }
+    queue.admitted.notify_all();
+  }
+}
+
+static void
+BakeWriteSummary(FILE *out, const BakeJob *jobs, u32 jobCount) {
+  fprintf(out,
+          "name,status,gridX,gridY,gridZ,atlasProbeDiameter,atlasLayout,rayLength,scale,"
+          "maxLevel,requiredBytes,ms,buildMs,mergeMs,reduceMs,irradianceMs,rays,"
+          "marchSteps,fileBytes,output\n");
+  for (u32 i = 0; i < jobCount; i++) {
+    const BakeJob &job = jobs[i];
+    const RadianceCascadesStatsSample &build = job.stages[RadianceCascadesStage_Build];
+    fprintf(out,
+            "%s,%s,%u,%u,%u,%u,%s,%f,%f,%i,%llu,"
+            "%.4f,%.4f,%.4f,%.4f,%.4f,%llu,%llu,%llu,%s\n",
+            job.name,
+            BakeStatusName(job.status),
+            job.config.gridDimX,
+            job.config.gridDimY,
+            job.config.gridDimZ,
+            job.config.atlasProbeDiameter,
+            job.config.atlasLayout == RADIANCE_CASCADES_ATLAS_LAYOUT_DIRECTION_MAJOR
+              ? "direction"
+              : "probe",
+            job.config.rayLength,
+            job.config.scale,
+            job.config.maxLevel,
+            (unsigned long long)job.requiredBytes,
+            job.milliseconds,
+            build.milliseconds,
+            job.stages[RadianceCascadesStage_Merge].milliseconds,
+            job.stages[RadianceCascadesStage_Reduce].milliseconds,
+            job.stages[RadianceCascadesStage_Irradiance].milliseconds,
+            (unsigned long long)build.counters.rays,
+            (unsigned long long)build.counters.marchSteps,
+            (unsigned long long)job.fileBytes,
+            job.output);
+  }
+}
+
+int
+main(int argc, char **argv) {
+  BakeOptions options = {};
+  options.concurrentJobs = 2;
+  options.maxMemoryBytes = u64(4096) * 1024 * 1024;
+  options.outputDir = ".";
+  options.scene = "shaders/shared.glsl";
+  const char *jobsPath = nullptr;
+
+  for (i32 i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    const char *value = i + 1 < argc ? argv[i + 1] : "";
+    if (!strcmp(arg, "--jobs")) {
+      options.concurrentJobs = Clamp(u32(atoi(value)), 1u, u32(BAKE_MAX_CONCURRENT_JOBS));
+      i++;
+    } else if (!strcmp(arg, "--threads")) {
+      options.threadCount = u32(atoi(value));
+      i++;
+    } else if (!strcmp(arg, "--max-memory-mb")) {
+      options.maxMemoryBytes = u64(atoll(value)) * 1024 * 1024;
+      i++;
+    } else if (!strcmp(arg, "--output-dir")) {
+      options.outputDir = value;
+      i++;
+    } else if (!strcmp(arg, "--scene")) {
+      options.scene = value;
+      i++;
+    } else if (!strcmp(arg, "--summary")) {
+      options.summary = value;
+      i++;
+    } else if (!strcmp(arg, "--stats")) {
+      options.stats = value;
+      i++;
+    } else if (arg[0] != '-' && !jobsPath) {
+      jobsPath = arg;
+    } else {
+      fprintf(stderr, "unknown argument: %s\n", arg);
+      return 1;
+    }
+  }
+  if (!jobsPath) {
+    fprintf(stderr, "usage: radiance-cascades-bake <jobs file> [options]\n");
+    return 1;
+  }
+  if (!options.threadCount) {
+    options.threadCount = Max(1u, u32(std::thread::hardware_concurrency()));
+  }
+
+  BakeJob *jobs = (BakeJob *)calloc(BAKE_MAX_JOBS, sizeof(BakeJob));
+  const i32 jobCount = jobs ? BakeReadJobs(jobs, jobsPath) : -1;
+  if (jobCount < 0) {
+    free(jobs);
+    return 1;
+  }
+  for (i32 i = 0; i < jobCount; i++) {
+    RadianceCascadesCPUFitSparseStorage(jobs[i].config, options.threadCount);
+    jobs[i].requiredBytes = RadianceCascadesCPUByteSize(jobs[i].config,
+                                                        jobs[i].keepOriginalAtlasCopy);
+  }
+
+  // what RadianceCascadesBakeCacheSceneHash keys a CPU backend bake of the scene with
+  const i32 cpuBackend = 1;
+  const u64 sceneHash = RadianceCascadesHashBytes(
+    &cpuBackend, sizeof(cpuBackend), RadianceCascadesHashFile(options.scene));
+
+  BakeQueue queue;
+  queue.next = 0;
+  queue.running = 0;
+  queue.reservedBytes = 0;
+  queue.statsOut = options.stats ? fopen(options.stats, "w") : nullptr;
+  if (options.stats && !queue.statsOut) {
+    fprintf(stderr, "unable to open %s\n", options.stats);
+    free(jobs);
+    return 1;
+  }
+  if (queue.statsOut) {
+    RadianceCascadesStatsWriteCSVHeader(queue.statsOut, "name,");
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  const u32 workerCount = Min(options.concurrentJobs, Max(u32(jobCount), 1u));
+  std::thread workers[BAKE_MAX_CONCURRENT_JOBS];
+  for (u32 i = 0; i < workerCount; i++) {
+    workers[i] = std::thread(
+      BakeWorker, jobs, u32(jobCount), std::cref(options), std::ref(queue), sceneHash);
+  }
+  for (u32 i = 0; i < workerCount; i++) {
+    workers[i].join();
+  }
+  auto end = std::chrono::steady_clock::now();
+
+  u32 skipped = 0;
+  u32 failed = 0;
+  for (i32 i = 0; i < jobCount; i++) {
+    skipped += jobs[i].status == BakeStatus_Skipped;
+    failed += jobs[i].status == BakeStatus_Failed;
+  }
+  fprintf(stderr,
+          "%i jobs, %u skipped, %u failed, %.2fms\n",
+          jobCount,
+          skipped,
+          failed,
+          std::chrono::duration<f64, std::milli>(end - start).count());
+
+  if (queue.statsOut) {
+    fclose(queue.statsOut);
+  }
+  if (options.summary) {
+    FILE *summary = fopen(options.summary, "w");
+    if (summary) {
+      BakeWriteSummary(summary, jobs, u32(jobCount));
+      fclose(summary);
+    } else {
+      fprintf(stderr, "unable to open %s\n", options.summary);
+    }
+  } else {
+    BakeWriteSummary(stdout, jobs, u32(jobCount));
+  }
+  free(jobs);
+  return failed ? 1 : 0;
+}
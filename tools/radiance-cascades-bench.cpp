@@ -0,0 +1,680 @@
+// Headless benchmark for the CPU cascade pipeline.
+//
+// Sweeps RadianceCascadesConfig values and reports per level / per stage wall time,
+// rays per second, bytes touched and the process peak RSS as JSON or CSV.
+//
+// build (needs the hotcart and dust include directories, no GL):
+//   c++ -std=c++20 -O3 -march=native -I<hotcart>/include -I<dust>
+//     tools/radiance-cascades-bench.cpp -o radiance-cascades-bench -lpthread
+//
+// usage:
+//   radiance-cascades-bench [--grid 16,32,64x16x64] [--probe 4,6,8] [--ray-length 0.05]
+//                           [--scale 0.25] [--max-level -1] [--threads 0]
+//                           [--repeat 3] [--max-memory-mb 4096] [--single-ray]
+//                           [--serial-stages]
+//                           [--refresh-period 0] [--distance-bricks] [--sparse]
+//                           [--layout probe,direction] [--branching 1]
+//                           [--cone-epsilon 0.5] [--cone-min-step 0.25] [--max-steps 0]
+//                           [--format json|csv] [--output path] [--stats path]
+//                           [--step-histogram path] [--bake-cache dir] [--per-level]
+//
+// --grid entries are either a cube diameter or XxYxZ probe counts.
+//
+// --layout sweeps the atlas layouts, probe major (the default) and/or direction major.
+//
+// --branching sets RadianceCascadesConfig::branchingFactor, each level has 4^N times
+// the directions of the one below. 1 is the app's default. The ray intervals stay the
+// same, and a factor whose levels don't fit an atlas layer is lowered.
+//
+// --distance-bricks traces through a distance brick cache covering the probe window
+// plus as much again on every side, like the "distance brick cache" debug toggle. The
+// bake time is reported on stderr.
+//
+// --sparse gives probes atlas storage only in the bricks near the scene's surfaces
+// (RADIANCE_CASCADES_STORAGE_SPARSE), sized for the scene before the memory check.
+// Rays and bytes count the stored probes only. Needs the probe major layout.
+//
+// --stats writes every RadianceCascadesStats sample (one frame per bake or refresh
+// tick, with march step counts) of every configuration to a CSV file.
+//
+// --cone-epsilon, --cone-min-step and --max-steps set the build's march config for
+// every level (RadianceCascadesConfig::march*), the defaults match the app's. 0 0 0 is
+// the fixed epsilon, unbounded march.
+//
+// --step-histogram writes the per level steps per ray histogram of the last update of
+// every configuration to a CSV file.
+//
+// --bake-cache loads each configuration's bake from dir when it is there, bakes and
+// writes it otherwise (bake-cache.h, --per-level stores one section per level), and
+// reports which one happened and how long it took on stderr. The measured updates run
+// as usual afterwards, --refresh-period starts from the loaded bake.
+//
+// --serial-stages runs every build, then every merge, then the irradiance instead of
+// starting each stage as soon as what it reads is ready (cpu-tasks.h). Overlapping
+// stages share the threads, so only serial runs time each stage on its own.
+//
+// --refresh-period N bakes once, then measures `repeat` amortized refresh ticks with
+// level 0 refreshed every N ticks instead of full bakes.
+
+#include "../radiance-cascades/bake-cache.h"
+#include "../radiance-cascades/cpu.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+
+#define BENCH_MAX_VALUES 16
+#define BENCH_MAX_LEVELS 16
+
+struct BenchValues {
+  f32 values[BENCH_MAX_VALUES];
+  u32 count;
+};
+
+struct BenchGrids {
+  v3u32 dims[BENCH_MAX_VALUES];
+  u32 count;
+};
+
+struct BenchOptions {
+  BenchGrids grids;
+  BenchValues atlasProbeDiameters;
+  BenchValues rayLengths;
+  BenchValues scales;
+  BenchValues maxLevels;
+  BenchValues atlasLayouts;
+  u32 threadCount;
+  u32 repeat;
+  u64 maxMemoryBytes;
+  bool singleRayTracer;
+  bool serialStages;
+  u32 refreshPeriod;
+  bool distanceBricks;
+  bool sparse;
+  u32 branchingFactor;
+  bool csv;
+  const char *output;
+  const char *stats;
+  f32 marchConeEpsilonScale;
+  f32 marchConeMinStepScale;
+  u32 marchMaxSteps;
+  const char *stepHistogram;
+  const char *bakeCache;
+  bool bakeCachePerLevel;
+};
+
+struct BenchStageSample {
+  f64 minMilliseconds;
+  f64 totalMilliseconds;
+  u32 runs;
+};
+
+struct BenchRun {
+  BenchStageSample samples[RadianceCascadesStage_Count][BENCH_MAX_LEVELS + 1];
+};
+
+static void
+BenchParseValues(BenchValues &values, const char *str) {
+  values.count = 0;
+  while (*str && values.count < BENCH_MAX_VALUES) {
+    char *end = nullptr;
+    values.values[values.count++] = strtof(str, &end);
+    if (end == str) {
+      break;
+    }
+    str = *end == ',' ? end + 1 : end;
+  }
+}
+
+// "probe,direction" -> RADIANCE_CASCADES_ATLAS_LAYOUT_*
+static void
+BenchParseLayouts(BenchValues &values, const char *str) {
+  values.count = 0;
+  while (*str && values.count < BENCH_MAX_VALUES) {
+    if (!strncmp(str, "probe", 5)) {
+      values.values[values.count++] = RADIANCE_CASCADES_ATLAS_LAYOUT_PROBE_MAJOR;
+    } else if (!strncmp(str, "direction", 9)) {
+      values.values[values.count++] = RADIANCE_CASCADES_ATLAS_LAYOUT_DIRECTION_MAJOR;
+    } else {
+      fprintf(stderr, "unknown atlas layout: %s\n", str);
+      return;
+    }
+    const char *end = strchr(str, ',');
+    if (!end) {
+      break;
+    }
+    str = end + 1;
+  }
+}
+
+inline const char *
+BenchLayoutName(u32 atlasLayout) {
+  return atlasLayout == RADIANCE_CASCADES_ATLAS_LAYOUT_DIRECTION_MAJOR ? "direction"
+                                                                      : "probe";
+}
+
+// "16,64x16x64" -> (16, 16, 16), (64, 16, 64)
+static void
+BenchParseGrids(BenchGrids &grids, const char *str) {
+  grids.count = 0;
+  while (*str && grids.count < BENCH_MAX_VALUES) {
+    v3u32 dims;
+    for (u32 axis = 0; axis < 3; axis++) {
+      char *end = nullptr;
+      dims[axis] = u32(strtoul(str, &end, 10));
+      if (end == str) {
+        return;
+      }
+      str = end;
+      if (*str == 'x' && axis < 2) {
+        str++;
+      } else {
+        // a single value is a cube
+        for (u32 rest = axis + 1; rest < 3; rest++) {
+          dims[rest] = dims[axis];
+        }
+        break;
+      }
+    }
+    grids.dims[grids.count++] = dims;
+    str = *str == ',' ? str + 1 : str;
+  }
+}
+
+static void
+BenchOnStage(void *user, RadianceCascadesStage stage, i32 level, f64 milliseconds) {
+  BenchRun *run = (BenchRun *)user;
+  // whole atlas stages are stored in the slot after the last level
+  u32 slot = level < 0 ? BENCH_MAX_LEVELS : Min(u32(level), u32(BENCH_MAX_LEVELS - 1));
+  BenchStageSample &sample = run->samples[stage][slot];
+  if (sample.runs == 0 || milliseconds < sample.minMilliseconds) {
+    sample.minMilliseconds = milliseconds;
+  }
+  sample.totalMilliseconds += milliseconds;
+  sample.runs++;
+}
+
+// Rays traced (build), texels produced (merge, reduce) or read (irradiance) by a stage
+static u64
+BenchStageRays(const RadianceCascadesConfig &config,
+               const RadianceCascadesLayout &layout,
+               RadianceCascadesStage stage,
+               i32 level) {
+  if (level < 0) {
+    return 0;
+  }
+  u64 probeCount = RadianceCascadesLevelStorageProbeCount(config, layout, level);
+  u64 d = RadianceCascadesLevelProbeDiameter(config, level);
+  switch (stage) {
+    case RadianceCascadesStage_Build:
+    case RadianceCascadesStage_Merge:
+    case RadianceCascadesStage_Irradiance: return probeCount * d * d;
+    // one texel per direction of the level below
+    case RadianceCascadesStage_Reduce:
+      return (probeCount * d * d) >> (2 * RadianceCascadesBranchingFactor(config));
+    default: return 0;
+  }
+}
+
+// Atlas bytes read + written by a stage, 16 bytes per atlas texel
+static u64
+BenchStageBytes(const RadianceCascadesConfig &config,
+                const RadianceCascadesLayout &layout,
+                RadianceCascadesStage stage,
+                i32 level) {
+  u64 rays = BenchStageRays(config, layout, stage, level);
+  // border copies written alongside the interior texels
+  u64 borderTexels = 0;
+  if (level >= 0) {
+    borderTexels = u64(RadianceCascadesLevelStorageProbeCount(config, layout, level)) *
+                   (RadianceCascadesLevelProbeDiameter(config, level) * 4 + 4);
+  }
+  switch (stage) {
+    // one write per ray plus the borders
+    case RadianceCascadesStage_Build: return (rays + borderTexels) * 16;
+    // 8 reduced upper texels, a read and a write of the lower texel plus the borders
+    case RadianceCascadesStage_Merge:
+      return rays * 8 * sizeof(RadianceCascadesReducedTexel) +
+             (rays * 2 + borderTexels) * 16;
+    // 2^N x 2^N atlas texels in, one reduced texel out
+    case RadianceCascadesStage_Reduce:
+      return rays * ((16ull << (2 * RadianceCascadesBranchingFactor(config))) +
+                     sizeof(RadianceCascadesReducedTexel));
+    // every interior texel of a level 0 probe in, one irradiance probe out
+    case RadianceCascadesStage_Irradiance:
+      return rays * 16 +
+             u64(RadianceCascadesLevelStorageProbeCount(config, layout, level)) *
+               sizeof(RadianceCascadesIrradianceProbe);
+    default: return 0;
+  }
+}
+
+static u64
+BenchPeakRSSBytes() {
+  struct rusage usage = {};
+  getrusage(RUSAGE_SELF, &usage);
+  // linux reports kilobytes
+  return u64(usage.ru_maxrss) * 1024;
+}
+
+static void
+BenchWriteRun(FILE *out,
+              const BenchOptions &options,
+              const RadianceCascadesCPU &cpu,
+              const BenchRun &run,
+              bool &first) {
+  const RadianceCascadesConfig &config = cpu.config;
+  const RadianceCascadesLayout &layout = cpu.layout;
+  const u64 peakRSS = BenchPeakRSSBytes();
+
+  for (u32 stage = 0; stage < RadianceCascadesStage_Count; stage++) {
+    for (u32 slot = 0; slot <= BENCH_MAX_LEVELS; slot++) {
+      const BenchStageSample &sample = run.samples[stage][slot];
+      if (!sample.runs) {
+        continue;
+      }
+
+      i32 level = slot == BENCH_MAX_LEVELS ? -1 : i32(slot);
+      u64 rays = BenchStageRays(config, layout, RadianceCascadesStage(stage), level);
+      u64 bytes = BenchStageBytes(config, layout, RadianceCascadesStage(stage), level);
+      f64 meanMilliseconds = sample.totalMilliseconds / f64(sample.runs);
+      f64 raysPerSecond = sample.minMilliseconds > 0.0
+                            ? f64(rays) / (sample.minMilliseconds / 1000.0)
+                            : 0.0;
+
+      if (options.csv) {
+        fprintf(out,
+                "%u,%u,%u,%u,%u,%s,%f,%f,%i,%u,%s,%i,"
+                "%.4f,%.4f,%llu,%.1f,%llu,%llu,%llu\n",
+                config.gridDimX,
+                config.gridDimY,
+                config.gridDimZ,
+                config.atlasProbeDiameter,
+                config.branchingFactor,
+                BenchLayoutName(config.atlasLayout),
+                config.rayLength,
+                config.scale,
+                config.maxLevel,
+                RadianceCascadesCPUThreadCount(cpu),
+                RadianceCascadesStageName(RadianceCascadesStage(stage)),
+                level,
+                sample.minMilliseconds,
+                meanMilliseconds,
+                (unsigned long long)rays,
+                raysPerSecond,
+                (unsigned long long)bytes,
+                (unsigned long long)cpu.atlasByteSize,
+                (unsigned long long)peakRSS);
+      } else {
+        fprintf(out,
+                "%s\n    {\"gridDims\": [%u, %u, %u], \"atlasProbeDiameter\": %u, "
+                "\"branchingFactor\": %u, \"atlasLayout\": \"%s\", \"rayLength\": %f, "
+                "\"scale\": %f, "
+                "\"maxLevel\": %i, \"threads\": %u, "
+                "\"stage\": \"%s\", \"level\": %i, \"minMs\": %.4f, \"meanMs\": %.4f, "
+                "\"rays\": %llu, \"raysPerSecond\": %.1f, \"bytesTouched\": %llu, "
+                "\"atlasBytes\": %llu, \"peakRSSBytes\": %llu}",
+                first ? "" : ",",
+                config.gridDimX,
+                config.gridDimY,
+                config.gridDimZ,
+                config.atlasProbeDiameter,
+                config.branchingFactor,
+                BenchLayoutName(config.atlasLayout),
+                config.rayLength,
+                config.scale,
+                config.maxLevel,
+                RadianceCascadesCPUThreadCount(cpu),
+                RadianceCascadesStageName(RadianceCascadesStage(stage)),
+                level,
+                sample.minMilliseconds,
+                meanMilliseconds,
+                (unsigned long long)rays,
+                raysPerSecond,
+                (unsigned long long)bytes,
+                (unsigned long long)cpu.atlasByteSize,
+                (unsigned long long)peakRSS);
+        first = false;
+      }
+    }
+  }
+}
+
+int
+main(int argc, char **argv) {
+  BenchOptions options = {};
+  BenchParseGrids(options.grids, "16,32,64");
+  BenchParseValues(options.atlasProbeDiameters, "4,6,8");
+  BenchParseValues(options.rayLengths, "0.05");
+  BenchParseValues(options.scales, "0.25");
+  BenchParseValues(options.maxLevels, "-1");
+  BenchParseLayouts(options.atlasLayouts, "probe");
+  options.repeat = 3;
+  options.branchingFactor = 1;
+  options.marchConeEpsilonScale = 0.5f;
+  options.marchConeMinStepScale = 0.25f;
+  options.maxMemoryBytes = u64(4096) * 1024 * 1024;
+
+  for (i32 i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    const char *value = i + 1 < argc ? argv[i + 1] : "";
+    if (!strcmp(arg, "--grid")) {
+      BenchParseGrids(options.grids, value);
+      i++;
+    } else if (!strcmp(arg, "--probe")) {
+      BenchParseValues(options.atlasProbeDiameters, value);
+      i++;
+    } else if (!strcmp(arg, "--ray-length")) {
+      BenchParseValues(options.rayLengths, value);
+      i++;
+    } else if (!strcmp(arg, "--scale")) {
+      BenchParseValues(options.scales, value);
+      i++;
+    } else if (!strcmp(arg, "--max-level")) {
+      BenchParseValues(options.maxLevels, value);
+      i++;
+    } else if (!strcmp(arg, "--threads")) {
+      options.threadCount = u32(atoi(value));
+      i++;
+    } else if (!strcmp(arg, "--repeat")) {
+      options.repeat = Max(1u, u32(atoi(value)));
+      i++;
+    } else if (!strcmp(arg, "--max-memory-mb")) {
+      options.maxMemoryBytes = u64(atoll(value)) * 1024 * 1024;
+      i++;
+    } else if (!strcmp(arg, "--single-ray")) {
+      options.singleRayTracer = true;
+    } else if (!strcmp(arg, "--serial-stages")) {
+      options.serialStages = true;
+    } else if (!strcmp(arg, "--refresh-period")) {
+      options.refreshPeriod = u32(atoi(value));
+      i++;
+    } else if (!strcmp(arg, "--distance-bricks")) {
+      options.distanceBricks = true;
+    } else if (!strcmp(arg, "--sparse")) {
+      options.sparse = true;
+    } else if (!strcmp(arg, "--branching")) {
+      options.branchingFactor = Min(u32(atoi(value)),
+                                    u32(RADIANCE_CASCADES_MAX_BRANCHING_FACTOR));
+      i++;
+    } else if (!strcmp(arg, "--layout")) {
+      BenchParseLayouts(options.atlasLayouts, value);
+      i++;
+    } else if (!strcmp(arg, "--cone-epsilon")) {
+      options.marchConeEpsilonScale = strtof(value, nullptr);
+      i++;
+    } else if (!strcmp(arg, "--cone-min-step")) {
+      options.marchConeMinStepScale = strtof(value, nullptr);
+      i++;
+    } else if (!strcmp(arg, "--max-steps")) {
+      options.marchMaxSteps = u32(atoi(value));
+      i++;
+    } else if (!strcmp(arg, "--step-histogram")) {
+      options.stepHistogram = value;
+      i++;
+    } else if (!strcmp(arg, "--bake-cache")) {
+      options.bakeCache = value;
+      i++;
+    } else if (!strcmp(arg, "--per-level")) {
+      options.bakeCachePerLevel = true;
+    } else if (!strcmp(arg, "--format")) {
+      options.csv = !strcmp(value, "csv");
+      i++;
+    } else if (!strcmp(arg, "--output")) {
+      options.output = value;
+      i++;
+    } else if (!strcmp(arg, "--stats")) {
+      options.stats = value;
+      i++;
+    } else {
+      fprintf(stderr, "unknown argument: %s\n", arg);
+      return 1;
+    }
+  }
+
+  FILE *out = options.output ? fopen(options.output, "w") : stdout;
+  if (!out) {
+    fprintf(stderr, "unable to open %s\n", options.output);
+    return 1;
+  }
+
+  FILE *statsOut = options.stats ? fopen(options.stats, "w") : nullptr;
+  if (options.stats && !statsOut) {
+    fprintf(stderr, "unable to open %s\n", options.stats);
+    return 1;
+  }
+  RadianceCascadesStats *stats = (RadianceCascadesStats *)calloc(
+    1, sizeof(RadianceCascadesStats));
+  if (statsOut) {
+    RadianceCascadesStatsWriteCSVHeader(
+      statsOut, "gridX,gridY,gridZ,atlasProbeDiameter,atlasLayout,");
+  }
+
+  FILE *histogramOut =
+    options.stepHistogram ? fopen(options.stepHistogram, "w") : nullptr;
+  if (options.stepHistogram && !histogramOut) {
+    fprintf(stderr, "unable to open %s\n", options.stepHistogram);
+    return 1;
+  }
+  if (histogramOut) {
+    RadianceCascadesStepHistogramWriteCSVHeader(
+      histogramOut,
+      "gridX,gridY,gridZ,atlasProbeDiameter,coneEpsilon,coneMinStep,maxSteps,");
+  }
+
+  if (options.csv) {
+    fprintf(out,
+            "gridX,gridY,gridZ,atlasProbeDiameter,branchingFactor,atlasLayout,rayLength,"
+            "scale,maxLevel,threads,stage,level,minMs,meanMs,rays,raysPerSecond,"
+            "bytesTouched,atlasBytes,peakRSSBytes\n");
+  } else {
+    fprintf(out, "{\n  \"results\": [");
+  }
+
+  bool first = true;
+  for (u32 g = 0; g < options.grids.count; g++) {
+    for (u32 p = 0; p < options.atlasProbeDiameters.count; p++) {
+      for (u32 r = 0; r < options.rayLengths.count; r++) {
+        for (u32 s = 0; s < options.scales.count; s++) {
+          for (u32 m = 0; m < options.maxLevels.count; m++) {
+            for (u32 l = 0; l < options.atlasLayouts.count; l++) {
+              RadianceCascadesConfig config = {};
+              config.gridDimX = options.grids.dims[g].x;
+              config.gridDimY = options.grids.dims[g].y;
+              config.gridDimZ = options.grids.dims[g].z;
+              config.atlasProbeDiameter = u32(options.atlasProbeDiameters.values[p]);
+              config.rayLength = options.rayLengths.values[r];
+              config.scale = options.scales.values[s];
+              config.maxLevel = i32(options.maxLevels.values[m]);
+              config.branchingFactor = options.branchingFactor;
+              config.atlasLayout = u32(options.atlasLayouts.values[l]);
+              config.marchConeEpsilonScale = options.marchConeEpsilonScale;
+              config.marchConeMinStepScale = options.marchConeMinStepScale;
+              for (u32 level = 0; level < RADIANCE_CASCADES_MAX_LEVELS; level++) {
+                config.marchMaxSteps[level] = options.marchMaxSteps;
+              }
+
+              RadianceCascadesCPU cpu = {};
+              cpu.threadCount = options.threadCount;
+              cpu.keepOriginalAtlasCopy = true;
+              cpu.singleRayTracer = options.singleRayTracer;
+              cpu.serialStages = options.serialStages;
+              if (options.sparse) {
+                config.storage = RADIANCE_CASCADES_STORAGE_SPARSE;
+                RadianceCascadesCPUFitSparseStorage(config,
+                                                    RadianceCascadesCPUThreadCount(cpu));
+              }
+
+              u64 requiredBytes =
+                RadianceCascadesCPUByteSize(config, cpu.keepOriginalAtlasCopy);
+              if (requiredBytes > options.maxMemoryBytes) {
+                fprintf(stderr,
+                        "skipping grid(%ux%ux%u) probe(%u): needs %.2fMB\n",
+                        config.gridDimX,
+                        config.gridDimY,
+                        config.gridDimZ,
+                        config.atlasProbeDiameter,
+                        f64(requiredBytes) / (1024.0 * 1024.0));
+                continue;
+              }
+
+              if (!RadianceCascadesCPUInit(cpu, config)) {
+                continue;
+              }
+
+              RadianceCascadesDistanceBricks distanceBricks = {};
+              if (options.distanceBricks) {
+                const f32 extent = f32(Max(Max(cpu.config.gridDimX, cpu.config.gridDimY),
+                                           cpu.config.gridDimZ)) *
+                                   cpu.config.scale;
+                if (RadianceCascadesDistanceBricksInit(distanceBricks,
+                                                       v3(-extent),
+                                                       v3(extent),
+                                                       cpu.config.scale)) {
+                  auto start = std::chrono::steady_clock::now();
+                  RadianceCascadesCPUBakeDistanceBricks(
+                    distanceBricks, RadianceCascadesCPUThreadCount(cpu));
+                  auto end = std::chrono::steady_clock::now();
+                  fprintf(stderr,
+                          "distance bricks grid(%ux%ux%u): %u of %u bricks with samples, "
+                          "baked in %.2fms\n",
+                          cpu.config.gridDimX,
+                          cpu.config.gridDimY,
+                          cpu.config.gridDimZ,
+                          distanceBricks.slotCount - distanceBricks.freeSlotCount,
+                          RadianceCascadesDistanceBrickCount(distanceBricks.info),
+                          std::chrono::duration<f64, std::milli>(end - start).count());
+                  cpu.distanceBricks = &distanceBricks;
+                }
+              }
+
+              char statsPrefix[128];
+              snprintf(statsPrefix,
+                       sizeof(statsPrefix),
+                       "%u,%u,%u,%u,%s,",
+                       cpu.config.gridDimX,
+                       cpu.config.gridDimY,
+                       cpu.config.gridDimZ,
+                       cpu.config.atlasProbeDiameter,
+                       BenchLayoutName(cpu.config.atlasLayout));
+              // one frame per update, written out before the ring buffer can wrap
+              auto update = [&](const RadianceCascadesUpdatePlan &plan) {
+                cpu.stats = statsOut ? stats : nullptr;
+                stats->frame++;
+                RadianceCascadesCPUUpdate(cpu, plan);
+                if (statsOut) {
+                  RadianceCascadesStatsWriteCSV(*stats, statsOut, statsPrefix);
+                  RadianceCascadesStatsClear(*stats);
+                }
+              };
+
+              bool baked = false;
+              if (options.bakeCache) {
+                // map() is compiled in, so a rebuild of the bench is a new scene
+                const char *buildStamp = __DATE__ " " __TIME__;
+                const u64 sceneHash =
+                  RadianceCascadesHashBytes(buildStamp, strlen(buildStamp));
+                char path[512];
+                RadianceCascadesBakeCachePath(
+                  path, sizeof(path), options.bakeCache, cpu.config, sceneHash);
+
+                auto start = std::chrono::steady_clock::now();
+                RadianceCascadesBakeCacheFile file;
+                const bool hit = RadianceCascadesBakeCacheOpen(
+                                   file, path, cpu.config, sceneHash) &&
+                                 RadianceCascadesCPULoadBakeCache(cpu, file);
+                RadianceCascadesBakeCacheClose(file);
+                if (!hit) {
+                  RadianceCascadesCPUBake(cpu);
+                  RadianceCascadesBakeCacheWrite(
+                    path,
+                    cpu.config,
+                    sceneHash,
+                    RadianceCascadesCPUBakeCacheContents(cpu),
+                    options.bakeCachePerLevel ? RADIANCE_CASCADES_BAKE_CACHE_PER_LEVEL
+                                              : 0);
+                }
+                auto end = std::chrono::steady_clock::now();
+                fprintf(stderr,
+                        "bake cache grid(%ux%ux%u) probe(%u): %s %s in %.2fms\n",
+                        cpu.config.gridDimX,
+                        cpu.config.gridDimY,
+                        cpu.config.gridDimZ,
+                        cpu.config.atlasProbeDiameter,
+                        hit ? "loaded" : "baked and wrote",
+                        path,
+                        std::chrono::duration<f64, std::milli>(end - start).count());
+                baked = true;
+              }
+
+              BenchRun *run = (BenchRun *)calloc(1, sizeof(BenchRun));
+              if (options.refreshPeriod) {
+                if (!baked) {
+                  RadianceCascadesCPUBake(cpu);
+                }
+                cpu.onStage = BenchOnStage;
+                cpu.onStageUser = run;
+
+                RadianceCascadesRefreshSchedule schedule = {};
+                schedule.enabled = true;
+                schedule.level0Period = options.refreshPeriod;
+                schedule.periodScale = 2;
+                for (u32 i = 0; i < options.repeat; i++) {
+                  RadianceCascadesUpdatePlan plan;
+                  RadianceCascadesPlanScheduled(plan, cpu.config, cpu.layout, schedule);
+                  update(plan);
+                }
+              } else {
+                cpu.onStage = BenchOnStage;
+                cpu.onStageUser = run;
+                for (u32 i = 0; i < options.repeat; i++) {
+                  RadianceCascadesUpdatePlan plan;
+                  RadianceCascadesPlanFull(plan, cpu.config, cpu.layout);
+                  update(plan);
+                }
+              }
+
+              BenchWriteRun(out, options, cpu, *run, first);
+              fflush(out);
+              if (histogramOut) {
+                char histogramPrefix[128];
+                snprintf(histogramPrefix,
+                         sizeof(histogramPrefix),
+                         "%u,%u,%u,%u,%f,%f,%u,",
+                         cpu.config.gridDimX,
+                         cpu.config.gridDimY,
+                         cpu.config.gridDimZ,
+                         cpu.config.atlasProbeDiameter,
+                         cpu.config.marchConeEpsilonScale,
+                         cpu.config.marchConeMinStepScale,
+                         options.marchMaxSteps);
+                RadianceCascadesStepHistogramWriteCSV(
+                  cpu.stepHistogram, histogramOut, histogramPrefix);
+              }
+              free(run);
+              RadianceCascadesCPUFree(cpu);
+              RadianceCascadesDistanceBricksFree(distanceBricks);
+            }
+          }
+        }
+      }
+    }
+  }
+
+  if (!options.csv) {
+    fprintf(out, "\n  ]\n}\n");
+  }
+
+  if (out != stdout) {
+    fclose(out);
+  }
+  if (statsOut) {
+    fclose(statsOut);
+  }
+  if (histogramOut) {
+    fclose(histogramOut);
+  }
+  free(stats);
+  return 0;
+}